@@ -0,0 +1,186 @@
+// =================================================================================================
+// TRINITY ON-TARGET BENCHMARK FIRMWARE (pio run -e bench -t upload)
+//
+// Runs lib/bench_suite, the same workloads as the host benchmark (native/bench.cpp), on the
+// ESP32-S3 itself, where Xtensa LX7 timing, the PSRAM cache and concurrent Wi-Fi work show up.
+// The suite runs four times, in every combination of:
+//  - buffers in internal RAM or in PSRAM (the whole workspace, jitter buffer slots included)
+//  - Wi-Fi off, or a soft AP (no network needed) with a task on core 0 sending ~1000 broadcast
+//    datagrams a second, so the radio, lwIP and their interrupts compete for the caches and the
+//    PSRAM bus while the benchmarks run on core 1
+//
+// Results are in CPU cycles per item, from the fastest of the repetitions (and the median).
+// Every machine-readable line starts with "@bench" followed by one JSON object, so it can be
+// picked out of the boot log:
+//     @bench-start {"cpu_mhz": ..., "frames": ..., "repetitions": ..., "pie": ...}
+//     @bench-dsp {"name": ..., "exact": ..., "vectorized": ..., "cycles_per_sample": ..., "scalar": ...}
+//     @bench {"config": ..., "name": ..., "unit": ..., "items": ..., "cycles_per_item": ..., "median_cycles_per_item": ...}
+//     @bench-load {"config": ..., "datagrams": ..., "ms": ...}
+//     @bench-skip {"config": ..., "reason": ...}
+//     @bench-done {"dsp_mismatches": ..., "checksum": ...}
+// The suite runs once after boot and again whenever 'r' arrives on the serial port;
+// tools/bench_collect.py triggers a run, collects the results and compares them with a baseline.
+// =================================================================================================
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include <esp_heap_caps.h>
+
+#include <bench_suite.h>
+#include <dsp_kernels.h>
+
+// 200 ms of 16 kHz audio keeps the workspace (~90 KB) small enough for internal RAM with Wi-Fi up
+const size_t BENCH_FRAMES = 3200;
+const int BENCH_REPETITIONS = 7;
+const uint32_t BENCH_MIN_REPETITION_MS = 5;
+
+// Wi-Fi load
+#define BENCH_AP_SSID "Trinity-Bench"
+const int BENCH_AP_CHANNEL = 6;
+const uint16_t BENCH_UDP_PORT = 9;          // Discard
+const size_t BENCH_DATAGRAM_BYTES = 1400;
+const uint32_t BENCH_WIFI_SETTLE_MS = 1000;
+const uint32_t LOAD_TASK_STACK_BYTES = 4096;
+const UBaseType_t LOAD_TASK_PRIORITY = 1;
+const BaseType_t LOAD_TASK_CORE = 0;        // The benchmarks run in the loop task on core 1
+
+struct BenchConfig {
+    const char* name;
+    uint32_t caps;      // heap_caps_* capabilities of the workspace
+    bool wifi;
+};
+
+static const BenchConfig CONFIGS[] = {
+    {"internal", MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT, false},
+    {"psram", MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT, false},
+    {"internal+wifi", MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT, true},
+    {"psram+wifi", MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT, true},
+};
+
+static volatile bool loadRunning = false;
+static volatile bool loadStopped = true;
+static volatile uint32_t loadDatagrams = 0;
+
+uint32_t cpuCycles() {
+    return ESP.getCycleCount();
+}
+
+// Broadcasts datagrams as fast as one per tick until loadRunning is cleared
+void wifiLoadTask(void*) {
+    static uint8_t datagram[BENCH_DATAGRAM_BYTES];
+    WiFiUDP udp;
+    udp.begin(BENCH_UDP_PORT);
+    const IPAddress broadcast = WiFi.softAPBroadcastIP();
+    while (loadRunning) {
+        udp.beginPacket(broadcast, BENCH_UDP_PORT);
+        udp.write(datagram, sizeof(datagram));
+        if (udp.endPacket()) {
+            loadDatagrams++;
+        }
+        vTaskDelay(1);
+    }
+    udp.stop();
+    loadStopped = true;
+    vTaskDelete(NULL);
+}
+
+void startWifiLoad() {
+    WiFi.mode(WIFI_AP);
+    WiFi.softAP(BENCH_AP_SSID, NULL, BENCH_AP_CHANNEL);
+    loadDatagrams = 0;
+    loadRunning = true;
+    loadStopped = false;
+    xTaskCreatePinnedToCore(wifiLoadTask, "wifiLoad", LOAD_TASK_STACK_BYTES, NULL, LOAD_TASK_PRIORITY, NULL, LOAD_TASK_CORE);
+    delay(BENCH_WIFI_SETTLE_MS);
+}
+
+void stopWifiLoad() {
+    loadRunning = false;
+    while (!loadStopped) {
+        delay(10);
+    }
+    WiFi.softAPdisconnect(true);
+    WiFi.mode(WIFI_OFF);
+}
+
+// Checks the DSP kernels' vector paths against their references; returns the mismatches
+int checkDspKernels() {
+    static uint8_t workspace[DSP_SELF_TEST_BYTES] DSP_ALIGNED;
+    DspKernelResult results[DSP_KERNEL_COUNT + 1];
+    const size_t count = dspSelfTest(cpuCycles, workspace, sizeof(workspace), results, DSP_KERNEL_COUNT + 1);
+    int mismatches = 0;
+    for (size_t i = 0; i < count; i++) {
+        Serial.printf("@bench-dsp {\"name\": \"%s\", \"exact\": %s, \"vectorized\": %s, \"cycles_per_sample\": %.3f, \"scalar\": %.3f}\n",
+                      results[i].name, results[i].exact ? "true" : "false", results[i].vectorized ? "true" : "false",
+                      results[i].fastPerSample, results[i].refPerSample);
+        mismatches += results[i].exact ? 0 : 1;
+    }
+    return count == 0 ? 1 : mismatches;
+}
+
+void skipConfig(const BenchConfig& config, const char* reason) {
+    Serial.printf("@bench-skip {\"config\": \"%s\", \"reason\": \"%s\"}\n", config.name, reason);
+}
+
+void runConfig(const BenchConfig& config) {
+    if (config.wifi) {
+        startWifiLoad();
+    }
+    const size_t bytes = benchWorkspaceBytes(BENCH_FRAMES);
+    void* workspace = heap_caps_aligned_alloc(DSP_ALIGN, bytes, config.caps);
+    if (workspace == NULL) {
+        skipConfig(config, "no memory for the workspace");
+    } else if (!benchPrepare(workspace, bytes, BENCH_FRAMES)) {
+        skipConfig(config, "workspace rejected");
+    } else {
+        const uint32_t minCycles = BENCH_MIN_REPETITION_MS * ESP.getCpuFreqMHz() * 1000;
+        const uint32_t startMs = millis();
+        const uint32_t startDatagrams = loadDatagrams;
+        for (size_t i = 0; i < benchCount(); i++) {
+            const BenchResult result = benchMeasure(benchAt(i), cpuCycles, minCycles, BENCH_REPETITIONS);
+            Serial.printf("@bench {\"config\": \"%s\", \"name\": \"%s\", \"unit\": \"%s\", \"items\": %u, "
+                          "\"cycles_per_item\": %.4f, \"median_cycles_per_item\": %.4f}\n",
+                          config.name, result.name, result.unit, (unsigned)result.items, result.best, result.median);
+            // Nothing of the serial output overlaps the next measurement
+            Serial.flush();
+        }
+        if (config.wifi) {
+            Serial.printf("@bench-load {\"config\": \"%s\", \"datagrams\": %u, \"ms\": %u}\n", config.name,
+                          (unsigned)(loadDatagrams - startDatagrams), (unsigned)(millis() - startMs));
+        }
+    }
+    heap_caps_free(workspace);
+    if (config.wifi) {
+        stopWifiLoad();
+    }
+}
+
+void runSuite() {
+    Serial.printf("@bench-start {\"cpu_mhz\": %u, \"frames\": %u, \"repetitions\": %d, \"pie\": %d, \"psram_bytes\": %u}\n",
+                  (unsigned)ESP.getCpuFreqMHz(), (unsigned)BENCH_FRAMES, BENCH_REPETITIONS, DSP_KERNELS_PIE,
+                  (unsigned)ESP.getPsramSize());
+    const int mismatches = checkDspKernels();
+    for (size_t i = 0; i < sizeof(CONFIGS) / sizeof(CONFIGS[0]); i++) {
+        if ((CONFIGS[i].caps & MALLOC_CAP_SPIRAM) && ESP.getPsramSize() == 0) {
+            skipConfig(CONFIGS[i], "no PSRAM");
+            continue;
+        }
+        runConfig(CONFIGS[i]);
+    }
+    Serial.printf("@bench-done {\"dsp_mismatches\": %d, \"checksum\": \"%08x\"}\n", mismatches, (unsigned)benchChecksum());
+}
+
+void setup() {
+    Serial.begin(115200);
+    WiFi.mode(WIFI_OFF);
+    delay(2000); // Time for the host to open the port after a reset
+    runSuite();
+}
+
+void loop() {
+    if (Serial.available() > 0 && Serial.read() == 'r') {
+        runSuite();
+    }
+    delay(10);
+}
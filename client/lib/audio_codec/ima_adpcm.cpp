@@ -0,0 +1,85 @@
+#include "ima_adpcm.h"
+
+static const int8_t INDEX_TABLE[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8,
+};
+
+static const int16_t STEP_TABLE[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+    19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+    130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+    5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+};
+
+static inline int32_t clampSample(int32_t value) {
+    return value > 32767 ? 32767 : (value < -32768 ? -32768 : value);
+}
+
+static inline int32_t clampIndex(int32_t index) {
+    return index < 0 ? 0 : (index > 88 ? 88 : index);
+}
+
+// Reconstructs the prediction for one nibble and advances the step index
+static inline void applyDelta(uint8_t delta, AdpcmState& state) {
+    const int32_t step = STEP_TABLE[state.index];
+    int32_t vpdiff = step >> 3;
+    if (delta & 4) vpdiff += step;
+    if (delta & 2) vpdiff += step >> 1;
+    if (delta & 1) vpdiff += step >> 2;
+    state.predicted = clampSample((delta & 8) ? state.predicted - vpdiff : state.predicted + vpdiff);
+    state.index = clampIndex(state.index + INDEX_TABLE[delta]);
+}
+
+static inline uint8_t encodeSample(int32_t sample, AdpcmState& state) {
+    int32_t step = STEP_TABLE[state.index];
+    int32_t diff = sample - state.predicted;
+    uint8_t delta = 0;
+    if (diff < 0) {
+        delta = 8;
+        diff = -diff;
+    }
+    if (diff >= step) {
+        delta |= 4;
+        diff -= step;
+    }
+    step >>= 1;
+    if (diff >= step) {
+        delta |= 2;
+        diff -= step;
+    }
+    step >>= 1;
+    if (diff >= step) {
+        delta |= 1;
+    }
+    applyDelta(delta, state);
+    return delta;
+}
+
+size_t adpcmEncode(const int16_t* in, size_t samples, uint8_t* out, AdpcmState& state) {
+    const size_t bytes = samples / 2;
+    for (size_t i = 0; i < bytes; i++) {
+        // Both samples are read before out[i] is written, which keeps in-place encoding safe
+        const int16_t first = in[2 * i];
+        const int16_t second = in[2 * i + 1];
+        const uint8_t high = encodeSample(first, state);
+        const uint8_t low = encodeSample(second, state);
+        out[i] = (uint8_t)((high << 4) | low);
+    }
+    return bytes;
+}
+
+size_t adpcmDecode(const uint8_t* in, size_t length, int16_t* out, AdpcmState& state) {
+    for (size_t i = 0; i < length; i++) {
+        applyDelta(in[i] >> 4, state);
+        out[2 * i] = (int16_t)state.predicted;
+        applyDelta(in[i] & 0x0F, state);
+        out[2 * i + 1] = (int16_t)state.predicted;
+    }
+    return length * 2;
+}
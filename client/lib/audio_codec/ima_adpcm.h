@@ -0,0 +1,23 @@
+#pragma once
+
+// =================================================================================================
+// IMA/DVI ADPCM (4 bits per sample)
+// Bit-exact with Python's audioop.lin2adpcm()/adpcm2lin() as used by server.py: the first
+// sample of each byte is in the high nibble, and a stream starts from a zeroed AdpcmState.
+// The state carries over between calls, so a stream can be coded in arbitrary pieces.
+// =================================================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct AdpcmState {
+    int32_t predicted;
+    int32_t index;
+};
+
+// Encodes 'samples' 16-bit samples (an even count; a trailing odd sample is dropped) into
+// samples / 2 bytes. 'out' may alias 'in' for in-place encoding. Returns the bytes written.
+size_t adpcmEncode(const int16_t* in, size_t samples, uint8_t* out, AdpcmState& state);
+
+// Decodes 'length' bytes into length * 2 samples. Returns the samples written.
+size_t adpcmDecode(const uint8_t* in, size_t length, int16_t* out, AdpcmState& state);
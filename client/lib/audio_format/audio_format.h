@@ -0,0 +1,133 @@
+#pragma once
+
+// =================================================================================================
+// AUDIO FORMATS
+// AudioFormat<Rate, Bits, Channels> carries a PCM format in the type, and FrameSpan<Format> is a
+// view of interleaved frames in that format. Sizes and durations are computed from the type
+// (no hand-written "/ 2" or "* SAMPLE_RATE * 2"), and the kernels in audio_kernels.h are
+// specialized per format at compile time, so their inner loops never branch on the format.
+// Rates chosen at run time (link adaptation) are turned into a type once per buffer by
+// dispatchRate().
+// Portable (no Arduino dependencies) for the native build. No heap allocation.
+// =================================================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+
+// Rate of a format whose kernels don't depend on it (gain, mix, codecs). Kernels that do
+// (conversion, durations) reject it at compile time.
+const uint32_t AUDIO_RATE_ANY = 0;
+
+template <uint32_t Rate>
+struct AudioRequireRate {
+    static_assert(Rate != AUDIO_RATE_ANY, "This needs a format with a fixed rate");
+    static const uint32_t VALUE = Rate;
+};
+
+template <uint8_t Bits>
+struct AudioSample;
+template <>
+struct AudioSample<16> {
+    typedef int16_t Type;
+    typedef int32_t Wide;   // Holds a product or a sum of two samples without overflow
+    static const int32_t MIN = -32768;
+    static const int32_t MAX = 32767;
+};
+template <>
+struct AudioSample<32> {
+    typedef int32_t Type;
+    typedef int64_t Wide;
+    static const int64_t MIN = -2147483647LL - 1;
+    static const int64_t MAX = 2147483647LL;
+};
+
+template <uint32_t Rate, uint8_t Bits, uint8_t Channels>
+struct AudioFormat {
+    static_assert(Channels == 1 || Channels == 2, "Mono or stereo only");
+
+    typedef typename AudioSample<Bits>::Type Sample;
+    typedef typename AudioSample<Bits>::Wide Wide;
+    static const uint32_t RATE = Rate;
+    static const uint8_t BITS = Bits;
+    static const uint8_t CHANNELS = Channels;
+    static const size_t FRAME_BYTES = Bits / 8 * Channels;
+
+    // Whole frames in 'bytes' (a partial trailing frame is not counted)
+    static constexpr size_t framesIn(size_t bytes) { return bytes / FRAME_BYTES; }
+    static constexpr size_t bytesFor(size_t frames) { return frames * FRAME_BYTES; }
+
+    static constexpr size_t framesForMs(uint32_t ms) {
+        return (size_t)((uint64_t)AudioRequireRate<Rate>::VALUE * ms / 1000);
+    }
+    static constexpr size_t bytesForMs(uint32_t ms) { return bytesFor(framesForMs(ms)); }
+    static constexpr uint32_t msFor(size_t bytes) {
+        return (uint32_t)((uint64_t)framesIn(bytes) * 1000 / AudioRequireRate<Rate>::VALUE);
+    }
+};
+
+// The formats the device handles: INMP441 capture and MAX98357A playback are mono 16-bit, at
+// either of the rates offered in the capability handshake
+typedef AudioFormat<16000, 16, 1> Pcm16k;
+typedef AudioFormat<8000, 16, 1> Pcm8k;
+typedef AudioFormat<AUDIO_RATE_ANY, 16, 1> Mono16;
+
+// Same samples at a rate only known at run time (gain, mix and codecs don't need it)
+template <class Format>
+struct AnyRate {
+    typedef AudioFormat<AUDIO_RATE_ANY, Format::BITS, Format::CHANNELS> Type;
+};
+
+// Interleaved frames of 'Format' (const Sample for read-only views). Does not own the memory.
+template <class Format, class Sample = typename Format::Sample>
+class FrameSpan {
+public:
+    typedef Format FormatType;
+    typedef Sample SampleType;
+    typedef typename std::conditional<std::is_const<Sample>::value, const void, void>::type Bytes;
+
+    FrameSpan() : _data(NULL), _frames(0) {}
+    FrameSpan(Sample* data, size_t frames) : _data(data), _frames(frames) {}
+
+    // Over raw bytes; a partial trailing frame is left out
+    static FrameSpan fromBytes(Bytes* data, size_t bytes) {
+        return FrameSpan((Sample*)data, Format::framesIn(bytes));
+    }
+    // A mutable span converts to a read-only one
+    operator FrameSpan<Format, const typename Format::Sample>() const {
+        return FrameSpan<Format, const typename Format::Sample>(_data, _frames);
+    }
+
+    Sample* data() const { return _data; }
+    size_t frames() const { return _frames; }
+    size_t samples() const { return _frames * Format::CHANNELS; }
+    size_t bytes() const { return Format::bytesFor(_frames); }
+    bool empty() const { return _frames == 0; }
+    FrameSpan first(size_t frames) const { return FrameSpan(_data, frames < _frames ? frames : _frames); }
+    FrameSpan skip(size_t frames) const {
+        return frames < _frames ? FrameSpan(_data + frames * Format::CHANNELS, _frames - frames) : FrameSpan();
+    }
+
+private:
+    Sample* _data;
+    size_t _frames;
+};
+
+template <class Format>
+using ConstFrameSpan = FrameSpan<Format, const typename Format::Sample>;
+
+// Calls visitor.template run<Format>() with the mono 16-bit format for 'rate', so code below it
+// is specialized for the rate. Returns false for rates the device doesn't support.
+template <class Visitor>
+bool dispatchRate(uint32_t rate, Visitor& visitor) {
+    switch (rate) {
+        case Pcm16k::RATE:
+            visitor.template run<Pcm16k>();
+            return true;
+        case Pcm8k::RATE:
+            visitor.template run<Pcm8k>();
+            return true;
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+// =================================================================================================
+// AUDIO KERNELS
+// Format conversion, gain, mix and codec kernels over FrameSpans (audio_format.h). Each one is
+// instantiated per format: sample width, channel count and rate ratio are template parameters,
+// so the inner loops are straight-line code for that format. Conversions exist only between
+// formats the device uses; any other pair fails to compile rather than running a slow generic
+// path.
+// Portable (no Arduino dependencies) for the native build. No heap allocation.
+// =================================================================================================
+
+#include <string.h>
+
+#include <ima_adpcm.h>
+
+#include "audio_format.h"
+
+// Gains are Q8 fixed point: 256 passes samples through unchanged
+const int32_t AUDIO_GAIN_UNITY_Q8 = 256;
+
+template <class Format>
+inline typename Format::Sample audioSaturate(typename Format::Wide value) {
+    typedef AudioSample<Format::BITS> Limits;
+    return (typename Format::Sample)(value > Limits::MAX ? Limits::MAX : (value < Limits::MIN ? Limits::MIN : value));
+}
+
+// --- Gain and mix ---
+
+// Scales the samples in place, saturating at full scale
+template <class Format>
+void applyGain(FrameSpan<Format> pcm, int32_t gainQ8) {
+    typedef typename Format::Wide Wide;
+    typename Format::Sample* samples = pcm.data();
+    const size_t count = pcm.samples();
+    for (size_t i = 0; i < count; i++) {
+        samples[i] = audioSaturate<Format>(((Wide)samples[i] * gainQ8) >> 8);
+    }
+}
+
+// Adds 'source' scaled by 'gainQ8' onto 'target', saturating. Mixes min(frames) frames and
+// returns that count.
+template <class Format>
+size_t mixInto(FrameSpan<Format> target, ConstFrameSpan<Format> source, int32_t gainQ8) {
+    typedef typename Format::Wide Wide;
+    const size_t frames = target.frames() < source.frames() ? target.frames() : source.frames();
+    typename Format::Sample* out = target.data();
+    const typename Format::Sample* in = source.data();
+    for (size_t i = 0; i < frames * Format::CHANNELS; i++) {
+        out[i] = audioSaturate<Format>((Wide)out[i] + (((Wide)in[i] * gainQ8) >> 8));
+    }
+    return frames;
+}
+
+// --- Format conversion ---
+// AudioConverter<From, To>::run() converts 'frames' input frames and returns the output frames;
+// inFrames() is how many input frames fill 'frames' output frames. Rate halving and bit
+// narrowing work in place, and so does widening.
+
+template <class From, class To>
+struct AudioConverter {
+    static_assert(sizeof(From) == 0, "No conversion between these formats");
+};
+
+// Same format: a copy
+template <class Format>
+struct AudioConverter<Format, Format> {
+    static size_t inFrames(size_t frames) { return frames; }
+    static size_t run(const typename Format::Sample* in, size_t frames, typename Format::Sample* out) {
+        if (in != out) {
+            memmove(out, in, Format::bytesFor(frames));
+        }
+        return frames;
+    }
+};
+
+// 16 kHz to 8 kHz: each output sample is the mean of an input pair (a trailing odd sample is
+// dropped). Matches the decimation the server applies for adpcm@8000.
+template <>
+struct AudioConverter<Pcm16k, Pcm8k> {
+    static size_t inFrames(size_t frames) { return frames * 2; }
+    static size_t run(const int16_t* in, size_t frames, int16_t* out) {
+        for (size_t i = 0; i < frames / 2; i++) {
+            out[i] = (int16_t)((in[2 * i] + in[2 * i + 1]) / 2);
+        }
+        return frames / 2;
+    }
+};
+
+// 8 kHz to 16 kHz: linear interpolation, the last sample repeated at the end
+template <>
+struct AudioConverter<Pcm8k, Pcm16k> {
+    static size_t inFrames(size_t frames) { return frames / 2; }
+    static size_t run(const int16_t* in, size_t frames, int16_t* out) {
+        for (size_t i = 0; i < frames; i++) {
+            const int32_t next = i + 1 < frames ? in[i + 1] : in[i];
+            out[2 * i] = in[i];
+            out[2 * i + 1] = (int16_t)((in[i] + next) / 2);
+        }
+        return frames * 2;
+    }
+};
+
+// Mono to stereo: both channels get the sample
+template <uint32_t Rate, uint8_t Bits>
+struct AudioConverter<AudioFormat<Rate, Bits, 1>, AudioFormat<Rate, Bits, 2>> {
+    typedef typename AudioFormat<Rate, Bits, 1>::Sample Sample;
+    static size_t inFrames(size_t frames) { return frames; }
+    static size_t run(const Sample* in, size_t frames, Sample* out) {
+        for (size_t i = 0; i < frames; i++) {
+            out[2 * i] = in[i];
+            out[2 * i + 1] = in[i];
+        }
+        return frames;
+    }
+};
+
+// Stereo to mono: the mean of both channels
+template <uint32_t Rate, uint8_t Bits>
+struct AudioConverter<AudioFormat<Rate, Bits, 2>, AudioFormat<Rate, Bits, 1>> {
+    typedef AudioFormat<Rate, Bits, 1> Mono;
+    typedef typename Mono::Sample Sample;
+    static size_t inFrames(size_t frames) { return frames; }
+    static size_t run(const Sample* in, size_t frames, Sample* out) {
+        for (size_t i = 0; i < frames; i++) {
+            out[i] = (Sample)(((typename Mono::Wide)in[2 * i] + in[2 * i + 1]) / 2);
+        }
+        return frames;
+    }
+};
+
+// 32-bit I2S slots to 16-bit samples: the top half of each slot
+template <uint32_t Rate, uint8_t Channels>
+struct AudioConverter<AudioFormat<Rate, 32, Channels>, AudioFormat<Rate, 16, Channels>> {
+    static size_t inFrames(size_t frames) { return frames; }
+    static size_t run(const int32_t* in, size_t frames, int16_t* out) {
+        for (size_t i = 0; i < frames * Channels; i++) {
+            out[i] = (int16_t)(in[i] >> 16);
+        }
+        return frames;
+    }
+};
+
+// 16-bit samples to 32-bit slots
+template <uint32_t Rate, uint8_t Channels>
+struct AudioConverter<AudioFormat<Rate, 16, Channels>, AudioFormat<Rate, 32, Channels>> {
+    static size_t inFrames(size_t frames) { return frames; }
+    static size_t run(const int16_t* in, size_t frames, int32_t* out) {
+        // Backwards, so a buffer can be widened in place
+        for (size_t i = frames * Channels; i-- > 0; ) {
+            out[i] = (int32_t)((uint32_t)(int32_t)in[i] << 16);
+        }
+        return frames;
+    }
+};
+
+// Converts as many input frames as fit in 'out'. Returns the part of 'out' written.
+template <class From, class To>
+FrameSpan<To> convertAudio(ConstFrameSpan<From> in, FrameSpan<To> out) {
+    typedef AudioConverter<From, To> Converter;
+    const size_t fit = Converter::inFrames(out.frames());
+    return out.first(Converter::run(in.data(), in.frames() < fit ? in.frames() : fit, out.data()));
+}
+
+// --- Codecs ---
+
+// IMA ADPCM of a mono 16-bit span (see ima_adpcm.h). 'out' may alias the span's samples.
+template <class Format>
+size_t adpcmEncode(ConstFrameSpan<Format> pcm, uint8_t* out, AdpcmState& state) {
+    static_assert(Format::BITS == 16 && Format::CHANNELS == 1, "IMA ADPCM codes mono 16-bit PCM");
+    return adpcmEncode(pcm.data(), pcm.frames(), out, state);
+}
+
+// Decodes 'length' bytes into 'out' (room for length * 2 frames). Returns the decoded frames.
+template <class Format>
+FrameSpan<Format> adpcmDecode(const uint8_t* in, size_t length, FrameSpan<Format> out, AdpcmState& state) {
+    static_assert(Format::BITS == 16 && Format::CHANNELS == 1, "IMA ADPCM codes mono 16-bit PCM");
+    const size_t bytes = length * 2 > out.frames() ? out.frames() / 2 : length;
+    return out.first(adpcmDecode(in, bytes, out.data(), state));
+}
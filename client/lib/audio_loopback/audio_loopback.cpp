@@ -0,0 +1,154 @@
+#include "audio_loopback.h"
+
+#include <math.h>
+#include <string.h>
+
+// Each dspDot() block is at most DSP_DOT_MAX full-scale products, so a 9 bit shift fits 32 bits
+static const uint8_t LOOPBACK_DOT_SHIFT = 9;
+static const float PI_F = 3.14159265f;
+
+void loopbackChirp(int16_t* out, size_t frames, uint32_t rate, float f0Hz, float f1Hz, int16_t amplitude) {
+    const float duration = (float)frames / rate;
+    const size_t fade = (size_t)(LOOPBACK_FADE_MS * rate / 1000);
+    for (size_t i = 0; i < frames; i++) {
+        const float t = (float)i / rate;
+        // Phase of a linear sweep: 2 pi (f0 t + (f1 - f0) t^2 / 2T), wrapped so sinf() stays precise
+        float cycles = f0Hz * t + (f1Hz - f0Hz) * t * t / (2 * duration);
+        cycles -= floorf(cycles);
+        float envelope = 1;
+        if (i < fade) {
+            envelope = 0.5f - 0.5f * cosf(PI_F * i / fade);
+        } else if (frames - 1 - i < fade) {
+            envelope = 0.5f - 0.5f * cosf(PI_F * (frames - 1 - i) / fade);
+        }
+        out[i] = (int16_t)lrintf(amplitude * envelope * sinf(2 * PI_F * cycles));
+    }
+}
+
+LoopbackCorrelator::LoopbackCorrelator() : _phases(NULL), _frames(0), _padded(0), _energy(0) {}
+
+bool LoopbackCorrelator::begin(const int16_t* reference, size_t frames, int16_t* phases) {
+    if (frames == 0 || frames > LOOPBACK_MAX_REFERENCE || !dspAligned(phases)) {
+        return false;
+    }
+    _phases = phases;
+    _frames = frames;
+    _padded = loopbackPadded(frames);
+    _energy = 0;
+    for (size_t i = 0; i < frames; i++) {
+        _energy += (int32_t)reference[i] * reference[i];
+    }
+    // Copy k starts k zeros in: at lag a + k the window starting at (aligned) a lines up with it
+    for (size_t k = 0; k < DSP_LANES; k++) {
+        int16_t* phase = phases + k * _padded;
+        memset(phase, 0, _padded * sizeof(int16_t));
+        memcpy(phase + k, reference, frames * sizeof(int16_t));
+    }
+    return true;
+}
+
+int64_t LoopbackCorrelator::correlate(const int16_t* capture, size_t lag) const {
+    const size_t aligned = lag & ~(DSP_LANES - 1);
+    const int16_t* phase = _phases + (lag - aligned) * _padded;
+    int64_t sum = 0;
+    for (size_t offset = 0; offset < _padded; offset += DSP_DOT_MAX) {
+        const size_t n = _padded - offset < DSP_DOT_MAX ? _padded - offset : DSP_DOT_MAX;
+        sum += dspDot(phase + offset, capture + aligned + offset, n, LOOPBACK_DOT_SHIFT);
+    }
+    return sum;
+}
+
+LoopbackMatch LoopbackCorrelator::match(const int16_t* capture, size_t captureFrames) const {
+    LoopbackMatch result = {false, 0, 0, false, 0};
+    if (_frames == 0 || !dspAligned(capture) || captureFrames < _padded) {
+        return result;
+    }
+    const size_t lags = captureFrames - _padded + 1;
+    size_t best = 0;
+    int64_t bestValue = 0;
+    double sumSquares = 0;
+    for (size_t lag = 0; lag < lags; lag++) {
+        const int64_t value = correlate(capture, lag);
+        sumSquares += (double)value * value;
+        if ((value < 0 ? -value : value) > (bestValue < 0 ? -bestValue : bestValue)) {
+            bestValue = value;
+            best = lag;
+        }
+    }
+    if (bestValue == 0) {
+        return result;
+    }
+
+    // Parabola through the peak and its neighbours for the fraction of a sample, and the
+    // height of the peak between samples
+    const double sampled = bestValue < 0 ? -(double)bestValue : (double)bestValue;
+    double peak = sampled;
+    float fraction = 0;
+    if (best > 0 && best + 1 < lags) {
+        const double sign = bestValue < 0 ? -1 : 1;
+        const double before = sign * correlate(capture, best - 1);
+        const double after = sign * correlate(capture, best + 1);
+        const double curvature = before - 2 * sampled + after;
+        if (curvature < 0) {
+            fraction = (float)(0.5 * (before - after) / curvature);
+            peak = sampled - 0.25 * (before - after) * fraction;
+        }
+    }
+
+    const double rms = sqrt(sumSquares / lags);
+    result.lag = best + fraction;
+    result.inverted = bestValue < 0;
+    result.gainDb = (float)(20 * log10(peak * (1 << LOOPBACK_DOT_SHIFT) / _energy));
+    result.peakDb = (float)(20 * log10(sampled / rms));
+    result.found = result.peakDb >= LOOPBACK_MIN_PEAK_DB;
+    return result;
+}
+
+LoopbackRateFit::LoopbackRateFit() {
+    reset();
+}
+
+void LoopbackRateFit::reset() {
+    _points = 0;
+    _micros0 = 0;
+    _frames0 = 0;
+    _sumT = _sumF = _sumTT = _sumTF = 0;
+}
+
+void LoopbackRateFit::add(uint32_t micros, uint32_t frames) {
+    if (_points == 0) {
+        _micros0 = micros;
+        _frames0 = frames;
+    }
+    const double t = (double)(uint32_t)(micros - _micros0);
+    const double f = (double)(uint32_t)(frames - _frames0);
+    _sumT += t;
+    _sumF += f;
+    _sumTT += t * t;
+    _sumTF += t * f;
+    _points++;
+}
+
+double LoopbackRateFit::rate() const {
+    const double denominator = _points * _sumTT - _sumT * _sumT;
+    if (_points < 2 || denominator <= 0) {
+        return 0;
+    }
+    return (_points * _sumTF - _sumT * _sumF) / denominator * 1e6;
+}
+
+float LoopbackRateFit::errorPpm(uint32_t nominal) const {
+    const double measured = rate();
+    return measured > 0 ? (float)((measured - nominal) / nominal * 1e6) : 0;
+}
+
+double LoopbackRateFit::microsAt(double frame) const {
+    const double framesPerMicro = rate() / 1e6;
+    if (framesPerMicro <= 0) {
+        return _micros0;
+    }
+    // The line passes through the mean point
+    const double meanT = _sumT / _points;
+    const double meanF = _sumF / _points;
+    return _micros0 + meanT + (frame - _frames0 - meanF) / framesPerMicro;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+// =================================================================================================
+// AUDIO LOOPBACK MEASUREMENT
+// Finds a played reference signal (a chirp) in what the microphone captured, for the
+// mic-to-speaker self-test: the cross-correlation peak gives the echo's position to a fraction
+// of a sample and its level relative to the reference. A least-squares fit of a stream's frame
+// count against a microsecond clock gives its real sample rate.
+//
+// The correlation runs on dspDot() (the PIE path on the ESP32-S3). Like the FIR, it keeps the
+// reference in DSP_LANES copies, each shifted by one sample, so every lag has a 16-byte aligned
+// window in the capture.
+// Portable (no Arduino dependencies) for the native build. No heap allocation.
+// =================================================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <dsp_kernels.h>
+
+const size_t LOOPBACK_MAX_REFERENCE = 8192;     // Frames
+const float LOOPBACK_FADE_MS = 5;               // Raised-cosine edges of the chirp
+const float LOOPBACK_MIN_PEAK_DB = 15;          // Correlation peak over its RMS for a match
+
+// Samples in each shifted copy of the reference (a whole number of vectors)
+constexpr size_t loopbackPadded(size_t frames) { return dspFirPadded(frames); }
+// int16 elements of the 'phases' buffer LoopbackCorrelator::begin() takes
+constexpr size_t loopbackPhaseSamples(size_t frames) { return DSP_LANES * loopbackPadded(frames); }
+
+// Linear sweep from f0Hz to f1Hz over 'frames', peak 'amplitude', faded in and out
+void loopbackChirp(int16_t* out, size_t frames, uint32_t rate, float f0Hz, float f1Hz, int16_t amplitude);
+
+struct LoopbackMatch {
+    bool found;             // The peak stands LOOPBACK_MIN_PEAK_DB over the correlation's RMS
+    float lag;              // Capture frame where the reference starts, with a fraction
+    float gainDb;           // Level of the echo relative to the reference (least-squares fit)
+    bool inverted;          // The echo has the opposite polarity
+    float peakDb;           // Correlation peak over its RMS across all lags
+};
+
+class LoopbackCorrelator {
+public:
+    LoopbackCorrelator();
+
+    // 'phases' is 16-byte aligned and loopbackPhaseSamples(frames) long; it must stay valid
+    // while the correlator is used. False if the reference is empty or too long.
+    bool begin(const int16_t* reference, size_t frames, int16_t* phases);
+
+    // Cross-correlates the reference with every window of 'capture' (16-byte aligned), lags 0
+    // up to captureFrames - loopbackPadded(frames), and reports the strongest match
+    LoopbackMatch match(const int16_t* capture, size_t captureFrames) const;
+
+    size_t frames() const { return _frames; }
+
+private:
+    // Correlation at 'lag', scaled down by the dot products' shift
+    int64_t correlate(const int16_t* capture, size_t lag) const;
+
+    int16_t* _phases;
+    size_t _frames;
+    size_t _padded;
+    int64_t _energy;        // Sum of the reference's squares
+};
+
+// Least-squares line through (microseconds, cumulative frames) points of one stream
+class LoopbackRateFit {
+public:
+    LoopbackRateFit();
+    void reset();
+    void add(uint32_t micros, uint32_t frames);
+
+    size_t points() const { return _points; }
+    // Frames per second; 0 until two points span some time
+    double rate() const;
+    // Parts per million off 'nominal'
+    float errorPpm(uint32_t nominal) const;
+    // Microsecond clock at which the stream reached 'frame', on the fitted line
+    double microsAt(double frame) const;
+
+private:
+    size_t _points;
+    uint32_t _micros0;      // Sums are taken relative to the first point
+    uint32_t _frames0;
+    double _sumT, _sumF, _sumTT, _sumTF;
+};
@@ -0,0 +1,70 @@
+#include "audio_profile.h"
+
+#include <string.h>
+
+#include <trinity_protocol.h>
+
+// True if the jitter buffer, sizing its delay for 'jitterMs' (three times the jitter on top of
+// the minimum), stays within the profile's range
+static bool coversJitter(const AudioProfile& profile, float jitterMs) {
+    return profile.jitterMinPackets + 3 * jitterMs / TRINITY_RTP_PACKET_MS <= profile.jitterMaxPackets;
+}
+
+size_t audioProfileFind(const char* name) {
+    for (size_t i = 0; i < AUDIO_PROFILE_COUNT; i++) {
+        if (strcmp(AUDIO_PROFILES[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return AUDIO_PROFILE_COUNT;
+}
+
+AudioProfileSelector::AudioProfileSelector() : _switches(0) {
+    memset(_stats, 0, sizeof(_stats));
+    start(AUDIO_PROFILE_BALANCED, true);
+}
+
+void AudioProfileSelector::start(size_t profile, bool automatic) {
+    _profile = profile < AUDIO_PROFILE_COUNT ? profile : (size_t)AUDIO_PROFILE_BALANCED;
+    _automatic = automatic;
+    _calmStreak = 0;
+}
+
+bool AudioProfileSelector::update(const AudioProfileTurn& turn) {
+    if (turn.audioSeconds <= 0) {
+        return false;
+    }
+    AudioProfileStats& stats = _stats[_profile];
+    stats.turns++;
+    stats.audioSeconds += turn.audioSeconds;
+    stats.latencyMsSeconds += turn.latencyMs * turn.audioSeconds;
+    stats.glitches += turn.glitches;
+    if (!_automatic) {
+        return false;
+    }
+
+    // Step towards robust right away when the turn glitched or outgrew the playout delay
+    if (turn.glitches > 0 || !coversJitter(profile(), turn.jitterMs)) {
+        _calmStreak = 0;
+        if (_profile + 1 < AUDIO_PROFILE_COUNT) {
+            _profile++;
+            _switches++;
+            return true;
+        }
+        return false;
+    }
+
+    // Step towards low latency after AUDIO_PROFILE_CALM_TURNS turns that would have fit there
+    const bool weak = turn.rssiDbm != 0 && turn.rssiDbm <= AUDIO_PROFILE_WEAK_RSSI_DBM;
+    if (_profile == 0 || weak || !coversJitter(AUDIO_PROFILES[_profile - 1], turn.jitterMs)) {
+        _calmStreak = 0;
+        return false;
+    }
+    if (++_calmStreak >= AUDIO_PROFILE_CALM_TURNS) {
+        _profile--;
+        _switches++;
+        _calmStreak = 0;
+        return true;
+    }
+    return false;
+}
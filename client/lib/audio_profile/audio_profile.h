@@ -0,0 +1,111 @@
+#pragma once
+
+// =================================================================================================
+// AUDIO PROFILES
+// Named trade-offs between latency and robustness for everything that buffers audio on the way
+// through the device: the I2S DMA ring, the RTP jitter buffer's playout delay, the capture read
+// size (how much is recorded before it is streamed), the RTP socket's receive buffer and how much
+// reply audio is queued before a TCP reply starts to play. A profile sets all of them at once;
+// the firmware switches between turns, never during one.
+//
+// AudioProfileSelector fixes the profile (set per device) or, in automatic mode, walks the list
+// like the link adapter walks its format ladder: one step towards robust after a turn that
+// glitched, or whose jitter the profile's playout delay can't cover, and one step towards low
+// latency only after several calm turns in a row. It also keeps each profile's measured latency
+// and glitch rate. Portable (no Arduino dependencies) for the native build. No heap allocation.
+// =================================================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct AudioProfile {
+    const char* name;
+    uint16_t dmaBufferCount;        // I2S DMA ring, each direction
+    uint16_t dmaBufferSamples;
+    uint8_t jitterMinPackets;       // RTP playout delay range
+    uint8_t jitterMaxPackets;
+    uint16_t captureChunkMs;        // Recording read (and streamed) per loop pass, at most
+    uint16_t socketBufferBytes;     // SO_RCVBUF of the RTP socket (datagrams past it are dropped); 0 = no limit
+    uint16_t prebufferMs;           // Reply audio queued before a TCP reply starts to play
+};
+
+// Lowest latency first
+enum AudioProfileId {
+    AUDIO_PROFILE_LOW_LATENCY,
+    AUDIO_PROFILE_BALANCED,
+    AUDIO_PROFILE_LOSSY_WIFI
+};
+
+constexpr AudioProfile AUDIO_PROFILES[] = {
+    {"low-latency", 4, 32, 1, 4, 16, 4 * 652, 0},   // Socket: its longest delay of pcm16@16000 packets
+    {"balanced", 8, 64, 2, 10, 64, 0, 0},           // What the firmware used before profiles
+    {"lossy-wifi", 16, 64, 4, 10, 64, 0, 250},
+};
+constexpr size_t AUDIO_PROFILE_COUNT = sizeof(AUDIO_PROFILES) / sizeof(AUDIO_PROFILES[0]);
+
+// Profile setting that lets AudioProfileSelector pick
+#define AUDIO_PROFILE_AUTO "auto"
+
+// Calm turns (no glitches, jitter the lower latency profile covers) in a row before stepping there
+const uint8_t AUDIO_PROFILE_CALM_TURNS = 3;
+const int AUDIO_PROFILE_WEAK_RSSI_DBM = -80;        // Below it, never step towards low latency
+
+// Largest DMA ring and capture read over all profiles, for sizing buffers at compile time
+// (recursive: C++11 constexpr functions are one expression)
+constexpr size_t audioProfileMaxDmaSamples(size_t i = 0) {
+    return i == AUDIO_PROFILE_COUNT ? 0
+         : ((size_t)AUDIO_PROFILES[i].dmaBufferCount * AUDIO_PROFILES[i].dmaBufferSamples > audioProfileMaxDmaSamples(i + 1)
+            ? (size_t)AUDIO_PROFILES[i].dmaBufferCount * AUDIO_PROFILES[i].dmaBufferSamples : audioProfileMaxDmaSamples(i + 1));
+}
+constexpr uint16_t audioProfileMaxCaptureMs(size_t i = 0) {
+    return i == AUDIO_PROFILE_COUNT ? 0
+         : (AUDIO_PROFILES[i].captureChunkMs > audioProfileMaxCaptureMs(i + 1)
+            ? AUDIO_PROFILES[i].captureChunkMs : audioProfileMaxCaptureMs(i + 1));
+}
+
+// Index of the profile called 'name', or AUDIO_PROFILE_COUNT if there is none
+size_t audioProfileFind(const char* name);
+
+// One voice turn's playback, measured under the profile that was active
+struct AudioProfileTurn {
+    float audioSeconds;     // Reply audio played; a turn without any says nothing about the profile
+    float latencyMs;        // Mean audio queued ahead of the speaker (ring, DMA and jitter buffer)
+    uint32_t glitches;      // Underruns, plus concealed and stretched RTP packets
+    float jitterMs;         // RTP interarrival jitter (0 over TCP)
+    int rssiDbm;
+};
+
+struct AudioProfileStats {
+    uint32_t turns;
+    float audioSeconds;
+    float latencyMsSeconds; // Latency weighted by the audio played
+    uint32_t glitches;
+
+    float meanLatencyMs() const { return audioSeconds > 0 ? latencyMsSeconds / audioSeconds : 0; }
+    float glitchesPerMinute() const { return audioSeconds > 0 ? glitches * 60 / audioSeconds : 0; }
+};
+
+class AudioProfileSelector {
+public:
+    AudioProfileSelector();
+
+    // Starts at 'profile'. Unless 'automatic', it stays there.
+    void start(size_t profile, bool automatic);
+
+    // Records one turn under the current profile and, in automatic mode, picks the profile for
+    // the next one. Returns true if it switched.
+    bool update(const AudioProfileTurn& turn);
+
+    const AudioProfile& profile() const { return AUDIO_PROFILES[_profile]; }
+    size_t index() const { return _profile; }
+    bool automatic() const { return _automatic; }
+    uint32_t switches() const { return _switches; }
+    const AudioProfileStats& stats(size_t profile) const { return _stats[profile]; }
+
+private:
+    size_t _profile;
+    bool _automatic;
+    uint8_t _calmStreak;    // Consecutive calm turns
+    uint32_t _switches;
+    AudioProfileStats _stats[AUDIO_PROFILE_COUNT];
+};
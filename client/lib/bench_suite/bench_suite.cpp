@@ -0,0 +1,697 @@
+#include "bench_suite.h"
+
+#include <math.h>
+#include <new>
+#include <stdio.h>
+#include <string.h>
+
+#include <audio_format.h>
+#include <audio_loopback.h>
+#include <audio_kernels.h>
+#include <binlog.h>
+#include <dsp_kernels.h>
+#include <frame_parser.h>
+#include <http_response.h>
+#include <ima_adpcm.h>
+#include <jitter_buffer.h>
+#include <link_adapt.h>
+#include <output_chain.h>
+#include <playback_ring.h>
+#include <rtp_packet.h>
+#include <trinity_caps.h>
+
+static const size_t SEGMENT_BYTES = 1460;       // One TCP segment
+static const size_t RESPONSE_CHUNK_BYTES = 2048;
+static const size_t CHUNK_FRAMING_BYTES = 16;   // Size line and CRLFs around each HTTP chunk
+static const size_t RESPONSE_EXTRA_BYTES = 512; // Text frames, timing, HTTP head and trailer
+static const size_t CAPS_BYTES = 512;
+static const size_t FIR_MAX_TAPS = 63;
+static const size_t FFT_POINTS = 256;
+static const size_t CHIRP_FRAMES = 512;
+static const size_t BINLOG_RING_BYTES = 4096;
+static const size_t BINLOG_RECORDS = 256;
+static const size_t LINK_UPDATES = 1000;
+static const size_t RECEIVE_BUFFER_BYTES = 1436;    // WiFiClient's receive buffer
+static const size_t BODY_CHUNK_BYTES = 2048;        // The firmware's voiceBodyChunk
+static const size_t HEAD_CHUNK_BYTES = 256;         // The firmware's voiceHeadChunk
+static const size_t CHUNK_FRAMING_READ_BYTES = 8;
+static const size_t PLAYBACK_RING_BYTES = 8192;       // Wraps a few times per run
+static const size_t DMA_BYTES = 1024;               // The amplifier's DMA buffers
+
+static_assert(BENCH_FRAME_MULTIPLE % OUTPUT_CHAIN_BLOCK == 0, "The output chain benchmark runs whole blocks");
+
+typedef AudioFormat<16000, 16, 2> Stereo16k;
+typedef AudioFormat<16000, 32, 1> Slots16k;
+
+// Everything the benchmarks read or write, in the caller's workspace
+struct BenchData {
+    size_t frames;
+    size_t packets;             // RTP audio packets in the recording
+    int16_t* speech;            // 2 * frames: the recording, then more of the same signal
+    int16_t* work;              // 2 * frames of output
+    int32_t* slots;             // The recording as 32-bit I2S slots
+    uint8_t* adpcm;
+    // Framed response: transcript, reply, timing, the recording in AUDIO frames, end
+    uint8_t* framed;
+    size_t framedLength;
+    // The same body as an HTTP/1.1 response in RESPONSE_CHUNK_BYTES chunks
+    uint8_t* chunked;
+    size_t chunkedLength;
+    uint8_t* segment;
+    uint8_t* bodyChunk;
+    int16_t* staging;           // The old playback sink's aligned PCM buffer
+    uint8_t* playbackRing;
+    uint8_t* dma;
+    uint8_t* rtpPackets;        // RTP_MAX_PACKET apart
+    size_t* rtpLengths;
+    uint32_t* rtpArrivalMs;     // Real time, TRINITY_RTP_PACKET_MS per audio packet
+    size_t rtpCount;
+    char* caps;
+    size_t capsLength;
+    int16_t* firPhases;
+    int16_t* firHistory;
+    int16_t* fftTwiddles;
+    int16_t* chirp;
+    int16_t* chirpPhases;       // For the loopback correlator
+    int16_t* pcm;               // One RTP packet's worth
+    uint8_t* binlogRing;
+    uint8_t* binlogRecord;
+    JitterBuffer* jitter;
+};
+
+static BenchData d;
+static int16_t firCoeffs[FIR_MAX_TAPS];
+static volatile uint32_t sink = 0;
+
+// --- Workspace layout ---
+
+// Reserves 'bytes' at '*offset' (kept 16-byte aligned); returns the address if 'base' is set
+static void* carve(uint8_t* base, size_t* offset, size_t bytes) {
+    void* p = base != NULL ? base + *offset : NULL;
+    *offset += (bytes + DSP_ALIGN - 1) / DSP_ALIGN * DSP_ALIGN;
+    return p;
+}
+
+static size_t framedCapacity(size_t frames) {
+    const size_t audio = frames * sizeof(int16_t);
+    return audio + (audio / RESPONSE_CHUNK_BYTES + 1) * TRINITY_FRAME_HEADER_SIZE + RESPONSE_EXTRA_BYTES;
+}
+
+static size_t chunkedCapacity(size_t frames) {
+    const size_t body = framedCapacity(frames);
+    return body + (body / RESPONSE_CHUNK_BYTES + 1) * CHUNK_FRAMING_BYTES + RESPONSE_EXTRA_BYTES;
+}
+
+// Lays out the buffers for 'frames' and returns the bytes used. With a NULL base only sizes.
+static size_t layout(uint8_t* base, size_t frames, BenchData& data) {
+    const size_t packets = frames / BENCH_FRAME_MULTIPLE;
+    const size_t datagrams = 2 * packets; // FEC adds one per TRINITY_RTP_FEC_GROUP and one at the end
+    size_t offset = 0;
+    data.frames = frames;
+    data.packets = packets;
+    data.speech = (int16_t*)carve(base, &offset, 2 * frames * sizeof(int16_t));
+    data.work = (int16_t*)carve(base, &offset, 2 * frames * sizeof(int16_t));
+    data.slots = (int32_t*)carve(base, &offset, frames * sizeof(int32_t));
+    data.adpcm = (uint8_t*)carve(base, &offset, frames / 2);
+    data.framed = (uint8_t*)carve(base, &offset, framedCapacity(frames));
+    data.chunked = (uint8_t*)carve(base, &offset, chunkedCapacity(frames));
+    data.segment = (uint8_t*)carve(base, &offset, SEGMENT_BYTES);
+    data.bodyChunk = (uint8_t*)carve(base, &offset, BODY_CHUNK_BYTES);
+    data.staging = (int16_t*)carve(base, &offset, BODY_CHUNK_BYTES);
+    data.playbackRing = (uint8_t*)carve(base, &offset, PLAYBACK_RING_BYTES);
+    data.dma = (uint8_t*)carve(base, &offset, DMA_BYTES);
+    data.rtpPackets = (uint8_t*)carve(base, &offset, datagrams * RTP_MAX_PACKET);
+    data.rtpLengths = (size_t*)carve(base, &offset, datagrams * sizeof(size_t));
+    data.rtpArrivalMs = (uint32_t*)carve(base, &offset, datagrams * sizeof(uint32_t));
+    data.caps = (char*)carve(base, &offset, CAPS_BYTES);
+    data.firPhases = (int16_t*)carve(base, &offset, dspFirPhaseSamples(FIR_MAX_TAPS) * sizeof(int16_t));
+    data.firHistory = (int16_t*)carve(base, &offset, dspFirHistorySamples(FIR_MAX_TAPS) * sizeof(int16_t));
+    data.fftTwiddles = (int16_t*)carve(base, &offset, FFT_POINTS * sizeof(int16_t));
+    data.chirp = (int16_t*)carve(base, &offset, CHIRP_FRAMES * sizeof(int16_t));
+    data.chirpPhases = (int16_t*)carve(base, &offset, loopbackPhaseSamples(CHIRP_FRAMES) * sizeof(int16_t));
+    data.pcm = (int16_t*)carve(base, &offset, RTP_MAX_PAYLOAD);
+    data.binlogRing = (uint8_t*)carve(base, &offset, BINLOG_RING_BYTES);
+    data.binlogRecord = (uint8_t*)carve(base, &offset, BINLOG_MAX_RECORD);
+    data.jitter = (JitterBuffer*)carve(base, &offset, sizeof(JitterBuffer));
+    return offset;
+}
+
+size_t benchWorkspaceBytes(size_t frames) {
+    BenchData sizes;
+    return layout(NULL, frames, sizes);
+}
+
+// --- Workloads ---
+
+// Two tones and a little noise, peaking near -6 dBFS
+static void makeSpeech() {
+    uint32_t seed = 1;
+    for (size_t i = 0; i < 2 * d.frames; i++) {
+        const float t = (float)i / Pcm16k::RATE;
+        seed = seed * 1664525u + 1013904223u;
+        const int noise = (int)(seed >> 16) % 2001 - 1000;
+        d.speech[i] = (int16_t)(9000 * sinf(2 * (float)M_PI * 220 * t) + 6000 * sinf(2 * (float)M_PI * 1700 * t) + noise);
+    }
+    for (size_t i = 0; i < d.frames; i++) {
+        d.slots[i] = (int32_t)((uint32_t)(int32_t)d.speech[i] << 16);
+    }
+    AdpcmState state = {0, 0};
+    adpcmEncode(d.speech, d.frames, d.adpcm, state);
+}
+
+static uint8_t* putFrame(uint8_t* out, TrinityFrameType type, const void* payload, uint32_t length) {
+    *out++ = type;
+    memcpy(out, &length, 4);
+    if (length > 0) {
+        memcpy(out + 4, payload, length);
+    }
+    return out + 4 + length;
+}
+
+static void makeResponses() {
+    static const char transcript[] = "\x00what's the weather like tomorrow";
+    static const char reply[] = "\x01Tomorrow looks dry, with a high of eighteen degrees and a light breeze.";
+    const size_t audioBytes = d.frames * sizeof(int16_t);
+    const TrinityTimingFrame timing = {(uint32_t)audioBytes, Pcm16k::RATE, 180, 420, 95};
+    uint8_t* out = d.framed;
+    out = putFrame(out, TRINITY_FRAME_TEXT, transcript, sizeof(transcript) - 1);
+    out = putFrame(out, TRINITY_FRAME_TEXT, reply, sizeof(reply) - 1);
+    out = putFrame(out, TRINITY_FRAME_TIMING, &timing, sizeof(timing));
+    for (size_t done = 0; done < audioBytes; done += RESPONSE_CHUNK_BYTES) {
+        const size_t length = audioBytes - done < RESPONSE_CHUNK_BYTES ? audioBytes - done : RESPONSE_CHUNK_BYTES;
+        out = putFrame(out, TRINITY_FRAME_AUDIO, (const uint8_t*)d.speech + done, (uint32_t)length);
+    }
+    out = putFrame(out, TRINITY_FRAME_END, NULL, 0);
+    d.framedLength = (size_t)(out - d.framed);
+
+    char* text = (char*)d.chunked;
+    text += sprintf(text, "HTTP/1.1 200 OK\r\nContent-Type: " TRINITY_FRAMES_MIME "\r\nTransfer-Encoding: chunked\r\n"
+                          TRINITY_CONTROL_HEADER ": volume_up\r\n" TRINITY_TRACE_ID_HEADER ": 5f1c0a\r\n\r\n");
+    for (size_t done = 0; done < d.framedLength; done += RESPONSE_CHUNK_BYTES) {
+        const size_t length = d.framedLength - done < RESPONSE_CHUNK_BYTES ? d.framedLength - done : RESPONSE_CHUNK_BYTES;
+        text += sprintf(text, "%x\r\n", (unsigned)length);
+        memcpy(text, d.framed + done, length);
+        text += length;
+        text += sprintf(text, "\r\n");
+    }
+    text += sprintf(text, "0\r\n\r\n");
+    d.chunkedLength = (size_t)((uint8_t*)text - d.chunked);
+
+    d.capsLength = (size_t)snprintf(d.caps, CAPS_BYTES,
+        TRINITY_CAP_PROTOCOL "=2\n" TRINITY_CAP_CODECS "=pcm16,adpcm\n" TRINITY_CAP_RATES "=16000,8000\n"
+        TRINITY_CAP_UPLINK "=adpcm@16000\n" TRINITY_CAP_DOWNLINK "=pcm16@16000\n" TRINITY_CAP_MAX_UPLOAD "=192000\n"
+        TRINITY_CAP_RTP_PORT "=5005\n");
+}
+
+static uint8_t* rtpPacket(size_t index) {
+    return d.rtpPackets + index * RTP_MAX_PACKET;
+}
+
+static void makePackets() {
+    RtpPacketizer packetizer;
+    packetizer.begin(0x1234, false, Pcm16k::RATE, 100);
+    d.rtpCount = 0;
+    for (size_t i = 0; i < d.packets; i++) {
+        d.rtpLengths[d.rtpCount] = packetizer.packAudio(d.speech + i * BENCH_FRAME_MULTIPLE, BENCH_FRAME_MULTIPLE,
+                                                        i + 1 == d.packets, rtpPacket(d.rtpCount));
+        d.rtpArrivalMs[d.rtpCount++] = i * TRINITY_RTP_PACKET_MS;
+        const size_t fec = packetizer.packFec(rtpPacket(d.rtpCount));
+        if (fec > 0) {
+            d.rtpLengths[d.rtpCount] = fec;
+            d.rtpArrivalMs[d.rtpCount++] = i * TRINITY_RTP_PACKET_MS;
+        }
+    }
+}
+
+// --- Benchmarks: each run() processes 'items' of 'unit' ---
+
+static void captureDecimate() {
+    sink += convertAudio<Pcm16k, Pcm8k>(ConstFrameSpan<Pcm16k>(d.speech, d.frames), FrameSpan<Pcm8k>(d.work, d.frames)).frames();
+}
+static void capturePack32() {
+    dspPack32(d.slots, d.work, d.frames);
+}
+
+static void formatGain() {
+    applyGain(FrameSpan<Mono16>(d.work, d.frames), 179);
+}
+static void formatMix() {
+    mixInto<Mono16>(FrameSpan<Mono16>(d.work, d.frames), ConstFrameSpan<Mono16>(d.speech + 1, d.frames), 128);
+}
+static void format8kTo16k() {
+    convertAudio<Pcm8k, Pcm16k>(ConstFrameSpan<Pcm8k>(d.speech, d.frames / 2), FrameSpan<Pcm16k>(d.work, d.frames));
+}
+static void formatMonoToStereo() {
+    convertAudio<Pcm16k, Stereo16k>(ConstFrameSpan<Pcm16k>(d.speech, d.frames), FrameSpan<Stereo16k>(d.work, d.frames));
+}
+static void formatStereoToMono() {
+    convertAudio<Stereo16k, Pcm16k>(ConstFrameSpan<Stereo16k>(d.speech, d.frames), FrameSpan<Pcm16k>(d.work, d.frames));
+}
+static void format16To32() {
+    convertAudio<Pcm16k, Slots16k>(ConstFrameSpan<Pcm16k>(d.speech, d.frames), FrameSpan<Slots16k>(d.slots, d.frames));
+}
+static void format32To16() {
+    convertAudio<Slots16k, Pcm16k>(ConstFrameSpan<Slots16k>(d.slots, d.frames), FrameSpan<Pcm16k>(d.work, d.frames));
+}
+
+static void dspScaleRun() {
+    dspScale(d.work, d.frames, 23170);
+}
+static void dspRampRun() {
+    dspRamp(d.work, d.frames, 0, 10);
+}
+static void dspMixRun() {
+    dspMix(d.work, d.speech, d.frames);
+}
+static void dspPeakRun() {
+    sink += dspPeak(d.speech, d.frames);
+}
+static void dspRmsRun() {
+    sink += dspRms(d.speech, d.frames);
+}
+static void dspDotRun() {
+    for (size_t done = 0; done + DSP_DOT_MAX <= d.frames; done += DSP_DOT_MAX) {
+        sink += dspDot(d.speech + done, d.speech + d.frames + done, DSP_DOT_MAX, 15);
+    }
+}
+static void dspFirRun(size_t taps) {
+    DspFir fir;
+    dspFirInit(fir, firCoeffs, taps, d.firPhases, d.firHistory);
+    dspFir(fir, d.speech, d.work, d.frames);
+}
+static void dspFir15Run() {
+    dspFirRun(15);
+}
+static void dspFir63Run() {
+    dspFirRun(63);
+}
+static void dspBiquadRun() {
+    // Second-order low-pass near 3.4 kHz (Q14)
+    DspBiquad biquad;
+    dspBiquadInit(biquad, 2714, 5428, 2714, -9175, 3647);
+    memcpy(d.work, d.speech, d.frames * sizeof(int16_t));
+    dspBiquad(biquad, d.work, d.frames);
+}
+static void dspFftRun() {
+    memcpy(d.work, d.speech, 2 * FFT_POINTS * sizeof(int16_t));
+    dspFft(d.work, FFT_POINTS, d.fftTwiddles);
+}
+
+static void dspCorrelateRun() {
+    // Every lag of the chirp in the recording, as in the audio loopback self-test
+    LoopbackCorrelator correlator;
+    correlator.begin(d.chirp, CHIRP_FRAMES, d.chirpPhases);
+    sink += (uint32_t)correlator.match(d.speech, d.frames).lag;
+}
+
+static void outputChainRun() {
+    // The recording through volume (above unity, so the limiter has work), normalizer and
+    // limiter, a block at a time with the next one as the look-ahead
+    OutputChain chain;
+    chain.setVolume(OUTPUT_GAIN_UNITY * 5 / 4);
+    memcpy(d.work, d.speech, d.frames * sizeof(int16_t));
+    for (size_t done = 0; done < d.frames; done += OUTPUT_CHAIN_BLOCK) {
+        const bool last = done + OUTPUT_CHAIN_BLOCK == d.frames;
+        chain.process(d.work + done, OUTPUT_CHAIN_BLOCK, last ? NULL : d.work + done + OUTPUT_CHAIN_BLOCK,
+                      last ? 0 : OUTPUT_CHAIN_BLOCK);
+    }
+    sink += chain.deepestReduction();
+}
+
+static void codecAdpcmEncode() {
+    AdpcmState state = {0, 0};
+    sink += adpcmEncode(d.speech, d.frames, d.adpcm, state);
+}
+static void codecAdpcmDecode() {
+    AdpcmState state = {0, 0};
+    sink += adpcmDecode(d.adpcm, d.frames / 2, d.work, state);
+}
+
+class CountingSink : public FrameSink {
+public:
+    void onText(TrinityTextKind, const char*, size_t length) override { bytes += length; }
+    void onControl(const char*) override {}
+    void onTiming(const TrinityTimingFrame& timing) override { bytes += timing.audio_bytes; }
+    void onAudio(uint8_t*, size_t length) override { bytes += length; }
+    void onEnd() override {}
+    size_t bytes = 0;
+};
+
+static void httpChunked() {
+    static HttpResponse response;
+    response.reset();
+    size_t payload = 0;
+    bool head = true;
+    for (size_t offset = 0; offset < d.chunkedLength; offset += SEGMENT_BYTES) {
+        const size_t length = d.chunkedLength - offset < SEGMENT_BYTES ? d.chunkedLength - offset : SEGMENT_BYTES;
+        memcpy(d.segment, d.chunked + offset, length);
+        size_t used = 0;
+        if (head) {
+            head = response.feedHead(d.segment, length, &used) == HTTP_HEAD_PENDING;
+        }
+        payload += response.decodeBody(d.segment + used, length - used);
+    }
+    sink += (uint32_t)payload + response.bodyComplete();
+}
+
+static void framesParse() {
+    static FrameParser parser;
+    CountingSink counter;
+    parser.reset();
+    for (size_t offset = 0; offset < d.framedLength; offset += SEGMENT_BYTES) {
+        const size_t length = d.framedLength - offset < SEGMENT_BYTES ? d.framedLength - offset : SEGMENT_BYTES;
+        memcpy(d.segment, d.framed + offset, length);
+        parser.feed(d.segment, length, counter);
+    }
+    sink += (uint32_t)counter.bytes + parser.finished();
+}
+
+// --- Downlink playback: the chunked framed response from the socket to the DMA buffers, at the
+// default volume (unity: nothing is scaled) ---
+
+static size_t dmaOffset = 0;
+
+// i2s_write(): the DMA buffers take every sample, as if the speaker kept up
+static void dmaWrite(const uint8_t* data, size_t length) {
+    while (length > 0) {
+        const size_t take = length < DMA_BYTES - dmaOffset ? length : DMA_BYTES - dmaOffset;
+        memcpy(d.dma + dmaOffset, data, take);
+        dmaOffset = (dmaOffset + take) % DMA_BYTES;
+        data += take;
+        length -= take;
+    }
+}
+
+// The receive path before the playback ring: each segment copied into WiFiClient's receive
+// buffer, from there into voiceBodyChunk, the AUDIO payload staged through an aligned buffer
+// (samples can split across reads) and written to the DMA buffers
+class StagedSink : public CountingSink {
+public:
+    void onAudio(uint8_t* data, size_t length) override {
+        bytes += length;
+        while (length > 0) {
+            const size_t take = length < BODY_CHUNK_BYTES - fill ? length : BODY_CHUNK_BYTES - fill;
+            memcpy((uint8_t*)d.staging + fill, data, take);
+            fill += take;
+            data += take;
+            length -= take;
+            const size_t whole = fill & ~(size_t)1;
+            dmaWrite((const uint8_t*)d.staging, whole);
+            if (fill > whole) {
+                ((uint8_t*)d.staging)[0] = ((uint8_t*)d.staging)[whole];
+            }
+            fill -= whole;
+        }
+    }
+    size_t fill = 0;
+};
+
+static void playbackStaged() {
+    static HttpResponse response;
+    static FrameParser parser;
+    StagedSink staged;
+    response.reset();
+    parser.reset();
+    bool head = true;
+    for (size_t offset = 0; offset < d.chunkedLength; offset += RECEIVE_BUFFER_BYTES) {
+        const size_t length = d.chunkedLength - offset < RECEIVE_BUFFER_BYTES ? d.chunkedLength - offset : RECEIVE_BUFFER_BYTES;
+        memcpy(d.segment, d.chunked + offset, length);
+        size_t used = 0;
+        if (head) {
+            head = response.feedHead(d.segment, length, &used) == HTTP_HEAD_PENDING;
+        }
+        memcpy(d.bodyChunk, d.segment + used, length - used);
+        parser.feed(d.bodyChunk, response.decodeBody(d.bodyChunk, length - used), staged);
+    }
+    sink += (uint32_t)staged.bytes + parser.finished() + d.dma[0];
+}
+
+// The firmware's path: recv() straight into the playback ring for AUDIO payload, everything
+// else through voiceBodyChunk in pieces no longer than the current part; the feeder writes
+// from the ring to the DMA buffers
+class RingSink : public CountingSink {
+public:
+    explicit RingSink(PlaybackRing& target) : ring(target) {}
+    void onAudio(uint8_t* data, size_t length) override {
+        bytes += length;
+        if (ring.contains(data)) {
+            ring.commit(length);
+            return;
+        }
+        while (length > 0) {
+            const size_t written = ring.write(data, length);
+            if (written == 0) {
+                feed();
+            }
+            data += written;
+            length -= written;
+        }
+    }
+    void feed() {
+        RingSpan span;
+        while ((span = ring.readable()).length > 1) {
+            const size_t whole = span.length & ~(size_t)1;
+            dmaWrite(span.data, whole);
+            ring.consume(whole);
+        }
+    }
+    PlaybackRing& ring;
+};
+
+// recv() from a socket holding the whole response
+static size_t socketRecv(size_t& position, uint8_t* out, size_t capacity) {
+    const size_t length = d.chunkedLength - position < capacity ? d.chunkedLength - position : capacity;
+    memcpy(out, d.chunked + position, length);
+    position += length;
+    return length;
+}
+
+static void playbackRingRun() {
+    static HttpResponse response;
+    static FrameParser parser;
+    static PlaybackRing ring;
+    ring.begin(d.playbackRing, PLAYBACK_RING_BYTES);
+    RingSink ringSink(ring);
+    response.reset();
+    parser.reset();
+    size_t position = 0;
+    size_t used = 0;
+    size_t length;
+    do {
+        length = socketRecv(position, d.segment, HEAD_CHUNK_BYTES);
+    } while (response.feedHead(d.segment, length, &used) == HTTP_HEAD_PENDING);
+    parser.feed(d.segment + used, response.decodeBody(d.segment + used, length - used), ringSink);
+    while (!parser.finished() && position < d.chunkedLength) {
+        const size_t payload = response.payloadRemaining();
+        if (parser.audioPart() && payload > 0) {
+            RingSpan spans[2];
+            const size_t count = ring.writable(spans, parser.partRemaining() < payload ? parser.partRemaining() : payload);
+            for (size_t i = 0; i < count; i++) {
+                length = socketRecv(position, spans[i].data, spans[i].length);
+                parser.feed(spans[i].data, response.decodeBody(spans[i].data, length), ringSink);
+            }
+        } else {
+            const size_t part = parser.partRemaining() < BODY_CHUNK_BYTES ? parser.partRemaining() : BODY_CHUNK_BYTES;
+            length = socketRecv(position, d.bodyChunk, payload == 0 ? CHUNK_FRAMING_READ_BYTES : part);
+            parser.feed(d.bodyChunk, response.decodeBody(d.bodyChunk, length), ringSink);
+        }
+        ringSink.feed();
+    }
+    sink += (uint32_t)ringSink.bytes + parser.finished() + d.dma[0];
+}
+
+static void framesCaps() {
+    char copy[CAPS_BYTES];
+    memcpy(copy, d.caps, d.capsLength + 1);
+    char* cursor = copy;
+    char* key;
+    char* value;
+    char codec[16];
+    uint32_t rate = 0;
+    while (trinityNextCap(&cursor, &key, &value)) {
+        if (strcmp(key, TRINITY_CAP_UPLINK) == 0 || strcmp(key, TRINITY_CAP_DOWNLINK) == 0) {
+            trinityParseFormat(value, codec, sizeof(codec), &rate);
+        }
+    }
+    sink += rate;
+}
+
+static void rtpPacketize(bool adpcmPayload) {
+    RtpPacketizer packetizer;
+    packetizer.begin(0x1234, adpcmPayload, Pcm16k::RATE, 100);
+    for (size_t i = 0; i < d.packets; i++) {
+        sink += packetizer.packAudio(d.speech + i * BENCH_FRAME_MULTIPLE, BENCH_FRAME_MULTIPLE, i + 1 == d.packets, d.segment);
+        sink += packetizer.packFec(d.segment);
+    }
+}
+static void rtpPacketizePcm() {
+    rtpPacketize(false);
+}
+static void rtpPacketizeAdpcm() {
+    rtpPacketize(true);
+}
+
+// Packets arrive in real time with no loss or jitter; the speaker takes one every 20 ms
+static void rtpJitter() {
+    JitterBuffer& jitter = *d.jitter;
+    jitter.start(0x1234, false, Pcm16k::RATE, 100, d.packets, 0);
+    size_t next = 0;
+    uint32_t now = 0;
+    size_t samples;
+    while (!jitter.finished() && now < JITTER_STREAM_TIMEOUT_MS + d.packets * 2 * TRINITY_RTP_PACKET_MS) {
+        while (next < d.rtpCount && now >= d.rtpArrivalMs[next]) {
+            jitter.push(rtpPacket(next), d.rtpLengths[next], now);
+            next++;
+        }
+        if (jitter.pop(now, d.pcm, &samples) != JITTER_WAITING) {
+            sink += (uint32_t)samples;
+        }
+        now += TRINITY_RTP_PACKET_MS;
+    }
+}
+
+// Records of the size voice-turn log lines have, each written then drained
+static void ringBinlog() {
+    static BinLogRing ring;
+    ring.begin(d.binlogRing, BINLOG_RING_BYTES);
+    for (size_t i = 0; i < BINLOG_RECORDS; i++) {
+        ring.log("[RTP] %u/%u packets played, jitter %.1f ms, %s\n", (unsigned)i, 50u, 3.5f, "ok");
+        sink += (uint32_t)ring.read(d.binlogRecord);
+    }
+}
+
+static void linkUpdate() {
+    static LinkAdapter adapter;
+    adapter.allow("pcm16,adpcm", "16000,8000");
+    adapter.start(TRINITY_CODEC_PCM16, 16000, TRINITY_CODEC_PCM16, 16000);
+    for (size_t i = 0; i < LINK_UPDATES; i++) {
+        // A link that sags and recovers
+        const float goodput = 20000.0f + 18000.0f * (float)((i / 10) % 5) / 4.0f;
+        const LinkSample sample = {goodput, goodput * 1.5f, 40.0f + (float)(i % 7), -60};
+        sink += adapter.update(sample);
+    }
+}
+
+static Benchmark benchmarks[] = {
+    {"capture/pack32", "sample", 0, capturePack32},
+    {"capture/decimate_8k", "sample", 0, captureDecimate},
+    {"format/gain_mono16", "sample", 0, formatGain},
+    {"format/mix_mono16", "sample", 0, formatMix},
+    {"format/convert_8k_16k", "sample", 0, format8kTo16k},
+    {"format/convert_mono_stereo", "sample", 0, formatMonoToStereo},
+    {"format/convert_stereo_mono", "sample", 0, formatStereoToMono},
+    {"format/convert_16_32", "sample", 0, format16To32},
+    {"format/convert_32_16", "sample", 0, format32To16},
+    {"dsp/scale", "sample", 0, dspScaleRun},
+    {"dsp/ramp", "sample", 0, dspRampRun},
+    {"dsp/mix", "sample", 0, dspMixRun},
+    {"dsp/peak", "sample", 0, dspPeakRun},
+    {"dsp/rms", "sample", 0, dspRmsRun},
+    {"dsp/dot", "sample", 0, dspDotRun},
+    {"dsp/fir15", "sample", 0, dspFir15Run},
+    {"dsp/fir63", "sample", 0, dspFir63Run},
+    {"dsp/biquad", "sample", 0, dspBiquadRun},
+    {"dsp/fft256", "point", 0, dspFftRun},
+    {"dsp/correlate512", "lag", 0, dspCorrelateRun},
+    {"output/chain", "block", 0, outputChainRun},
+    {"codec/adpcm_encode", "sample", 0, codecAdpcmEncode},
+    {"codec/adpcm_decode", "sample", 0, codecAdpcmDecode},
+    {"http/chunked_response", "byte", 0, httpChunked},
+    {"frames/parse", "byte", 0, framesParse},
+    {"frames/caps", "byte", 0, framesCaps},
+    {"playback/staged", "byte", 0, playbackStaged},
+    {"playback/ring", "byte", 0, playbackRingRun},
+    {"rtp/packetize_pcm16", "packet", 0, rtpPacketizePcm},
+    {"rtp/packetize_adpcm", "packet", 0, rtpPacketizeAdpcm},
+    {"rtp/jitter_buffer", "packet", 0, rtpJitter},
+    {"ring/binlog", "record", 0, ringBinlog},
+    {"link/update", "update", 0, linkUpdate},
+};
+
+static const size_t BENCHMARK_COUNT = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+// Items per run(), most of which depend on the workload size
+static size_t itemsFor(void (*run)()) {
+    if (run == format8kTo16k) return d.frames / 2;
+    if (run == dspFftRun) return FFT_POINTS;
+    if (run == outputChainRun) return d.frames / OUTPUT_CHAIN_BLOCK;
+    if (run == dspDotRun) return d.frames / DSP_DOT_MAX * DSP_DOT_MAX;
+    if (run == dspCorrelateRun) return d.frames - loopbackPadded(CHIRP_FRAMES) + 1;
+    if (run == httpChunked || run == playbackStaged || run == playbackRingRun) return d.chunkedLength;
+    if (run == framesParse) return d.framedLength;
+    if (run == framesCaps) return d.capsLength;
+    if (run == rtpPacketizePcm || run == rtpPacketizeAdpcm || run == rtpJitter) return d.packets;
+    if (run == ringBinlog) return BINLOG_RECORDS;
+    if (run == linkUpdate) return LINK_UPDATES;
+    return d.frames;
+}
+
+bool benchPrepare(void* workspace, size_t bytes, size_t frames) {
+    if (frames < BENCH_MIN_FRAMES || frames % BENCH_FRAME_MULTIPLE != 0 || !dspAligned(workspace) ||
+        bytes < benchWorkspaceBytes(frames)) {
+        return false;
+    }
+    layout((uint8_t*)workspace, frames, d);
+    new (d.jitter) JitterBuffer();
+    makeSpeech();
+    makeResponses();
+    makePackets();
+    for (size_t i = 0; i < FIR_MAX_TAPS; i++) {
+        firCoeffs[i] = (int16_t)(i % 7 * 900 - 2700);
+    }
+    dspFftTwiddles(d.fftTwiddles, FFT_POINTS);
+    loopbackChirp(d.chirp, CHIRP_FRAMES, Pcm16k::RATE, 300, 6000, 8192);
+    for (size_t i = 0; i < BENCHMARK_COUNT; i++) {
+        benchmarks[i].items = itemsFor(benchmarks[i].run);
+    }
+    return true;
+}
+
+size_t benchCount() {
+    return BENCHMARK_COUNT;
+}
+
+const Benchmark& benchAt(size_t index) {
+    return benchmarks[index];
+}
+
+BenchResult benchMeasure(const Benchmark& benchmark, BenchClock clock, uint32_t minTicks, int repetitions) {
+    if (repetitions < 1) {
+        repetitions = 1;
+    } else if (repetitions > BENCH_MAX_REPETITIONS) {
+        repetitions = BENCH_MAX_REPETITIONS;
+    }
+    // Enough runs per repetition to last minTicks
+    uint32_t runs = 1;
+    for (;;) {
+        const uint32_t start = clock();
+        for (uint32_t i = 0; i < runs; i++) {
+            benchmark.run();
+        }
+        if (clock() - start >= minTicks) {
+            break;
+        }
+        runs *= 2;
+    }
+    float perItem[BENCH_MAX_REPETITIONS];
+    for (int r = 0; r < repetitions; r++) {
+        const uint32_t start = clock();
+        for (uint32_t i = 0; i < runs; i++) {
+            benchmark.run();
+        }
+        const float value = (float)(uint32_t)(clock() - start) / runs / benchmark.items;
+        // Kept sorted as the repetitions come in
+        int j = r;
+        while (j > 0 && perItem[j - 1] > value) {
+            perItem[j] = perItem[j - 1];
+            j--;
+        }
+        perItem[j] = value;
+    }
+    const BenchResult result = {benchmark.name, benchmark.unit, benchmark.items, perItem[0], perItem[repetitions / 2]};
+    return result;
+}
+
+uint32_t benchChecksum() {
+    return sink;
+}
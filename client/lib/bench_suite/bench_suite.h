@@ -0,0 +1,75 @@
+#pragma once
+
+// =================================================================================================
+// BENCHMARK SUITE
+// The client's compute-heavy code on fixed workloads, shared by the host benchmark
+// (native/bench.cpp) and the on-target benchmark firmware (bench/bench_firmware.cpp) so both
+// time exactly the same work:
+//  - capture/   conversion of microphone data (I2S slot packing, decimation to 8 kHz)
+//  - format/    the per-format gain, mix and conversion kernels (lib/audio_format)
+//  - dsp/       the DSP kernels (lib/dsp_kernels), including the peak and RMS level measurements
+//              and the audio loopback test's correlation (lib/audio_loopback)
+//  - output/   the reply's output chain, volume, normalizer and limiter (lib/output_chain), per
+//              block
+//  - codec/     IMA ADPCM (lib/audio_codec)
+//  - http/      response head and chunked body parsing (lib/http_lite)
+//  - frames/    the framed response parser (lib/trinity_protocol), capability lines
+//  - playback/  a framed response from the socket to the DMA buffers: the old staged copies and
+//              the playback ring's receive path (lib/playback_ring)
+//  - rtp/       packetization with FEC and the jitter buffer (lib/rtp_audio)
+//  - ring/      the binary log ring (lib/binlog)
+//  - link/      link adaptation updates (lib/link_adapt)
+// Network input is fed in 1460-byte segments, as it arrives from lwIP, and copied into the read
+// buffer the way the firmware reads it.
+//
+// Every buffer the benchmarks touch, the jitter buffer's slots included, is carved out of one
+// caller-provided workspace, so the caller decides where the data lives (internal RAM or PSRAM
+// on the device). Workloads scale with 'frames', the length of the test recording.
+// Portable (no Arduino dependencies) for the native build. No heap allocation.
+// =================================================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <trinity_protocol.h>
+
+// Test recording length: a whole number of RTP packets at 16 kHz (and so of output chain blocks)
+// and at least one FFT
+const size_t BENCH_FRAME_MULTIPLE = 16000 * TRINITY_RTP_PACKET_MS / 1000;
+const size_t BENCH_MIN_FRAMES = 1600;
+
+struct Benchmark {
+    const char* name;
+    const char* unit;       // What 'items' counts
+    size_t items;           // Processed by one run() (set by benchPrepare())
+    void (*run)();
+};
+
+struct BenchResult {
+    const char* name;
+    const char* unit;
+    size_t items;
+    float best;             // Clock ticks per item, fastest repetition
+    float median;
+};
+
+// Clock for the timings: CPU cycles on the device, nanoseconds on the host
+typedef uint32_t (*BenchClock)();
+
+// Workspace benchPrepare() needs for 'frames' (16-byte aligned)
+size_t benchWorkspaceBytes(size_t frames);
+
+// Builds the workloads in 'workspace'. False if 'frames' is not a multiple of
+// BENCH_FRAME_MULTIPLE of at least BENCH_MIN_FRAMES, or the workspace is too small or misaligned.
+// The workspace stays in use until the next benchPrepare().
+bool benchPrepare(void* workspace, size_t bytes, size_t frames);
+
+size_t benchCount();
+const Benchmark& benchAt(size_t index);
+
+// Runs the benchmark in 'repetitions' (at most BENCH_MAX_REPETITIONS) of at least 'minTicks'
+const int BENCH_MAX_REPETITIONS = 64;
+BenchResult benchMeasure(const Benchmark& benchmark, BenchClock clock, uint32_t minTicks, int repetitions);
+
+// Folds in every result the benchmarks compute, so none of the work can be optimized away
+uint32_t benchChecksum();
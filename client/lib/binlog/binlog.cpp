@@ -0,0 +1,110 @@
+#include "binlog.h"
+
+#ifdef ESP_PLATFORM
+#include <esp_timer.h>
+#else
+#include <time.h>
+#endif
+
+// Format word of a record that fills the rest of the buffer, so no record wraps around
+static const uint32_t PAD_MARKER = 1;
+
+BinLogRing binlog;
+
+uint32_t binlogMicros() {
+#ifdef ESP_PLATFORM
+    return (uint32_t)esp_timer_get_time();
+#else
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)((uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000);
+#endif
+}
+
+static void writeWord(uint8_t* p, uint32_t value) {
+    memcpy(p, &value, 4);
+}
+
+// The format word doubles as the record's commit flag: 0 until the record is complete
+static uint32_t* formatWord(uint8_t* record) {
+    return (uint32_t*)record;
+}
+
+BinLogRing::BinLogRing() : _buffer(NULL), _mask(0), _head(0), _tail(0), _dropped(0), _droppedTotal(0) {}
+
+void BinLogRing::begin(uint8_t* buffer, size_t capacity) {
+    memset(buffer, 0, capacity);
+    _head = 0;
+    _tail = 0;
+    _mask = (uint32_t)capacity - 1;
+    __atomic_store_n(&_buffer, buffer, __ATOMIC_RELEASE);
+}
+
+uint8_t* BinLogRing::reserve(size_t payload) {
+    uint8_t* buffer = __atomic_load_n(&_buffer, __ATOMIC_ACQUIRE);
+    if (buffer == NULL) {
+        return NULL;
+    }
+    const uint32_t capacity = _mask + 1;
+    const uint32_t need = (uint32_t)pad(BINLOG_HEADER_SIZE + payload);
+    uint32_t head = __atomic_load_n(&_head, __ATOMIC_RELAXED);
+    uint32_t offset, skip;
+    do {
+        offset = head & _mask;
+        // A record that would run past the end starts at the beginning instead; the pad marker
+        // tells the reader to skip the rest of the buffer
+        skip = offset + need > capacity ? capacity - offset : 0;
+        const uint32_t tail = __atomic_load_n(&_tail, __ATOMIC_ACQUIRE);
+        if (head + skip + need - tail > capacity) {
+            return NULL;
+        }
+    } while (!__atomic_compare_exchange_n(&_head, &head, head + skip + need, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    if (skip) {
+        __atomic_store_n(formatWord(buffer + offset), PAD_MARKER, __ATOMIC_RELEASE);
+        return buffer;
+    }
+    return buffer + offset;
+}
+
+void BinLogRing::commit(uint8_t* record, const char* format, size_t payload) {
+    const uint32_t dropped = __atomic_exchange_n(&_dropped, 0, __ATOMIC_RELAXED);
+    writeWord(record + 4, binlogMicros());
+    const uint32_t lengths = (uint32_t)payload | (dropped > 0xFFFF ? 0xFFFF : dropped) << 16;
+    writeWord(record + 8, lengths);
+    __atomic_store_n(formatWord(record), (uint32_t)(uintptr_t)format, __ATOMIC_RELEASE);
+}
+
+void BinLogRing::countDrop() {
+    __atomic_fetch_add(&_dropped, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&_droppedTotal, 1, __ATOMIC_RELAXED);
+}
+
+size_t BinLogRing::read(uint8_t* out) {
+    uint8_t* buffer = __atomic_load_n(&_buffer, __ATOMIC_ACQUIRE);
+    if (buffer == NULL) {
+        return 0;
+    }
+    const uint32_t capacity = _mask + 1;
+    uint32_t tail = _tail;
+    uint32_t offset = tail & _mask;
+    uint32_t format = __atomic_load_n(formatWord(buffer + offset), __ATOMIC_ACQUIRE);
+    if (format == PAD_MARKER) {
+        memset(buffer + offset, 0, capacity - offset);
+        tail += capacity - offset;
+        __atomic_store_n(&_tail, tail, __ATOMIC_RELEASE);
+        offset = 0;
+        format = __atomic_load_n(formatWord(buffer), __ATOMIC_ACQUIRE);
+    }
+    if (format == 0) {
+        return 0; // Empty, or the oldest record is still being written
+    }
+
+    uint8_t* record = buffer + offset;
+    const size_t length = BINLOG_HEADER_SIZE + (record[8] | record[9] << 8);
+    memcpy(out, record, length);
+    // Zeroed so a later record reserved over this space reads as uncommitted until it is
+    memset(record, 0, pad(length));
+    __atomic_store_n(&_tail, tail + (uint32_t)pad(length), __ATOMIC_RELEASE);
+    return length;
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+// =================================================================================================
+// BINARY LOG RING
+// Deferred-formatting logger for timing-sensitive code. A BINLOG() call stores only the address
+// of its format string, a microsecond timestamp and the raw argument values in a lock-free ring;
+// nothing is formatted on the device. A low-priority task drains the ring with read() and
+// tools/binlog_decode.py rebuilds the text, reading the format strings back out of the ELF.
+//
+// Record layout (little-endian, 4-byte aligned in the ring):
+//     u32:format address  u32:timestamp us  u16:payload length  u16:records dropped before this one
+//     payload: the arguments in order; integers up to 32 bits and pointers as u32, 64-bit
+//              integers as u64, float/double as f32, strings as u8:length + bytes (no NUL)
+// The decoder walks the format's conversions to split the payload, so each argument must match
+// its conversion's width: %f for floating point, %ll for 64-bit integers, %s for C strings.
+//
+// Any number of tasks may log concurrently; one task drains. A full ring drops new records and
+// counts them rather than blocking. Portable (no Arduino dependencies) for the native build.
+// =================================================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+const size_t BINLOG_HEADER_SIZE = 12;
+const size_t BINLOG_MAX_STRING = 255;     // Longer %s arguments are truncated
+const size_t BINLOG_MAX_PAYLOAD = 512;    // Records with more argument bytes are dropped
+const size_t BINLOG_MAX_RECORD = BINLOG_HEADER_SIZE + BINLOG_MAX_PAYLOAD;
+// Precedes every drained record on the serial stream, so the decoder can pick records out of
+// ordinary text output
+const uint8_t BINLOG_SYNC[2] = {0xB1, 0x06};
+
+// Microseconds since boot (esp_timer on the device, the monotonic clock on the host)
+uint32_t binlogMicros();
+
+class BinLogRing {
+public:
+    BinLogRing();
+
+    // Uses 'buffer' ('capacity' bytes, a power of two) for the ring. Records logged before this
+    // are dropped.
+    void begin(uint8_t* buffer, size_t capacity);
+
+    template <typename... Args>
+    void log(const char* format, const Args&... args) {
+        const size_t payload = encodedSize(args...);
+        uint8_t* record = payload <= BINLOG_MAX_PAYLOAD ? reserve(payload) : NULL;
+        if (record == NULL) {
+            countDrop();
+            return;
+        }
+        encode(record + BINLOG_HEADER_SIZE, args...);
+        commit(record, format, payload);
+    }
+
+    // Consumer side: copies the oldest complete record (header and payload) into 'out', which
+    // needs BINLOG_MAX_RECORD bytes. Returns its length, or 0 if there is none yet.
+    size_t read(uint8_t* out);
+
+    uint32_t dropped() const { return _droppedTotal; }
+
+private:
+    uint8_t* reserve(size_t payload);
+    void commit(uint8_t* record, const char* format, size_t payload);
+    void countDrop();
+
+    static size_t pad(size_t length) { return (length + 3) & ~(size_t)3; }
+
+    // Argument encoding; see the record layout above. Plain overloads rather than C++17 folds,
+    // so it builds with the Arduino core's C++ dialect.
+    static size_t encodedSize() { return 0; }
+    template <typename T, typename... Rest>
+    static size_t encodedSize(const T& first, const Rest&... rest) {
+        return argSize(first) + encodedSize(rest...);
+    }
+    static void encode(uint8_t*) {}
+    template <typename T, typename... Rest>
+    static void encode(uint8_t* out, const T& first, const Rest&... rest) {
+        encode(encodeArg(out, first), rest...);
+    }
+
+    template <typename T>
+    static size_t argSize(const T&) {
+        static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value,
+                      "BINLOG arguments must be numbers, pointers or C strings");
+        return std::is_integral<T>::value && sizeof(T) == 8 ? 8 : 4;
+    }
+    template <typename T>
+    static size_t argSize(T*) { return 4; }
+    static size_t argSize(const char* text) { return 1 + stringLength(text); }
+    static size_t argSize(char* text) { return 1 + stringLength(text); }
+
+    template <typename T>
+    static uint8_t* encodeArg(uint8_t* out, const T& value) {
+        return putInteger(out, value, std::integral_constant<bool, sizeof(T) == 8>());
+    }
+    template <typename T>
+    static uint8_t* encodeArg(uint8_t* out, T* pointer) {
+        return putWord(out, (uint32_t)(uintptr_t)pointer);
+    }
+    static uint8_t* encodeArg(uint8_t* out, float value) {
+        memcpy(out, &value, 4);
+        return out + 4;
+    }
+    static uint8_t* encodeArg(uint8_t* out, double value) { return encodeArg(out, (float)value); }
+    static uint8_t* encodeArg(uint8_t* out, const char* text) {
+        const size_t length = stringLength(text);
+        *out++ = (uint8_t)length;
+        memcpy(out, text, length);
+        return out + length;
+    }
+    static uint8_t* encodeArg(uint8_t* out, char* text) { return encodeArg(out, (const char*)text); }
+
+    template <typename T>
+    static uint8_t* putInteger(uint8_t* out, const T& value, std::true_type) {
+        memcpy(out, &value, 8);
+        return out + 8;
+    }
+    // Sign-extends signed types, so %d of an int8_t still reads back negative
+    template <typename T>
+    static uint8_t* putInteger(uint8_t* out, const T& value, std::false_type) {
+        return putWord(out, (uint32_t)(int64_t)value);
+    }
+    static uint8_t* putWord(uint8_t* out, uint32_t word) {
+        memcpy(out, &word, 4);
+        return out + 4;
+    }
+
+    static size_t stringLength(const char* text) {
+        size_t length = 0;
+        while (text && length < BINLOG_MAX_STRING && text[length]) {
+            length++;
+        }
+        return length;
+    }
+
+    uint8_t* _buffer;
+    uint32_t _mask;         // capacity - 1
+    uint32_t _head;         // Bytes reserved so far (producers, atomic)
+    uint32_t _tail;         // Bytes consumed so far (consumer)
+    uint32_t _dropped;      // Since the last committed record (atomic)
+    uint32_t _droppedTotal;
+};
+
+extern BinLogRing binlog;
+
+#define BINLOG(format, ...) binlog.log(format, ##__VA_ARGS__)
@@ -0,0 +1,121 @@
+#include "config_store.h"
+
+#include <string.h>
+
+// Terminates every string field, whatever the blob held
+static void terminateStrings(DeviceConfig& config) {
+    config.ssid[sizeof(config.ssid) - 1] = '\0';
+    config.pass[sizeof(config.pass) - 1] = '\0';
+    config.serverHost[sizeof(config.serverHost) - 1] = '\0';
+    config.audioProfile[sizeof(config.audioProfile) - 1] = '\0';
+}
+
+// Reflected CRC-32 (IEEE 802.3), a bit at a time: the blob is checked once per boot and write
+uint32_t configCrc32(const uint8_t* data, size_t length) {
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+ConfigStore::ConfigStore()
+    : _generation(0), _dirty(false), _firstChangeMs(0), _lastChangeMs(0), _storedCrc(0), _flushCrc(0), _writes(0) {
+    memset(_slots, 0, sizeof(_slots));
+}
+
+ConfigLoadResult ConfigStore::begin(const DeviceConfig& defaults, const uint8_t* blob, size_t length) {
+    // Copied as bytes, like everything else here: the CRC covers the padding too
+    DeviceConfig& config = _slots[_generation & 1];
+    memcpy(&config, &defaults, sizeof(config));
+    _dirty = false;
+    _storedCrc = 0;
+
+    ConfigBlobHeader header;
+    if (blob == NULL || length < sizeof(header)) {
+        return CONFIG_DEFAULTS;
+    }
+    memcpy(&header, blob, sizeof(header));
+    const uint8_t* payload = blob + sizeof(header);
+    if (header.magic != CONFIG_MAGIC || header.length != length - sizeof(header) ||
+        configCrc32(payload, header.length) != header.crc) {
+        return CONFIG_DEFAULTS;
+    }
+
+    // Fields are only appended, so whatever the version, the prefix both schemas have matches
+    memcpy(&config, payload, header.length < sizeof(config) ? header.length : sizeof(config));
+    terminateStrings(config);
+    _storedCrc = header.crc;
+    if (header.version == CONFIG_VERSION && header.length == sizeof(config)) {
+        return CONFIG_LOADED;
+    }
+    _storedCrc = 0;     // Rewrite in this schema
+    _dirty = true;
+    return CONFIG_MIGRATED;
+}
+
+void ConfigStore::read(DeviceConfig& out) const {
+    uint32_t generation = __atomic_load_n(&_generation, __ATOMIC_ACQUIRE);
+    for (;;) {
+        memcpy(&out, &_slots[generation & 1], sizeof(out));
+        // The owner only fills this slot again after publishing the next generation
+        const uint32_t after = __atomic_load_n(&_generation, __ATOMIC_ACQUIRE);
+        if (after == generation) {
+            return;
+        }
+        generation = after;
+    }
+}
+
+DeviceConfig& ConfigStore::edit() {
+    DeviceConfig& next = _slots[(_generation + 1) & 1];
+    memcpy(&next, &_slots[_generation & 1], sizeof(next));
+    return next;
+}
+
+void ConfigStore::publish(uint32_t nowMs) {
+    terminateStrings(_slots[(_generation + 1) & 1]);
+    __atomic_store_n(&_generation, _generation + 1, __ATOMIC_RELEASE);
+    if (!_dirty) {
+        _firstChangeMs = nowMs;
+    }
+    _lastChangeMs = nowMs;
+    _dirty = true;
+}
+
+size_t ConfigStore::flushDue(uint32_t nowMs, bool force, uint8_t* blob) {
+    if (!_dirty || (!force && nowMs - _lastChangeMs < CONFIG_WRITE_DEBOUNCE_MS &&
+                    nowMs - _firstChangeMs < CONFIG_WRITE_MAX_DELAY_MS)) {
+        return 0;
+    }
+    const DeviceConfig& config = current();
+    ConfigBlobHeader header;
+    header.magic = CONFIG_MAGIC;
+    header.version = CONFIG_VERSION;
+    header.length = sizeof(config);
+    header.crc = configCrc32((const uint8_t*)&config, sizeof(config));
+    if (header.crc == _storedCrc) {
+        _dirty = false;     // Changed back to what flash holds
+        return 0;
+    }
+    memcpy(blob, &header, sizeof(header));
+    memcpy(blob + sizeof(header), &config, sizeof(config));
+    _flushCrc = header.crc;
+    return CONFIG_BLOB_BYTES;
+}
+
+void ConfigStore::flushed(bool ok, uint32_t nowMs) {
+    if (!ok) {
+        // Try again after another debounce period
+        _firstChangeMs = nowMs;
+        _lastChangeMs = nowMs;
+        return;
+    }
+    _storedCrc = _flushCrc;
+    _writes++;
+    // A change published between flushDue() and now stays pending
+    _dirty = configCrc32((const uint8_t*)&current(), sizeof(DeviceConfig)) != _storedCrc;
+}
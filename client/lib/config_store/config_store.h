@@ -0,0 +1,97 @@
+#pragma once
+
+// =================================================================================================
+// CONFIG STORE
+// The device's settings as one versioned blob: read from flash once at boot into RAM, read from
+// there by any task without a lock, and written back as a whole, a while after the last change.
+//
+// Blob: a header (magic, schema version, payload length, CRC-32 of the payload) and DeviceConfig
+// as it is laid out in memory. Fields are only ever appended, which is the migration: a blob from
+// an older schema fills the fields it has and the rest keep their defaults, one from a newer
+// schema (after a downgrade) loses the fields this firmware doesn't know. Either way the blob is
+// rewritten in the current schema.
+//
+// Reads: there are two copies and a generation counter whose low bit picks the current one. The
+// task that owns the store (the only one that edits it) fills the other copy and then bumps the
+// generation, so read() copies the current one and only retries if a new generation was
+// published meanwhile; it never waits for the owner. Writes to flash are debounced: a change is
+// written CONFIG_WRITE_DEBOUNCE_MS after the last one in a row (the volume buttons make several),
+// CONFIG_WRITE_MAX_DELAY_MS after the first at the latest, and not at all if the settings ended up
+// as they are in flash. Portable (no Arduino dependencies) for the native build. No heap allocation.
+// =================================================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+
+const uint32_t CONFIG_MAGIC = 0x47464354;           // "TCFG"
+const uint16_t CONFIG_VERSION = 1;
+const uint32_t CONFIG_WRITE_DEBOUNCE_MS = 5000;
+const uint32_t CONFIG_WRITE_MAX_DELAY_MS = 60000;
+
+// Append new fields at the end and bump CONFIG_VERSION
+struct DeviceConfig {
+    char ssid[33];
+    char pass[65];
+    char serverHost[40];        // Voice server; an IPv4 address for RTP
+    uint16_t serverPort;
+    char audioProfile[16];      // A profile name or "auto" (audio_profile.h)
+    uint8_t volume;             // Playback volume step
+    uint8_t maxRecordSeconds;
+    uint32_t apTimeoutMs;       // Setup portal, since its last request
+};
+
+struct ConfigBlobHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t length;            // Payload bytes
+    uint32_t crc;               // CRC-32 of the payload
+};
+
+const size_t CONFIG_BLOB_BYTES = sizeof(ConfigBlobHeader) + sizeof(DeviceConfig);
+const size_t CONFIG_BLOB_MAX_BYTES = 512;          // Read buffer: room for blobs of later schemas
+static_assert(CONFIG_BLOB_BYTES <= CONFIG_BLOB_MAX_BYTES, "DeviceConfig outgrew CONFIG_BLOB_MAX_BYTES");
+
+enum ConfigLoadResult {
+    CONFIG_LOADED,              // The blob is in the current schema
+    CONFIG_MIGRATED,            // From another schema version; write it back
+    CONFIG_DEFAULTS             // No blob, or an invalid one
+};
+
+uint32_t configCrc32(const uint8_t* data, size_t length);
+
+class ConfigStore {
+public:
+    ConfigStore();
+
+    // Starts from 'defaults' overlaid with 'blob' as read from flash (NULL if there is none)
+    ConfigLoadResult begin(const DeviceConfig& defaults, const uint8_t* blob, size_t length);
+
+    // Any task: a consistent copy of the current settings
+    void read(DeviceConfig& out) const;
+
+    // Owner task only: the current settings, without copying them
+    const DeviceConfig& current() const { return _slots[_generation & 1]; }
+
+    // Owner task only: edit() returns a copy of the current settings to change, and publish()
+    // makes it current and schedules the flash write
+    DeviceConfig& edit();
+    void publish(uint32_t nowMs);
+
+    // Owner task only: if a write is due at 'nowMs' (any pending one if 'force'), fills 'blob'
+    // (CONFIG_BLOB_BYTES) and returns its length, 0 otherwise. Call flushed() once it is written.
+    size_t flushDue(uint32_t nowMs, bool force, uint8_t* blob);
+    void flushed(bool ok, uint32_t nowMs);
+
+    bool pending() const { return _dirty; }
+    uint32_t writes() const { return _writes; }
+
+private:
+    DeviceConfig _slots[2];
+    uint32_t _generation;       // Published with release; its low bit picks the current slot
+    bool _dirty;
+    uint32_t _firstChangeMs;    // Of the changes not written yet
+    uint32_t _lastChangeMs;
+    uint32_t _storedCrc;        // Of the payload in flash (0 if none)
+    uint32_t _flushCrc;         // Of the blob handed out by flushDue()
+    uint32_t _writes;
+};
@@ -0,0 +1,211 @@
+#include "cpu_profile.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const size_t SUMMARY_TASKS = 4;
+static const size_t SHORT_WINDOWS = 10;
+
+void cpuWaitRecord(CpuWaitSite& site, uint32_t us) {
+    __atomic_fetch_add(&site.waits, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&site.totalUs, us, __ATOMIC_RELAXED);
+    uint32_t max = __atomic_load_n(&site.maxUs, __ATOMIC_RELAXED);
+    while (us > max && !__atomic_compare_exchange_n(&site.maxUs, &max, us, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+CpuProfiler::CpuProfiler() {
+    begin(1, 1000, NULL, 0);
+}
+
+void CpuProfiler::begin(uint8_t cores, uint32_t windowMs, CpuWaitSite* sites, size_t siteCount) {
+    _cores = cores < CPU_PROFILE_MAX_CORES ? cores : CPU_PROFILE_MAX_CORES;
+    _windowMs = windowMs;
+    _samples = 0;
+    _taskCount = 0;
+    _historyHead = 0;
+    _historyFill = 0;
+    memset(_history, 0, sizeof(_history));
+    memset(_peak, 0, sizeof(_peak));
+    memset(_lastSwitches, 0, sizeof(_lastSwitches));
+    memset(_switchRate, 0, sizeof(_switchRate));
+    _sites = sites;
+    _siteCount = siteCount < CPU_PROFILE_MAX_WAIT_SITES ? siteCount : CPU_PROFILE_MAX_WAIT_SITES;
+    for (size_t i = 0; i < _siteCount; i++) {
+        _lastWaits[i] = sites[i].waits;
+        _lastWaitUs[i] = sites[i].totalUs;
+        _waitStats[i].name = sites[i].name;
+        _waitStats[i].waits = 0;
+        _waitStats[i].averageUs = 0;
+        _waitStats[i].maxUs = 0;
+    }
+}
+
+CpuTaskLoad* CpuProfiler::findTask(uintptr_t id, uint8_t core) {
+    for (size_t i = 0; i < _taskCount; i++) {
+        if (_tasks[i].id == id && _tasks[i].core == core) {
+            return &_tasks[i];
+        }
+    }
+    return NULL;
+}
+
+void CpuProfiler::beginSample() {
+    for (size_t i = 0; i < _taskCount; i++) {
+        _tasks[i].seen = false;
+    }
+}
+
+void CpuProfiler::addTask(uintptr_t id, const char* name, uint8_t core, bool idle, uint32_t counter) {
+    CpuTaskLoad* task = findTask(id, core);
+    if (task == NULL) {
+        if (_taskCount == CPU_PROFILE_MAX_TASKS) {
+            return;
+        }
+        // First seen: its counter is the baseline for the next window
+        task = &_tasks[_taskCount++];
+        task->id = id;
+        task->core = core;
+        task->percent = -1;
+        task->averagePercent = 0;
+        task->measured = false;
+        task->counter = counter;
+    } else {
+        // Stored until endSample(), which knows the window's length
+        task->percent = (float)(uint32_t)(counter - task->counter);
+        task->counter = counter;
+    }
+    task->idle = idle;
+    task->seen = true;
+    strncpy(task->name, name, CPU_PROFILE_NAME_MAX - 1);
+    task->name[CPU_PROFILE_NAME_MAX - 1] = '\0';
+}
+
+void CpuProfiler::endSample(const uint32_t* elapsed, const uint32_t* switches) {
+    // Tasks that are gone (deleted) drop out
+    size_t kept = 0;
+    for (size_t i = 0; i < _taskCount; i++) {
+        if (_tasks[i].seen) {
+            _tasks[kept++] = _tasks[i];
+        }
+    }
+    _taskCount = kept;
+
+    float idle[CPU_PROFILE_MAX_CORES];
+    bool haveIdle[CPU_PROFILE_MAX_CORES] = {};
+    for (size_t i = 0; i < _taskCount; i++) {
+        CpuTaskLoad& task = _tasks[i];
+        const uint32_t window = task.core < _cores ? elapsed[task.core] : elapsed[0];
+        if (task.percent < 0 || window == 0) {
+            task.percent = 0;
+            continue;
+        }
+        task.percent = task.percent * 100 / window;
+        task.averagePercent = !task.measured ? task.percent
+                            : task.averagePercent + (task.percent - task.averagePercent) / CPU_PROFILE_TASK_WINDOWS;
+        task.measured = true;
+        if (task.idle && task.core < _cores) {
+            idle[task.core] = task.percent;
+            haveIdle[task.core] = true;
+        }
+    }
+
+    for (uint8_t core = 0; core < _cores; core++) {
+        float load = haveIdle[core] ? 100 - idle[core] : 0;
+        load = load < 0 ? 0 : (load > 100 ? 100 : load);
+        _history[core][_historyHead] = load;
+        if (load > _peak[core]) {
+            _peak[core] = load;
+        }
+        _switchRate[core] = (float)(uint32_t)(switches[core] - _lastSwitches[core]) * 1000 / _windowMs;
+        _lastSwitches[core] = switches[core];
+    }
+    _historyHead = (_historyHead + 1) % CPU_PROFILE_HISTORY;
+    if (_historyFill < CPU_PROFILE_HISTORY) {
+        _historyFill++;
+    }
+
+    for (size_t i = 0; i < _siteCount; i++) {
+        const uint32_t waits = __atomic_load_n(&_sites[i].waits, __ATOMIC_RELAXED);
+        const uint32_t totalUs = __atomic_load_n(&_sites[i].totalUs, __ATOMIC_RELAXED);
+        CpuWaitStats& stats = _waitStats[i];
+        stats.waits = waits - _lastWaits[i];
+        stats.averageUs = stats.waits > 0 ? (float)(uint32_t)(totalUs - _lastWaitUs[i]) / stats.waits : 0;
+        stats.maxUs = __atomic_exchange_n(&_sites[i].maxUs, 0, __ATOMIC_RELAXED);
+        _lastWaits[i] = waits;
+        _lastWaitUs[i] = totalUs;
+    }
+    _samples++;
+}
+
+float CpuProfiler::coreLoad(uint8_t core) const {
+    return coreAverage(core, 1);
+}
+
+float CpuProfiler::coreAverage(uint8_t core, size_t windows) const {
+    if (windows > _historyFill) {
+        windows = _historyFill;
+    }
+    if (windows == 0 || core >= _cores) {
+        return 0;
+    }
+    float sum = 0;
+    for (size_t i = 1; i <= windows; i++) {
+        sum += _history[core][(_historyHead + CPU_PROFILE_HISTORY - i) % CPU_PROFILE_HISTORY];
+    }
+    return sum / windows;
+}
+
+void CpuProfiler::markPeak() {
+    memset(_peak, 0, sizeof(_peak));
+}
+
+size_t CpuProfiler::busiest(const CpuTaskLoad** out, size_t capacity) const {
+    size_t count = 0;
+    for (size_t i = 0; i < _taskCount; i++) {
+        if (_tasks[i].idle) {
+            continue;
+        }
+        // Insertion into the sorted list, dropping whatever falls off its end
+        size_t j = count < capacity ? count++ : capacity;
+        while (j > 0 && out[j - 1]->percent < _tasks[i].percent) {
+            if (j < capacity) {
+                out[j] = out[j - 1];
+            }
+            j--;
+        }
+        if (j < capacity) {
+            out[j] = &_tasks[i];
+        }
+    }
+    return count;
+}
+
+size_t CpuProfiler::format(char* out, size_t capacity) const {
+    size_t length = 0;
+#define CPU_PROFILE_APPEND(...) \
+    length += (size_t)snprintf(out + length, length < capacity ? capacity - length : 0, __VA_ARGS__)
+    for (uint8_t core = 0; core < _cores; core++) {
+        CPU_PROFILE_APPEND("%score%u %.0f%% (%.0f%%/%.0f%%, %.0f sw/s)", core ? " " : "", (unsigned)core, coreLoad(core),
+                           coreAverage(core, SHORT_WINDOWS), coreAverage(core, CPU_PROFILE_HISTORY), _switchRate[core]);
+    }
+    const CpuTaskLoad* top[SUMMARY_TASKS];
+    const size_t tasks = busiest(top, SUMMARY_TASKS);
+    CPU_PROFILE_APPEND(" |");
+    for (size_t i = 0; i < tasks; i++) {
+        if (top[i]->core == CPU_PROFILE_ANY_CORE) {
+            CPU_PROFILE_APPEND(" %s %.0f%%", top[i]->name, top[i]->percent);
+        } else {
+            CPU_PROFILE_APPEND(" %s@%u %.0f%%", top[i]->name, (unsigned)top[i]->core, top[i]->percent);
+        }
+    }
+    if (_siteCount > 0) {
+        CPU_PROFILE_APPEND(" |");
+    }
+    for (size_t i = 0; i < _siteCount; i++) {
+        CPU_PROFILE_APPEND(" %s %ux %.1f/%.1f ms", _waitStats[i].name, (unsigned)_waitStats[i].waits,
+                           _waitStats[i].averageUs / 1000, _waitStats[i].maxUs / 1000.0f);
+    }
+#undef CPU_PROFILE_APPEND
+    return length < capacity ? length : (capacity > 0 ? capacity - 1 : 0);
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+// =================================================================================================
+// CPU PROFILER
+// Per-task and per-core utilization, context-switch rates and time blocked at wait sites, over
+// fixed windows (one sample per window) with a sliding history per core, so a saturated core
+// shows up before tasks are re-pinned.
+//
+// The source of the run-time figures is up to the caller: FreeRTOS run-time stats (cumulative
+// microseconds per task) where the SDK has them, or per-core tick samples of the running task.
+// Either way a task's share of a window is its counter's advance over the window's length in the
+// same unit, and a core's load is what its idle task left over. Wait sites are counted by the
+// tasks that block there (cpuWaitRecord() is safe from any task) and reported per window.
+// Portable (no Arduino dependencies) for the native build. No heap allocation.
+// =================================================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+
+const size_t CPU_PROFILE_MAX_CORES = 2;
+const size_t CPU_PROFILE_MAX_TASKS = 24;
+const size_t CPU_PROFILE_MAX_WAIT_SITES = 8;
+const size_t CPU_PROFILE_NAME_MAX = 16;     // configMAX_TASK_NAME_LEN
+const size_t CPU_PROFILE_HISTORY = 60;      // Windows of per-core load kept
+const float CPU_PROFILE_TASK_WINDOWS = 10;  // Smoothing of the per-task average, in windows
+const uint8_t CPU_PROFILE_ANY_CORE = 0xFF;  // A task measured across all cores
+
+struct CpuTaskLoad {
+    uintptr_t id;               // Task handle or any other unique key
+    uint8_t core;
+    bool idle;                  // The core's idle task
+    bool seen;                  // In the current sample
+    bool measured;              // Over at least one whole window
+    char name[CPU_PROFILE_NAME_MAX];
+    uint32_t counter;           // Cumulative run time at the last sample
+    float percent;              // Of one core, over the last window
+    float averagePercent;       // Smoothed over about CPU_PROFILE_TASK_WINDOWS windows
+};
+
+// A place where tasks block: a queue, or a driver call that waits on one
+struct CpuWaitSite {
+    const char* name;
+    uint32_t waits;             // Cumulative
+    uint32_t totalUs;           // Cumulative
+    uint32_t maxUs;             // Since the last sample
+};
+
+struct CpuWaitStats {
+    const char* name;
+    uint32_t waits;             // In the last window
+    float averageUs;
+    uint32_t maxUs;
+};
+
+// Records one wait of 'us' microseconds
+void cpuWaitRecord(CpuWaitSite& site, uint32_t us);
+
+class CpuProfiler {
+public:
+    CpuProfiler();
+
+    // 'sites' stay owned by the caller; at most CPU_PROFILE_MAX_WAIT_SITES are reported
+    void begin(uint8_t cores, uint32_t windowMs, CpuWaitSite* sites, size_t siteCount);
+
+    // One sample per window: every task with its cumulative counter, then, per core, how far
+    // the counters' clock advanced over the window (the same value for every core when the
+    // counters are run time) and the cumulative context switches.
+    void beginSample();
+    void addTask(uintptr_t id, const char* name, uint8_t core, bool idle, uint32_t counter);
+    void endSample(const uint32_t* elapsed, const uint32_t* switches);
+
+    uint8_t cores() const { return _cores; }
+    uint32_t samples() const { return _samples; }
+    // Percent busy over the last window, and the mean over the last 'windows' (up to
+    // CPU_PROFILE_HISTORY, fewer until that many have been sampled)
+    float coreLoad(uint8_t core) const;
+    float coreAverage(uint8_t core, size_t windows) const;
+    // Highest window load since markPeak()
+    float corePeak(uint8_t core) const { return _peak[core]; }
+    void markPeak();
+    float switchesPerSec(uint8_t core) const { return _switchRate[core]; }
+
+    size_t taskCount() const { return _taskCount; }
+    const CpuTaskLoad& task(size_t index) const { return _tasks[index]; }
+    // The 'capacity' busiest tasks of the last window, idle tasks left out. Returns the count.
+    size_t busiest(const CpuTaskLoad** out, size_t capacity) const;
+
+    size_t waitSiteCount() const { return _siteCount; }
+    const CpuWaitStats& waitStats(size_t index) const { return _waitStats[index]; }
+
+    // One-line summary: per-core load (last window, 10 and 60 window means, switches/s), the
+    // busiest tasks ("name@core percent") and the wait sites
+    size_t format(char* out, size_t capacity) const;
+
+private:
+    CpuTaskLoad* findTask(uintptr_t id, uint8_t core);
+
+    uint8_t _cores;
+    uint32_t _windowMs;
+    uint32_t _samples;
+    CpuTaskLoad _tasks[CPU_PROFILE_MAX_TASKS];
+    size_t _taskCount;
+    float _history[CPU_PROFILE_MAX_CORES][CPU_PROFILE_HISTORY];
+    size_t _historyHead;        // Next slot to write
+    size_t _historyFill;
+    float _peak[CPU_PROFILE_MAX_CORES];
+    uint32_t _lastSwitches[CPU_PROFILE_MAX_CORES];
+    float _switchRate[CPU_PROFILE_MAX_CORES];
+    CpuWaitSite* _sites;
+    size_t _siteCount;
+    uint32_t _lastWaits[CPU_PROFILE_MAX_WAIT_SITES];
+    uint32_t _lastWaitUs[CPU_PROFILE_MAX_WAIT_SITES];
+    CpuWaitStats _waitStats[CPU_PROFILE_MAX_WAIT_SITES];
+};
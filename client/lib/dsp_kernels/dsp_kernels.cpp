@@ -0,0 +1,408 @@
+#include "dsp_kernels.h"
+
+#include <math.h>
+#include <string.h>
+
+static uint32_t vectorized = (1u << DSP_KERNEL_COUNT) - 1;
+
+uint32_t dspVectorized() {
+    return vectorized;
+}
+
+void dspDisable(DspKernel kernel) {
+    vectorized &= ~(1u << kernel);
+}
+
+static inline int16_t saturate16(int32_t value) {
+    return (int16_t)(value > 32767 ? 32767 : (value < -32768 ? -32768 : value));
+}
+
+// Whole vectors of 'n' the vector path takes: all of them if it's on and the buffers are aligned
+static size_t vectorBlocks(DspKernel kernel, size_t n, const void* a, const void* b) {
+    return ((vectorized >> kernel) & 1) && dspAligned(a) && dspAligned(b) ? n / DSP_LANES : 0;
+}
+
+// --- Scalar references ---
+
+void dspScaleRef(int16_t* x, size_t n, int16_t gainQ15) {
+    for (size_t i = 0; i < n; i++) {
+        x[i] = (int16_t)(((int32_t)x[i] * gainQ15) >> 15);
+    }
+}
+
+// Gain of vector 'vectors' of a ramp
+static int16_t rampGain(int16_t gainQ12, int16_t stepQ12, size_t vectors) {
+    const int64_t gain = gainQ12 + (int64_t)stepQ12 * (int64_t)vectors;
+    return (int16_t)(gain > 32767 ? 32767 : (gain < -32768 ? -32768 : gain));
+}
+
+void dspRampRef(int16_t* x, size_t n, int16_t gainQ12, int16_t stepQ12) {
+    for (size_t i = 0; i < n; i++) {
+        x[i] = (int16_t)(((int32_t)x[i] * rampGain(gainQ12, stepQ12, i / DSP_LANES)) >> 12);
+    }
+}
+
+void dspMixRef(int16_t* out, const int16_t* in, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = saturate16((int32_t)out[i] + in[i]);
+    }
+}
+
+int16_t dspPeakRef(const int16_t* x, size_t n) {
+    int16_t peak = 0;
+    for (size_t i = 0; i < n; i++) {
+        const int16_t magnitude = x[i] == -32768 ? 32767 : (int16_t)(x[i] < 0 ? -x[i] : x[i]);
+        if (magnitude > peak) {
+            peak = magnitude;
+        }
+    }
+    return peak;
+}
+
+static int32_t roundShift(int64_t sum, uint8_t shift) {
+    if (shift > 0) {
+        sum = (sum + ((int64_t)1 << (shift - 1))) >> shift;
+    }
+    return (int32_t)(sum > INT32_MAX ? INT32_MAX : (sum < INT32_MIN ? INT32_MIN : sum));
+}
+
+int32_t dspDotRef(const int16_t* a, const int16_t* b, size_t n, uint8_t shift) {
+    int64_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += (int32_t)a[i] * b[i];
+    }
+    return roundShift(sum, shift);
+}
+
+// --- Vector bodies: 'blocks' (> 0) whole vectors from 16-byte aligned buffers ---
+
+#if DSP_KERNELS_PIE
+
+// EE.VMUL.S16 shifts each 32-bit product right by SAR before keeping the low 16 bits
+static void scaleBlocks(int16_t* x, size_t blocks, int16_t gainQ15) {
+    int16_t gain[DSP_LANES] DSP_ALIGNED;
+    for (size_t i = 0; i < DSP_LANES; i++) {
+        gain[i] = gainQ15;
+    }
+    asm volatile(
+        "wsr.sar %[shift]\n"
+        "ee.vld.128.ip q1, %[gain], 0\n"
+        "1:\n"
+        "ee.vld.128.ip q0, %[x], 0\n"
+        "ee.vmul.s16 q0, q0, q1\n"
+        "ee.vst.128.ip q0, %[x], 16\n"
+        "addi %[blocks], %[blocks], -1\n"
+        "bnez %[blocks], 1b\n"
+        : [x] "+r"(x), [blocks] "+r"(blocks)
+        : [gain] "r"(gain), [shift] "r"(15)
+        : "memory");
+}
+
+// The gain vector steps with a saturating add after each block
+static void rampBlocks(int16_t* x, size_t blocks, int16_t gainQ12, int16_t stepQ12) {
+    int16_t vectors[2 * DSP_LANES] DSP_ALIGNED;
+    for (size_t i = 0; i < DSP_LANES; i++) {
+        vectors[i] = gainQ12;
+        vectors[DSP_LANES + i] = stepQ12;
+    }
+    int16_t* gains = vectors;
+    asm volatile(
+        "wsr.sar %[shift]\n"
+        "ee.vld.128.ip q1, %[gains], 16\n"
+        "ee.vld.128.ip q2, %[gains], 0\n"
+        "1:\n"
+        "ee.vld.128.ip q0, %[x], 0\n"
+        "ee.vmul.s16 q0, q0, q1\n"
+        "ee.vst.128.ip q0, %[x], 16\n"
+        "ee.vadds.s16 q1, q1, q2\n"
+        "addi %[blocks], %[blocks], -1\n"
+        "bnez %[blocks], 1b\n"
+        : [x] "+r"(x), [blocks] "+r"(blocks), [gains] "+r"(gains)
+        : [shift] "r"(12)
+        : "memory");
+}
+
+static void mixBlocks(int16_t* out, const int16_t* in, size_t blocks) {
+    asm volatile(
+        "1:\n"
+        "ee.vld.128.ip q0, %[out], 0\n"
+        "ee.vld.128.ip q1, %[in], 16\n"
+        "ee.vadds.s16 q0, q0, q1\n"
+        "ee.vst.128.ip q0, %[out], 16\n"
+        "addi %[blocks], %[blocks], -1\n"
+        "bnez %[blocks], 1b\n"
+        : [out] "+r"(out), [in] "+r"(in), [blocks] "+r"(blocks)
+        :
+        : "memory");
+}
+
+// |x| is max(x, 0 - x) with a saturating subtraction, so -32768 becomes 32767
+static int16_t peakBlocks(const int16_t* x, size_t blocks) {
+    int16_t lanes[DSP_LANES] DSP_ALIGNED;
+    asm volatile(
+        "ee.zero.q q2\n"
+        "ee.zero.q q3\n"
+        "1:\n"
+        "ee.vld.128.ip q0, %[x], 16\n"
+        "ee.vsubs.s16 q1, q3, q0\n"
+        "ee.vmax.s16 q0, q0, q1\n"
+        "ee.vmax.s16 q2, q2, q0\n"
+        "addi %[blocks], %[blocks], -1\n"
+        "bnez %[blocks], 1b\n"
+        "ee.vst.128.ip q2, %[lanes], 0\n"
+        : [x] "+r"(x), [blocks] "+r"(blocks)
+        : [lanes] "r"(lanes)
+        : "memory");
+    return dspPeakRef(lanes, DSP_LANES);
+}
+
+// Products accumulate in the 40-bit ACCX register; EE.SRS.ACCX shifts, rounds and saturates
+static int32_t dotBlocks(const int16_t* a, const int16_t* b, size_t blocks, uint8_t shift) {
+    int32_t result;
+    asm volatile(
+        "ee.zero.accx\n"
+        "1:\n"
+        "ee.vld.128.ip q0, %[a], 16\n"
+        "ee.vld.128.ip q1, %[b], 16\n"
+        "ee.vmulas.s16.accx q0, q1\n"
+        "addi %[blocks], %[blocks], -1\n"
+        "bnez %[blocks], 1b\n"
+        "ee.srs.accx %[result], %[shift], 0\n"
+        : [a] "+r"(a), [b] "+r"(b), [blocks] "+r"(blocks), [result] "=&r"(result)
+        : [shift] "r"((uint32_t)shift)
+        : "memory");
+    return result;
+}
+
+#else
+
+// Portable model of the same instructions, one vector of lanes at a time
+
+static void scaleBlocks(int16_t* x, size_t blocks, int16_t gainQ15) {
+    for (size_t block = 0; block < blocks; block++, x += DSP_LANES) {
+        for (size_t lane = 0; lane < DSP_LANES; lane++) {
+            x[lane] = (int16_t)(((int32_t)x[lane] * gainQ15) >> 15);
+        }
+    }
+}
+
+static void rampBlocks(int16_t* x, size_t blocks, int16_t gainQ12, int16_t stepQ12) {
+    int16_t gain = gainQ12;
+    for (size_t block = 0; block < blocks; block++, x += DSP_LANES) {
+        for (size_t lane = 0; lane < DSP_LANES; lane++) {
+            x[lane] = (int16_t)(((int32_t)x[lane] * gain) >> 12);
+        }
+        gain = saturate16((int32_t)gain + stepQ12);
+    }
+}
+
+static void mixBlocks(int16_t* out, const int16_t* in, size_t blocks) {
+    for (size_t block = 0; block < blocks; block++, out += DSP_LANES, in += DSP_LANES) {
+        for (size_t lane = 0; lane < DSP_LANES; lane++) {
+            out[lane] = saturate16((int32_t)out[lane] + in[lane]);
+        }
+    }
+}
+
+static int16_t peakBlocks(const int16_t* x, size_t blocks) {
+    int16_t lanes[DSP_LANES] = {0};
+    for (size_t block = 0; block < blocks; block++, x += DSP_LANES) {
+        for (size_t lane = 0; lane < DSP_LANES; lane++) {
+            const int16_t negated = saturate16(-(int32_t)x[lane]);
+            const int16_t magnitude = x[lane] > negated ? x[lane] : negated;
+            lanes[lane] = magnitude > lanes[lane] ? magnitude : lanes[lane];
+        }
+    }
+    return dspPeakRef(lanes, DSP_LANES);
+}
+
+static int32_t dotBlocks(const int16_t* a, const int16_t* b, size_t blocks, uint8_t shift) {
+    int64_t accumulator = 0;
+    for (size_t block = 0; block < blocks; block++, a += DSP_LANES, b += DSP_LANES) {
+        for (size_t lane = 0; lane < DSP_LANES; lane++) {
+            accumulator += (int32_t)a[lane] * b[lane];
+        }
+    }
+    return roundShift(accumulator, shift);
+}
+
+#endif
+
+// --- Dispatch: vector bodies, with the rest of each buffer on the reference ---
+
+void dspScale(int16_t* x, size_t n, int16_t gainQ15) {
+    const size_t done = vectorBlocks(DSP_KERNEL_SCALE, n, x, x) * DSP_LANES;
+    if (done > 0) {
+        scaleBlocks(x, done / DSP_LANES, gainQ15);
+    }
+    dspScaleRef(x + done, n - done, gainQ15);
+}
+
+void dspRamp(int16_t* x, size_t n, int16_t gainQ12, int16_t stepQ12) {
+    const size_t done = vectorBlocks(DSP_KERNEL_RAMP, n, x, x) * DSP_LANES;
+    if (done > 0) {
+        rampBlocks(x, done / DSP_LANES, gainQ12, stepQ12);
+    }
+    dspRampRef(x + done, n - done, rampGain(gainQ12, stepQ12, done / DSP_LANES), stepQ12);
+}
+
+void dspMix(int16_t* out, const int16_t* in, size_t n) {
+    const size_t done = vectorBlocks(DSP_KERNEL_MIX, n, out, in) * DSP_LANES;
+    if (done > 0) {
+        mixBlocks(out, in, done / DSP_LANES);
+    }
+    dspMixRef(out + done, in + done, n - done);
+}
+
+int16_t dspPeak(const int16_t* x, size_t n) {
+    const size_t done = vectorBlocks(DSP_KERNEL_PEAK, n, x, x) * DSP_LANES;
+    const int16_t head = done > 0 ? peakBlocks(x, done / DSP_LANES) : 0;
+    const int16_t tail = dspPeakRef(x + done, n - done);
+    return head > tail ? head : tail;
+}
+
+int32_t dspDot(const int16_t* a, const int16_t* b, size_t n, uint8_t shift) {
+    // The rounding applies to the whole sum, so the vector path needs all of it
+    if (n % DSP_LANES != 0 || vectorBlocks(DSP_KERNEL_DOT, n, a, b) == 0) {
+        return dspDotRef(a, b, n, shift);
+    }
+    return dotBlocks(a, b, n / DSP_LANES, shift);
+}
+
+void dspPack32(const int32_t* in, int16_t* out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = (int16_t)(in[i] >> 16);
+    }
+}
+
+uint16_t dspRms(const int16_t* x, size_t n) {
+    if (n == 0) {
+        return 0;
+    }
+    // Each block's sum of squares divided by DSP_DOT_MAX fits the 32-bit result
+    const uint8_t blockShift = 9;
+    static_assert(DSP_DOT_MAX == 1u << 9, "blockShift divides by DSP_DOT_MAX");
+    uint64_t sum = 0;
+    for (size_t done = 0; done < n; done += DSP_DOT_MAX) {
+        const size_t count = n - done < DSP_DOT_MAX ? n - done : DSP_DOT_MAX;
+        sum += (uint32_t)dspDot(x + done, x + done, count, blockShift);
+    }
+    return (uint16_t)sqrt((double)sum * DSP_DOT_MAX / n);
+}
+
+// --- FIR ---
+
+bool dspFirInit(DspFir& fir, const int16_t* coeffs, size_t taps, int16_t* phases, int16_t* history) {
+    const size_t padded = dspFirPadded(taps);
+    if (taps == 0 || padded > DSP_DOT_MAX || !dspAligned(phases) || !dspAligned(history)) {
+        return false;
+    }
+    // Copy p starts p samples late, matching a window that starts p samples before the newest input
+    for (size_t phase = 0; phase < DSP_LANES; phase++) {
+        for (size_t i = 0; i < padded; i++) {
+            phases[phase * padded + i] = i >= phase && i - phase < taps ? coeffs[i - phase] : 0;
+        }
+    }
+    memset(history, 0, dspFirHistorySamples(taps) * sizeof(int16_t));
+    fir.coeffs = coeffs;
+    fir.taps = taps;
+    fir.phases = phases;
+    fir.history = history;
+    fir.position = 0;
+    return true;
+}
+
+static void firPush(DspFir& fir, int16_t sample) {
+    fir.position = (fir.position == 0 ? fir.taps : fir.position) - 1;
+    fir.history[fir.position] = sample;
+    fir.history[fir.position + fir.taps] = sample;
+}
+
+void dspFir(DspFir& fir, const int16_t* in, int16_t* out, size_t n) {
+    const size_t padded = dspFirPadded(fir.taps);
+    for (size_t i = 0; i < n; i++) {
+        firPush(fir, in[i]);
+        const size_t start = fir.position / DSP_LANES * DSP_LANES;
+        const int16_t* coeffs = fir.phases + (fir.position - start) * padded;
+        out[i] = saturate16(dspDot(fir.history + start, coeffs, padded, 15));
+    }
+}
+
+void dspFirRef(DspFir& fir, const int16_t* in, int16_t* out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        firPush(fir, in[i]);
+        out[i] = saturate16(dspDotRef(fir.history + fir.position, fir.coeffs, fir.taps, 15));
+    }
+}
+
+// --- Biquad ---
+
+void dspBiquadInit(DspBiquad& biquad, int16_t b0, int16_t b1, int16_t b2, int16_t a1, int16_t a2) {
+    biquad = {b0, b1, b2, a1, a2, 0, 0, 0, 0};
+}
+
+void dspBiquad(DspBiquad& biquad, int16_t* x, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        const int32_t sum = (int32_t)biquad.b0 * x[i] + (int32_t)biquad.b1 * biquad.x1 + (int32_t)biquad.b2 * biquad.x2
+                            - (int32_t)biquad.a1 * biquad.y1 - (int32_t)biquad.a2 * biquad.y2;
+        const int16_t y = saturate16((sum + (1 << 13)) >> 14);
+        biquad.x2 = biquad.x1;
+        biquad.x1 = x[i];
+        biquad.y2 = biquad.y1;
+        biquad.y1 = y;
+        x[i] = y;
+    }
+}
+
+// --- FFT ---
+
+// Q15, kept within +-32767 so a complex product plus rounding fits 32 bits
+static int16_t q15(double value) {
+    const long scaled = lround(value * 32768);
+    return (int16_t)(scaled > 32767 ? 32767 : (scaled < -32767 ? -32767 : scaled));
+}
+
+void dspFftTwiddles(int16_t* twiddles, size_t n) {
+    for (size_t k = 0; k < n / 2; k++) {
+        const double angle = 2 * M_PI * k / n;
+        twiddles[2 * k] = q15(cos(angle));
+        twiddles[2 * k + 1] = q15(-sin(angle));
+    }
+}
+
+void dspFft(int16_t* data, size_t n, const int16_t* twiddles) {
+    // Bit-reversed order
+    for (size_t i = 1, j = 0; i < n; i++) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            int16_t re = data[2 * i], im = data[2 * i + 1];
+            data[2 * i] = data[2 * j];
+            data[2 * i + 1] = data[2 * j + 1];
+            data[2 * j] = re;
+            data[2 * j + 1] = im;
+        }
+    }
+    // Butterflies, halving each stage's outputs
+    for (size_t size = 2; size <= n; size *= 2) {
+        const size_t half = size / 2;
+        const size_t step = n / size;
+        for (size_t start = 0; start < n; start += size) {
+            for (size_t k = 0; k < half; k++) {
+                int16_t* a = data + 2 * (start + k);
+                int16_t* b = a + 2 * half;
+                const int32_t wr = twiddles[2 * k * step];
+                const int32_t wi = twiddles[2 * k * step + 1];
+                const int32_t tr = (wr * b[0] - wi * b[1] + (1 << 14)) >> 15;
+                const int32_t ti = (wr * b[1] + wi * b[0] + (1 << 14)) >> 15;
+                b[0] = saturate16((a[0] - tr) >> 1);
+                b[1] = saturate16((a[1] - ti) >> 1);
+                a[0] = saturate16((a[0] + tr) >> 1);
+                a[1] = saturate16((a[1] + ti) >> 1);
+            }
+        }
+    }
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+// =================================================================================================
+// DSP KERNELS
+// Fixed-point primitives for audio stages: gain and gain ramps, mix, 32-to-16-bit packing, peak
+// and RMS, dot product, FIR, biquad and FFT, all on Q15 int16 samples. Every accelerated kernel
+// has a scalar reference (the ...Ref functions) that defines its exact output.
+//
+// On the ESP32-S3 the gain, ramp, mix, peak and dot product kernels run their bulk on the PIE
+// vector unit (128-bit registers, 8 samples per instruction). Vector loads ignore the low address
+// bits, so the PIE path is taken only for 16-byte aligned buffers (DSP_ALIGNED); whatever is left
+// over goes through the reference code. Elsewhere the same block structure runs on a portable
+// model of the vector lanes, so the host build exercises the block/tail split. dspSelfTest()
+// checks each kernel against its reference and turns off the vector path of any kernel that
+// disagrees. Build with -DDSP_KERNELS_SCALAR to leave PIE out entirely.
+//
+// FIR runs on dspDot() and gets the PIE path too: its coefficients are kept in 8 copies, each
+// shifted by one sample, so every window starts on an aligned address. Biquads are recursive and
+// FFT butterflies are complex, so neither splits into independent lanes; both are scalar only.
+// Portable (no Arduino dependencies) for the native build. No heap allocation.
+// =================================================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(ESP_PLATFORM) && !defined(DSP_KERNELS_SCALAR)
+#include <sdkconfig.h>
+#endif
+#if defined(CONFIG_IDF_TARGET_ESP32S3) && !defined(DSP_KERNELS_SCALAR)
+#define DSP_KERNELS_PIE 1
+#else
+#define DSP_KERNELS_PIE 0
+#endif
+
+const size_t DSP_LANES = 8;     // int16 samples per PIE vector
+const size_t DSP_ALIGN = 16;    // Bytes per PIE vector
+#define DSP_ALIGNED __attribute__((aligned(16)))
+
+inline bool dspAligned(const void* pointer) {
+    return ((uintptr_t)pointer & (DSP_ALIGN - 1)) == 0;
+}
+
+// Kernels with a vector path, as bits of dspVectorized()
+enum DspKernel {
+    DSP_KERNEL_SCALE,
+    DSP_KERNEL_RAMP,
+    DSP_KERNEL_MIX,
+    DSP_KERNEL_PEAK,
+    DSP_KERNEL_DOT,
+    DSP_KERNEL_COUNT
+};
+
+// Bit per DspKernel: 1 while its vector path (PIE, or the lane model off target) is in use
+uint32_t dspVectorized();
+void dspDisable(DspKernel kernel);
+
+// --- Gain, mix, conversion ---
+
+// x = x * gainQ15 / 32768, rounding toward minus infinity. Attenuation only: 0 <= gainQ15 <= 32767.
+void dspScale(int16_t* x, size_t n, int16_t gainQ15);
+void dspScaleRef(int16_t* x, size_t n, int16_t gainQ15);
+
+// Gain that moves once per vector: x[i] = x[i] * g >> 12 with g = gainQ12 + stepQ12 * (i / DSP_LANES),
+// the gain saturating at the int16 range. Q12 gains pass samples through at 4096 and boost up to
+// about +18 dB. Only the low 16 bits of each result are kept, as the PIE multiply does: the
+// caller keeps the output within full scale (the output chain's limiter does).
+void dspRamp(int16_t* x, size_t n, int16_t gainQ12, int16_t stepQ12);
+void dspRampRef(int16_t* x, size_t n, int16_t gainQ12, int16_t stepQ12);
+
+// out = out + in, saturating
+void dspMix(int16_t* out, const int16_t* in, size_t n);
+void dspMixRef(int16_t* out, const int16_t* in, size_t n);
+
+// Top 16 bits of each 32-bit I2S slot. 'out' may alias 'in'.
+void dspPack32(const int32_t* in, int16_t* out, size_t n);
+
+// --- Measurement ---
+
+// Largest |x[i]|; -32768 counts as 32767
+int16_t dspPeak(const int16_t* x, size_t n);
+int16_t dspPeakRef(const int16_t* x, size_t n);
+
+// Sum of a[i] * b[i], shifted right by 'shift' (rounding half up) and saturated to 32 bits. The
+// PIE accumulator has 40 bits, so the sum must fit in them: up to DSP_DOT_MAX full-scale products.
+const size_t DSP_DOT_MAX = 512;
+int32_t dspDot(const int16_t* a, const int16_t* b, size_t n, uint8_t shift);
+int32_t dspDotRef(const int16_t* a, const int16_t* b, size_t n, uint8_t shift);
+
+// Root mean square, from dspDot() over blocks of DSP_DOT_MAX
+uint16_t dspRms(const int16_t* x, size_t n);
+
+// --- Filters ---
+
+// Samples in each shifted copy of the FIR coefficients (a whole number of vectors)
+constexpr size_t dspFirPadded(size_t taps) {
+    return (taps + 2 * DSP_LANES - 2) / DSP_LANES * DSP_LANES;
+}
+// int16 elements of the buffers dspFirInit() takes
+constexpr size_t dspFirPhaseSamples(size_t taps) { return DSP_LANES * dspFirPadded(taps); }
+constexpr size_t dspFirHistorySamples(size_t taps) { return taps + dspFirPadded(taps); }
+
+// y[n] = sum of coeffs[k] * x[n - k] (Q15 coefficients), rounded and saturated
+struct DspFir {
+    const int16_t* coeffs;
+    size_t taps;
+    int16_t* phases;    // DSP_LANES shifted copies of the coefficients
+    int16_t* history;   // Input, newest first, stored twice so any window is contiguous
+    size_t position;    // Index of the newest input in 'history'
+};
+
+// 'phases' and 'history' are 16-byte aligned, dspFirPhaseSamples(taps) and
+// dspFirHistorySamples(taps) long, and dspFirPadded(taps) <= DSP_DOT_MAX. False if not.
+bool dspFirInit(DspFir& fir, const int16_t* coeffs, size_t taps, int16_t* phases, int16_t* history);
+void dspFir(DspFir& fir, const int16_t* in, int16_t* out, size_t n);
+// Direct form on the same state (its phases are not used)
+void dspFirRef(DspFir& fir, const int16_t* in, int16_t* out, size_t n);
+
+// Direct form I biquad with Q14 coefficients (a0 normalized to 1), filtering in place. The
+// accumulator can't overflow while |b0| + |b1| + |b2| + |a1| + |a2| < 4.
+struct DspBiquad {
+    int16_t b0, b1, b2, a1, a2;
+    int16_t x1, x2, y1, y2;
+};
+void dspBiquadInit(DspBiquad& biquad, int16_t b0, int16_t b1, int16_t b2, int16_t a1, int16_t a2);
+void dspBiquad(DspBiquad& biquad, int16_t* x, size_t n);
+
+// --- FFT ---
+
+const size_t DSP_FFT_MAX = 1024;
+
+// Fills 'twiddles' (n complex values: n / 2 pairs of cos, -sin in Q15) for dspFft()
+void dspFftTwiddles(int16_t* twiddles, size_t n);
+
+// In-place radix-2 FFT of n complex Q15 values (interleaved re, im), n a power of two up to
+// DSP_FFT_MAX. Every stage halves its outputs, so the result is the DFT divided by n and never
+// overflows.
+void dspFft(int16_t* data, size_t n, const int16_t* twiddles);
+
+// --- Verification ---
+
+struct DspKernelResult {
+    const char* name;
+    bool exact;             // Same output as the reference on every test vector
+    bool vectorized;        // Runs on the vector path (after the check)
+    float fastPerSample;    // Clock ticks per sample, kernel as dispatched
+    float refPerSample;     // and scalar reference
+};
+
+// Clock for the timings: CPU cycles on the device, nanoseconds on the host
+typedef uint32_t (*DspClock)();
+
+// Workspace dspSelfTest() needs (16-byte aligned)
+const size_t DSP_SELF_TEST_BYTES = 2048;
+
+// Runs every kernel with a vector path (and FIR, which rides on dspDot()) against its reference
+// on fixed pseudo-random and full-scale vectors, and times both. Disables the vector path of a
+// kernel whose output differs. Returns the results written, 0 if the workspace is too small or
+// misaligned.
+size_t dspSelfTest(DspClock clock, void* workspace, size_t bytes, DspKernelResult* results, size_t capacity);
@@ -0,0 +1,231 @@
+#include "dsp_kernels.h"
+
+#include <string.h>
+
+// 16 vectors, and a length that leaves a 5-sample tail for the reference code
+static const size_t TEST_SAMPLES = 128;
+static const size_t TAIL_SAMPLES = TEST_SAMPLES - 3;
+static const size_t FIR_TAPS = 15;
+static const int TIMING_ROUNDS = 4;
+
+static const int16_t TEST_GAINS[] = {0, 1, 9830, 16384, 23170, 32767};
+static const uint8_t TEST_SHIFTS[] = {0, 8, 15};
+// Ramps as {gain, step} (Q12): flat unity, rising from silence, falling boost (the products
+// overflow, so the kept low bits are compared too), and one whose gain saturates
+static const int16_t TEST_RAMPS[][2] = {{4096, 0}, {0, 512}, {20000, -2500}, {30000, 1000}};
+
+// Buffers carved out of the caller's workspace, each 16-byte aligned
+struct TestBuffers {
+    int16_t* a;
+    int16_t* b;
+    int16_t* out;
+    int16_t* ref;
+    int16_t* phases;
+    int16_t* history;
+    int16_t* refHistory;
+};
+
+static constexpr size_t alignedSamples(size_t samples) {
+    return (samples + DSP_LANES - 1) / DSP_LANES * DSP_LANES;
+}
+
+// Pseudo-random samples, with every 16th at each end of the range so saturation gets exercised
+static void fillTest(int16_t* x, size_t n, uint32_t seed) {
+    for (size_t i = 0; i < n; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        x[i] = (int16_t)(seed >> 16);
+        if (i % 16 == 3) {
+            x[i] = -32768;
+        } else if (i % 16 == 11) {
+            x[i] = 32767;
+        }
+    }
+}
+
+static float perSample(DspClock clock, uint32_t start, size_t samples) {
+    return (float)(clock() - start) / (float)(TIMING_ROUNDS * samples);
+}
+
+static void record(DspKernelResult& result, const char* name, DspKernel kernel, bool exact, float fast, float ref) {
+    if (!exact) {
+        dspDisable(kernel);
+    }
+    result.name = name;
+    result.exact = exact;
+    result.vectorized = (dspVectorized() >> kernel) & 1;
+    result.fastPerSample = fast;
+    result.refPerSample = ref;
+}
+
+static void checkScale(const TestBuffers& t, DspClock clock, DspKernelResult& result) {
+    bool exact = true;
+    for (size_t i = 0; i < sizeof(TEST_GAINS) / sizeof(TEST_GAINS[0]); i++) {
+        for (size_t n = TAIL_SAMPLES; n <= TEST_SAMPLES; n += TEST_SAMPLES - TAIL_SAMPLES) {
+            memcpy(t.out, t.a, n * sizeof(int16_t));
+            memcpy(t.ref, t.a, n * sizeof(int16_t));
+            dspScale(t.out, n, TEST_GAINS[i]);
+            dspScaleRef(t.ref, n, TEST_GAINS[i]);
+            exact = exact && memcmp(t.out, t.ref, n * sizeof(int16_t)) == 0;
+        }
+    }
+    uint32_t start = clock();
+    for (int round = 0; round < TIMING_ROUNDS; round++) {
+        dspScale(t.out, TEST_SAMPLES, 32767);
+    }
+    const float fast = perSample(clock, start, TEST_SAMPLES);
+    start = clock();
+    for (int round = 0; round < TIMING_ROUNDS; round++) {
+        dspScaleRef(t.ref, TEST_SAMPLES, 32767);
+    }
+    record(result, "scale", DSP_KERNEL_SCALE, exact, fast, perSample(clock, start, TEST_SAMPLES));
+}
+
+static void checkRamp(const TestBuffers& t, DspClock clock, DspKernelResult& result) {
+    bool exact = true;
+    for (size_t i = 0; i < sizeof(TEST_RAMPS) / sizeof(TEST_RAMPS[0]); i++) {
+        for (size_t n = TAIL_SAMPLES; n <= TEST_SAMPLES; n += TEST_SAMPLES - TAIL_SAMPLES) {
+            memcpy(t.out, t.a, n * sizeof(int16_t));
+            memcpy(t.ref, t.a, n * sizeof(int16_t));
+            dspRamp(t.out, n, TEST_RAMPS[i][0], TEST_RAMPS[i][1]);
+            dspRampRef(t.ref, n, TEST_RAMPS[i][0], TEST_RAMPS[i][1]);
+            exact = exact && memcmp(t.out, t.ref, n * sizeof(int16_t)) == 0;
+        }
+    }
+    uint32_t start = clock();
+    for (int round = 0; round < TIMING_ROUNDS; round++) {
+        dspRamp(t.out, TEST_SAMPLES, 4096, 0);
+    }
+    const float fast = perSample(clock, start, TEST_SAMPLES);
+    start = clock();
+    for (int round = 0; round < TIMING_ROUNDS; round++) {
+        dspRampRef(t.ref, TEST_SAMPLES, 4096, 0);
+    }
+    record(result, "ramp", DSP_KERNEL_RAMP, exact, fast, perSample(clock, start, TEST_SAMPLES));
+}
+
+static void checkMix(const TestBuffers& t, DspClock clock, DspKernelResult& result) {
+    bool exact = true;
+    for (size_t n = TAIL_SAMPLES; n <= TEST_SAMPLES; n += TEST_SAMPLES - TAIL_SAMPLES) {
+        memcpy(t.out, t.a, n * sizeof(int16_t));
+        memcpy(t.ref, t.a, n * sizeof(int16_t));
+        dspMix(t.out, t.b, n);
+        dspMixRef(t.ref, t.b, n);
+        exact = exact && memcmp(t.out, t.ref, n * sizeof(int16_t)) == 0;
+    }
+    uint32_t start = clock();
+    for (int round = 0; round < TIMING_ROUNDS; round++) {
+        dspMix(t.out, t.b, TEST_SAMPLES);
+    }
+    const float fast = perSample(clock, start, TEST_SAMPLES);
+    start = clock();
+    for (int round = 0; round < TIMING_ROUNDS; round++) {
+        dspMixRef(t.ref, t.b, TEST_SAMPLES);
+    }
+    record(result, "mix", DSP_KERNEL_MIX, exact, fast, perSample(clock, start, TEST_SAMPLES));
+}
+
+static void checkPeak(const TestBuffers& t, DspClock clock, DspKernelResult& result) {
+    // Full-scale input, a quiet one, and one whose peak is a lone negative sample in the tail
+    fillTest(t.out, TEST_SAMPLES, 7);
+    dspScaleRef(t.out, TEST_SAMPLES, 1000);
+    memcpy(t.ref, t.out, TEST_SAMPLES * sizeof(int16_t));
+    t.ref[TEST_SAMPLES - 2] = -30000;
+    const int16_t* inputs[] = {t.a, t.out, t.ref};
+    bool exact = true;
+    int16_t sink = 0;
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+        for (size_t n = TAIL_SAMPLES; n <= TEST_SAMPLES; n += TEST_SAMPLES - TAIL_SAMPLES) {
+            exact = exact && dspPeak(inputs[i], n) == dspPeakRef(inputs[i], n);
+        }
+    }
+    uint32_t start = clock();
+    for (int round = 0; round < TIMING_ROUNDS; round++) {
+        sink ^= dspPeak(t.a, TEST_SAMPLES);
+    }
+    const float fast = perSample(clock, start, TEST_SAMPLES);
+    start = clock();
+    for (int round = 0; round < TIMING_ROUNDS; round++) {
+        sink ^= dspPeakRef(t.a, TEST_SAMPLES);
+    }
+    t.out[0] = sink; // Keeps the timed calls from being optimized away
+    record(result, "peak", DSP_KERNEL_PEAK, exact, fast, perSample(clock, start, TEST_SAMPLES));
+}
+
+static void checkDot(const TestBuffers& t, DspClock clock, DspKernelResult& result) {
+    bool exact = true;
+    int32_t sink = 0;
+    for (size_t i = 0; i < sizeof(TEST_SHIFTS) / sizeof(TEST_SHIFTS[0]); i++) {
+        // a.a is all positive and saturates at shift 0; a.b mixes signs
+        exact = exact && dspDot(t.a, t.a, TEST_SAMPLES, TEST_SHIFTS[i]) == dspDotRef(t.a, t.a, TEST_SAMPLES, TEST_SHIFTS[i]);
+        exact = exact && dspDot(t.a, t.b, TEST_SAMPLES, TEST_SHIFTS[i]) == dspDotRef(t.a, t.b, TEST_SAMPLES, TEST_SHIFTS[i]);
+    }
+    uint32_t start = clock();
+    for (int round = 0; round < TIMING_ROUNDS; round++) {
+        sink ^= dspDot(t.a, t.b, TEST_SAMPLES, 15);
+    }
+    const float fast = perSample(clock, start, TEST_SAMPLES);
+    start = clock();
+    for (int round = 0; round < TIMING_ROUNDS; round++) {
+        sink ^= dspDotRef(t.a, t.b, TEST_SAMPLES, 15);
+    }
+    t.out[0] = (int16_t)sink;
+    record(result, "dot", DSP_KERNEL_DOT, exact, fast, perSample(clock, start, TEST_SAMPLES));
+}
+
+// Timed per output sample, which takes FIR_TAPS multiply-accumulates
+static void checkFir(const TestBuffers& t, DspClock clock, DspKernelResult& result) {
+    int16_t coeffs[FIR_TAPS];
+    fillTest(coeffs, FIR_TAPS, 3);
+    dspScaleRef(coeffs, FIR_TAPS, 4096); // Mostly below full scale, with some saturation left
+    DspFir fir;
+    DspFir ref;
+    dspFirInit(fir, coeffs, FIR_TAPS, t.phases, t.history);
+    dspFirInit(ref, coeffs, FIR_TAPS, t.phases, t.refHistory);
+    // Odd block lengths, so the newest sample lands on every phase
+    for (size_t done = 0; done < TEST_SAMPLES; ) {
+        const size_t n = TEST_SAMPLES - done < 13 ? TEST_SAMPLES - done : 13;
+        dspFir(fir, t.a + done, t.out + done, n);
+        dspFirRef(ref, t.a + done, t.ref + done, n);
+        done += n;
+    }
+    const bool exact = memcmp(t.out, t.ref, TEST_SAMPLES * sizeof(int16_t)) == 0;
+    DspFir scratch = fir;
+    uint32_t start = clock();
+    for (int round = 0; round < TIMING_ROUNDS; round++) {
+        dspFir(scratch, t.b, t.out, TEST_SAMPLES);
+    }
+    const float fast = perSample(clock, start, TEST_SAMPLES);
+    start = clock();
+    for (int round = 0; round < TIMING_ROUNDS; round++) {
+        dspFirRef(scratch, t.b, t.ref, TEST_SAMPLES);
+    }
+    record(result, "fir15", DSP_KERNEL_DOT, exact, fast, perSample(clock, start, TEST_SAMPLES));
+}
+
+size_t dspSelfTest(DspClock clock, void* workspace, size_t bytes, DspKernelResult* results, size_t capacity) {
+    static constexpr size_t firHistory = alignedSamples(dspFirHistorySamples(FIR_TAPS));
+    static_assert((4 * TEST_SAMPLES + dspFirPhaseSamples(FIR_TAPS) + 2 * firHistory) * sizeof(int16_t) <= DSP_SELF_TEST_BYTES,
+                  "DSP_SELF_TEST_BYTES is too small for the test buffers");
+    if (!dspAligned(workspace) || bytes < DSP_SELF_TEST_BYTES || capacity < DSP_KERNEL_COUNT + 1) {
+        return 0;
+    }
+    int16_t* next = (int16_t*)workspace;
+    TestBuffers t;
+    t.a = next;
+    t.b = next += TEST_SAMPLES;
+    t.out = next += TEST_SAMPLES;
+    t.ref = next += TEST_SAMPLES;
+    t.phases = next += TEST_SAMPLES;
+    t.history = next += dspFirPhaseSamples(FIR_TAPS);
+    t.refHistory = next + firHistory;
+    fillTest(t.a, TEST_SAMPLES, 1);
+    fillTest(t.b, TEST_SAMPLES, 2);
+
+    checkScale(t, clock, results[0]);
+    checkRamp(t, clock, results[1]);
+    checkMix(t, clock, results[2]);
+    checkPeak(t, clock, results[3]);
+    checkDot(t, clock, results[4]);
+    checkFir(t, clock, results[5]);
+    return DSP_KERNEL_COUNT + 1;
+}
@@ -0,0 +1,85 @@
+#include "heap_track.h"
+
+#include <new>
+#include <stdlib.h>
+
+// Per thread, so other tasks' allocations never land in a turn's count and no locking is needed
+static __thread bool tracking = false;
+static __thread HeapTrackStats stats;
+
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* pointer, size_t size);
+void __real_free(void* pointer);
+
+void* __wrap_malloc(size_t size) {
+    if (tracking) {
+        stats.allocations++;
+        stats.bytes += size;
+    }
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    if (tracking) {
+        stats.allocations++;
+        stats.bytes += count * size;
+    }
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* pointer, size_t size) {
+    void* moved = __real_realloc(pointer, size);
+    if (tracking && (pointer == NULL || moved != pointer)) {
+        stats.allocations++;
+        stats.bytes += size;
+    }
+    return moved;
+}
+
+void __wrap_free(void* pointer) {
+    if (tracking && pointer != NULL) {
+        stats.frees++;
+    }
+    __real_free(pointer);
+}
+}
+
+// libstdc++'s own operator new calls malloc from inside a prebuilt library (a shared one on the
+// host), out of reach of --wrap; these make sure C++ allocations are counted as well
+void* operator new(size_t size) {
+    void* pointer = malloc(size ? size : 1);
+    if (pointer == NULL) {
+        abort(); // Built without exceptions on the device
+    }
+    return pointer;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return malloc(size ? size : 1); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return malloc(size ? size : 1); }
+void operator delete(void* pointer) noexcept { free(pointer); }
+void operator delete[](void* pointer) noexcept { free(pointer); }
+void operator delete(void* pointer, size_t) noexcept { free(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { free(pointer); }
+
+bool heapTrackAvailable() {
+    static int available = -1;
+    if (available < 0) {
+        heapTrackBegin();
+        void* volatile probe = malloc(1); // volatile: the pair must not be optimized away
+        free(probe);
+        available = heapTrackEnd().allocations == 1;
+    }
+    return available == 1;
+}
+
+void heapTrackBegin() {
+    stats = HeapTrackStats();
+    tracking = true;
+}
+
+HeapTrackStats heapTrackEnd() {
+    tracking = false;
+    return stats;
+}
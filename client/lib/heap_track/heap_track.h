@@ -0,0 +1,33 @@
+#pragma once
+
+// =================================================================================================
+// HEAP ALLOCATION TRACKING
+// Counts the heap allocations made by one thread between heapTrackBegin() and heapTrackEnd(), so
+// a voice turn can check that it runs without touching the heap once warmed up. The counting
+// hooks wrap malloc, calloc, realloc and free at link time; both PlatformIO environments link
+// with
+//     -Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc -Wl,--wrap=free
+// (GNU ld). operator new/delete are routed through them too. Allocations made inside a shared C
+// library on the host, or by other tasks (lwIP's tcpip task, the Wi-Fi driver) on the device,
+// are not counted: the budget covers the code the turn itself runs.
+// Portable (no Arduino dependencies) for the native build.
+// =================================================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct HeapTrackStats {
+    uint32_t allocations;   // malloc/calloc/new calls, plus reallocs that moved or grew a block
+    uint32_t frees;
+    uint32_t bytes;         // Requested by those allocations
+};
+
+// True if the link-time hooks are in place (counting works). Checked once with a probe
+// allocation, so call it outside the code being measured.
+bool heapTrackAvailable();
+
+// Starts counting the calling thread's allocations from zero
+void heapTrackBegin();
+
+// Stops counting and returns what the calling thread allocated since heapTrackBegin()
+HeapTrackStats heapTrackEnd();
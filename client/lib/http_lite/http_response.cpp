@@ -0,0 +1,246 @@
+#include "http_response.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Chunk sizes past this many hex digits (256 MB) are treated as malformed
+static const uint8_t MAX_CHUNK_DIGITS = 7;
+
+static int hexValue(uint8_t c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// True if the comma-separated header value contains 'token' (case-insensitive)
+static bool hasToken(const char* value, const char* token) {
+    const size_t length = strlen(token);
+    for (const char* p = value; *p; ) {
+        while (*p == ' ' || *p == ',') p++;
+        if (strncasecmp(p, token, length) == 0 && (p[length] == '\0' || p[length] == ',' || p[length] == ' ')) {
+            return true;
+        }
+        while (*p && *p != ',') p++;
+    }
+    return false;
+}
+
+HttpResponse::HttpResponse() : _watchCount(0) {
+    reset();
+}
+
+bool HttpResponse::watch(const char* name, char* value, size_t capacity) {
+    if (_watchCount == HTTP_WATCH_MAX || capacity == 0) {
+        return false;
+    }
+    _watches[_watchCount++] = {name, value, capacity};
+    value[0] = '\0';
+    return true;
+}
+
+void HttpResponse::clearWatches() {
+    _watchCount = 0;
+}
+
+void HttpResponse::reset() {
+    for (size_t i = 0; i < _watchCount; i++) {
+        _watches[i].value[0] = '\0';
+    }
+    _lineFill = 0;
+    _statusSeen = false;
+    _status = 0;
+    _keepAlive = false;
+    _chunked = false;
+    _contentLength = -1;
+    _bodyReceived = 0;
+    _chunkState = CHUNK_SIZE;
+    _chunkRemaining = 0;
+    _chunkDigits = 0;
+    _failed = false;
+}
+
+// Handles one complete line of the head (in _line, CR stripped)
+bool HttpResponse::headerLine() {
+    if (!_statusSeen) {
+        // "HTTP/1.x NNN reason"
+        if (strncmp(_line, "HTTP/1.", 7) != 0 || _line[7] < '0' || _line[7] > '9' || _line[8] != ' ') {
+            return false;
+        }
+        _status = atoi(_line + 9);
+        _statusSeen = true;
+        _keepAlive = _line[7] >= '1'; // HTTP/1.0 closes unless it says otherwise
+        return true;
+    }
+    char* colon = strchr(_line, ':');
+    if (colon == NULL) {
+        return true;
+    }
+    *colon = '\0';
+    const char* value = colon + 1;
+    while (*value == ' ' || *value == '\t') value++;
+
+    if (strcasecmp(_line, "Content-Length") == 0) {
+        _contentLength = strtol(value, NULL, 10);
+    } else if (strcasecmp(_line, "Transfer-Encoding") == 0) {
+        _chunked = hasToken(value, "chunked");
+    } else if (strcasecmp(_line, "Connection") == 0) {
+        if (hasToken(value, "close")) {
+            _keepAlive = false;
+        } else if (hasToken(value, "keep-alive")) {
+            _keepAlive = true;
+        }
+    }
+    for (size_t i = 0; i < _watchCount; i++) {
+        if (strcasecmp(_line, _watches[i].name) == 0) {
+            strncpy(_watches[i].value, value, _watches[i].capacity - 1);
+            _watches[i].value[_watches[i].capacity - 1] = '\0';
+        }
+    }
+    return true;
+}
+
+HttpHeadState HttpResponse::feedHead(const uint8_t* data, size_t length, size_t* consumed) {
+    for (size_t i = 0; i < length; i++) {
+        const uint8_t c = data[i];
+        if (c == '\r') {
+            continue;
+        }
+        if (c != '\n') {
+            if (_lineFill < HTTP_LINE_MAX) {
+                _line[_lineFill++] = (char)c;
+            }
+            continue;
+        }
+        _line[_lineFill] = '\0';
+        const bool blank = _lineFill == 0;
+        _lineFill = 0;
+        if (!blank) {
+            if (!headerLine()) {
+                *consumed = i + 1;
+                return HTTP_HEAD_FAILED;
+            }
+            continue;
+        }
+        if (!_statusSeen) {
+            continue; // Stray CRLF before the status line
+        }
+        if (_status >= 100 && _status < 200) {
+            // Interim response (100 Continue): the real one follows
+            reset();
+            continue;
+        }
+        if (_status == 204 || _status == 304) {
+            _contentLength = 0;
+            _chunked = false;
+        }
+        if (_chunked) {
+            _contentLength = -1;
+        }
+        *consumed = i + 1;
+        return HTTP_HEAD_DONE;
+    }
+    *consumed = length;
+    return HTTP_HEAD_PENDING;
+}
+
+size_t HttpResponse::decodeBody(uint8_t* data, size_t length) {
+    if (!_chunked) {
+        if (_contentLength >= 0 && (long)length > _contentLength - _bodyReceived) {
+            length = (size_t)(_contentLength - _bodyReceived);
+        }
+        _bodyReceived += (long)length;
+        return length;
+    }
+
+    size_t out = 0;
+    for (size_t i = 0; i < length && !_failed && _chunkState != CHUNK_DONE; ) {
+        const uint8_t c = data[i];
+        switch (_chunkState) {
+            case CHUNK_SIZE: {
+                const int digit = hexValue(c);
+                if (digit >= 0) {
+                    if (++_chunkDigits > MAX_CHUNK_DIGITS) {
+                        _failed = true;
+                    }
+                    _chunkRemaining = _chunkRemaining * 16 + digit;
+                } else if (c == '\n' && _chunkDigits > 0) {
+                    _chunkState = _chunkRemaining > 0 ? CHUNK_DATA : CHUNK_TRAILER;
+                } else if ((c == ';' || c == ' ' || c == '\t') && _chunkDigits > 0) {
+                    _chunkState = CHUNK_EXTENSION;
+                } else if (c != '\r') {
+                    _failed = true;
+                }
+                i++;
+                break;
+            }
+            case CHUNK_EXTENSION:
+                if (c == '\n') {
+                    _chunkState = _chunkRemaining > 0 ? CHUNK_DATA : CHUNK_TRAILER;
+                }
+                i++;
+                break;
+            case CHUNK_DATA: {
+                size_t take = length - i;
+                if (take > _chunkRemaining) {
+                    take = _chunkRemaining;
+                }
+                if (out != i) {
+                    memmove(data + out, data + i, take);
+                }
+                out += take;
+                i += take;
+                _chunkRemaining -= (uint32_t)take;
+                _bodyReceived += (long)take;
+                if (_chunkRemaining == 0) {
+                    _chunkState = CHUNK_DATA_END;
+                }
+                break;
+            }
+            case CHUNK_DATA_END:
+                if (c == '\n') {
+                    _chunkState = CHUNK_SIZE;
+                    _chunkDigits = 0;
+                } else if (c != '\r') {
+                    _failed = true;
+                }
+                i++;
+                break;
+            case CHUNK_TRAILER:
+                if (c == '\n') {
+                    _chunkState = CHUNK_DONE;
+                } else if (c != '\r') {
+                    _chunkState = CHUNK_TRAILER_LINE;
+                }
+                i++;
+                break;
+            case CHUNK_TRAILER_LINE:
+                if (c == '\n') {
+                    _chunkState = CHUNK_TRAILER;
+                }
+                i++;
+                break;
+            case CHUNK_DONE:
+                break;
+        }
+    }
+    return out;
+}
+
+size_t HttpResponse::payloadRemaining() const {
+    if (_failed) {
+        return 0;
+    }
+    if (!_chunked) {
+        return _contentLength < 0 ? SIZE_MAX : (size_t)(_contentLength - _bodyReceived);
+    }
+    return _chunkState == CHUNK_DATA ? _chunkRemaining : 0;
+}
+
+bool HttpResponse::bodyComplete() const {
+    if (_chunked) {
+        return _chunkState == CHUNK_DONE;
+    }
+    return _contentLength >= 0 && _bodyReceived >= _contentLength;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+// =================================================================================================
+// HTTP/1.1 RESPONSE PARSER
+// Reads a response head and body from arbitrary-sized network chunks into fixed buffers, for a
+// voice turn that reuses one kept-alive connection and never touches the heap (HTTPClient
+// builds Strings for the URL, every header and every response line). Tracks what is needed to
+// reuse the connection: the body's end (Content-Length or chunked encoding, which is undone in
+// place) and whether the server keeps the connection open. The values of a few headers chosen
+// with watch() are copied out; all others are skipped.
+// Portable (no Arduino dependencies) for the native build. No heap allocation.
+// =================================================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Longest header line looked at; the rest of a longer line is skipped
+const size_t HTTP_LINE_MAX = 256;
+const size_t HTTP_WATCH_MAX = 4;
+
+enum HttpHeadState {
+    HTTP_HEAD_PENDING,
+    HTTP_HEAD_DONE,
+    HTTP_HEAD_FAILED    // Not an HTTP/1.x response
+};
+
+class HttpResponse {
+public:
+    HttpResponse();
+
+    // Copies the value of header 'name' into 'value' (NUL-terminated, truncated to 'capacity';
+    // empty if the response has no such header). Applies to every response until clearWatches().
+    bool watch(const char* name, char* value, size_t capacity);
+    void clearWatches();
+
+    // Before each response
+    void reset();
+
+    // Consumes bytes of the response head. '*consumed' is how many were used: once the head is
+    // complete, the rest of 'data' is the start of the body.
+    HttpHeadState feedHead(const uint8_t* data, size_t length, size_t* consumed);
+
+    // Takes raw body bytes and returns how many payload bytes are now at the start of 'data'
+    // (chunk framing removed in place; bytes past the body's end dropped).
+    size_t decodeBody(uint8_t* data, size_t length);
+
+    int status() const { return _status; }
+    bool chunked() const { return _chunked; }
+    // -1 if the body runs until the connection closes
+    long contentLength() const { return _contentLength; }
+    bool bodyComplete() const;
+    // Body bytes from here on that are all payload: the rest of the current chunk, or of a
+    // Content-Length body (SIZE_MAX if it runs until the connection closes). 0 while chunk
+    // framing comes next. Reading no more than this lets the payload be received in place,
+    // where decodeBody() leaves it unmoved.
+    size_t payloadRemaining() const;
+    // Malformed chunk framing; the connection can't be trusted any more
+    bool failed() const { return _failed; }
+    // The connection can carry the next request once the body is complete
+    bool reusable() const { return _keepAlive && !_failed && bodyComplete(); }
+
+private:
+    enum ChunkState {
+        CHUNK_SIZE,
+        CHUNK_EXTENSION,    // ";name=value" after the size, ignored
+        CHUNK_DATA,
+        CHUNK_DATA_END,     // CRLF after the data
+        CHUNK_TRAILER,      // Start of a trailer line (an empty one ends the body)
+        CHUNK_TRAILER_LINE,
+        CHUNK_DONE
+    };
+
+    struct Watch {
+        const char* name;
+        char* value;
+        size_t capacity;
+    };
+
+    bool headerLine();
+
+    Watch _watches[HTTP_WATCH_MAX];
+    size_t _watchCount;
+
+    char _line[HTTP_LINE_MAX + 1];
+    size_t _lineFill;
+    bool _statusSeen;
+    int _status;
+    bool _keepAlive;
+    bool _chunked;
+    long _contentLength;
+    long _bodyReceived;
+    ChunkState _chunkState;
+    uint32_t _chunkRemaining;
+    uint8_t _chunkDigits;
+    bool _failed;
+};
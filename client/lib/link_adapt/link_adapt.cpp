@@ -0,0 +1,135 @@
+#include "link_adapt.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <trinity_protocol.h>
+
+const LinkMode LINK_MODES[] = {
+    {TRINITY_CODEC_PCM16, 16000, 32000},
+    {TRINITY_CODEC_ADPCM, 16000, 8000},
+    {TRINITY_CODEC_ADPCM, 8000, 4000},
+};
+const size_t LINK_MODE_COUNT = sizeof(LINK_MODES) / sizeof(LINK_MODES[0]);
+
+// Uploads must run this many times faster than real time (a 6 s recording in 1.5 s)
+static const float UPLINK_HEADROOM = 4.0f;
+// Downloads need margin over the playback rate so the playback buffer never starves
+static const float DOWNLINK_HEADROOM = 2.0f;
+// A better mode must fit with this much extra margin...
+static const float UPGRADE_MARGIN = 1.5f;
+// ...for this many consecutive turns before switching up
+static const uint8_t UPGRADE_TURNS = 3;
+// Weight of a better-than-estimate measurement in the smoothed estimates
+static const float EWMA_ALPHA = 0.4f;
+// Below this signal strength the link is too unstable to step up at all
+static const int RSSI_WEAK_DBM = -80;
+
+// True if 'item' is one of the comma-separated entries of 'list'
+static bool listContains(const char* list, const char* item) {
+    const size_t length = strlen(item);
+    for (const char* p = list; p && *p; ) {
+        const char* end = strchr(p, ',');
+        const size_t entry = end ? (size_t)(end - p) : strlen(p);
+        if (entry == length && strncmp(p, item, length) == 0) {
+            return true;
+        }
+        p = end ? end + 1 : NULL;
+    }
+    return false;
+}
+
+LinkAdapter::LinkAdapter() : _rttMs(0), _switches(0) {
+    // Until allow() is called (no handshake), only the protocol 1 format is safe
+    for (size_t i = 0; i < LINK_MODE_COUNT; i++) {
+        _allowed[i] = (i == 0);
+    }
+    _uplink = {0, 0, 0};
+    _downlink = {0, 0, 0};
+}
+
+void LinkAdapter::allow(const char* codecs, const char* rates) {
+    for (size_t i = 0; i < LINK_MODE_COUNT; i++) {
+        char rate[12];
+        snprintf(rate, sizeof(rate), "%u", (unsigned)LINK_MODES[i].rate);
+        _allowed[i] = listContains(codecs, LINK_MODES[i].codec) && listContains(rates, rate);
+    }
+    // pcm16 at the top rung always works, even against a server that allows nothing else
+    _allowed[0] = true;
+    if (!_allowed[_uplink.mode]) _uplink.mode = 0;
+    if (!_allowed[_downlink.mode]) _downlink.mode = 0;
+}
+
+size_t LinkAdapter::findMode(const char* codec, uint32_t rate) const {
+    for (size_t i = 0; i < LINK_MODE_COUNT; i++) {
+        if (_allowed[i] && LINK_MODES[i].rate == rate && strcmp(LINK_MODES[i].codec, codec) == 0) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+void LinkAdapter::start(const char* uplinkCodec, uint32_t uplinkRate, const char* downlinkCodec, uint32_t downlinkRate) {
+    _uplink.mode = findMode(uplinkCodec, uplinkRate);
+    _downlink.mode = findMode(downlinkCodec, downlinkRate);
+}
+
+size_t LinkAdapter::betterMode(size_t mode) const {
+    for (size_t i = mode; i-- > 0; ) {
+        if (_allowed[i]) return i;
+    }
+    return mode;
+}
+
+size_t LinkAdapter::worseMode(size_t mode) const {
+    for (size_t i = mode + 1; i < LINK_MODE_COUNT; i++) {
+        if (_allowed[i]) return i;
+    }
+    return mode;
+}
+
+bool LinkAdapter::adapt(Direction& direction, float measured, float headroom, bool allowUpgrade) {
+    if (measured <= 0) {
+        return false;
+    }
+    // Fast attack, slow release: a worse turn takes effect at once, better ones are averaged in
+    direction.estimate = (direction.estimate > 0 && measured > direction.estimate)
+        ? EWMA_ALPHA * measured + (1 - EWMA_ALPHA) * direction.estimate
+        : measured;
+
+    // Step down right away (possibly several rungs) while the current mode doesn't fit
+    const size_t before = direction.mode;
+    while (direction.estimate < LINK_MODES[direction.mode].bytesPerSecond * headroom &&
+           worseMode(direction.mode) != direction.mode) {
+        direction.mode = worseMode(direction.mode);
+    }
+    if (direction.mode != before) {
+        direction.upgradeStreak = 0;
+        return true;
+    }
+
+    // Step up one rung after the better mode has fit with margin for UPGRADE_TURNS turns
+    const size_t better = betterMode(direction.mode);
+    if (better != direction.mode && allowUpgrade &&
+        direction.estimate >= LINK_MODES[better].bytesPerSecond * headroom * UPGRADE_MARGIN) {
+        if (++direction.upgradeStreak >= UPGRADE_TURNS) {
+            direction.mode = better;
+            direction.upgradeStreak = 0;
+            return true;
+        }
+    } else {
+        direction.upgradeStreak = 0;
+    }
+    return false;
+}
+
+bool LinkAdapter::update(const LinkSample& sample) {
+    if (sample.rttMs > 0) {
+        _rttMs = _rttMs > 0 ? EWMA_ALPHA * sample.rttMs + (1 - EWMA_ALPHA) * _rttMs : sample.rttMs;
+    }
+    const bool allowUpgrade = sample.rssiDbm == 0 || sample.rssiDbm > RSSI_WEAK_DBM;
+    const bool uplinkSwitched = adapt(_uplink, sample.uplinkBytesPerSec, UPLINK_HEADROOM, allowUpgrade);
+    const bool downlinkSwitched = adapt(_downlink, sample.downlinkBytesPerSec, DOWNLINK_HEADROOM, allowUpgrade);
+    _switches += (uplinkSwitched ? 1 : 0) + (downlinkSwitched ? 1 : 0);
+    return uplinkSwitched || downlinkSwitched;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+// =================================================================================================
+// LINK ADAPTATION
+// Picks the uplink and downlink audio formats for the next voice turn from the goodput measured
+// in previous turns. Each direction walks a ladder of formats (best quality first): it steps
+// down as soon as the smoothed goodput can't carry the current format, but only steps up
+// after the better format has fit comfortably for several turns in a row, so a noisy link
+// doesn't make it flap. Portable (no Arduino dependencies) for the native build.
+// =================================================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct LinkMode {
+    const char* codec;
+    uint32_t rate;
+    uint32_t bytesPerSecond;   // Encoded audio bytes per second of speech
+};
+
+// Best quality first
+extern const LinkMode LINK_MODES[];
+extern const size_t LINK_MODE_COUNT;
+
+// Measurements from one voice turn. A direction without a usable measurement (e.g. a body
+// too small to fill the TCP send buffer) passes 0 and keeps its previous estimate.
+struct LinkSample {
+    float uplinkBytesPerSec;
+    float downlinkBytesPerSec;
+    float rttMs;
+    int rssiDbm;
+};
+
+class LinkAdapter {
+public:
+    LinkAdapter();
+
+    // Restricts the ladder to the codecs and rates agreed in the capability handshake
+    // (comma-separated lists). Modes outside them are never chosen.
+    void allow(const char* codecs, const char* rates);
+
+    // Starts each direction at the given format if it is on the ladder.
+    void start(const char* uplinkCodec, uint32_t uplinkRate, const char* downlinkCodec, uint32_t downlinkRate);
+
+    // Feeds one turn's measurements and updates both directions. Returns true if either switched.
+    bool update(const LinkSample& sample);
+
+    const LinkMode& uplink() const { return LINK_MODES[_uplink.mode]; }
+    const LinkMode& downlink() const { return LINK_MODES[_downlink.mode]; }
+    float uplinkEstimate() const { return _uplink.estimate; }
+    float downlinkEstimate() const { return _downlink.estimate; }
+    float rttEstimate() const { return _rttMs; }
+    uint32_t switches() const { return _switches; }
+
+private:
+    struct Direction {
+        size_t mode;            // Index into LINK_MODES
+        float estimate;         // Conservative goodput, bytes/s (0 = no measurement yet)
+        uint8_t upgradeStreak;  // Consecutive turns in which the next better mode fit
+    };
+
+    bool adapt(Direction& direction, float measured, float headroom, bool allowUpgrade);
+    size_t betterMode(size_t mode) const;
+    size_t worseMode(size_t mode) const;
+    size_t findMode(const char* codec, uint32_t rate) const;
+
+    bool _allowed[8];
+    Direction _uplink;
+    Direction _downlink;
+    float _rttMs;
+    uint32_t _switches;
+};
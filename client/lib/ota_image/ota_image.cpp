@@ -0,0 +1,278 @@
+#include "ota_image.h"
+
+#include <string.h>
+
+// Reflected CRC-32 with a nibble table: a quarter of the bitwise loop's work for 64 bytes of
+// table, which matters over a whole image (and a whole base) on every update
+static const uint32_t CRC32_NIBBLES[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+};
+
+uint32_t otaCrc32(uint32_t crc, const uint8_t* data, size_t length) {
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ CRC32_NIBBLES[crc & 0x0F];
+        crc = (crc >> 4) ^ CRC32_NIBBLES[crc & 0x0F];
+    }
+    return ~crc;
+}
+
+static uint32_t readLe32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static size_t smallest(size_t a, size_t b) {
+    return a < b ? a : b;
+}
+
+OtaDecoder::OtaDecoder() {
+    begin(NULL);
+}
+
+void OtaDecoder::begin(OtaTarget* target) {
+    _target = target;
+    _status = OTA_MORE;
+    _headerFill = 0;
+    memset(&_header, 0, sizeof(_header));
+    _consumed = 0;
+    _payloadConsumed = 0;
+    _state = READ_TAG;
+    _op = OTA_OP_LITERAL;
+    _length = 0;
+    _varint = 0;
+    _varintShift = 0;
+    _baseCursor = 0;
+    _decoded = 0;
+    _flushed = 0;
+    _crc = 0;
+}
+
+OtaStatus OtaDecoder::feed(const uint8_t* data, size_t length) {
+    size_t i = 0;
+    while (_status == OTA_MORE && i < length) {
+        if (_headerFill < OTA_HEADER_BYTES) {
+            const size_t n = smallest(OTA_HEADER_BYTES - _headerFill, length - i);
+            memcpy(_headerBytes + _headerFill, data + i, n);
+            _headerFill += n;
+            _consumed += n;
+            i += n;
+            if (_headerFill == OTA_HEADER_BYTES) {
+                _status = readHeader();
+                if (_status == OTA_MORE && _header.payloadBytes == 0) {
+                    _status = finish();
+                }
+            }
+            continue;
+        }
+        if (_payloadConsumed == _header.payloadBytes) {
+            _status = OTA_CORRUPT;      // Past the end of the payload
+            break;
+        }
+        if (_state == READ_LITERAL) {
+            // As many of the literal's bytes as arrived, straight from the caller's buffer
+            const size_t n = smallest(smallest(_length, length - i), _header.payloadBytes - _payloadConsumed);
+            append(data + i, n);
+            _length -= n;
+            if (_length == 0) {
+                _state = READ_TAG;
+            }
+            _consumed += n;
+            _payloadConsumed += n;
+            i += n;
+        } else {
+            _consumed++;
+            _payloadConsumed++;
+            _status = step(data[i++]);
+        }
+        if (_status == OTA_MORE && _payloadConsumed == _header.payloadBytes) {
+            _status = finish();
+        }
+    }
+    return _status;
+}
+
+OtaStatus OtaDecoder::readHeader() {
+    const uint8_t* h = _headerBytes;
+    if (readLe32(h) != OTA_MAGIC || h[4] != OTA_VERSION || (h[5] & ~OTA_FLAG_DELTA) != 0 ||
+        (h[6] | (h[7] << 8)) != (int)OTA_HEADER_BYTES || readLe32(h + 28) != otaCrc32(0, h, 28)) {
+        return OTA_BAD_HEADER;
+    }
+    _header.version = h[4];
+    _header.flags = h[5];
+    _header.imageBytes = readLe32(h + 8);
+    _header.imageCrc = readLe32(h + 12);
+    _header.baseBytes = readLe32(h + 16);
+    _header.baseCrc = readLe32(h + 20);
+    _header.payloadBytes = readLe32(h + 24);
+
+    if (_header.flags & OTA_FLAG_DELTA) {
+        uint32_t crc;
+        if (!_target->baseCrc(_header.baseBytes, &crc) || crc != _header.baseCrc) {
+            return OTA_BASE_MISMATCH;
+        }
+    }
+    return _target->start(_header) ? OTA_MORE : OTA_TARGET_FAILED;
+}
+
+OtaStatus OtaDecoder::step(uint8_t byte) {
+    if (_state == READ_TAG) {
+        _op = byte >> OTA_TAG_LENGTH_BITS;
+        if (_op > OTA_OP_BASE_COPY || (_op == OTA_OP_BASE_COPY && !(_header.flags & OTA_FLAG_DELTA))) {
+            return OTA_CORRUPT;
+        }
+        _length = byte & ((1 << OTA_TAG_LENGTH_BITS) - 1);
+        _varint = 0;
+        _varintShift = 0;
+        if (_length == OTA_TAG_LENGTH_MORE) {
+            _state = READ_LENGTH;
+            return OTA_MORE;
+        }
+    } else {
+        // A varint byte: 7 bits of value, low bits first, more to come while the top bit is set
+        if (_varintShift > 28 || (_varintShift == 28 && (byte & 0x70) != 0)) {
+            return OTA_CORRUPT;
+        }
+        _varint |= (uint32_t)(byte & 0x7F) << _varintShift;
+        _varintShift += 7;
+        if (byte & 0x80) {
+            return OTA_MORE;
+        }
+        if (_state == READ_ARGUMENT) {
+            return opReady();
+        }
+        if (_varint > UINT32_MAX - OTA_TAG_LENGTH_MORE - OTA_MIN_COPY) {
+            return OTA_CORRUPT;
+        }
+        _length += _varint;
+    }
+
+    // The length is complete
+    if (_op == OTA_OP_LITERAL) {
+        _length += OTA_MIN_LITERAL;
+        _state = READ_LITERAL;
+    } else {
+        _length += OTA_MIN_COPY;
+        _varint = 0;
+        _varintShift = 0;
+        _state = READ_ARGUMENT;
+    }
+    return OTA_MORE;
+}
+
+OtaStatus OtaDecoder::opReady() {
+    _state = READ_TAG;
+    if (_op == OTA_OP_IMAGE_COPY) {
+        return copyImage(_varint, _length);
+    }
+    const int32_t delta = (int32_t)(_varint >> 1) ^ -(int32_t)(_varint & 1);     // Zigzag
+    return copyBase(delta, _length);
+}
+
+OtaStatus OtaDecoder::copyImage(uint32_t distance, uint32_t length) {
+    if (distance == 0 || distance > _decoded || length > _header.imageBytes - _decoded) {
+        return OTA_CORRUPT;
+    }
+    const uint32_t from = _decoded - distance;
+    if (distance < OTA_COPY_BYTES) {
+        // Overlapping (runs of padding, repeated patterns): the source repeats every 'distance'
+        // bytes, so read it once, repeat it through the copy buffer and write that out whole
+        const size_t inFlash = from < _flushed ? smallest(distance, _flushed - from) : 0;
+        if (inFlash > 0 && !_target->readImage(from, _copy, inFlash)) {
+            return OTA_TARGET_FAILED;
+        }
+        memcpy(_copy + inFlash, _stage + (from + inFlash - _flushed), distance - inFlash);
+        const size_t period = OTA_COPY_BYTES / distance * distance;
+        for (size_t i = distance; i < period; i++) {
+            _copy[i] = _copy[i - distance];
+        }
+        while (length > 0) {
+            const size_t n = smallest(length, period);
+            if (!append(_copy, n)) {
+                return _status;
+            }
+            length -= n;
+        }
+        return OTA_MORE;
+    }
+    for (uint32_t at = from; length > 0;) {
+        // Older bytes are in flash, newer ones still in the stage
+        const size_t n = smallest(length, OTA_COPY_BYTES);
+        const size_t inFlash = at < _flushed ? smallest(n, _flushed - at) : 0;
+        if (inFlash > 0 && !_target->readImage(at, _copy, inFlash)) {
+            return OTA_TARGET_FAILED;
+        }
+        memcpy(_copy + inFlash, _stage + (at + inFlash - _flushed), n - inFlash);
+        if (!append(_copy, n)) {
+            return _status;
+        }
+        at += n;
+        length -= n;
+    }
+    return OTA_MORE;
+}
+
+OtaStatus OtaDecoder::copyBase(int32_t delta, uint32_t length) {
+    const int64_t start = (int64_t)_baseCursor + delta;
+    if (start < 0 || start + length > _header.baseBytes || length > _header.imageBytes - _decoded) {
+        return OTA_CORRUPT;
+    }
+    _baseCursor = (uint32_t)start + length;
+    for (uint32_t at = (uint32_t)start; length > 0;) {
+        const size_t n = smallest(length, OTA_COPY_BYTES);
+        if (!_target->readBase(at, _copy, n)) {
+            return OTA_TARGET_FAILED;
+        }
+        if (!append(_copy, n)) {
+            return _status;
+        }
+        at += n;
+        length -= n;
+    }
+    return OTA_MORE;
+}
+
+// Adds decoded bytes to the stage, writing it out whenever it fills. On failure _status says why.
+bool OtaDecoder::append(const uint8_t* data, size_t length) {
+    if (length > _header.imageBytes - _decoded) {
+        _status = OTA_CORRUPT;
+        return false;
+    }
+    while (length > 0) {
+        const size_t fill = _decoded - _flushed;
+        const size_t n = smallest(length, OTA_STAGE_BYTES - fill);
+        memcpy(_stage + fill, data, n);
+        _decoded += n;
+        data += n;
+        length -= n;
+        if (_decoded - _flushed == OTA_STAGE_BYTES && !flushStage()) {
+            _status = OTA_TARGET_FAILED;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool OtaDecoder::flushStage() {
+    const size_t fill = _decoded - _flushed;
+    if (fill == 0) {
+        return true;
+    }
+    if (!_target->write(_stage, fill)) {
+        return false;
+    }
+    _crc = otaCrc32(_crc, _stage, fill);
+    _flushed = _decoded;
+    return true;
+}
+
+OtaStatus OtaDecoder::finish() {
+    if (_state != READ_TAG || _decoded != _header.imageBytes) {
+        return OTA_CORRUPT;     // The payload ended inside an op, or short of the image
+    }
+    if (!flushStage()) {
+        return OTA_TARGET_FAILED;
+    }
+    return _crc == _header.imageCrc ? OTA_DONE : OTA_BAD_CRC;
+}
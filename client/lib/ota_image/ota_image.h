@@ -0,0 +1,145 @@
+#pragma once
+
+// =================================================================================================
+// OTA IMAGE
+// Streaming decoder for firmware update packages (made by tools/ota_pack.py): an app image,
+// compressed, and optionally as a delta against the image the device already runs. The payload
+// is an LZ77 stream whose copies reach back into the image decoded so far or into the base
+// image. Both are in flash and are read back through the OtaTarget, so the decoder keeps no
+// window in RAM. Output is staged OTA_STAGE_BYTES at a time (one flash sector) before it goes to
+// the target.
+//
+// The decoder takes the package in whatever pieces the network delivers and keeps its state
+// between them. After a dropped connection the download picks up at consumed() (an HTTP Range
+// request) and decoding carries on as if nothing happened. A delta's base is checked against the
+// header before anything is written, and the image's CRC-32 once it is complete.
+//
+// Package (little-endian):
+//
+//     header := u32:magic "TOTA" u8:version u8:flags u16:header bytes u32:image bytes
+//               u32:image crc u32:base bytes u32:base crc u32:payload bytes u32:header crc
+//     op     := u8:tag [varint:length] [varint:argument] [bytes]
+//
+// The tag's top two bits are the op (OtaOp), the low six its length minus the op's minimum;
+// 63 means the rest of the length follows as a varint (7 bits a byte, low bits first). A literal
+// is followed by its bytes. An image copy's argument is how far back it starts (at least 1; it
+// may overlap what it writes). A base copy's argument is where it starts relative to where the
+// previous base copy ended, zigzag-coded, so the copies of a delta that follows its base in order
+// cost a byte each. The header crc covers the 28 bytes before it.
+// Portable (no Arduino dependencies) for the native build. No heap allocation.
+// =================================================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+
+const uint32_t OTA_MAGIC = 0x41544F54;          // "TOTA"
+const uint8_t OTA_VERSION = 1;
+const uint8_t OTA_FLAG_DELTA = 0x01;            // Has base copies; needs the base image
+const size_t OTA_HEADER_BYTES = 32;
+const size_t OTA_STAGE_BYTES = 4096;            // Output written to the target at a time
+const size_t OTA_COPY_BYTES = 256;              // Copies are read back from flash this much at a time
+
+enum OtaOp {
+    OTA_OP_LITERAL = 0,
+    OTA_OP_IMAGE_COPY = 1,
+    OTA_OP_BASE_COPY = 2
+};
+
+const uint8_t OTA_TAG_LENGTH_BITS = 6;
+const uint8_t OTA_TAG_LENGTH_MORE = 63;         // The length continues in a varint
+const uint32_t OTA_MIN_LITERAL = 1;
+const uint32_t OTA_MIN_COPY = 4;
+
+struct OtaHeader {
+    uint8_t version;
+    uint8_t flags;
+    uint32_t imageBytes;
+    uint32_t imageCrc;
+    uint32_t baseBytes;         // Delta: how much of the base image it copies from
+    uint32_t baseCrc;           // Of those bytes
+    uint32_t payloadBytes;
+};
+
+enum OtaStatus {
+    OTA_MORE,                   // Feed more of the package
+    OTA_DONE,                   // The image is written and its CRC matches
+    OTA_BAD_HEADER,             // Not a package, or a version this decoder doesn't know
+    OTA_BASE_MISMATCH,          // A delta against another image than the target's base
+    OTA_CORRUPT,                // An op out of range, or more payload than the header says
+    OTA_TARGET_FAILED,          // The target refused to start, read or write
+    OTA_BAD_CRC                 // The decoded image isn't the one packed
+};
+
+// Continues a CRC-32 (IEEE 802.3, as zlib.crc32) over 'length' more bytes; start from 0
+uint32_t otaCrc32(uint32_t crc, const uint8_t* data, size_t length);
+
+// Where the image goes: the update partition, with the running image as the base
+class OtaTarget {
+public:
+    virtual ~OtaTarget() {}
+
+    // CRC-32 of the base image's first 'length' bytes; false if it is shorter
+    virtual bool baseCrc(uint32_t length, uint32_t* crc) = 0;
+    // Called once the header checks out, before the first write
+    virtual bool start(const OtaHeader& header) = 0;
+    virtual bool readBase(uint32_t offset, uint8_t* data, size_t length) = 0;
+    // Reads back image bytes written earlier
+    virtual bool readImage(uint32_t offset, uint8_t* data, size_t length) = 0;
+    // Appends to the image
+    virtual bool write(const uint8_t* data, size_t length) = 0;
+};
+
+class OtaDecoder {
+public:
+    OtaDecoder();
+
+    // Starts a new package for 'target'
+    void begin(OtaTarget* target);
+
+    // Decodes the next 'length' bytes of the package. Once it returns anything but OTA_MORE,
+    // further calls return the same.
+    OtaStatus feed(const uint8_t* data, size_t length);
+
+    OtaStatus status() const { return _status; }
+    bool headerRead() const { return _headerFill == OTA_HEADER_BYTES; }
+    const OtaHeader& header() const { return _header; }
+    // Package bytes taken so far: where a resumed download starts
+    uint32_t consumed() const { return _consumed; }
+    uint32_t packageBytes() const { return OTA_HEADER_BYTES + _header.payloadBytes; }
+    // Image bytes decoded so far
+    uint32_t decoded() const { return _decoded; }
+
+private:
+    enum State { READ_TAG, READ_LENGTH, READ_ARGUMENT, READ_LITERAL };
+
+    OtaStatus readHeader();
+    // Handles one payload byte other than a literal's
+    OtaStatus step(uint8_t byte);
+    OtaStatus opReady();
+    OtaStatus copyImage(uint32_t distance, uint32_t length);
+    OtaStatus copyBase(int32_t delta, uint32_t length);
+    bool append(const uint8_t* data, size_t length);
+    bool flushStage();
+    OtaStatus finish();
+
+    OtaTarget* _target;
+    OtaStatus _status;
+    uint8_t _headerBytes[OTA_HEADER_BYTES];
+    size_t _headerFill;
+    OtaHeader _header;
+    uint32_t _consumed;
+    uint32_t _payloadConsumed;
+
+    State _state;
+    uint8_t _op;
+    uint32_t _length;           // Of the current op
+    uint32_t _varint;           // Being read
+    uint8_t _varintShift;
+    uint32_t _baseCursor;       // Where the last base copy ended
+
+    uint32_t _decoded;
+    uint32_t _flushed;          // Image bytes handed to the target; the rest are in _stage
+    uint32_t _crc;              // Of the flushed bytes
+    uint8_t _stage[OTA_STAGE_BYTES];
+    uint8_t _copy[OTA_COPY_BYTES];
+};
@@ -0,0 +1,97 @@
+#include "output_chain.h"
+
+static int16_t clampGain(int32_t gain, int32_t low, int32_t high) {
+    return (int16_t)(gain < low ? low : (gain > high ? high : gain));
+}
+
+// Integer square root (floor), a bit at a time
+static uint32_t squareRoot(uint32_t value) {
+    uint32_t root = 0;
+    for (uint32_t bit = 1u << 30; bit != 0; bit >>= 2) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+    }
+    return root;
+}
+
+OutputChain::OutputChain()
+    : _targetVolume(OUTPUT_GAIN_UNITY), _volume(OUTPUT_GAIN_UNITY),
+      _loudness((uint32_t)OUTPUT_TARGET_RMS * OUTPUT_TARGET_RMS), _normalizer(OUTPUT_GAIN_UNITY) {
+    restart();
+}
+
+void OutputChain::restart() {
+    _reduction = OUTPUT_GAIN_UNITY;
+    _deepest = OUTPUT_GAIN_UNITY;
+    _gain = 0;
+    _primed = false;
+    _nextPre = 0;
+    _nextAllowed = 0;
+}
+
+void OutputChain::setVolume(int16_t gainQ12) {
+    _targetVolume = gainQ12 < 0 ? 0 : gainQ12;
+}
+
+void OutputChain::analyze(const int16_t* block, size_t n) {
+    // Volume: a fraction of the remaining distance per block, then the last few steps at once
+    const int32_t toVolume = _targetVolume - _volume;
+    _volume = (int16_t)(toVolume > -8 && toVolume < 8 ? _targetVolume : _volume + (toVolume >> OUTPUT_VOLUME_SHIFT));
+
+    // Loudness: exponential average of the blocks' mean squares, skipping pauses so silence
+    // doesn't pull the gain up
+    const uint16_t rms = dspRms(block, n);
+    if (rms >= OUTPUT_GATE_RMS) {
+        const int64_t meanSquare = (int64_t)rms * rms;
+        _loudness = (uint32_t)((int64_t)_loudness + ((meanSquare - (int64_t)_loudness) >> OUTPUT_LOUDNESS_SHIFT));
+    }
+    const uint32_t level = squareRoot(_loudness);
+    _normalizer = level == 0 ? OUTPUT_MAX_BOOST
+                : clampGain((int32_t)((uint32_t)OUTPUT_TARGET_RMS * OUTPUT_GAIN_UNITY / level), OUTPUT_MAX_CUT, OUTPUT_MAX_BOOST);
+
+    _nextPre = clampGain(((int32_t)_volume * _normalizer) >> 12, 0, OUTPUT_GAIN_MAX);
+    const int16_t peak = dspPeak(block, n);
+    _nextAllowed = peak == 0 ? OUTPUT_GAIN_MAX
+                 : clampGain(((int32_t)OUTPUT_CEILING << 12) / peak, 0, OUTPUT_GAIN_MAX);
+}
+
+void OutputChain::process(int16_t* block, size_t n, const int16_t* next, size_t nextN) {
+    if (n == 0) {
+        return;
+    }
+    if (!_primed) {
+        // A stream's first block: nothing measured it ahead, so start from a gain it allows
+        analyze(block, n);
+        _gain = _gain < _nextAllowed ? _gain : _nextAllowed;
+    }
+    const int16_t pre = _nextPre;
+    const int16_t allowed = _nextAllowed;
+    int16_t nextAllowed = OUTPUT_GAIN_MAX;
+    _primed = next != NULL && nextN > 0;
+    if (_primed) {
+        analyze(next, nextN);
+        nextAllowed = _nextAllowed;
+    }
+
+    // Limiter: the gain the block should end at, released a little from the last block's
+    // reduction, held under what this block and the next one allow. The next block then starts
+    // from a gain its own peak allows.
+    const int32_t released = _reduction + ((OUTPUT_GAIN_UNITY - _reduction) >> OUTPUT_RELEASE_SHIFT) + 1;
+    int32_t end = ((int32_t)pre * (released < OUTPUT_GAIN_UNITY ? released : OUTPUT_GAIN_UNITY)) >> 12;
+    end = end < allowed ? end : allowed;
+    end = end < nextAllowed ? end : nextAllowed;
+    _reduction = pre > 0 ? clampGain(end * OUTPUT_GAIN_UNITY / pre, 0, OUTPUT_GAIN_UNITY) : OUTPUT_GAIN_UNITY;
+    if (_reduction < _deepest) {
+        _deepest = _reduction;
+    }
+
+    // One step per vector, ending at (or just short of) 'end'
+    const int32_t vectors = (int32_t)((n + DSP_LANES - 1) / DSP_LANES);
+    const int32_t step = (end - _gain) / vectors;
+    dspRamp(block, n, (int16_t)(_gain + step), (int16_t)step);
+    _gain = (int16_t)(_gain + step * vectors);
+}
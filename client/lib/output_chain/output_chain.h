@@ -0,0 +1,73 @@
+#pragma once
+
+// =================================================================================================
+// OUTPUT CHAIN
+// Fixed-point processing of the reply audio on its way to the amplifier, which adds a fixed 9 dB
+// and has no volume control of its own: a smoothed digital volume, a short-window loudness
+// normalizer and a look-ahead peak limiter. All three fold into one gain per sample, applied in
+// place with dspRamp() (the PIE path on the ESP32-S3) a block at a time.
+//
+// The stream is processed in blocks of OUTPUT_CHAIN_BLOCK samples, and each block is scaled only
+// once the block after it has been measured: the limiter sees the next block's peak and has
+// brought the gain down by the end of the current one. The gain ramps linearly across a block
+// between two values that both keep the block's peak under the ceiling, so the output never
+// clips (the ceiling's headroom covers the ramp's rounding, since dspRamp() doesn't saturate).
+// The look-ahead needs no delay line of its own when the blocks stay where they are, e.g. in the
+// playback ring, until they are scaled.
+// Portable (no Arduino dependencies) for the native build. No heap allocation.
+// =================================================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <dsp_kernels.h>
+
+const size_t OUTPUT_CHAIN_BLOCK = 64;           // Samples per block and look-ahead: 4 ms at 16 kHz
+const int16_t OUTPUT_GAIN_UNITY = 4096;         // Gains are Q12
+const int16_t OUTPUT_GAIN_MAX = 32767;          // About +18 dB
+const int16_t OUTPUT_CEILING = 29205;           // Limiter ceiling: -1 dBFS
+const uint16_t OUTPUT_TARGET_RMS = 3277;        // Normalizer target: -20 dBFS
+const uint16_t OUTPUT_GATE_RMS = 104;           // Quieter blocks (-50 dBFS) leave the loudness alone
+const int16_t OUTPUT_MAX_BOOST = 16384;         // Normalizer range: +12 dB
+const int16_t OUTPUT_MAX_CUT = 1024;            // and -12 dB
+const uint8_t OUTPUT_LOUDNESS_SHIFT = 7;        // Loudness window: 2^7 blocks (0.5 s at 16 kHz)
+const uint8_t OUTPUT_VOLUME_SHIFT = 3;          // Volume changes: time constant of 8 blocks
+const uint8_t OUTPUT_RELEASE_SHIFT = 4;         // Limiter release: time constant of 16 blocks
+
+class OutputChain {
+public:
+    OutputChain();
+
+    // Starts a new stream: its first block fades in and the limiter is released. The volume and
+    // the loudness estimate carry over, so a reply starts at the gain the last one ended with.
+    void restart();
+
+    // Volume (Q12, 0 mutes); the gain glides there over a few blocks
+    void setVolume(int16_t gainQ12);
+    int16_t volume() const { return _targetVolume; }
+
+    // Scales 'block' (n <= OUTPUT_CHAIN_BLOCK samples) in place. 'next' is the block that
+    // follows (the look-ahead, left as it is and scaled by the next call), NULL at the end of
+    // the stream. Blocks that are 16-byte aligned and whole vectors long take the vector path.
+    void process(int16_t* block, size_t n, const int16_t* next, size_t nextN);
+
+    // Normalizer gain, and the limiter's deepest gain reduction since restart() (Q12)
+    int16_t normalizerGain() const { return _normalizer; }
+    int16_t deepestReduction() const { return _deepest; }
+
+private:
+    // Measures the block process() scales after the current one: steps the volume and the
+    // loudness estimate, and sets _nextPre and _nextAllowed
+    void analyze(const int16_t* block, size_t n);
+
+    int16_t _targetVolume;
+    int16_t _volume;            // Smoothed
+    uint32_t _loudness;         // Mean square over the loudness window, gated
+    int16_t _normalizer;
+    int16_t _reduction;         // Limiter gain at the end of the last block (at most unity)
+    int16_t _deepest;
+    int16_t _gain;              // Total gain at the end of the last block
+    bool _primed;               // The next block was measured as the last one's look-ahead
+    int16_t _nextPre;           // Volume times normalizer for the next block
+    int16_t _nextAllowed;       // Highest total gain that keeps the next block under the ceiling
+};
@@ -0,0 +1,78 @@
+#include "playback_ring.h"
+
+#include <string.h>
+
+PlaybackRing::PlaybackRing() : _storage(NULL), _capacity(0), _write(0), _read(0), _fill(0) {}
+
+bool PlaybackRing::begin(uint8_t* storage, size_t capacity) {
+    if (storage == NULL || capacity == 0 || capacity % PLAYBACK_RING_ALIGN != 0) {
+        return false;
+    }
+    _storage = storage;
+    _capacity = capacity;
+    reset();
+    return true;
+}
+
+void PlaybackRing::reset() {
+    _write = 0;
+    _read = 0;
+    __atomic_store_n(&_fill, 0, __ATOMIC_RELEASE);
+}
+
+size_t PlaybackRing::writable(RingSpan* spans, size_t limit) const {
+    size_t room = space();
+    if (room > limit) {
+        room = limit;
+    }
+    if (room == 0) {
+        return 0;
+    }
+    const size_t toEnd = _capacity - _write;
+    spans[0].data = _storage + _write;
+    spans[0].length = room < toEnd ? room : toEnd;
+    if (room <= toEnd) {
+        return 1;
+    }
+    spans[1].data = _storage;
+    spans[1].length = room - toEnd;
+    return 2;
+}
+
+void PlaybackRing::commit(size_t bytes) {
+    _write += bytes;
+    if (_write >= _capacity) {
+        _write -= _capacity;
+    }
+    // Release: the bytes are in place before the consumer sees them
+    __atomic_fetch_add(&_fill, bytes, __ATOMIC_RELEASE);
+}
+
+size_t PlaybackRing::write(const uint8_t* data, size_t length) {
+    RingSpan spans[2];
+    const size_t count = writable(spans, length);
+    size_t written = 0;
+    for (size_t i = 0; i < count; i++) {
+        memcpy(spans[i].data, data + written, spans[i].length);
+        written += spans[i].length;
+    }
+    commit(written);
+    return written;
+}
+
+RingSpan PlaybackRing::readable(size_t offset) const {
+    const size_t filled = fill();
+    const size_t available = offset < filled ? filled - offset : 0;
+    const size_t start = _read + offset < _capacity ? _read + offset : _read + offset - _capacity;
+    const size_t toEnd = _capacity - start;
+    const RingSpan span = {_storage + start, available < toEnd ? available : toEnd};
+    return span;
+}
+
+void PlaybackRing::consume(size_t bytes) {
+    _read += bytes;
+    if (_read >= _capacity) {
+        _read -= _capacity;
+    }
+    __atomic_fetch_sub(&_fill, bytes, __ATOMIC_RELEASE);
+}
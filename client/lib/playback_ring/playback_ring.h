@@ -0,0 +1,65 @@
+#pragma once
+
+// =================================================================================================
+// PLAYBACK RING
+// Byte ring between the downlink socket and the I2S driver. The receive side reads from the
+// socket straight into the ring's free space (two spans when it wraps, for one scatter read)
+// and the I2S feeder writes whole samples out of it, so received PCM is not copied again on its
+// way to the DMA buffers. Data that arrives some other way (a decoder's output, bytes read along
+// with the response head) is written in with write().
+//
+// One producer and one consumer. Each side owns its position and the fill level is updated with
+// __atomic, so they may run in different tasks. The capacity is a multiple of
+// PLAYBACK_RING_ALIGN, so neither a 16-bit sample nor the two samples an ADPCM byte decodes to
+// ever straddle the wrap.
+// Portable (no Arduino dependencies) for the native build. No heap allocation.
+// =================================================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+
+const size_t PLAYBACK_RING_ALIGN = 4;
+
+// A contiguous piece of the ring
+struct RingSpan {
+    uint8_t* data;
+    size_t length;
+};
+
+class PlaybackRing {
+public:
+    PlaybackRing();
+
+    // Uses 'storage' ('capacity' bytes, a multiple of PLAYBACK_RING_ALIGN). False otherwise.
+    bool begin(uint8_t* storage, size_t capacity);
+    // Empties the ring; neither side may be using it
+    void reset();
+
+    size_t capacity() const { return _capacity; }
+    size_t fill() const { return __atomic_load_n(&_fill, __ATOMIC_ACQUIRE); }
+    size_t space() const { return _capacity - fill(); }
+
+    // --- Producer ---
+    // Free space from the write position, at most 'limit' bytes, split at the wrap. Fills
+    // 'spans' (room for two) and returns how many there are: 0 if the ring is full.
+    size_t writable(RingSpan* spans, size_t limit) const;
+    // Makes the first 'bytes' of the free space readable
+    void commit(size_t bytes);
+    // Copies in as much of 'data' as fits; returns the bytes written
+    size_t write(const uint8_t* data, size_t length);
+    // True if 'data' points into the ring's storage (received in place)
+    bool contains(const uint8_t* data) const { return data >= _storage && data < _storage + _capacity; }
+
+    // --- Consumer ---
+    // Readable bytes from 'offset' bytes past the read position up to the wrap (the rest
+    // follows at the start)
+    RingSpan readable(size_t offset = 0) const;
+    void consume(size_t bytes);
+
+private:
+    uint8_t* _storage;
+    size_t _capacity;
+    size_t _write;          // Producer's position
+    size_t _read;           // Consumer's position
+    size_t _fill;           // Committed and not yet consumed
+};
@@ -0,0 +1,270 @@
+#include "jitter_buffer.h"
+
+#include <string.h>
+
+static const size_t FEC_SLOTS = JITTER_SLOTS / TRINITY_RTP_FEC_GROUP;
+// Playout delay before the first stream has measured any jitter
+static const uint32_t INITIAL_DELAY_PACKETS = 3;
+// Each concealed packet fades the repeated audio by this factor
+static const float CONCEAL_FADE = 0.5f;
+
+// Scales 'pcm' by a gain moving linearly from 'from' to 'to' across the packet (no clicks)
+static void ramp(int16_t* pcm, size_t samples, float from, float to) {
+    if (from == 1.0f && to == 1.0f) {
+        return;
+    }
+    const float step = samples ? (to - from) / samples : 0;
+    float gain = from;
+    for (size_t i = 0; i < samples; i++, gain += step) {
+        pcm[i] = (int16_t)(pcm[i] * gain);
+    }
+}
+
+static uint16_t readU16(const uint8_t* p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+JitterBuffer::JitterBuffer()
+    : _delayPackets(INITIAL_DELAY_PACKETS), _minDelayPackets(JITTER_MIN_DELAY_PACKETS),
+      _maxDelayPackets(JITTER_MAX_DELAY_PACKETS), _jitterMs(0) {
+    start(0, false, 16000, 0, 0, 0);
+}
+
+void JitterBuffer::setDelayRange(uint32_t minPackets, uint32_t maxPackets) {
+    _maxDelayPackets = maxPackets < 1 ? 1 : (maxPackets > JITTER_MAX_DELAY_PACKETS ? JITTER_MAX_DELAY_PACKETS : maxPackets);
+    _minDelayPackets = minPackets < 1 ? 1 : (minPackets > _maxDelayPackets ? _maxDelayPackets : minPackets);
+}
+
+void JitterBuffer::start(uint32_t ssrc, bool adpcm, uint32_t rate, uint16_t firstSequence, uint32_t packets, uint32_t nowMs) {
+    for (size_t i = 0; i < JITTER_SLOTS; i++) {
+        _slots[i].filled = false;
+    }
+    for (size_t i = 0; i < FEC_SLOTS; i++) {
+        _fec[i].filled = false;
+    }
+    _ssrc = ssrc;
+    _adpcm = adpcm;
+    _rate = rate;
+    _firstSequence = firstSequence;
+    _packets = packets;
+    _next = 0;
+    _highest = 0;
+    _started = false;
+    _rebuffering = false;
+    _finished = packets == 0;
+    _lastArrivalMs = nowMs;
+    _haveTransit = false;
+    _gain = 1.0f;
+    _lastSamples = 0;
+    memset(&_stats, 0, sizeof(_stats));
+
+    // Size the delay for the jitter seen so far, shrinking by at most a packet per stream
+    uint32_t delay = _minDelayPackets + (uint32_t)(3 * _jitterMs / TRINITY_RTP_PACKET_MS + 0.5f);
+    if (delay + 1 < _delayPackets) {
+        delay = _delayPackets - 1;
+    }
+    _delayPackets = delay < _minDelayPackets ? _minDelayPackets
+                  : (delay > _maxDelayPackets ? _maxDelayPackets : delay);
+}
+
+void JitterBuffer::push(const uint8_t* packet, size_t length, uint32_t nowMs) {
+    RtpHeader header;
+    const size_t offset = rtpReadHeader(packet, length, header);
+    if (offset == 0 || header.ssrc != _ssrc || _finished) {
+        return;
+    }
+    const uint8_t* payload = packet + offset;
+    const size_t payloadLength = length - offset;
+
+    if (header.payloadType == TRINITY_RTP_PT_FEC) {
+        if (payloadLength < RTP_FEC_HEADER_SIZE) {
+            return;
+        }
+        const uint16_t base = readU16(payload);
+        const uint32_t group = (uint16_t)(base - _firstSequence) / TRINITY_RTP_FEC_GROUP;
+        if ((uint16_t)(base - _firstSequence) >= _packets) {
+            return;
+        }
+        FecSlot& fec = _fec[group % FEC_SLOTS];
+        fec.filled = true;
+        fec.base = base;
+        fec.count = payload[2];
+        fec.lengthXor = readU16(payload + 4);
+        fec.length = payloadLength - RTP_FEC_HEADER_SIZE < RTP_MAX_PAYLOAD ? payloadLength - RTP_FEC_HEADER_SIZE : RTP_MAX_PAYLOAD;
+        memcpy(fec.payload, payload + RTP_FEC_HEADER_SIZE, fec.length);
+        _lastArrivalMs = nowMs;
+        return;
+    }
+    if (header.payloadType != TRINITY_RTP_PT_AUDIO) {
+        return;
+    }
+    const uint32_t index = (uint16_t)(header.sequence - _firstSequence);
+    if (index >= _packets) {
+        return;
+    }
+    _stats.received++;
+    _lastArrivalMs = nowMs;
+
+    // RFC 3550 interarrival jitter, in ms
+    const int32_t transitMs = (int32_t)nowMs - (int32_t)((uint64_t)header.timestamp * 1000 / _rate);
+    if (_haveTransit) {
+        const int32_t d = transitMs - _lastTransitMs;
+        _jitterMs += ((d < 0 ? -d : d) - _jitterMs) / 16;
+    }
+    _haveTransit = true;
+    _lastTransitMs = transitMs;
+
+    if (index < _next) {
+        // Its slot was already concealed: the delay is too short for this link
+        _stats.late++;
+        growDelay();
+        return;
+    }
+    if (index >= _next + JITTER_SLOTS) {
+        return; // Far ahead of playout (sender not pacing); no room
+    }
+    Slot& slot = _slots[index % JITTER_SLOTS];
+    if (slot.filled && slot.sequence == header.sequence) {
+        _stats.duplicates++;
+        return;
+    }
+    slot.filled = true;
+    slot.sequence = header.sequence;
+    slot.length = payloadLength < RTP_MAX_PAYLOAD ? payloadLength : RTP_MAX_PAYLOAD;
+    memcpy(slot.payload, payload, slot.length);
+    if (index + 1 > _highest) {
+        _highest = index + 1;
+    }
+}
+
+JitterBuffer::Slot* JitterBuffer::find(uint32_t index) {
+    Slot& slot = _slots[index % JITTER_SLOTS];
+    return (slot.filled && slot.sequence == (uint16_t)(_firstSequence + index)) ? &slot : NULL;
+}
+
+// Rebuilds packet 'index' from its group's parity if it is the group's only missing packet
+bool JitterBuffer::recover(uint32_t index) {
+    const uint32_t group = index / TRINITY_RTP_FEC_GROUP;
+    const uint32_t first = group * TRINITY_RTP_FEC_GROUP;
+    const FecSlot& fec = _fec[group % FEC_SLOTS];
+    if (!fec.filled || fec.base != (uint16_t)(_firstSequence + first)) {
+        return false;
+    }
+    for (uint32_t i = first; i < first + fec.count; i++) {
+        if (i != index && !find(i)) {
+            return false;
+        }
+    }
+
+    Slot& slot = _slots[index % JITTER_SLOTS];
+    memcpy(slot.payload, fec.payload, fec.length);
+    uint16_t length = fec.lengthXor;
+    for (uint32_t i = first; i < first + fec.count; i++) {
+        if (i == index) {
+            continue;
+        }
+        const Slot* other = find(i);
+        for (size_t b = 0; b < other->length; b++) {
+            slot.payload[b] ^= other->payload[b];
+        }
+        length ^= other->length;
+    }
+    if (length > fec.length) {
+        return false; // Inconsistent parity
+    }
+    slot.filled = true;
+    slot.sequence = (uint16_t)(_firstSequence + index);
+    slot.length = length;
+    return true;
+}
+
+// True once the network has moved past packet 'index', so a gap there is a loss, not a delay
+bool JitterBuffer::laterPacketKnown(uint32_t index) const {
+    if (_highest > index + 1) {
+        return true;
+    }
+    const uint32_t group = index / TRINITY_RTP_FEC_GROUP;
+    const FecSlot& fec = _fec[group % FEC_SLOTS];
+    return fec.filled && fec.base == (uint16_t)(_firstSequence + group * TRINITY_RTP_FEC_GROUP);
+}
+
+// Repeats the last good packet, fading further with every consecutive concealment
+size_t JitterBuffer::conceal(int16_t* pcm) {
+    size_t samples = _lastSamples;
+    if (samples == 0) {
+        samples = rtpPacketSamples(_rate);
+        memset(pcm, 0, samples * 2);
+        return samples;
+    }
+    memcpy(pcm, _lastPcm, samples * 2);
+    const float to = _gain * CONCEAL_FADE;
+    ramp(pcm, samples, _gain, to);
+    _gain = to;
+    return samples;
+}
+
+void JitterBuffer::growDelay() {
+    if (_delayPackets < _maxDelayPackets) {
+        _delayPackets++;
+    }
+}
+
+JitterFrame JitterBuffer::pop(uint32_t nowMs, int16_t* pcm, size_t* samples) {
+    *samples = 0;
+    if (_finished) {
+        return JITTER_FINISHED;
+    }
+    if (_next >= _packets || nowMs - _lastArrivalMs > JITTER_STREAM_TIMEOUT_MS) {
+        _finished = true;
+        return JITTER_FINISHED;
+    }
+
+    // Nothing arrived for longer than the playout delay: whatever is missing is not in flight
+    // (the stream's tail was lost, or the link is out), so stop waiting for it
+    const bool quiet = nowMs - _lastArrivalMs > (_delayPackets + 1) * TRINITY_RTP_PACKET_MS;
+    // Enough queued to absorb the jitter, or everything already in
+    const bool ready = _highest >= _next + _delayPackets || _highest >= _packets || (quiet && _highest > 0);
+    if (!_started) {
+        if (!ready) {
+            return JITTER_WAITING;
+        }
+        _started = true;
+    } else if (_rebuffering) {
+        if (!ready && !quiet) {
+            *samples = conceal(pcm);
+            _stats.stretched++;
+            return JITTER_STRETCHED;
+        }
+        _rebuffering = false;
+    }
+
+    const bool received = find(_next) != NULL;
+    if (received || recover(_next)) {
+        const Slot* slot = find(_next);
+        const size_t count = rtpDecodePayload(slot->payload, slot->length, _adpcm, pcm, rtpPacketSamples(_rate));
+        ramp(pcm, count, _gain, 1.0f); // Fade back in after a concealment
+        _gain = 1.0f;
+        memcpy(_lastPcm, pcm, count * 2);
+        _lastSamples = count;
+        _next++;
+        *samples = count;
+        if (received) {
+            _stats.played++;
+            return JITTER_PLAYED;
+        }
+        _stats.recovered++;
+        return JITTER_RECOVERED;
+    }
+
+    *samples = conceal(pcm);
+    if (laterPacketKnown(_next) || quiet) {
+        _next++;
+        _stats.concealed++;
+        return JITTER_CONCEALED;
+    }
+    // Nothing queued: hold playout here until the buffer has refilled to the (longer) delay
+    growDelay();
+    _rebuffering = true;
+    _stats.stretched++;
+    return JITTER_STRETCHED;
+}
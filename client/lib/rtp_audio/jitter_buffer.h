@@ -0,0 +1,119 @@
+#pragma once
+
+// =================================================================================================
+// ADAPTIVE JITTER BUFFER
+// Receiver side of the RTP audio transport. Holds back playout until enough packets are queued
+// to ride out the network's jitter, then hands out one packet of PCM per call:
+//  - a packet missing at its playout time is rebuilt from its FEC group if possible, otherwise
+//    concealed by repeating the previous packet with a fade towards silence;
+//  - if nothing at all is queued the last packet is stretched instead (playout waits without
+//    skipping audio) and the playout delay grows by a packet, as it does for late packets;
+//  - once nothing has arrived for longer than the playout delay, missing packets are treated
+//    as lost rather than waited for (a lost tail must not stall until the stream times out).
+// The delay for the next stream starts from the measured interarrival jitter (RFC 3550), so it
+// shrinks again on a calmer link. Times are caller-supplied milliseconds, which keeps it
+// deterministic for the native build's simulations. No heap allocation.
+// =================================================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rtp_packet.h"
+
+// Packets held at once; must exceed JITTER_MAX_DELAY_PACKETS plus a FEC group
+const size_t JITTER_SLOTS = 16;
+// Default playout delay range; setDelayRange() narrows or moves it within 1..JITTER_MAX_DELAY_PACKETS
+const uint32_t JITTER_MIN_DELAY_PACKETS = 2;
+const uint32_t JITTER_MAX_DELAY_PACKETS = 10;
+// A stream with no new packet for this long is over (its tail was lost)
+const uint32_t JITTER_STREAM_TIMEOUT_MS = 1000;
+
+enum JitterFrame {
+    JITTER_WAITING,     // Still buffering; nothing to play yet
+    JITTER_PLAYED,
+    JITTER_RECOVERED,   // Rebuilt from FEC
+    JITTER_CONCEALED,   // Lost packet replaced by a faded repeat
+    JITTER_STRETCHED,   // Buffer ran dry; faded repeat without consuming a packet
+    JITTER_FINISHED
+};
+
+struct JitterStats {
+    uint32_t received;
+    uint32_t played;
+    uint32_t recovered;
+    uint32_t concealed;
+    uint32_t stretched;
+    uint32_t late;          // Arrived after their playout time (discarded)
+    uint32_t duplicates;
+};
+
+class JitterBuffer {
+public:
+    JitterBuffer();
+
+    // Bounds the playout delay (in packets) from the next start() on; clamped to
+    // 1..JITTER_MAX_DELAY_PACKETS
+    void setDelayRange(uint32_t minPackets, uint32_t maxPackets);
+
+    // Starts a stream of 'packets' audio packets. Earlier streams' packets are ignored.
+    void start(uint32_t ssrc, bool adpcm, uint32_t rate, uint16_t firstSequence, uint32_t packets, uint32_t nowMs);
+
+    // Takes one received datagram (audio or FEC).
+    void push(const uint8_t* packet, size_t length, uint32_t nowMs);
+
+    // Produces the next packet's worth of PCM into 'pcm' (room for rtpPacketSamples(rate)).
+    // Call whenever the speaker can take more audio.
+    JitterFrame pop(uint32_t nowMs, int16_t* pcm, size_t* samples);
+
+    bool finished() const { return _finished; }
+    uint32_t ssrc() const { return _ssrc; }
+    uint32_t delayPackets() const { return _delayPackets; }
+    float jitterMs() const { return _jitterMs; }
+    const JitterStats& stats() const { return _stats; }
+
+private:
+    struct Slot {
+        bool filled;
+        uint16_t sequence;
+        uint16_t length;
+        uint8_t payload[RTP_MAX_PAYLOAD];
+    };
+    struct FecSlot {
+        bool filled;
+        uint16_t base;
+        uint8_t count;
+        uint16_t lengthXor;
+        uint16_t length;
+        uint8_t payload[RTP_MAX_PAYLOAD];
+    };
+
+    Slot* find(uint32_t index);
+    bool recover(uint32_t index);
+    bool laterPacketKnown(uint32_t index) const;
+    size_t conceal(int16_t* pcm);
+    void growDelay();
+
+    Slot _slots[JITTER_SLOTS];
+    FecSlot _fec[JITTER_SLOTS / TRINITY_RTP_FEC_GROUP];
+    uint32_t _ssrc;
+    bool _adpcm;
+    uint32_t _rate;
+    uint16_t _firstSequence;
+    uint32_t _packets;
+    uint32_t _next;             // Stream index of the next packet to play
+    uint32_t _highest;          // One past the highest stream index received
+    bool _started;
+    bool _rebuffering;          // Ran dry; stretching until the delay is queued again
+    bool _finished;
+    uint32_t _lastArrivalMs;    // Stream start until the first packet arrives
+    uint32_t _delayPackets;
+    uint32_t _minDelayPackets;
+    uint32_t _maxDelayPackets;
+    float _jitterMs;
+    bool _haveTransit;
+    int32_t _lastTransitMs;     // Arrival time minus media time of the previous packet
+    float _gain;                // Gain at the end of the last packet played (< 1 while concealing)
+    int16_t _lastPcm[RTP_MAX_PAYLOAD / 2];
+    size_t _lastSamples;
+    JitterStats _stats;
+};
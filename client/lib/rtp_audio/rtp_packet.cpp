@@ -0,0 +1,145 @@
+#include "rtp_packet.h"
+
+#include <string.h>
+
+static const uint8_t RTP_VERSION = 2;
+
+static void writeU16(uint8_t* p, uint16_t value) {
+    p[0] = value >> 8;
+    p[1] = value;
+}
+
+static void writeU32(uint8_t* p, uint32_t value) {
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+static uint16_t readU16(const uint8_t* p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t readU32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+size_t rtpWriteHeader(const RtpHeader& header, uint8_t* out) {
+    out[0] = RTP_VERSION << 6;
+    out[1] = (header.marker ? 0x80 : 0) | (header.payloadType & 0x7F);
+    writeU16(out + 2, header.sequence);
+    writeU32(out + 4, header.timestamp);
+    writeU32(out + 8, header.ssrc);
+    return RTP_HEADER_SIZE;
+}
+
+size_t rtpReadHeader(const uint8_t* packet, size_t length, RtpHeader& header) {
+    if (length < RTP_HEADER_SIZE || (packet[0] >> 6) != RTP_VERSION) {
+        return 0;
+    }
+    const size_t offset = RTP_HEADER_SIZE + (packet[0] & 0x0F) * 4; // Skip any CSRCs
+    if (offset > length || (packet[0] & 0x10)) {
+        return 0; // Header extensions are never sent
+    }
+    header.marker = (packet[1] & 0x80) != 0;
+    header.payloadType = packet[1] & 0x7F;
+    header.sequence = readU16(packet + 2);
+    header.timestamp = readU32(packet + 4);
+    header.ssrc = readU32(packet + 8);
+    return offset;
+}
+
+size_t rtpDecodePayload(const uint8_t* payload, size_t length, bool adpcm, int16_t* pcm, size_t maxSamples) {
+    if (!adpcm) {
+        const size_t samples = length / 2 < maxSamples ? length / 2 : maxSamples;
+        memcpy(pcm, payload, samples * 2); // Little-endian on both ends
+        return samples;
+    }
+    if (length < RTP_ADPCM_BLOCK_HEADER_SIZE) {
+        return 0;
+    }
+    AdpcmState state;
+    state.predicted = (int16_t)(payload[0] | (payload[1] << 8));
+    state.index = payload[2] > 88 ? 88 : payload[2];
+    size_t bytes = length - RTP_ADPCM_BLOCK_HEADER_SIZE;
+    if (bytes * 2 > maxSamples) {
+        bytes = maxSamples / 2;
+    }
+    return adpcmDecode(payload + RTP_ADPCM_BLOCK_HEADER_SIZE, bytes, pcm, state);
+}
+
+RtpPacketizer::RtpPacketizer() {
+    begin(0, false, 16000, 0);
+}
+
+void RtpPacketizer::begin(uint32_t ssrc, bool adpcm, uint32_t rate, uint16_t firstSequence) {
+    _ssrc = ssrc;
+    _adpcm = adpcm;
+    _rate = rate;
+    _firstSequence = firstSequence;
+    _packets = 0;
+    _fecSequence = 0;
+    _fecReady = false;
+    _adpcmState = {0, 0};
+    _groupCount = 0;
+    _lengthXor = 0;
+    _parityLength = 0;
+}
+
+size_t RtpPacketizer::packAudio(const int16_t* pcm, size_t samples, bool last, uint8_t* packet) {
+    const size_t maxSamples = rtpPacketSamples(_rate);
+    if (samples > maxSamples) {
+        samples = maxSamples;
+    }
+    RtpHeader header = {TRINITY_RTP_PT_AUDIO, last, (uint16_t)(_firstSequence + _packets),
+                        (uint32_t)(_packets * maxSamples), _ssrc};
+    uint8_t* payload = packet + rtpWriteHeader(header, packet);
+
+    size_t length;
+    if (_adpcm) {
+        payload[0] = (uint8_t)_adpcmState.predicted;
+        payload[1] = (uint8_t)(_adpcmState.predicted >> 8);
+        payload[2] = (uint8_t)_adpcmState.index;
+        payload[3] = 0;
+        length = RTP_ADPCM_BLOCK_HEADER_SIZE +
+                 adpcmEncode(pcm, samples, payload + RTP_ADPCM_BLOCK_HEADER_SIZE, _adpcmState);
+    } else {
+        memcpy(payload, pcm, samples * 2);
+        length = samples * 2;
+    }
+
+    // Fold the payload into the group's parity
+    if (_groupCount == 0) {
+        _groupBase = header.sequence;
+        _lengthXor = 0;
+        _parityLength = 0;
+        memset(_parity, 0, sizeof(_parity));
+    }
+    for (size_t i = 0; i < length; i++) {
+        _parity[i] ^= payload[i];
+    }
+    _lengthXor ^= (uint16_t)length;
+    if (length > _parityLength) {
+        _parityLength = length;
+    }
+    _groupCount++;
+    _fecReady = _groupCount == TRINITY_RTP_FEC_GROUP || last;
+    _packets++;
+    return RTP_HEADER_SIZE + length;
+}
+
+size_t RtpPacketizer::packFec(uint8_t* packet) {
+    if (!_fecReady) {
+        return 0;
+    }
+    _fecReady = false;
+    RtpHeader header = {TRINITY_RTP_PT_FEC, false, _fecSequence++, 0, _ssrc};
+    uint8_t* payload = packet + rtpWriteHeader(header, packet);
+    writeU16(payload, _groupBase);
+    payload[2] = _groupCount;
+    payload[3] = 0;
+    writeU16(payload + 4, _lengthXor);
+    memcpy(payload + RTP_FEC_HEADER_SIZE, _parity, _parityLength);
+    _groupCount = 0;
+    return RTP_HEADER_SIZE + RTP_FEC_HEADER_SIZE + _parityLength;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+// =================================================================================================
+// RTP AUDIO PACKETS
+// Builds and parses the datagrams of the RTP audio transport (wire format in trinity_protocol.h):
+// one audio packet per TRINITY_RTP_PACKET_MS of audio, plus an XOR parity packet per FEC group.
+// Portable (no Arduino dependencies) for the native build; the server side is rtp_transport.py.
+// =================================================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <trinity_protocol.h>
+#include <ima_adpcm.h>
+
+const size_t RTP_HEADER_SIZE = 12;
+const size_t RTP_FEC_HEADER_SIZE = 6;
+const size_t RTP_ADPCM_BLOCK_HEADER_SIZE = 4;
+// Largest audio payload: one packet of pcm16 at 16 kHz
+const size_t RTP_MAX_PAYLOAD = 16000 * TRINITY_RTP_PACKET_MS / 1000 * 2;
+const size_t RTP_MAX_PACKET = RTP_HEADER_SIZE + RTP_FEC_HEADER_SIZE + RTP_MAX_PAYLOAD;
+
+struct RtpHeader {
+    uint8_t payloadType;
+    bool marker;            // Set on the last audio packet of a stream
+    uint16_t sequence;
+    uint32_t timestamp;     // In samples
+    uint32_t ssrc;
+};
+
+// Writes the 12-byte header. Returns RTP_HEADER_SIZE.
+size_t rtpWriteHeader(const RtpHeader& header, uint8_t* out);
+
+// Parses a datagram's header. Returns the payload offset, or 0 if it isn't RTP version 2.
+size_t rtpReadHeader(const uint8_t* packet, size_t length, RtpHeader& header);
+
+// Samples in one audio packet
+inline size_t rtpPacketSamples(uint32_t rate) { return rate * TRINITY_RTP_PACKET_MS / 1000; }
+
+// Decodes one audio payload into 'pcm' (room for rtpPacketSamples(rate)). Returns the samples.
+size_t rtpDecodePayload(const uint8_t* payload, size_t length, bool adpcm, int16_t* pcm, size_t maxSamples);
+
+// Turns a PCM stream into audio packets, with a parity packet after every FEC group.
+// Usage per packet: packAudio(), send it, then send packFec() if it returns non-zero.
+class RtpPacketizer {
+public:
+    RtpPacketizer();
+
+    void begin(uint32_t ssrc, bool adpcm, uint32_t rate, uint16_t firstSequence);
+
+    // Packs up to rtpPacketSamples(rate) samples as the next audio packet ('last' ends the
+    // stream). 'packet' needs RTP_MAX_PACKET bytes. Returns the datagram length.
+    size_t packAudio(const int16_t* pcm, size_t samples, bool last, uint8_t* packet);
+
+    // The parity packet if the last audio packet closed a FEC group, otherwise 0.
+    size_t packFec(uint8_t* packet);
+
+    uint32_t ssrc() const { return _ssrc; }
+    uint16_t firstSequence() const { return _firstSequence; }
+    uint32_t packets() const { return _packets; }   // Audio packets so far
+
+private:
+    uint32_t _ssrc;
+    bool _adpcm;
+    uint32_t _rate;
+    uint16_t _firstSequence;
+    uint32_t _packets;
+    uint16_t _fecSequence;
+    bool _fecReady;
+    AdpcmState _adpcmState;     // Runs across packets; each block header records it
+    // Parity of the current FEC group
+    uint16_t _groupBase;
+    uint8_t _groupCount;
+    uint16_t _lengthXor;
+    size_t _parityLength;
+    uint8_t _parity[RTP_MAX_PAYLOAD];
+};
@@ -0,0 +1,50 @@
+#include "trace_capture.h"
+
+#include <string.h>
+
+static const uint8_t TRACE_MAGIC[4] = {'T', 'R', 'C', 'A'};
+static const uint32_t RECORD_HEADER_SIZE = 5; // u32 length + u8 field count
+static const uint32_t FIELD_HEADER_SIZE = 5;  // u8 tag + u32 length
+
+bool TraceCaptureWriter::put(const void* data, size_t length) {
+    return length == 0 || _sink(_context, (const uint8_t*)data, length) == length;
+}
+
+bool TraceCaptureWriter::putU32(uint32_t value) {
+    // Little-endian regardless of host byte order
+    const uint8_t bytes[4] = {(uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24)};
+    return put(bytes, sizeof(bytes));
+}
+
+bool TraceCaptureWriter::writeFileHeader() {
+    const uint8_t version[2] = {(uint8_t)TRACE_ARCHIVE_VERSION, (uint8_t)(TRACE_ARCHIVE_VERSION >> 8)};
+    return put(TRACE_MAGIC, sizeof(TRACE_MAGIC)) && put(version, sizeof(version));
+}
+
+bool TraceCaptureWriter::writeRecord(const TraceField* fields, size_t count) {
+    if (count > 255) {
+        return false;
+    }
+
+    uint32_t recordLength = RECORD_HEADER_SIZE;
+    for (size_t i = 0; i < count; i++) {
+        recordLength += FIELD_HEADER_SIZE + fields[i].length;
+    }
+
+    const uint8_t fieldCount = (uint8_t)count;
+    if (!putU32(recordLength) || !put(&fieldCount, 1)) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t tag = fields[i].tag;
+        if (!put(&tag, 1) || !putU32(fields[i].length) || !put(fields[i].data, fields[i].length)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+TraceField TraceCaptureWriter::textField(TraceTag tag, const char* text) {
+    TraceField field = {tag, text, text ? (uint32_t)strlen(text) : 0};
+    return field;
+}
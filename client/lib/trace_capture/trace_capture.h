@@ -0,0 +1,66 @@
+#pragma once
+
+// =================================================================================================
+// TRACE CAPTURE WRITER
+// Writes voice-turn records in the server's archive/capture format (see trace_archive.py):
+//
+//     file   := "TRCA" u16:version record*
+//     record := u32:record_length u8:field_count field*
+//     field  := u8:tag u32:length bytes[length]
+//
+// Portable (no Arduino dependencies) so the firmware and its native build share it.
+// The writer never allocates: callers describe a record as an array of fields pointing at
+// their own buffers, and the bytes go straight to a caller-supplied sink.
+// =================================================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Field tags (must match trace_archive.py)
+enum TraceTag : uint8_t {
+    TRACE_TAG_TRACE_ID = 1,
+    TRACE_TAG_DEVICE_ID = 2,
+    TRACE_TAG_TIMESTAMP = 3,        // f64 seconds since the epoch
+    TRACE_TAG_INPUT_PCM = 4,        // Request body as sent to the server
+    TRACE_TAG_TRANSCRIPT = 5,
+    TRACE_TAG_REPLY_TEXT = 6,
+    TRACE_TAG_TIMINGS = 7,          // JSON object, server stage -> ms
+    TRACE_TAG_REQUEST_HEADERS = 8,  // JSON object
+    TRACE_TAG_RESPONSE_BODY = 9,
+    TRACE_TAG_MODEL_EXCHANGES = 10, // JSON array
+    TRACE_TAG_DEVICE_TIMINGS = 11,  // JSON object, device stage -> ms
+    TRACE_TAG_SOURCE = 12,          // "server" or "native"
+    TRACE_TAG_DEVICE_PCM = 13       // PCM as recorded on the device
+};
+
+const uint16_t TRACE_ARCHIVE_VERSION = 1;     // New fields are new tags; same framing, same version
+
+struct TraceField {
+    TraceTag tag;
+    const void* data;
+    uint32_t length;
+};
+
+// Receives encoded bytes; returns the number of bytes accepted.
+typedef size_t (*TraceSink)(void* context, const uint8_t* data, size_t length);
+
+class TraceCaptureWriter {
+public:
+    TraceCaptureWriter(TraceSink sink, void* context) : _sink(sink), _context(context) {}
+
+    // Writes the file header; call once when starting a new (empty) capture file.
+    bool writeFileHeader();
+
+    // Writes one record made of 'count' fields. Returns false if the sink refused bytes.
+    bool writeRecord(const TraceField* fields, size_t count);
+
+    // Convenience for NUL-terminated text fields.
+    static TraceField textField(TraceTag tag, const char* text);
+
+private:
+    bool put(const void* data, size_t length);
+    bool putU32(uint32_t value);
+
+    TraceSink _sink;
+    void* _context;
+};
@@ -0,0 +1,130 @@
+#include "frame_parser.h"
+
+#include <string.h>
+
+static uint32_t readU32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+void FrameParser::reset() {
+    _state = STATE_HEADER;
+    _headerFill = 0;
+    _type = 0;
+    _remaining = 0;
+    _payloadFill = 0;
+}
+
+size_t FrameParser::partRemaining() const {
+    switch (_state) {
+        case STATE_HEADER:
+            return TRINITY_FRAME_HEADER_SIZE - _headerFill;
+        case STATE_PAYLOAD:
+            return _remaining;
+        default:
+            return 0;
+    }
+}
+
+void FrameParser::finishSmallFrame(FrameSink& sink) {
+    _payload[_payloadFill] = '\0';
+    switch (_type) {
+        case TRINITY_FRAME_TEXT:
+            if (_payloadFill > 0) {
+                sink.onText((TrinityTextKind)_payload[0], _payload + 1, _payloadFill - 1);
+            }
+            break;
+        case TRINITY_FRAME_CONTROL:
+            sink.onControl(_payload);
+            break;
+        case TRINITY_FRAME_TIMING:
+            if (_payloadFill >= TRINITY_TIMING_FRAME_SIZE) {
+                const uint8_t* p = (const uint8_t*)_payload;
+                TrinityTimingFrame timing;
+                timing.audio_bytes = readU32(p);
+                timing.sample_rate = readU32(p + 4);
+                timing.stt_ms = readU32(p + 8);
+                timing.llm_ms = readU32(p + 12);
+                timing.tts_ms = readU32(p + 16);
+                sink.onTiming(timing);
+            }
+            break;
+        case TRINITY_FRAME_RTP:
+            if (_payloadFill >= TRINITY_RTP_FRAME_SIZE) {
+                const uint8_t* p = (const uint8_t*)_payload;
+                TrinityRtpFrame rtp;
+                rtp.ssrc = readU32(p);
+                rtp.first_sequence = readU32(p + 4);
+                rtp.packets = readU32(p + 8);
+                sink.onRtp(rtp);
+            }
+            break;
+    }
+}
+
+bool FrameParser::feed(uint8_t* data, size_t length, FrameSink& sink) {
+    while (length > 0) {
+        switch (_state) {
+            case STATE_HEADER: {
+                const size_t take = (TRINITY_FRAME_HEADER_SIZE - _headerFill) < length ? (TRINITY_FRAME_HEADER_SIZE - _headerFill) : length;
+                memcpy(_header + _headerFill, data, take);
+                _headerFill += take;
+                data += take;
+                length -= take;
+                if (_headerFill < TRINITY_FRAME_HEADER_SIZE) {
+                    break;
+                }
+
+                _headerFill = 0;
+                _type = _header[0];
+                _remaining = readU32(_header + 1);
+                _payloadFill = 0;
+                if (_type > TRINITY_FRAME_RTP) {
+                    _state = STATE_ERROR;
+                    return false;
+                }
+                if (_type == TRINITY_FRAME_END) {
+                    _state = STATE_DONE;
+                    sink.onEnd();
+                    return true;
+                }
+                if (_remaining == 0) {
+                    finishSmallFrame(sink);
+                } else {
+                    _state = STATE_PAYLOAD;
+                }
+                break;
+            }
+
+            case STATE_PAYLOAD: {
+                const size_t take = _remaining < length ? _remaining : length;
+                if (_type == TRINITY_FRAME_AUDIO) {
+                    // Audio goes straight through, no copy
+                    sink.onAudio(data, take);
+                } else {
+                    const size_t room = FRAME_PARSER_TEXT_MAX - _payloadFill;
+                    const size_t keep = take < room ? take : room;
+                    memcpy(_payload + _payloadFill, data, keep);
+                    _payloadFill += keep;
+                }
+                data += take;
+                length -= take;
+                _remaining -= take;
+                if (_remaining == 0) {
+                    if (_type != TRINITY_FRAME_AUDIO) {
+                        finishSmallFrame(sink);
+                    }
+                    _state = STATE_HEADER;
+                }
+                break;
+            }
+
+            case STATE_DONE:
+                // Trailing bytes after END are ignored
+                return true;
+
+            case STATE_ERROR:
+                return false;
+        }
+    }
+    return _state != STATE_ERROR;
+}
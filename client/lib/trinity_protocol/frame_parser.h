@@ -0,0 +1,62 @@
+#pragma once
+
+// =================================================================================================
+// INCREMENTAL FRAME PARSER
+// Parses the framed response format (see trinity_protocol.h) from arbitrary-sized network
+// chunks without buffering audio: AUDIO payload bytes are handed to the sink as they arrive,
+// in place, so the playback loop adds no latency. Only TEXT/CONTROL/TIMING/RTP payloads (small)
+// are collected into a fixed internal buffer. No heap allocation.
+// =================================================================================================
+
+#include "trinity_protocol.h"
+
+// Longest TEXT/CONTROL payload kept; longer ones are truncated (the rest is skipped)
+const size_t FRAME_PARSER_TEXT_MAX = 512;
+
+class FrameSink {
+public:
+    virtual ~FrameSink() {}
+    // 'text' is NUL-terminated (truncated to FRAME_PARSER_TEXT_MAX bytes)
+    virtual void onText(TrinityTextKind kind, const char* text, size_t length) = 0;
+    virtual void onControl(const char* opcodes) = 0;
+    virtual void onTiming(const TrinityTimingFrame& timing) = 0;
+    // Only sent on RTP turns
+    virtual void onRtp(const TrinityRtpFrame&) {}
+    // Audio bytes point into the caller's buffer and may be modified in place
+    virtual void onAudio(uint8_t* data, size_t length) = 0;
+    virtual void onEnd() = 0;
+};
+
+class FrameParser {
+public:
+    FrameParser() { reset(); }
+
+    void reset();
+
+    // Consumes all 'length' bytes, calling the sink for every completed frame or audio piece.
+    // Returns false once the stream is malformed (unknown frame type); further input is ignored.
+    bool feed(uint8_t* data, size_t length, FrameSink& sink);
+
+    bool finished() const { return _state == STATE_DONE; }
+    bool failed() const { return _state == STATE_ERROR; }
+
+    // Bytes left in the current part of the stream: the frame header being read, or the current
+    // frame's payload. A reader that takes no more than this at a time gets AUDIO payloads apart
+    // from everything else, so it can receive them straight into playback memory.
+    size_t partRemaining() const;
+    // The current part is an AUDIO payload
+    bool audioPart() const { return _state == STATE_PAYLOAD && _type == TRINITY_FRAME_AUDIO; }
+
+private:
+    enum State { STATE_HEADER, STATE_PAYLOAD, STATE_DONE, STATE_ERROR };
+
+    void finishSmallFrame(FrameSink& sink);
+
+    State _state;
+    uint8_t _header[TRINITY_FRAME_HEADER_SIZE];
+    size_t _headerFill;
+    uint8_t _type;
+    uint32_t _remaining;        // Payload bytes still to come for the current frame
+    char _payload[FRAME_PARSER_TEXT_MAX + 1];
+    size_t _payloadFill;
+};
@@ -0,0 +1,48 @@
+#include "trinity_caps.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+bool trinityNextCap(char** cursor, char** key, char** value) {
+    while (*cursor && **cursor) {
+        char* line = *cursor;
+        char* end = strchr(line, '\n');
+        if (end) {
+            *end = '\0';
+            *cursor = end + 1;
+        } else {
+            *cursor = line + strlen(line);
+        }
+
+        // Tolerate CRLF line endings
+        const size_t length = strlen(line);
+        if (length > 0 && line[length - 1] == '\r') {
+            line[length - 1] = '\0';
+        }
+
+        char* equals = strchr(line, '=');
+        if (equals) {
+            *equals = '\0';
+            *key = line;
+            *value = equals + 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool trinityParseFormat(const char* value, char* codec, size_t codecSize, uint32_t* rate) {
+    const char* at = strchr(value, '@');
+    if (!at || at == value || (size_t)(at - value) >= codecSize) {
+        return false;
+    }
+    char* end = NULL;
+    const unsigned long parsed = strtoul(at + 1, &end, 10);
+    if (end == at + 1 || *end != '\0' || parsed == 0) {
+        return false;
+    }
+    memcpy(codec, value, at - value);
+    codec[at - value] = '\0';
+    *rate = (uint32_t)parsed;
+    return true;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+// =================================================================================================
+// CAPABILITY MESSAGE HELPERS
+// Parsing for the "key=value" bodies of the TRINITY_HELLO_PATH handshake and for "codec@rate"
+// format names. Works in place on caller-owned buffers; no heap allocation.
+// =================================================================================================
+
+#include "trinity_protocol.h"
+
+// Splits the next "key=value" line off *cursor, NUL-terminating key and value in place.
+// Lines without '=' are skipped. Returns false when no lines are left.
+bool trinityNextCap(char** cursor, char** key, char** value);
+
+// Parses "codec@rate". Returns false if the value is malformed or the codec name doesn't fit.
+bool trinityParseFormat(const char* value, char* codec, size_t codecSize, uint32_t* rate);
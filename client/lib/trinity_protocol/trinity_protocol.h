@@ -0,0 +1,148 @@
+#pragma once
+
+// =================================================================================================
+// TRINITY DEVICE <-> SERVER PROTOCOL CONSTANTS
+// Shared by the firmware and its native (host) build so both speak exactly the same protocol.
+// The server-side counterparts live at the top of server.py.
+// =================================================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRINITY_VOICE_PATH "/voice_input"
+
+// --- Request Headers ---
+#define TRINITY_DEVICE_ID_HEADER "X-Device-ID"   // Server keys the conversation session on this
+#define TRINITY_DEADLINE_HEADER "X-Deadline-Ms"  // Server plans its model stages inside this budget
+
+// --- Response Headers ---
+#define TRINITY_TRACE_ID_HEADER "X-Trace-Id"     // Matches the server's archive/capture record
+#define TRINITY_CONTROL_HEADER "X-Trinity-Control" // Comma-separated device-control opcodes
+
+// --- Device-Control Opcodes (server intent fast path) ---
+#define TRINITY_OPCODE_STOP "stop"               // Do not play anything, return to READY
+#define TRINITY_OPCODE_VOLUME_UP "volume_up"
+#define TRINITY_OPCODE_VOLUME_DOWN "volume_down"
+
+// --- Framed Response Format ---
+// Requested with "Accept: application/x-trinity-frames"; older firmware gets raw PCM instead.
+// The body is a sequence of TLV frames:
+//
+//     frame := u8:type u32:length(LE) payload[length]
+//
+// Order: TEXT (transcript), TEXT (reply), CONTROL (optional), TIMING, AUDIO..., END.
+// Turns on the RTP transport carry one RTP frame instead of the AUDIO frames.
+#define TRINITY_FRAMES_MIME "application/x-trinity-frames"
+
+enum TrinityFrameType : uint8_t {
+    TRINITY_FRAME_END = 0x00,     // Empty; last frame of the response
+    TRINITY_FRAME_TEXT = 0x01,    // u8:kind (TrinityTextKind) + UTF-8 text
+    TRINITY_FRAME_AUDIO = 0x02,   // PCM samples (any length, may split a sample)
+    TRINITY_FRAME_TIMING = 0x03,  // TrinityTimingFrame
+    TRINITY_FRAME_CONTROL = 0x04, // Comma-separated opcodes (see above)
+    TRINITY_FRAME_RTP = 0x05      // TrinityRtpFrame: the audio follows over UDP
+};
+
+enum TrinityTextKind : uint8_t {
+    TRINITY_TEXT_TRANSCRIPT = 0,
+    TRINITY_TEXT_REPLY = 1
+};
+
+// TIMING payload: little-endian u32 fields in this order
+struct TrinityTimingFrame {
+    uint32_t audio_bytes;   // Total PCM bytes in the AUDIO frames that follow
+    uint32_t sample_rate;
+    uint32_t stt_ms;
+    uint32_t llm_ms;
+    uint32_t tts_ms;
+};
+
+// RTP payload: little-endian u32 fields in this order
+struct TrinityRtpFrame {
+    uint32_t ssrc;            // Stream of the reply audio (the turn's uplink SSRC)
+    uint32_t first_sequence;  // Sequence number of the first audio packet
+    uint32_t packets;         // Audio packets in the stream, FEC packets not counted
+};
+
+const size_t TRINITY_FRAME_HEADER_SIZE = 5;
+const size_t TRINITY_TIMING_FRAME_SIZE = 20;
+const size_t TRINITY_RTP_FRAME_SIZE = 12;
+
+// --- Capability Negotiation ---
+// At connect time the device POSTs its capabilities to TRINITY_HELLO_PATH and the server answers
+// with the formats to use. Both bodies are "key=value" lines; list values are comma-separated.
+// Servers without the endpoint (404) imply protocol 1: pcm16 at 16 kHz both ways.
+#define TRINITY_PROTOCOL_VERSION 2
+#define TRINITY_HELLO_PATH "/hello"
+#define TRINITY_CAPS_MIME "text/x-trinity-caps"
+
+// Device -> server
+#define TRINITY_CAP_PROTOCOL "protocol"
+// Codecs and sample rates the device supports; the server answers with the common subset,
+// which bounds the formats link adaptation may switch between
+#define TRINITY_CAP_CODECS "codecs"
+#define TRINITY_CAP_RATES "rates"
+#define TRINITY_CAP_FRAME_BYTES "frame_bytes"  // Preferred AUDIO frame payload size
+#define TRINITY_CAP_MAX_TEXT "max_text"        // Longest TEXT frame kept by the frame parser
+// Server -> device
+#define TRINITY_CAP_UPLINK "uplink"            // Format for request bodies
+#define TRINITY_CAP_DOWNLINK "downlink"        // Format of response audio
+#define TRINITY_CAP_MAX_UPLOAD "max_upload"    // Largest request body the server accepts
+
+// Formats are written "codec@rate", e.g. "pcm16@16000"
+#define TRINITY_CODEC_PCM16 "pcm16"            // 16-bit little-endian mono PCM
+#define TRINITY_CODEC_ADPCM "adpcm"            // IMA ADPCM, 4 bits per sample (lib/audio_codec)
+#define TRINITY_FORMAT_HEADER "X-Trinity-Format"  // Format of this request's body
+#define TRINITY_DOWNLINK_HEADER "X-Trinity-Downlink"  // Format wanted for this response's audio
+
+// --- Link Adaptation ---
+// Measurements from the device's previous turn, reported for the server's metrics:
+// "up_kbps=..,down_kbps=..,rtt_ms=..,rssi=..,underruns=..,switches=..", then optional fields
+// (RTP, audio profile, CPU), e.g. ",profile=balanced,latency_ms=..,glitches_pm=.."
+#define TRINITY_LINK_HEADER "X-Trinity-Link"
+
+// --- Network Self-Test ---
+// The device's diagnostic mode times bursts against these endpoints and reports the results
+// (TRINITY_CAPS_MIME lines: up_kbps, down_kbps, rtt_p50_ms, rtt_p90_ms, rtt_max_ms, rssi).
+#define TRINITY_DIAG_SINK_PATH "/diag/sink"       // POST; body discarded, answers bytes and receive_ms
+#define TRINITY_DIAG_SOURCE_PATH "/diag/source"   // GET ?bytes=N; streams N bytes
+#define TRINITY_DIAG_REPORT_PATH "/diag/report"
+
+// --- RTP Audio Transport ---
+// Optional: audio in both directions as RTP over UDP (lib/rtp_audio), with HTTP kept as the
+// control channel. A lost datagram costs one concealed 20 ms packet instead of stalling the
+// whole TCP stream until it is retransmitted. The device offers it in the handshake; a server
+// with the transport enabled answers with its UDP port.
+#define TRINITY_CAP_TRANSPORTS "transports"   // Device -> server, e.g. "tcp,rtp"
+#define TRINITY_CAP_RTP_PORT "rtp_port"       // Server -> device; absent = TCP only
+#define TRINITY_TRANSPORT_RTP "rtp"
+// Sent instead of an audio body: "ssrc=..,seq=..,packets=.." of the uplink stream (seq = first
+// sequence number). The server replies over RTP to the address the uplink came from, with the
+// same SSRC, and answers 422 if none of the stream arrived (the device then resends over TCP).
+#define TRINITY_RTP_HEADER "X-Trinity-Rtp"
+//
+// Datagrams are RTP (RFC 3550): 12-byte header, no CSRCs or extensions. Each audio packet holds
+// TRINITY_RTP_PACKET_MS of audio in the turn's format; adpcm packets start with a block header
+// (s16 predicted sample, u8 step index, u8 0; little-endian) so every packet decodes on its own.
+// After every TRINITY_RTP_FEC_GROUP audio packets, and after the last one, an XOR parity packet
+// (its own sequence numbers) can rebuild any single lost packet of its group:
+//
+//     fec payload := u16:base sequence u8:count u8:0 u16:length xor (big-endian) + xor of payloads
+const uint8_t TRINITY_RTP_PT_AUDIO = 96;
+const uint8_t TRINITY_RTP_PT_FEC = 97;
+const uint32_t TRINITY_RTP_PACKET_MS = 20;
+const uint8_t TRINITY_RTP_FEC_GROUP = 4;
+
+// --- Firmware Updates (OTA) ---
+// The device names its build in the handshake (the first 8 bytes of the app's ELF SHA-256, in
+// hex), and the build it last rolled back from, if any. A server with another build answers with
+// its id. Between turns the device GETs TRINITY_OTA_IMAGE_PATH "?base=<its build>": an update
+// package (lib/ota_image), a delta against that build if the server still has it. A dropped
+// download resumes with "Range: bytes=<consumed>-" and If-Range: <ETag>; a 200 instead of a 206
+// means the package changed and the update starts over later. The result goes to
+// TRINITY_OTA_REPORT_PATH as TRINITY_CAPS_MIME lines (build, result, received_bytes, resumes, ms).
+#define TRINITY_CAP_BUILD "build"              // Device -> server
+#define TRINITY_CAP_OTA_INVALID "ota_invalid"  // Device -> server: a build that failed its first boot
+#define TRINITY_CAP_OTA "ota"                  // Server -> device: the build to update to
+#define TRINITY_OTA_IMAGE_PATH "/ota/image"
+#define TRINITY_OTA_REPORT_PATH "/ota/report"
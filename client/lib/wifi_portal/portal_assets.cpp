@@ -0,0 +1,115 @@
+// Generated by tools/portal_assets.py from assets/index.html; do not edit.
+
+#include "portal_assets.h"
+
+const uint8_t WIFI_PORTAL_INDEX_GZ[WIFI_PORTAL_INDEX_GZ_BYTES] = {
+    0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x8d, 0x58, 0x6d, 0x73, 0xda, 0x46,
+    0x10, 0xfe, 0xce, 0xaf, 0xd8, 0xd2, 0x69, 0x11, 0x53, 0x10, 0xc2, 0x36, 0x8d, 0x8d, 0x31, 0x9d,
+    0x04, 0x93, 0x86, 0x49, 0x0a, 0x1e, 0x9b, 0xa6, 0x93, 0xe9, 0x74, 0x3a, 0x87, 0x74, 0x82, 0x6b,
+    0xa4, 0x3b, 0x55, 0x77, 0xc2, 0x26, 0x19, 0xff, 0xf7, 0xee, 0x9e, 0x5e, 0x78, 0x31, 0x64, 0x1a,
+    0xcf, 0x08, 0x69, 0xb5, 0x6f, 0xf7, 0xec, 0xb3, 0x7b, 0xa7, 0x0c, 0xbe, 0xbb, 0x9d, 0x8d, 0xe6,
+    0x9f, 0xee, 0xc6, 0xb0, 0x32, 0x71, 0x34, 0xac, 0x0d, 0xca, 0x1f, 0xce, 0x02, 0xfc, 0x89, 0xb9,
+    0x61, 0x20, 0x59, 0xcc, 0x6f, 0xea, 0x6b, 0xc1, 0x1f, 0x13, 0x95, 0x9a, 0x3a, 0xf8, 0x4a, 0x1a,
+    0x2e, 0xcd, 0x4d, 0xfd, 0x51, 0x04, 0x66, 0x75, 0x13, 0xf0, 0xb5, 0xf0, 0x79, 0xdb, 0x3e, 0xb4,
+    0x40, 0x48, 0x61, 0x04, 0x8b, 0xda, 0xda, 0x67, 0x11, 0xbf, 0xe9, 0xba, 0x5e, 0x1d, 0xdd, 0x18,
+    0x61, 0x22, 0x3e, 0x9c, 0xa7, 0xf4, 0x72, 0x03, 0x0f, 0xdc, 0x64, 0xc9, 0xa0, 0x93, 0x0b, 0x6b,
+    0x03, 0x6d, 0x36, 0xf4, 0xdb, 0x4f, 0x95, 0x32, 0xf0, 0xb5, 0xd6, 0x6e, 0x4b, 0xae, 0x64, 0x7b,
+    0x99, 0x72, 0x2e, 0xfb, 0xf0, 0xfd, 0xf9, 0x55, 0x18, 0x76, 0x2f, 0xae, 0x4b, 0xb1, 0xbf, 0x61,
+    0x24, 0xf5, 0xbc, 0x10, 0xff, 0x91, 0x74, 0xb1, 0x6c, 0xfb, 0x2a, 0x52, 0x29, 0x09, 0x03, 0xfa,
+    0xb3, 0x42, 0xf5, 0x54, 0x49, 0xbb, 0x8c, 0xfe, 0x48, 0x6a, 0xf8, 0x93, 0xa9, 0xc4, 0x61, 0x98,
+    0x7b, 0x78, 0xae, 0x2d, 0x54, 0xb0, 0xc1, 0xb8, 0x21, 0xae, 0xaa, 0x1d, 0xb2, 0x58, 0x44, 0x9b,
+    0x3e, 0x34, 0x1e, 0x12, 0xe6, 0x73, 0xf8, 0x4d, 0x49, 0xd5, 0x68, 0x41, 0x8c, 0x3f, 0x9a, 0x04,
+    0xd7, 0xb5, 0x05, 0xf3, 0x3f, 0x2f, 0x53, 0x95, 0xc9, 0xa0, 0xf4, 0xb4, 0x66, 0xa9, 0xb3, 0x4d,
+    0xa3, 0x79, 0x5d, 0xdb, 0x93, 0x6f, 0x63, 0xe2, 0x9b, 0x40, 0xe8, 0x24, 0x62, 0xe8, 0x3e, 0x8c,
+    0xf8, 0xd3, 0x75, 0xed, 0x9f, 0x4c, 0x1b, 0x11, 0x6e, 0xda, 0x05, 0x9e, 0x7d, 0xf0, 0xf1, 0xca,
+    0xd3, 0xeb, 0x1a, 0x8b, 0xc4, 0x52, 0xb6, 0x85, 0xe1, 0xb1, 0xde, 0x0a, 0x63, 0x21, 0xdb, 0x2b,
+    0x2e, 0x96, 0x2b, 0x54, 0xec, 0x7a, 0xde, 0x7a, 0x85, 0x22, 0x96, 0x2e, 0x05, 0xc2, 0xe1, 0xed,
+    0xe5, 0x25, 0x62, 0xb6, 0xe4, 0x7d, 0x88, 0x84, 0xe4, 0x2c, 0x45, 0x1c, 0x59, 0x20, 0xd0, 0x85,
+    0xe3, 0x05, 0x7c, 0xd9, 0x3a, 0xcc, 0x16, 0xae, 0xbc, 0x1f, 0x5a, 0x90, 0x2e, 0x17, 0xcc, 0xe9,
+    0xbd, 0x6a, 0xc1, 0x59, 0xaf, 0x87, 0x17, 0xaf, 0x05, 0x9e, 0xdb, 0x6d, 0x52, 0x94, 0x1f, 0x9a,
+    0xad, 0xda, 0xa1, 0xa3, 0xab, 0xdc, 0x93, 0x49, 0x99, 0x44, 0x50, 0x52, 0x14, 0xc1, 0xd5, 0x55,
+    0xe9, 0xc5, 0x2b, 0x9d, 0xd0, 0x65, 0xeb, 0x65, 0x2f, 0x41, 0x2d, 0xbe, 0x60, 0x7e, 0x3d, 0x2f,
+    0x79, 0xb2, 0x17, 0xaa, 0x81, 0x4b, 0x18, 0x30, 0x0c, 0x94, 0x62, 0x25, 0x2c, 0x93, 0xfa, 0x94,
+    0x1a, 0x2d, 0xf1, 0xa9, 0x5d, 0x3c, 0x5f, 0x78, 0x56, 0x39, 0x61, 0x41, 0x20, 0xe4, 0xb2, 0x0f,
+    0xe7, 0xf6, 0x71, 0xa1, 0xd2, 0x80, 0xa7, 0x6d, 0x4a, 0x2e, 0x43, 0xb4, 0xba, 0x67, 0x56, 0x78,
+    0xaa, 0x4a, 0x25, 0x2f, 0x28, 0x21, 0xbc, 0xd7, 0x2b, 0x16, 0xa8, 0x47, 0x04, 0x10, 0xff, 0xba,
+    0x3d, 0xcc, 0xe7, 0xd8, 0x1a, 0x7a, 0xcd, 0x96, 0x55, 0x38, 0xab, 0x14, 0x0e, 0xa0, 0x3a, 0x6f,
+    0x96, 0x69, 0xf4, 0x01, 0xc3, 0x83, 0x56, 0x91, 0x08, 0x8a, 0x88, 0x15, 0x69, 0x51, 0xc7, 0x22,
+    0x86, 0xdd, 0xa1, 0xb0, 0x64, 0x2c, 0x8a, 0xc8, 0x52, 0x03, 0x67, 0x9a, 0x13, 0x02, 0xab, 0x2e,
+    0xae, 0x7c, 0x2f, 0xd9, 0x3d, 0x53, 0xa2, 0xd1, 0x6e, 0xb6, 0x94, 0xcb, 0x4b, 0xb5, 0x02, 0x8c,
+    0x85, 0x32, 0x46, 0xc5, 0x27, 0x92, 0xb1, 0x8d, 0xd5, 0xac, 0x70, 0xac, 0x94, 0xbb, 0x16, 0xce,
+    0x9c, 0x52, 0x5b, 0x0f, 0x56, 0x68, 0xa3, 0x5b, 0x52, 0x6e, 0xe9, 0x68, 0xdb, 0x25, 0xaf, 0x64,
+    0xd7, 0xbd, 0xe4, 0x31, 0xad, 0x21, 0x29, 0xdb, 0x28, 0x97, 0x7b, 0xee, 0x15, 0xc9, 0xcb, 0x8e,
+    0xf3, 0x7d, 0xff, 0xb8, 0xab, 0xc3, 0x98, 0xbd, 0x9c, 0x13, 0x42, 0x26, 0x99, 0xf9, 0xd3, 0x6c,
+    0x12, 0x1c, 0x3e, 0x64, 0x56, 0xff, 0x8b, 0xa6, 0xcb, 0x56, 0x96, 0x30, 0xad, 0x1f, 0x71, 0xc1,
+    0x24, 0xd7, 0x3c, 0xe2, 0xbe, 0xd9, 0x72, 0x87, 0x48, 0xb7, 0x43, 0x95, 0x9c, 0x15, 0x65, 0xbb,
+    0xd0, 0x4a, 0x6d, 0xcf, 0x14, 0x35, 0xeb, 0x7e, 0x0b, 0xa6, 0x03, 0x7e, 0x5d, 0x1e, 0xa7, 0x17,
+    0x0e, 0x24, 0xef, 0xfa, 0x48, 0xf9, 0xb6, 0x5e, 0x9e, 0x5e, 0x94, 0xef, 0x18, 0x95, 0x7a, 0xa8,
+    0xab, 0x32, 0x43, 0x2d, 0xd7, 0x07, 0xa9, 0x24, 0xdf, 0x07, 0x9a, 0xe0, 0xb4, 0xae, 0xc4, 0x17,
+    0xbb, 0xae, 0xaa, 0xde, 0x4f, 0xfb, 0xec, 0x2a, 0xe4, 0x36, 0x1f, 0x4b, 0xb3, 0x16, 0x6c, 0x33,
+    0xb0, 0x82, 0xe3, 0x00, 0xf7, 0x43, 0xe5, 0x67, 0xfa, 0x14, 0xcc, 0xf9, 0x5b, 0x04, 0x79, 0xd7,
+    0x7d, 0xff, 0x28, 0x0d, 0x0f, 0x5a, 0xcb, 0x3b, 0xd1, 0x5a, 0xaf, 0x9a, 0x76, 0x00, 0x67, 0x58,
+    0x78, 0xf9, 0xbf, 0x8a, 0xd7, 0x36, 0x2a, 0x29, 0x59, 0x59, 0x96, 0x2f, 0x87, 0xe9, 0xdb, 0x75,
+    0x3a, 0x5a, 0x94, 0x53, 0x03, 0xdc, 0x22, 0xfe, 0x58, 0x8c, 0xda, 0x85, 0x8a, 0x82, 0x82, 0xb6,
+    0x16, 0xe1, 0x50, 0xa5, 0xc8, 0xd1, 0x2c, 0x49, 0x78, 0xea, 0xdb, 0xd6, 0xf5, 0xb3, 0x54, 0x93,
+    0x9b, 0x44, 0x89, 0x9c, 0xce, 0xa7, 0x57, 0x7f, 0x50, 0xec, 0x57, 0x07, 0x33, 0x61, 0x9b, 0xee,
+    0xf1, 0x9a, 0x15, 0x33, 0x97, 0x32, 0xa0, 0xd1, 0xaa, 0xb7, 0xd8, 0xf5, 0x57, 0x6a, 0x6d, 0x47,
+    0xe7, 0x89, 0x15, 0x9f, 0xaa, 0xcb, 0xf1, 0x91, 0xd7, 0xdd, 0x62, 0x93, 0xf3, 0xba, 0x0a, 0xc3,
+    0x7c, 0x23, 0xd6, 0x1c, 0xe3, 0xec, 0x40, 0x61, 0x6f, 0x23, 0x66, 0xf8, 0x27, 0x07, 0x1b, 0xc9,
+    0x16, 0xd4, 0xc5, 0xcd, 0x5f, 0x1e, 0xce, 0x82, 0xcb, 0xdd, 0x59, 0x70, 0x79, 0x79, 0x99, 0x2b,
+    0x1a, 0x66, 0x32, 0xdd, 0x8e, 0xb9, 0xd6, 0xb8, 0x69, 0xa1, 0xc9, 0xcb, 0x32, 0xbf, 0x1c, 0x28,
+    0xc7, 0x66, 0xc8, 0x49, 0x2e, 0x3e, 0xd7, 0x06, 0x9d, 0xe2, 0x84, 0x31, 0xe8, 0x14, 0xa7, 0x1a,
+    0xda, 0xf1, 0xf1, 0x27, 0x10, 0x6b, 0xf0, 0x23, 0xa4, 0xf7, 0x4d, 0xbd, 0xda, 0x7e, 0xe8, 0xb4,
+    0xb2, 0xea, 0x0e, 0x5f, 0x8f, 0x46, 0xe3, 0x87, 0x07, 0xb8, 0x9b, 0x4d, 0xa6, 0x73, 0x18, 0x4f,
+    0x7f, 0x7d, 0xfd, 0xeb, 0xf8, 0x16, 0xcd, 0xbb, 0xf8, 0x36, 0x19, 0x4e, 0xa6, 0x93, 0xf9, 0xe4,
+    0xf5, 0x7c, 0x0c, 0xa3, 0xd9, 0x74, 0x3a, 0x1e, 0xcd, 0x27, 0xb3, 0x29, 0xdc, 0xdd, 0xcf, 0xe6,
+    0xb3, 0xd1, 0xec, 0xc3, 0xa0, 0x93, 0xa0, 0x8e, 0x2d, 0x11, 0x81, 0xa5, 0xe4, 0x4d, 0xbd, 0xa3,
+    0xd9, 0x9a, 0xd7, 0x01, 0x8f, 0x52, 0x2b, 0x15, 0x60, 0x3f, 0x29, 0x6d, 0x28, 0x4a, 0xc4, 0x16,
+    0x3c, 0x02, 0xd4, 0xbc, 0xa9, 0x6b, 0x2d, 0x82, 0xfa, 0x70, 0x3a, 0x9e, 0xff, 0x31, 0xbb, 0x7f,
+    0x0f, 0x93, 0xdb, 0xf1, 0x74, 0x3e, 0x79, 0x3b, 0x19, 0xdf, 0x83, 0xf3, 0xf0, 0x30, 0xb9, 0x6d,
+    0xf6, 0x07, 0x1d, 0xab, 0x8c, 0x46, 0xb6, 0x31, 0x61, 0xa7, 0x65, 0x41, 0x04, 0x85, 0x7d, 0x71,
+    0x4c, 0xcb, 0xef, 0x23, 0xa1, 0xf1, 0x7c, 0x26, 0xb9, 0xc1, 0xce, 0xfd, 0xac, 0x31, 0x38, 0x7b,
+    0x8a, 0xb8, 0x5c, 0xe2, 0x69, 0xad, 0x7e, 0x7e, 0x56, 0x07, 0x3c, 0x85, 0xf8, 0x7c, 0x85, 0xcc,
+    0xe6, 0x18, 0xfd, 0x9d, 0x8a, 0x39, 0xfc, 0x21, 0xda, 0x6f, 0x05, 0x4c, 0x73, 0x03, 0x98, 0xa2,
+    0xab, 0x3a, 0xb0, 0xcc, 0x28, 0x5f, 0xc5, 0x49, 0xc4, 0x0d, 0x3a, 0x56, 0x61, 0x58, 0x87, 0x94,
+    0xff, 0x9b, 0x89, 0x94, 0x13, 0x88, 0x01, 0x33, 0x8c, 0xc2, 0xd8, 0x0c, 0xaa, 0x48, 0xc3, 0x41,
+    0xa7, 0x7c, 0xb1, 0x8f, 0x30, 0x51, 0xa2, 0xc8, 0x96, 0xee, 0x86, 0x0f, 0x78, 0x95, 0xd8, 0xdf,
+    0x84, 0x00, 0x94, 0xe6, 0xae, 0xeb, 0xa2, 0xbd, 0x58, 0xef, 0xc3, 0x53, 0x4d, 0xa0, 0xb2, 0x2c,
+    0xef, 0xc7, 0x9f, 0xc0, 0xb9, 0x2b, 0xa4, 0xa7, 0xe0, 0xa9, 0xac, 0x6c, 0xd0, 0xed, 0x53, 0x0e,
+    0xd3, 0xf6, 0x79, 0x07, 0x9a, 0x9f, 0x2f, 0x0e, 0xa0, 0xc9, 0x51, 0x29, 0x23, 0x81, 0xc3, 0xe3,
+    0x04, 0xcf, 0xaf, 0x22, 0x04, 0x95, 0xe0, 0x04, 0x39, 0xac, 0x22, 0x4f, 0xd7, 0x44, 0xa0, 0x8f,
+    0xb3, 0xc9, 0x68, 0x0c, 0x0f, 0xe3, 0xfb, 0x8f, 0x54, 0x41, 0x95, 0x10, 0x0b, 0x58, 0xf4, 0x3f,
+    0xaa, 0x98, 0xdb, 0x97, 0x75, 0x2c, 0x9e, 0x76, 0xd2, 0xbb, 0xe8, 0x1d, 0xa4, 0xd7, 0xbd, 0x3a,
+    0x73, 0xbb, 0x3f, 0x5f, 0xba, 0x78, 0xf5, 0xfa, 0x3d, 0xcf, 0x3b, 0x2b, 0x33, 0xfc, 0xcc, 0x79,
+    0xa2, 0x41, 0x98, 0xe6, 0xb1, 0x22, 0x1e, 0x80, 0x9b, 0xaa, 0x50, 0x44, 0x1c, 0xb1, 0xfd, 0xfd,
+    0x76, 0x32, 0x23, 0x1e, 0xbf, 0x9d, 0x7c, 0x18, 0xef, 0x24, 0x5b, 0x6c, 0xad, 0x16, 0xc4, 0x42,
+    0xb7, 0xc4, 0xb0, 0x34, 0xad, 0x0d, 0xf2, 0x55, 0x62, 0xfb, 0x45, 0x19, 0xbe, 0xa0, 0x98, 0xe8,
+    0x10, 0xaf, 0x31, 0x33, 0xc2, 0x07, 0x27, 0x4c, 0x55, 0x4c, 0x07, 0xd2, 0xcf, 0x40, 0x0d, 0xaf,
+    0x9b, 0x83, 0x4e, 0x6e, 0xf0, 0xc2, 0x32, 0x52, 0x8f, 0x6d, 0x9a, 0x25, 0xd2, 0xdf, 0xd4, 0x87,
+    0x1f, 0x70, 0xee, 0x15, 0x0f, 0x27, 0x0d, 0x16, 0x2c, 0x62, 0xd2, 0xe7, 0xc8, 0x8d, 0x37, 0xc5,
+    0xdd, 0x37, 0x7c, 0x6b, 0xbd, 0xc1, 0xc3, 0x64, 0x28, 0xc8, 0x35, 0xde, 0xe7, 0xa4, 0xdf, 0xd1,
+    0xef, 0xe4, 0x6b, 0xa5, 0x09, 0x91, 0x6f, 0x49, 0x79, 0x89, 0x74, 0xb6, 0x88, 0x85, 0x21, 0xf6,
+    0xcd, 0x27, 0x1f, 0xa9, 0xef, 0x7f, 0x84, 0xfb, 0xf1, 0x9b, 0xd9, 0x6c, 0x3e, 0xe8, 0xe4, 0x7a,
+    0x64, 0x4a, 0x2d, 0x7f, 0xc0, 0xf8, 0xbd, 0xd9, 0x56, 0x1f, 0x8e, 0x94, 0x94, 0xe8, 0x9d, 0x38,
+    0x6f, 0x54, 0x1f, 0x8a, 0xaf, 0xa1, 0xbf, 0xed, 0xd7, 0x10, 0xbc, 0xbe, 0x2b, 0x89, 0x5f, 0xfc,
+    0x68, 0x3f, 0x15, 0x09, 0xa6, 0xd2, 0xe9, 0x60, 0x57, 0xb2, 0x74, 0xb1, 0xa9, 0x9a, 0xc4, 0x76,
+    0x8c, 0x59, 0x71, 0xa0, 0xe1, 0x00, 0xa1, 0xe0, 0x51, 0xd0, 0x02, 0x8b, 0x30, 0x09, 0xe9, 0x13,
+    0x8d, 0x45, 0x0d, 0x0d, 0x3e, 0xf3, 0x57, 0x3c, 0x00, 0xea, 0xb6, 0x5a, 0x98, 0x49, 0x3b, 0x8c,
+    0xec, 0x93, 0xd3, 0xa4, 0xd1, 0xcc, 0x8d, 0xbf, 0x72, 0x1a, 0x1d, 0x12, 0x34, 0x9a, 0x2e, 0x5a,
+    0x4a, 0xa7, 0xd2, 0x72, 0xf0, 0xc3, 0xe0, 0x2b, 0xf6, 0xba, 0xc9, 0x52, 0x09, 0xa9, 0xfb, 0x8f,
+    0x56, 0x68, 0x74, 0x0d, 0xcf, 0x2f, 0xf4, 0x02, 0x72, 0x85, 0x33, 0xd7, 0xce, 0x1b, 0xb8, 0x81,
+    0x00, 0x0f, 0x08, 0x31, 0x4e, 0x64, 0x77, 0xc9, 0xcd, 0x38, 0xe2, 0x74, 0xfb, 0x66, 0x33, 0x09,
+    0x9c, 0x46, 0x99, 0x7b, 0x03, 0x27, 0x32, 0xe9, 0xba, 0x02, 0xb1, 0x48, 0xdf, 0xcd, 0x7f, 0xfb,
+    0x80, 0x56, 0x8d, 0x06, 0x7e, 0x1a, 0xb9, 0xd5, 0x0c, 0xc0, 0xe5, 0x8d, 0x31, 0xf7, 0x9d, 0x30,
+    0xb2, 0x0c, 0x53, 0x14, 0x74, 0x27, 0x90, 0x9f, 0x72, 0x64, 0x48, 0x11, 0xcb, 0x69, 0xe4, 0x0a,
+    0x14, 0x25, 0xbf, 0x73, 0x6d, 0xed, 0xd1, 0x40, 0xba, 0x34, 0x18, 0x2b, 0x71, 0xde, 0x00, 0x24,
+    0x4e, 0x51, 0x0e, 0x3f, 0x41, 0x03, 0x82, 0x37, 0x71, 0x03, 0x6f, 0x1c, 0xe9, 0x52, 0x73, 0xc3,
+    0x2f, 0x28, 0x72, 0x6c, 0x9b, 0x37, 0x00, 0xbf, 0x07, 0xab, 0xc4, 0x19, 0xee, 0xfc, 0x32, 0x18,
+    0xad, 0x44, 0x14, 0x14, 0xbd, 0x4d, 0x9b, 0x0c, 0x7d, 0xdc, 0x9d, 0x5a, 0x7b, 0x09, 0x31, 0x36,
+    0xfa, 0x28, 0xff, 0xd2, 0xa3, 0x05, 0xd8, 0x3d, 0xd2, 0x0e, 0x40, 0x8c, 0x74, 0x6a, 0x18, 0x52,
+    0xe8, 0x1d, 0x64, 0xf2, 0x41, 0x60, 0xb3, 0xdd, 0x21, 0x03, 0x6e, 0xf6, 0x08, 0x20, 0x0e, 0x25,
+    0x67, 0xeb, 0xb4, 0x89, 0x27, 0x62, 0x33, 0x17, 0x31, 0xc7, 0xc3, 0xa4, 0x43, 0x42, 0x3a, 0x73,
+    0x78, 0x9e, 0x4d, 0xd5, 0xf5, 0x99, 0xd9, 0x83, 0x97, 0x8a, 0xfd, 0x42, 0xfd, 0xdc, 0xaa, 0xc3,
+    0xb3, 0xdd, 0x42, 0x73, 0xda, 0x5c, 0x53, 0x87, 0x14, 0xb4, 0x44, 0xea, 0xe7, 0x9b, 0x68, 0x27,
+    0xff, 0x0f, 0x83, 0xff, 0x00, 0xf6, 0x32, 0xf0, 0xc8, 0x48, 0x10, 0x00, 0x00,
+};
@@ -0,0 +1,10 @@
+#pragma once
+
+// Generated by tools/portal_assets.py from assets/index.html; do not edit.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WIFI_PORTAL_INDEX_ETAG "\"924c9a53556c58ef\""
+const size_t WIFI_PORTAL_INDEX_GZ_BYTES = 1741;     // 4168 bytes uncompressed
+extern const uint8_t WIFI_PORTAL_INDEX_GZ[WIFI_PORTAL_INDEX_GZ_BYTES];
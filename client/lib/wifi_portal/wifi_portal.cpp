@@ -0,0 +1,250 @@
+#include "wifi_portal.h"
+
+#include <WiFi.h>
+#include <nvs_flash.h>
+#include <esp_log.h>
+
+#include "portal_assets.h"
+
+const char WIFI_PORTAL_SAVED_HTML[] =
+    "<meta http-equiv='refresh' content='5;url=/'>"
+    "<div style='text-align:center;color:white;background:black;padding:20px;border:3px solid #00ffff;'>"
+    "<h1>CREDENTIALS ACCEPTED</h1>"
+    "<p>System rebooting to connect. Please switch your device back to your home network.</p></div>";
+
+bool wifiPortalLoadCredentials(const char* nvsNamespace, char* ssid, size_t ssidSize, char* pass, size_t passSize) {
+    nvs_handle_t handle;
+    if (nvs_open(nvsNamespace, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+    const bool found = nvs_get_str(handle, WIFI_PORTAL_SSID_KEY, ssid, &ssidSize) == ESP_OK &&
+                       nvs_get_str(handle, WIFI_PORTAL_PASS_KEY, pass, &passSize) == ESP_OK;
+    nvs_close(handle);
+    return found;
+}
+
+bool wifiPortalSaveCredentials(const char* nvsNamespace, const char* ssid, const char* pass) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(nvsNamespace, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE("NVS", "Error opening NVS for write: %s", esp_err_to_name(err));
+        return false;
+    }
+    err = nvs_set_str(handle, WIFI_PORTAL_SSID_KEY, ssid);
+    if (err == ESP_OK) {
+        err = nvs_set_str(handle, WIFI_PORTAL_PASS_KEY, pass);
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    if (err != ESP_OK) {
+        ESP_LOGE("NVS", "Error saving credentials: %s", esp_err_to_name(err));
+        return false;
+    }
+    ESP_LOGI("NVS", "Credentials saved and committed.");
+    return true;
+}
+
+// Appends 'text' as a JSON string to out[*length], if it fits in 'size' (with the terminator)
+static bool appendJsonString(char* out, size_t size, size_t* length, const char* text) {
+    size_t at = *length;
+    if (at + 1 >= size) {
+        return false;
+    }
+    out[at++] = '"';
+    for (const char* c = text; *c; c++) {
+        const unsigned char ch = (unsigned char)*c;
+        char escaped[7];
+        int n;
+        if (ch == '"' || ch == '\\') {
+            n = snprintf(escaped, sizeof(escaped), "\\%c", ch);
+        } else if (ch < 0x20) {
+            n = snprintf(escaped, sizeof(escaped), "\\u%04x", ch);
+        } else {
+            escaped[0] = (char)ch;
+            n = 1;
+        }
+        if (at + n + 1 >= size) {
+            return false;
+        }
+        memcpy(out + at, escaped, n);
+        at += n;
+    }
+    if (at + 1 >= size) {
+        return false;
+    }
+    out[at++] = '"';
+    out[at] = '\0';
+    *length = at;
+    return true;
+}
+
+WifiPortal::WifiPortal()
+    : _server(80), _lastRequestMs(0), _saved(false), _savedMs(0), _scanning(false), _scannedMs(0),
+      _networksLength(2) {
+    memset(&_config, 0, sizeof(_config));
+    strcpy(_rootUrl, "http://192.168.4.1/");
+    strcpy(_networks, "[]");
+}
+
+void WifiPortal::begin(const WifiPortalConfig& config) {
+    _config = config;
+
+    // The station interface only scans; a connection attempt left over from a failed join would
+    // keep retuning the radio away from the AP's channel
+    WiFi.mode(WIFI_AP_STA);
+    WiFi.disconnect();
+    WiFi.softAP(config.apSsid, NULL, config.apChannel);
+    snprintf(_rootUrl, sizeof(_rootUrl), "http://%s/", WiFi.softAPIP().toString().c_str());
+
+    _dns.start(53, "*", WiFi.softAPIP());
+
+    static const char* headers[] = {"If-None-Match"};
+    _server.collectHeaders(headers, 1);
+    _server.on("/", HTTP_GET, [this]() { handleIndex(); });
+    _server.on("/scan", HTTP_GET, [this]() { handleScan(); });
+    _server.on("/save", HTTP_POST, [this]() { handleSave(); });
+    _server.onNotFound([this]() { handleNotFound(); });
+    _server.begin();
+
+    _lastRequestMs = millis();
+    startScan();
+
+    Serial.println("\n--- AP Mode Started ---");
+    Serial.printf("Connect to AP: %s\n", config.apSsid);
+    Serial.printf("Browse to: %s\n", _rootUrl);
+}
+
+WifiPortalState WifiPortal::poll() {
+    _dns.processNextRequest();
+    _server.handleClient();
+    collectScan();
+
+    const uint32_t now = millis();
+    if (_saved) {
+        return now - _savedMs >= WIFI_PORTAL_SAVE_DELAY_MS ? WIFI_PORTAL_SAVED : WIFI_PORTAL_SERVING;
+    }
+    if (_config.timeoutMs > 0 && now - _lastRequestMs >= _config.timeoutMs) {
+        return WIFI_PORTAL_TIMED_OUT;
+    }
+    return WIFI_PORTAL_SERVING;
+}
+
+void WifiPortal::handleIndex() {
+    _lastRequestMs = millis();
+    _server.sendHeader("Cache-Control", "max-age=" + String(WIFI_PORTAL_MAX_AGE_S));
+    _server.sendHeader("ETag", WIFI_PORTAL_INDEX_ETAG);
+    if (_server.header("If-None-Match") == WIFI_PORTAL_INDEX_ETAG) {
+        _server.send(304);
+        return;
+    }
+    // Sent from flash as it is; every browser accepts gzip
+    _server.sendHeader("Content-Encoding", "gzip");
+    _server.send_P(200, "text/html", (const char*)WIFI_PORTAL_INDEX_GZ, WIFI_PORTAL_INDEX_GZ_BYTES);
+}
+
+void WifiPortal::handleScan() {
+    _lastRequestMs = millis();
+    if (!_scanning && (_scannedMs == 0 || millis() - _scannedMs >= WIFI_PORTAL_SCAN_MAX_AGE_MS)) {
+        startScan();
+    }
+    // The cached list, and whether a fresher one is coming (the page asks again then)
+    const char* head = _scanning ? "{\"scanning\":true,\"networks\":" : "{\"scanning\":false,\"networks\":";
+    _server.sendHeader("Cache-Control", "no-store");
+    _server.setContentLength(strlen(head) + _networksLength + 1);
+    _server.send(200, "application/json", "");
+    _server.sendContent(head);
+    _server.sendContent(_networks, _networksLength);
+    _server.sendContent("}");
+}
+
+void WifiPortal::handleSave() {
+    _lastRequestMs = millis();
+    if (_saved) {
+        _server.send_P(200, "text/html", WIFI_PORTAL_SAVED_HTML);
+        return;
+    }
+    const String ssid = _server.arg("ssid");
+    const String pass = _server.arg("password");   // Empty for an open network
+    if (ssid.length() == 0 || ssid.length() >= WIFI_PORTAL_SSID_SIZE || pass.length() >= WIFI_PORTAL_PASS_SIZE) {
+        _server.send(400, "text/plain", "Error: an SSID of up to 32 characters and a password of up to 64 are required.");
+        return;
+    }
+    const bool saved = _config.onSave ? _config.onSave(_server)
+                                      : wifiPortalSaveCredentials(_config.nvsNamespace, ssid.c_str(), pass.c_str());
+    if (!saved) {
+        _server.send(500, "text/plain", "Error: the settings could not be saved.");
+        return;
+    }
+    _server.send_P(200, "text/html", WIFI_PORTAL_SAVED_HTML);
+    _saved = true;
+    _savedMs = millis();
+}
+
+// Captive portal: whatever the phone probes for gets the page
+void WifiPortal::handleNotFound() {
+    _lastRequestMs = millis();
+    _server.sendHeader("Location", _rootUrl, true);
+    _server.send(302, "text/plain", "");
+}
+
+void WifiPortal::startScan() {
+    _scanning = WiFi.scanNetworks(true) == WIFI_SCAN_RUNNING;
+}
+
+// Once a scan is done: each named network once, at its strongest, strongest first
+void WifiPortal::collectScan() {
+    if (!_scanning) {
+        return;
+    }
+    const int16_t found = WiFi.scanComplete();
+    if (found == WIFI_SCAN_RUNNING) {
+        return;
+    }
+    _scanning = false;
+    _scannedMs = millis();
+    if (found < 0) {
+        return;     // Failed: keep the last list
+    }
+
+    uint8_t listed[WIFI_PORTAL_MAX_NETWORKS];
+    uint8_t count = 0;
+    size_t length = 1;
+    _networks[0] = '[';
+    while (count < WIFI_PORTAL_MAX_NETWORKS) {
+        // Strongest network not listed yet, skipping hidden ones and SSIDs already listed
+        int best = -1;
+        for (int i = 0; i < found && i < 255; i++) {
+            const String ssid = WiFi.SSID(i);
+            bool skip = ssid.length() == 0;
+            for (uint8_t j = 0; j < count && !skip; j++) {
+                skip = WiFi.SSID(listed[j]) == ssid;
+            }
+            if (!skip && (best < 0 || WiFi.RSSI(i) > WiFi.RSSI(best))) {
+                best = i;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        char fields[40];
+        const int n = snprintf(fields, sizeof(fields), ",\"rssi\":%d,\"open\":%s}", (int)WiFi.RSSI(best),
+                               WiFi.encryptionType(best) == WIFI_AUTH_OPEN ? "true" : "false");
+        size_t at = length + (count > 0 ? 1 : 0) + strlen("{\"ssid\":");
+        if (at >= sizeof(_networks)) {
+            break;
+        }
+        memcpy(_networks + length, count > 0 ? ",{\"ssid\":" : "{\"ssid\":", at - length);
+        if (!appendJsonString(_networks, sizeof(_networks) - n - 1, &at, WiFi.SSID(best).c_str())) {
+            break;  // Full (one ']' still fits after the last entry)
+        }
+        memcpy(_networks + at, fields, n);
+        length = at + n;
+        listed[count++] = (uint8_t)best;
+    }
+    _networks[length++] = ']';
+    _networks[length] = '\0';
+    _networksLength = length;
+    WiFi.scanDelete();
+}
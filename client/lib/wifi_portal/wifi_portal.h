@@ -0,0 +1,84 @@
+#pragma once
+
+// =================================================================================================
+// WI-FI PROVISIONING PORTAL
+// The setup access point, shared by the firmware and the wifi_setup sketch: a captive portal
+// (every DNS name resolves to the AP, unknown paths redirect to the page) serving the
+// configuration page, a list of nearby networks and the form that saves the credentials to NVS.
+//
+// The page is gzipped at build time (tools/portal_assets.py, from assets/index.html) and sent
+// from flash as it is, with Content-Encoding: gzip, a max-age and an ETag, so a phone on the slow
+// setup AP downloads about a third of it, once. The network list comes from an asynchronous scan
+// started with the portal and cached, so /scan answers right away; a scan older than
+// WIFI_PORTAL_SCAN_MAX_AGE_MS is refreshed in the background when the page asks for it.
+// poll() never blocks: the caller runs it from its loop, next to everything else.
+//
+// Device only (Arduino WebServer and DNSServer); not part of the native build.
+// =================================================================================================
+
+#include <Arduino.h>
+#include <WebServer.h>
+#include <DNSServer.h>
+
+#define WIFI_PORTAL_SSID_KEY "ssid"     // NVS keys of the credentials
+#define WIFI_PORTAL_PASS_KEY "pass"
+
+const size_t WIFI_PORTAL_SSID_SIZE = 33;            // 32 characters and the terminator
+const size_t WIFI_PORTAL_PASS_SIZE = 65;            // 64 (a WPA2 key in hex)
+const uint8_t WIFI_PORTAL_MAX_NETWORKS = 16;        // Strongest first
+const size_t WIFI_PORTAL_SCAN_JSON_SIZE = 1024;     // The networks' JSON array; the weakest are left out
+const uint32_t WIFI_PORTAL_SCAN_MAX_AGE_MS = 60000;
+const uint32_t WIFI_PORTAL_SAVE_DELAY_MS = 500;     // Lets the confirmation page go out before SAVED
+const uint32_t WIFI_PORTAL_MAX_AGE_S = 600;         // Page caching; revalidated with the ETag after it
+
+enum WifiPortalState {
+    WIFI_PORTAL_SERVING,
+    WIFI_PORTAL_SAVED,      // The form is saved; the caller restarts to use it
+    WIFI_PORTAL_TIMED_OUT   // No request for the config's timeoutMs
+};
+
+struct WifiPortalConfig {
+    const char* apSsid;         // Open AP
+    uint8_t apChannel;
+    uint32_t timeoutMs;         // Since the last request; 0 = never
+    const char* nvsNamespace;   // Where the credentials are saved, without onSave
+    // Saves the form (form.arg(): "ssid", "password" and the caller's own fields) and returns
+    // false if it couldn't; NULL saves the credentials to nvsNamespace
+    bool (*onSave)(WebServer& form);
+};
+
+// Credentials in 'nvsNamespace'. Load returns false if there are none.
+bool wifiPortalLoadCredentials(const char* nvsNamespace, char* ssid, size_t ssidSize, char* pass, size_t passSize);
+bool wifiPortalSaveCredentials(const char* nvsNamespace, const char* ssid, const char* pass);
+
+class WifiPortal {
+public:
+    WifiPortal();
+
+    // Starts the AP (with a station interface for scanning), the DNS and web servers, and the
+    // first scan
+    void begin(const WifiPortalConfig& config);
+
+    // Serves pending DNS and HTTP requests and collects a finished scan
+    WifiPortalState poll();
+
+private:
+    void handleIndex();
+    void handleScan();
+    void handleSave();
+    void handleNotFound();
+    void startScan();
+    void collectScan();
+
+    WebServer _server;
+    DNSServer _dns;
+    WifiPortalConfig _config;
+    char _rootUrl[32];              // http://<AP address>/
+    uint32_t _lastRequestMs;
+    bool _saved;
+    uint32_t _savedMs;
+    bool _scanning;
+    uint32_t _scannedMs;            // 0 until the first scan finished
+    char _networks[WIFI_PORTAL_SCAN_JSON_SIZE];
+    size_t _networksLength;
+};
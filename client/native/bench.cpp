@@ -0,0 +1,115 @@
+// =================================================================================================
+// HOST BENCHMARK SUITE (host build: pio run -e native_bench)
+//
+// Runs lib/bench_suite on the host: capture conversion, the format and DSP kernels, ADPCM, HTTP
+// chunked decoding, the frame and capability parsers, RTP packetization and the jitter buffer,
+// the binary log ring and link adaptation, over one second of test audio. The on-target
+// benchmark firmware (bench/bench_firmware.cpp) runs the same suite on the device.
+//
+// Each benchmark runs in repetitions of at least 10 ms. It reports nanoseconds per item (sample,
+// byte, packet...) for the fastest repetition, the one least disturbed by the rest of the host,
+// with the median next to it. --json writes the results for tools/bench_compare.py, which
+// compares them with the checked-in native/bench_baseline.json and fails on a regression past
+// its threshold. Host numbers rank changes against each other; on-target cycle counts come from
+// the benchmark firmware.
+//
+// The suite ends with dspSelfTest(), which checks every vector-path DSP kernel against its
+// scalar reference; the exit status is 1 if any output differs.
+//
+// Usage: bench [--json file] [--filter text] [--repetitions n]
+// =================================================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <bench_suite.h>
+#include <dsp_kernels.h>
+
+static const size_t FRAMES = 16000;     // One second at 16 kHz
+static const int DEFAULT_REPETITIONS = 9;
+static const uint32_t MIN_REPETITION_NS = 10000000;
+static const int MAX_RESULTS = 64;
+
+static uint32_t clockNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+static bool writeJson(const char* path, const BenchResult* results, int count, int repetitions) {
+    FILE* out = fopen(path, "w");
+    if (out == NULL) {
+        return false;
+    }
+    fprintf(out, "{\n  \"suite\": \"native\",\n  \"repetitions\": %d,\n  \"benchmarks\": [\n", repetitions);
+    for (int i = 0; i < count; i++) {
+        fprintf(out, "    {\"name\": \"%s\", \"unit\": \"%s\", \"items\": %zu, \"ns_per_item\": %.4f, \"median_ns_per_item\": %.4f}%s\n",
+                results[i].name, results[i].unit, results[i].items, results[i].best, results[i].median,
+                i + 1 < count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    return fclose(out) == 0;
+}
+
+static int usage(const char* program) {
+    fprintf(stderr, "Usage: %s [--json file] [--filter text] [--repetitions n]\n", program);
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    const char* jsonPath = NULL;
+    const char* filter = NULL;
+    int repetitions = DEFAULT_REPETITIONS;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--repetitions") == 0 && i + 1 < argc) {
+            repetitions = atoi(argv[++i]);
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    if (repetitions < 1 || repetitions > BENCH_MAX_REPETITIONS) {
+        return usage(argv[0]);
+    }
+
+    const size_t bytes = benchWorkspaceBytes(FRAMES);
+    void* workspace = aligned_alloc(DSP_ALIGN, (bytes + DSP_ALIGN - 1) / DSP_ALIGN * DSP_ALIGN);
+    if (workspace == NULL || !benchPrepare(workspace, bytes, FRAMES)) {
+        fprintf(stderr, "Can't set up the %u-byte benchmark workspace\n", (unsigned)bytes);
+        return 2;
+    }
+    static BenchResult results[MAX_RESULTS];
+    int count = 0;
+    printf("%-28s %12s %12s  per\n", "benchmark", "best ns", "median ns");
+    for (size_t i = 0; i < benchCount() && count < MAX_RESULTS; i++) {
+        if (filter != NULL && strstr(benchAt(i).name, filter) == NULL) {
+            continue;
+        }
+        results[count] = benchMeasure(benchAt(i), clockNs, MIN_REPETITION_NS, repetitions);
+        printf("%-28s %12.3f %12.3f  %s\n", results[count].name, results[count].best, results[count].median, results[count].unit);
+        count++;
+    }
+    if (jsonPath != NULL && !writeJson(jsonPath, results, count, repetitions)) {
+        fprintf(stderr, "Can't write %s\n", jsonPath);
+        return 2;
+    }
+
+    static uint8_t dspWorkspace[DSP_SELF_TEST_BYTES] DSP_ALIGNED;
+    DspKernelResult checks[DSP_KERNEL_COUNT + 1];
+    const size_t checked = dspSelfTest(clockNs, dspWorkspace, sizeof(dspWorkspace), checks, DSP_KERNEL_COUNT + 1);
+    int mismatches = 0;
+    for (size_t i = 0; i < checked; i++) {
+        if (!checks[i].exact) {
+            printf("dsp %s: vector path differs from the scalar reference\n", checks[i].name);
+            mismatches++;
+        }
+    }
+    printf("DSP kernel check: %u kernels, %d mismatches (checksum %08x)\n", (unsigned)checked, mismatches,
+           (unsigned)benchChecksum());
+    return checked == 0 || mismatches > 0 ? 1 : 0;
+}
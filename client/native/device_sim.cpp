@@ -0,0 +1,776 @@
+// =================================================================================================
+// TRINITY NATIVE DEVICE SIMULATOR (host build: pio run -e native)
+//
+// Sends a recorded PCM file to the server exactly the way the firmware does (same path and
+// headers from lib/trinity_protocol) and optionally appends a device-side capture record
+// (lib/trace_capture) with the PCM, request headers, response body and device timings.
+// Captures from here and from server.py (TRINITY_CAPTURE_FULL=1) share the X-Trace-Id, so
+// both halves of a turn can be lined up by tools/replay.py.
+//
+// With -n it runs several turns in a row through the firmware's capability handshake and link
+// adaptation (lib/link_adapt), printing the formats chosen per turn. Pointed at
+// tools/netem_proxy.py this validates the adaptation against emulated link conditions.
+//
+// With -t rtp the audio goes over the RTP transport (lib/rtp_audio) when the server offers it:
+// the recording is streamed at real-time pace as if it were being recorded, and the reply plays
+// out through the firmware's jitter buffer. Either way each turn reports the time from the end
+// of speech to the first audio and the playout glitches (stalls, concealed packets), so the two
+// transports can be compared on the same emulated link. -u sends the RTP packets to another
+// port than the one the server advertised (netem_proxy.py's UDP relay).
+//
+// -p plays the replies under one of the firmware's audio profiles (lib/audio_profile): its
+// jitter buffer range over RTP, its prebuffer over TCP. "-p auto" lets the profile selector pick
+// per turn, as the firmware does by default. The run ends with each profile's mean latency and
+// glitch rate.
+//
+// Like the firmware, turns share one kept-alive connection (lib/http_lite parses the responses)
+// and each turn's heap allocations are counted (lib/heap_track, with the --wrap linker flags of
+// [env:native]). A turn after the first that reuses the connection and still allocates makes
+// the run fail: it is the host-side check of the firmware's no-allocation steady state.
+//
+// Usage: device_sim [-n turns] [-t tcp|rtp] [-u rtp_port] [-p profile|auto] <host> <port> <pcm_file> [capture_file.trca] [device_id]
+// =================================================================================================
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <audio_format.h>
+#include <audio_kernels.h>
+#include <audio_profile.h>
+#include <frame_parser.h>
+#include <heap_track.h>
+#include <http_response.h>
+#include <ima_adpcm.h>
+#include <jitter_buffer.h>
+#include <link_adapt.h>
+#include <rtp_packet.h>
+#include <trace_capture.h>
+#include <trinity_caps.h>
+#include <trinity_protocol.h>
+
+// Mirrors SERVER_TIMEOUT_MS in the firmware
+static const unsigned SERVER_TIMEOUT_MS = 30000;
+static const size_t MAX_PCM_BYTES = 16 * 1024 * 1024;
+static const size_t MAX_RESPONSE_BYTES = 32 * 1024 * 1024;
+static const size_t MAX_HEADER_BYTES = 8192;
+// Mirrors MIN_GOODPUT_SAMPLE_BYTES in the firmware
+static const size_t MIN_GOODPUT_SAMPLE_BYTES = 16 * 1024;
+// lwIP's default TCP send buffer on the ESP32, so upload timing behaves like the device's
+static const int DEVICE_SNDBUF_BYTES = 5744;
+// recv() calls timed per response, for the TCP playout simulation
+static const size_t MAX_ARRIVALS = 65536;
+
+static double nowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static size_t fileSink(void* context, const uint8_t* data, size_t length) {
+    return fwrite(data, 1, length, (FILE*)context);
+}
+
+static int connectTo(const char* host, const char* port, int type = SOCK_STREAM) {
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = type;
+    struct addrinfo* result = NULL;
+    if (getaddrinfo(host, port, &hints, &result) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo* ai = result; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && type == SOCK_STREAM) {
+            setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &DEVICE_SNDBUF_BYTES, sizeof(DEVICE_SNDBUF_BYTES));
+        }
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+
+    if (fd >= 0) {
+        struct timeval tv = {(time_t)(SERVER_TIMEOUT_MS / 1000), 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+    return fd;
+}
+
+static bool sendAll(int fd, const void* data, size_t length) {
+    const uint8_t* p = (const uint8_t*)data;
+    while (length > 0) {
+        ssize_t sent = send(fd, p, length, 0);
+        if (sent <= 0) {
+            return false;
+        }
+        p += sent;
+        length -= (size_t)sent;
+    }
+    return true;
+}
+
+// Copies the value of 'name' from a raw header block into 'out' (empty if missing).
+static void findHeader(const char* headers, const char* name, char* out, size_t outSize) {
+    out[0] = '\0';
+    const size_t nameLen = strlen(name);
+    for (const char* line = headers; line && *line; line = strstr(line, "\r\n") ? strstr(line, "\r\n") + 2 : NULL) {
+        if (strncasecmp(line, name, nameLen) == 0 && line[nameLen] == ':') {
+            const char* value = line + nameLen + 1;
+            while (*value == ' ') value++;
+            size_t i = 0;
+            while (value[i] && value[i] != '\r' && i + 1 < outSize) {
+                out[i] = value[i];
+                i++;
+            }
+            out[i] = '\0';
+            return;
+        }
+    }
+}
+
+// One HTTP exchange with the timings the firmware measures
+struct Exchange {
+    int status;
+    char headers[MAX_HEADER_BYTES + 1];
+    uint8_t* response;      // Whole response, headers included
+    const uint8_t* body;
+    size_t bodySize;
+    double connectMs, uploadMs, ttfbMs, downloadMs, totalMs;
+    double startMs;
+    // Response offset reached by each recv() and when it returned
+    size_t* arrivalEnds;
+    double* arrivalMs;
+    size_t arrivals;
+};
+
+// The kept-alive server connection, like voiceClient in the firmware (-1 = none)
+static int serverFd = -1;
+static HttpResponse response;
+
+static void closeServer() {
+    if (serverFd >= 0) {
+        close(serverFd);
+        serverFd = -1;
+    }
+}
+
+// POSTs 'body' with the given extra header lines ("Name: value\r\n"...) over the kept-alive
+// connection, reconnecting if there is none or the server closed it. The response body is
+// stored with its chunk framing removed. Returns false on connection errors or a malformed
+// response.
+static bool post(const char* host, const char* port, const char* path, const char* extraHeaders,
+                 const uint8_t* body, size_t bodySize, Exchange& ex) {
+    char requestHeaders[1024];
+    int headerLen = snprintf(requestHeaders, sizeof(requestHeaders),
+        "POST %s HTTP/1.1\r\n"
+        "Host: %s:%s\r\n"
+        "%s"
+        "Content-Length: %zu\r\n\r\n",
+        path, host, port, extraHeaders, bodySize);
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        const bool fresh = serverFd < 0;
+        const double tStart = nowMs();
+        ex.startMs = tStart;
+        ex.arrivals = 0;
+        if (fresh) {
+            serverFd = connectTo(host, port);
+            if (serverFd < 0) {
+                fprintf(stderr, "Server Connection Failed.\n");
+                return false;
+            }
+        }
+        const double tConnected = nowMs();
+        if (!sendAll(serverFd, requestHeaders, headerLen) || !sendAll(serverFd, body, bodySize)) {
+            closeServer();
+            if (!fresh) {
+                continue; // Closed on the server's side since the last request
+            }
+            fprintf(stderr, "Upload failed.\n");
+            return false;
+        }
+        const double tUploaded = nowMs();
+
+        // Read the head, then the body up to its end (or until the server closes)
+        response.reset();
+        size_t responseSize = 0;
+        size_t headerBytes = 0;
+        bool headDone = false;
+        double tFirstByte = 0;
+        ssize_t n;
+        while ((!headDone || !response.bodyComplete()) && responseSize < MAX_RESPONSE_BYTES &&
+               (n = recv(serverFd, ex.response + responseSize, MAX_RESPONSE_BYTES - responseSize, 0)) > 0) {
+            if (tFirstByte == 0) {
+                tFirstByte = nowMs();
+            }
+            uint8_t* data = ex.response + responseSize;
+            size_t length = (size_t)n;
+            if (!headDone) {
+                size_t consumed;
+                const HttpHeadState state = response.feedHead(data, length, &consumed);
+                if (state == HTTP_HEAD_FAILED) {
+                    break;
+                }
+                responseSize += consumed;
+                data += consumed;
+                length -= consumed;
+                headDone = state == HTTP_HEAD_DONE;
+                headerBytes = responseSize;
+            }
+            if (headDone) {
+                responseSize += response.decodeBody(data, length);
+            }
+            if (ex.arrivals == MAX_ARRIVALS) {
+                ex.arrivals--; // Out of room: fold into the last one
+            }
+            ex.arrivalEnds[ex.arrivals] = responseSize;
+            ex.arrivalMs[ex.arrivals++] = nowMs();
+        }
+        const double tDone = nowMs();
+        if (!response.reusable()) {
+            closeServer();
+        }
+        if (!headDone) {
+            if (responseSize == 0 && !fresh) {
+                continue; // Closed on the server's side before answering
+            }
+            fprintf(stderr, "Malformed response (%zu bytes).\n", responseSize);
+            return false;
+        }
+        const size_t copied = headerBytes < MAX_HEADER_BYTES ? headerBytes : MAX_HEADER_BYTES;
+        memcpy(ex.headers, ex.response, copied);
+        ex.headers[copied] = '\0';
+
+        ex.status = response.status();
+        ex.body = ex.response + headerBytes;
+        ex.bodySize = responseSize - headerBytes;
+        // Like the firmware, only a fresh connection gives an RTT sample (0 = not measured)
+        ex.connectMs = fresh ? tConnected - tStart : 0;
+        ex.uploadMs = tUploaded - tConnected;
+        ex.ttfbMs = tFirstByte - tUploaded;
+        ex.downloadMs = tDone - tFirstByte;
+        ex.totalMs = tDone - tStart;
+        return true;
+    }
+    fprintf(stderr, "Server Connection Failed.\n");
+    return false;
+}
+
+// Counts the audio in a framed response; the simulator has nothing to play it on
+class CountingSink : public FrameSink {
+public:
+    size_t audioBytes = 0;
+    bool ended = false;
+    bool rtpStream = false;
+    TrinityRtpFrame rtp = {};
+    void onText(TrinityTextKind, const char*, size_t) override {}
+    void onControl(const char*) override {}
+    void onTiming(const TrinityTimingFrame&) override {}
+    void onAudio(uint8_t*, size_t length) override { audioBytes += length; }
+    void onRtp(const TrinityRtpFrame& frame) override { rtp = frame; rtpStream = true; }
+    void onEnd() override { ended = true; }
+};
+
+// What the listener hears of one reply
+struct Playout {
+    double firstAudioMs;    // From the end of speech; 0 if nothing played
+    double audioMs;         // Audio played, concealment included
+    double latencyMs;       // Mean audio buffered ahead of the speaker
+    uint32_t glitches;      // Stalls and concealed stretches
+    double stallMs;
+    uint32_t concealed, recovered, late;
+    float jitterMs;
+};
+
+// Same handshake as negotiateCapabilities() in the firmware. Returns the server's RTP port
+// (0 = audio over TCP).
+static uint16_t negotiate(const char* host, const char* port, const char* deviceId, bool rtp, LinkAdapter& adapter, Exchange& ex) {
+    char caps[256];
+    const int capsLength = snprintf(caps, sizeof(caps),
+        TRINITY_CAP_PROTOCOL "=%d\n"
+        TRINITY_CAP_CODECS "=" TRINITY_CODEC_PCM16 "," TRINITY_CODEC_ADPCM "\n"
+        TRINITY_CAP_RATES "=16000,8000\n"
+        TRINITY_CAP_FRAME_BYTES "=2048\n"
+        TRINITY_CAP_MAX_TEXT "=%u\n"
+        "%s",
+        TRINITY_PROTOCOL_VERSION, (unsigned)FRAME_PARSER_TEXT_MAX,
+        rtp ? TRINITY_CAP_TRANSPORTS "=tcp," TRINITY_TRANSPORT_RTP "\n" : "");
+    char headers[128];
+    snprintf(headers, sizeof(headers), "Content-Type: " TRINITY_CAPS_MIME "\r\n" TRINITY_DEVICE_ID_HEADER ": %s\r\n", deviceId);
+    if (!post(host, port, TRINITY_HELLO_PATH, headers, (const uint8_t*)caps, capsLength, ex) || ex.status != 200) {
+        printf("No capability handshake, using " TRINITY_CODEC_PCM16 "@16000.\n");
+        return 0;
+    }
+
+    char reply[256];
+    const size_t replyLength = ex.bodySize < sizeof(reply) - 1 ? ex.bodySize : sizeof(reply) - 1;
+    memcpy(reply, ex.body, replyLength);
+    reply[replyLength] = '\0';
+    char codecs[64] = TRINITY_CODEC_PCM16, rates[64] = "16000";
+    char upCodec[16] = TRINITY_CODEC_PCM16, downCodec[16] = TRINITY_CODEC_PCM16;
+    uint32_t upRate = 16000, downRate = 16000;
+    uint16_t rtpPort = 0;
+    char* cursor = reply;
+    char* key;
+    char* value;
+    while (trinityNextCap(&cursor, &key, &value)) {
+        if (strcmp(key, TRINITY_CAP_CODECS) == 0) snprintf(codecs, sizeof(codecs), "%s", value);
+        else if (strcmp(key, TRINITY_CAP_RATES) == 0) snprintf(rates, sizeof(rates), "%s", value);
+        else if (strcmp(key, TRINITY_CAP_UPLINK) == 0) trinityParseFormat(value, upCodec, sizeof(upCodec), &upRate);
+        else if (strcmp(key, TRINITY_CAP_DOWNLINK) == 0) trinityParseFormat(value, downCodec, sizeof(downCodec), &downRate);
+        else if (strcmp(key, TRINITY_CAP_RTP_PORT) == 0) rtpPort = (uint16_t)strtoul(value, NULL, 10);
+    }
+    adapter.allow(codecs, rates);
+    adapter.start(upCodec, upRate, downCodec, downRate);
+    printf("Negotiated codecs %s, rates %s, uplink %s@%u, downlink %s@%u, audio over %s\n",
+           codecs, rates, upCodec, upRate, downCodec, downRate, rtpPort ? "RTP" : "TCP");
+    return rtpPort;
+}
+
+// Runs the 16 kHz recording through the converter for the uplink rate (see dispatchRate())
+struct UplinkStager {
+    ConstFrameSpan<Pcm16k> pcm;
+    int16_t* staged;
+    size_t count;
+
+    template <class Format>
+    void run() {
+        count = convertAudio<Pcm16k, Format>(pcm, FrameSpan<Format>(staged, pcm.frames())).frames();
+    }
+};
+
+// Converts the 16 kHz recording to the mode's rate; the device records at that rate directly.
+// Returns the samples.
+static size_t stageUplink(const int16_t* pcm, size_t samples, const LinkMode& mode, int16_t* staged) {
+    UplinkStager stager = {ConstFrameSpan<Pcm16k>(pcm, samples), staged, 0};
+    dispatchRate(mode.rate, stager);
+    return stager.count;
+}
+
+// Encodes the 16 kHz recording for 'mode'
+static size_t encodeUplink(const int16_t* pcm, size_t samples, const LinkMode& mode, uint8_t* out) {
+    int16_t* staged = (int16_t*)out;
+    const size_t count = stageUplink(pcm, samples, mode, staged);
+    if (strcmp(mode.codec, TRINITY_CODEC_ADPCM) == 0) {
+        AdpcmState state = {0, 0};
+        return adpcmEncode(staged, count, out, state);
+    }
+    return count * 2;
+}
+
+// Streams the staged recording over RTP as the firmware does while recording: each packet
+// leaves once its 20 ms have been "recorded". Returns the end of speech (the last packet).
+static double streamUplink(int udp, const int16_t* staged, size_t count, const LinkMode& mode, RtpPacketizer& packetizer) {
+    static uint8_t packet[RTP_MAX_PACKET];
+    const size_t packetSamples = rtpPacketSamples(mode.rate);
+    packetizer.begin((uint32_t)random(), strcmp(mode.codec, TRINITY_CODEC_ADPCM) == 0, mode.rate, (uint16_t)random());
+    const double start = nowMs();
+    for (size_t offset = 0; offset < count; offset += packetSamples) {
+        const size_t samples = count - offset < packetSamples ? count - offset : packetSamples;
+        const double due = start + (offset + samples) * 1000.0 / mode.rate;
+        while (nowMs() < due) {
+            usleep(1000);
+        }
+        send(udp, packet, packetizer.packAudio(staged + offset, samples, offset + samples == count, packet), 0);
+        const size_t fecLength = packetizer.packFec(packet);
+        if (fecLength > 0) {
+            send(udp, packet, fecLength, 0);
+        }
+    }
+    return nowMs();
+}
+
+// Replays the arrival times of a TCP reply's audio against real-time playout, starting once the
+// profile's prebuffer has arrived like the firmware does: every time the audio runs out before
+// more arrives, the speaker stalls.
+// 'frames' is scratch space for the parser, at least ex.bodySize bytes.
+static void simulateTcpPlayout(const Exchange& ex, const LinkMode& downlink, double endOfSpeechMs, const AudioProfile& profile,
+                               uint8_t* frames, Playout& out) {
+    const size_t headerBytes = (size_t)(ex.body - ex.response);
+    memcpy(frames, ex.body, ex.bodySize);
+    const double bytesPerMs = downlink.rate / 1000.0 * (strcmp(downlink.codec, TRINITY_CODEC_ADPCM) == 0 ? 0.5 : 2);
+    FrameParser parser;
+    CountingSink sink;
+    size_t parsed = 0;
+    double playedUntil = 0;
+    double prebufferedMs = 0;   // Audio in before playout started
+    double lastArrivedMs = 0;
+    double latencySum = 0;
+    uint32_t latencySamples = 0;
+    for (size_t i = 0; i < ex.arrivals && !parser.failed(); i++) {
+        if (ex.arrivalEnds[i] <= headerBytes + parsed) {
+            continue;
+        }
+        const size_t end = ex.arrivalEnds[i] - headerBytes;
+        const size_t before = sink.audioBytes;
+        parser.feed(frames + parsed, end - parsed, sink);
+        parsed = end;
+        if (sink.audioBytes == before) {
+            continue;
+        }
+        const double arrived = ex.arrivalMs[i];
+        const double audioMs = (sink.audioBytes - before) / bytesPerMs;
+        out.audioMs += audioMs;
+        lastArrivedMs = arrived;
+        if (playedUntil == 0) {
+            prebufferedMs += audioMs;
+            if (prebufferedMs < profile.prebufferMs) {
+                continue;
+            }
+            out.firstAudioMs = arrived - endOfSpeechMs;
+            playedUntil = arrived + prebufferedMs;
+        } else {
+            if (arrived > playedUntil) {
+                out.glitches++;
+                out.stallMs += arrived - playedUntil;
+                playedUntil = arrived;
+            }
+            playedUntil += audioMs;
+        }
+        latencySum += playedUntil - arrived;
+        latencySamples++;
+    }
+    if (playedUntil == 0 && prebufferedMs > 0) {
+        // The whole reply was shorter than the prebuffer: it plays once it is in
+        out.firstAudioMs = lastArrivedMs - endOfSpeechMs;
+        latencySum = prebufferedMs;
+        latencySamples = 1;
+    }
+    out.latencyMs = latencySamples > 0 ? latencySum / latencySamples : 0;
+}
+
+// Plays an RTP reply through the jitter buffer, one packet per 20 ms once playout starts
+static void playRtp(int udp, const TrinityRtpFrame& rtp, const LinkMode& downlink, double endOfSpeechMs,
+                    const AudioProfile& profile, Playout& out) {
+    static JitterBuffer jitter; // Keeps its jitter estimate across turns, as on the device
+    static uint8_t packet[RTP_MAX_PACKET];
+    int16_t pcm[RTP_MAX_PAYLOAD / 2];
+    size_t samples;
+    jitter.setDelayRange(profile.jitterMinPackets, profile.jitterMaxPackets);
+    jitter.start(rtp.ssrc, strcmp(downlink.codec, TRINITY_CODEC_ADPCM) == 0, downlink.rate,
+                 (uint16_t)rtp.first_sequence, rtp.packets, (uint32_t)nowMs());
+    double nextPopMs = 0;
+    bool glitching = false;
+    while (!jitter.finished()) {
+        ssize_t n;
+        while ((n = recv(udp, packet, sizeof(packet), MSG_DONTWAIT)) > 0) {
+            jitter.push(packet, (size_t)n, (uint32_t)nowMs());
+        }
+        if (nextPopMs != 0 && nowMs() < nextPopMs) {
+            usleep(1000);
+            continue;
+        }
+        const JitterFrame frame = jitter.pop((uint32_t)nowMs(), pcm, &samples);
+        if (frame == JITTER_WAITING) {
+            usleep(1000);
+            continue;
+        }
+        if (nextPopMs == 0 && samples > 0) {
+            out.firstAudioMs = nowMs() - endOfSpeechMs;
+            nextPopMs = nowMs();
+        }
+        nextPopMs += samples * 1000.0 / downlink.rate;
+        out.audioMs += samples * 1000.0 / downlink.rate;
+        const bool bad = frame == JITTER_CONCEALED || frame == JITTER_STRETCHED;
+        if (bad && !glitching) {
+            out.glitches++;
+        }
+        glitching = bad;
+        if (frame == JITTER_STRETCHED) {
+            out.stallMs += samples * 1000.0 / downlink.rate;
+        }
+    }
+    const JitterStats& stats = jitter.stats();
+    out.concealed = stats.concealed;
+    out.recovered = stats.recovered;
+    out.late = stats.late;
+    out.jitterMs = jitter.jitterMs();
+    out.latencyMs = jitter.delayPackets() * TRINITY_RTP_PACKET_MS;
+}
+
+int main(int argc, char** argv) {
+    int turns = 1;
+    bool rtp = false;
+    const char* rtpPortOverride = NULL;
+    const char* profileSetting = AUDIO_PROFILES[AUDIO_PROFILE_BALANCED].name;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:u:p:")) != -1) {
+        if (opt == 'n') {
+            turns = atoi(optarg) > 0 ? atoi(optarg) : 1;
+        } else if (opt == 't') {
+            rtp = strcmp(optarg, "rtp") == 0;
+        } else if (opt == 'u') {
+            rtpPortOverride = optarg;
+        } else if (opt == 'p') {
+            profileSetting = optarg;
+        }
+    }
+    const bool automaticProfile = strcmp(profileSetting, AUDIO_PROFILE_AUTO) == 0;
+    const size_t profileIndex = automaticProfile ? (size_t)AUDIO_PROFILE_BALANCED : audioProfileFind(profileSetting);
+    if (argc - optind < 3 || profileIndex == AUDIO_PROFILE_COUNT) {
+        fprintf(stderr, "Usage: %s [-n turns] [-t tcp|rtp] [-u rtp_port] [-p profile|auto] <host> <port> <pcm_file> [capture_file.trca] [device_id]\n", argv[0]);
+        return 2;
+    }
+    const char* host = argv[optind];
+    const char* port = argv[optind + 1];
+    const char* pcmPath = argv[optind + 2];
+    const char* capturePath = argc - optind > 3 ? argv[optind + 3] : NULL;
+    const char* deviceId = argc - optind > 4 ? argv[optind + 4] : "native-sim";
+
+    // 1. Load the recording
+    FILE* pcmFile = fopen(pcmPath, "rb");
+    if (!pcmFile) {
+        perror(pcmPath);
+        return 1;
+    }
+    uint8_t* pcm = (uint8_t*)malloc(MAX_PCM_BYTES);
+    size_t pcmSize = fread(pcm, 1, MAX_PCM_BYTES, pcmFile) & ~(size_t)1;
+    fclose(pcmFile);
+
+    Exchange ex;
+    ex.response = (uint8_t*)malloc(MAX_RESPONSE_BYTES);
+    ex.arrivalEnds = (size_t*)malloc(MAX_ARRIVALS * sizeof(size_t));
+    ex.arrivalMs = (double*)malloc(MAX_ARRIVALS * sizeof(double));
+    uint8_t* body = (uint8_t*)malloc(pcmSize);
+    // The parser works in place, so it parses a copy to keep the captured body intact
+    uint8_t* frames = (uint8_t*)malloc(MAX_RESPONSE_BYTES);
+    const bool heapTracked = heapTrackAvailable();
+    if (!heapTracked) {
+        printf("Heap tracking unavailable (built without the --wrap linker flags).\n");
+    }
+    LinkAdapter adapter;
+    uint16_t rtpPort = negotiate(host, port, deviceId, rtp, adapter, ex);
+    int udp = -1;
+    if (rtpPort != 0) {
+        char portText[8];
+        snprintf(portText, sizeof(portText), "%u", rtpPort);
+        udp = connectTo(host, rtpPortOverride ? rtpPortOverride : portText, SOCK_DGRAM);
+        if (udp < 0) {
+            printf("RTP socket unavailable, audio stays on TCP.\n");
+            rtpPort = 0;
+        }
+    } else if (rtp) {
+        printf("Server does not offer RTP, audio stays on TCP.\n");
+    }
+    srandom((unsigned)time(NULL) ^ (unsigned)getpid());
+    RtpPacketizer packetizer;
+    AudioProfileSelector profiles;
+    profiles.start(profileIndex, automaticProfile);
+    char linkReport[224] = "";
+    int failures = 0;
+    Playout total = {};
+    int played = 0;
+
+    for (int turn = 1; turn <= turns; turn++) {
+        // 2. Send the request the same way processVoiceCommand() does
+        heapTrackBegin();
+        const LinkMode uplink = adapter.uplink();
+        const LinkMode downlink = adapter.downlink();
+        const size_t profile = profiles.index();
+        const bool rtpTurn = rtpPort != 0;
+        size_t bodySize;
+        char rtpHeader[128] = "";
+        double endOfSpeechMs;
+        if (rtpTurn) {
+            // Staged PCM only for the capture; the audio itself goes out as RTP packets
+            bodySize = stageUplink((const int16_t*)pcm, pcmSize / 2, uplink, (int16_t*)body) * 2;
+            endOfSpeechMs = streamUplink(udp, (const int16_t*)body, bodySize / 2, uplink, packetizer);
+            snprintf(rtpHeader, sizeof(rtpHeader), TRINITY_RTP_HEADER ": ssrc=%u,seq=%u,packets=%u\r\n",
+                     packetizer.ssrc(), packetizer.firstSequence(), packetizer.packets());
+        } else {
+            bodySize = encodeUplink((const int16_t*)pcm, pcmSize / 2, uplink, body);
+        }
+        char headers[640];
+        snprintf(headers, sizeof(headers),
+            "Content-Type: application/octet-stream\r\n"
+            TRINITY_FORMAT_HEADER ": %s@%u\r\n"
+            TRINITY_DOWNLINK_HEADER ": %s@%u\r\n"
+            TRINITY_DEVICE_ID_HEADER ": %s\r\n"
+            TRINITY_DEADLINE_HEADER ": %u\r\n"
+            "Accept: " TRINITY_FRAMES_MIME ", application/octet-stream\r\n"
+            "%s%s%s%s",
+            uplink.codec, uplink.rate, downlink.codec, downlink.rate, deviceId, SERVER_TIMEOUT_MS,
+            linkReport[0] ? TRINITY_LINK_HEADER ": " : "", linkReport, linkReport[0] ? "\r\n" : "", rtpHeader);
+
+        if (!post(host, port, TRINITY_VOICE_PATH, headers, body, rtpTurn ? 0 : bodySize, ex)) {
+            heapTrackEnd();
+            failures++;
+            continue;
+        }
+        if (rtpTurn && ex.status == 422) {
+            // As the firmware does: nothing got through over UDP, so resend the turn over TCP
+            printf("turn %d: RTP uplink never arrived, falling back to TCP\n", turn);
+            rtpPort = 0;
+            turn--;
+            heapTrackEnd();
+            continue;
+        }
+        if (!rtpTurn) {
+            endOfSpeechMs = ex.startMs; // The upload starts when recording stops
+        }
+        char traceId[64];
+        findHeader(ex.headers, TRINITY_TRACE_ID_HEADER, traceId, sizeof(traceId));
+        char contentType[64];
+        findHeader(ex.headers, "Content-Type", contentType, sizeof(contentType));
+
+        size_t audioBytes = ex.bodySize;
+        Playout playout = {};
+        if (strncmp(contentType, TRINITY_FRAMES_MIME, strlen(TRINITY_FRAMES_MIME)) == 0) {
+            memcpy(frames, ex.body, ex.bodySize);
+            FrameParser parser;
+            CountingSink sink;
+            if (!parser.feed(frames, ex.bodySize, sink) || !sink.ended) {
+                fprintf(stderr, "Malformed response frames.\n");
+            }
+            audioBytes = sink.audioBytes;
+
+            if (sink.rtpStream && udp >= 0) {
+                playRtp(udp, sink.rtp, downlink, endOfSpeechMs, AUDIO_PROFILES[profile], playout);
+            } else {
+                simulateTcpPlayout(ex, downlink, endOfSpeechMs, AUDIO_PROFILES[profile], frames, playout);
+            }
+        }
+
+        // 3. Link adaptation, measured like the firmware (connect time of fresh connections as the RTT)
+        LinkSample sample = {0, 0, (float)ex.connectMs, 0};
+        if (!rtpTurn && bodySize >= MIN_GOODPUT_SAMPLE_BYTES && ex.uploadMs > 0) {
+            sample.uplinkBytesPerSec = bodySize * 1000.0f / ex.uploadMs;
+        }
+        if (audioBytes >= MIN_GOODPUT_SAMPLE_BYTES && ex.downloadMs > 0) {
+            sample.downlinkBytesPerSec = ex.bodySize * 1000.0f / ex.downloadMs;
+        }
+        const bool switched = adapter.update(sample);
+        const AudioProfileTurn profileTurn = {(float)(playout.audioMs / 1000), (float)playout.latencyMs, playout.glitches,
+                                              rtpTurn ? playout.jitterMs : 0, 0};
+        const bool profileSwitched = profiles.update(profileTurn);
+        int length = snprintf(linkReport, sizeof(linkReport), "up_kbps=%.0f,down_kbps=%.0f,rtt_ms=%.0f,underruns=%u,switches=%u",
+                              adapter.uplinkEstimate() * 8 / 1000, adapter.downlinkEstimate() * 8 / 1000,
+                              adapter.rttEstimate(), playout.glitches, adapter.switches());
+        if (rtpTurn && length > 0 && (size_t)length < sizeof(linkReport)) {
+            length += snprintf(linkReport + length, sizeof(linkReport) - length, ",concealed=%u,jitter_ms=%.0f",
+                               playout.concealed, playout.jitterMs);
+        }
+        if (length > 0 && (size_t)length < sizeof(linkReport)) {
+            snprintf(linkReport + length, sizeof(linkReport) - length, ",profile=%s,latency_ms=%.0f,glitches_pm=%.1f",
+                     AUDIO_PROFILES[profile].name, profiles.stats(profile).meanLatencyMs(),
+                     profiles.stats(profile).glitchesPerMinute());
+        }
+
+        char deviceTimings[256];
+        snprintf(deviceTimings, sizeof(deviceTimings),
+            "{\"connect_ms\":%.1f,\"upload_ms\":%.1f,\"ttfb_ms\":%.1f,\"download_ms\":%.1f,\"total_ms\":%.1f}",
+            ex.connectMs, ex.uploadMs, ex.ttfbMs, ex.downloadMs, ex.totalMs);
+        printf("turn %d: HTTP %d, trace %s, up %s@%u (%zu B, %.0f kbit/s), down %s@%u (%zu B, %.0f kbit/s)%s\n  %s\n",
+               turn, ex.status, traceId[0] ? traceId : "-",
+               uplink.codec, uplink.rate, bodySize, sample.uplinkBytesPerSec * 8 / 1000,
+               downlink.codec, downlink.rate, audioBytes, sample.downlinkBytesPerSec * 8 / 1000,
+               switched ? "  -> switching" : "", deviceTimings);
+        printf("  %s, %s: first audio %.0f ms after speech, %.0f ms played, %.0f ms latency, %u glitches (%.0f ms stalled), "
+               "%u concealed, %u recovered, %u late%s\n",
+               rtpTurn ? "rtp" : "tcp", AUDIO_PROFILES[profile].name, playout.firstAudioMs, playout.audioMs, playout.latencyMs,
+               playout.glitches, playout.stallMs, playout.concealed, playout.recovered, playout.late,
+               profileSwitched ? "  -> switching profile" : "");
+        const HeapTrackStats heap = heapTrackEnd();
+        if (heapTracked) {
+            // runVoiceTurn() in the firmware: once the connection is reused, a turn allocates nothing
+            const bool steadyState = turn > 1 && ex.connectMs == 0;
+            printf("  heap: %u allocations (%u bytes), %u frees%s\n", heap.allocations, heap.bytes, heap.frees,
+                   steadyState && heap.allocations > 0 ? "  <- steady-state turn allocated" : "");
+            if (steadyState && heap.allocations > 0) {
+                failures++;
+            }
+        }
+        if (ex.status != 200) {
+            failures++;
+        } else if (playout.audioMs > 0) {
+            played++;
+            total.firstAudioMs += playout.firstAudioMs;
+            total.audioMs += playout.audioMs;
+            total.glitches += playout.glitches;
+            total.stallMs += playout.stallMs;
+            total.concealed += playout.concealed;
+            total.recovered += playout.recovered;
+        }
+
+        // 4. Append the device-side capture record
+        if (capturePath) {
+            FILE* capture = fopen(capturePath, "ab");
+            if (!capture) {
+                perror(capturePath);
+                return 1;
+            }
+            TraceCaptureWriter writer(fileSink, capture);
+            if (ftell(capture) == 0) {
+                writer.writeFileHeader();
+            }
+
+            struct timeval wall;
+            gettimeofday(&wall, NULL);
+            const double timestamp = wall.tv_sec + wall.tv_usec / 1e6;
+            char requestHeaderJson[256];
+            // RTP turns capture the staged PCM, as the server does after reassembly
+            snprintf(requestHeaderJson, sizeof(requestHeaderJson),
+                "{\"" TRINITY_DEVICE_ID_HEADER "\":\"%s\",\"" TRINITY_DEADLINE_HEADER "\":\"%u\",\"" TRINITY_FORMAT_HEADER "\":\"%s@%u\"}",
+                deviceId, SERVER_TIMEOUT_MS, rtpTurn ? TRINITY_CODEC_PCM16 : uplink.codec, uplink.rate);
+
+            // The device PCM is the recording; the input is what was uploaded after encoding
+            const TraceField fields[] = {
+                TraceCaptureWriter::textField(TRACE_TAG_TRACE_ID, traceId),
+                TraceCaptureWriter::textField(TRACE_TAG_DEVICE_ID, deviceId),
+                {TRACE_TAG_TIMESTAMP, &timestamp, sizeof(timestamp)},
+                TraceCaptureWriter::textField(TRACE_TAG_SOURCE, "native"),
+                {TRACE_TAG_DEVICE_PCM, pcm, (uint32_t)pcmSize},
+                {TRACE_TAG_INPUT_PCM, body, (uint32_t)bodySize},
+                TraceCaptureWriter::textField(TRACE_TAG_REQUEST_HEADERS, requestHeaderJson),
+                {TRACE_TAG_RESPONSE_BODY, ex.body, (uint32_t)ex.bodySize},
+                TraceCaptureWriter::textField(TRACE_TAG_DEVICE_TIMINGS, deviceTimings),
+            };
+            const bool ok = writer.writeRecord(fields, sizeof(fields) / sizeof(fields[0]));
+            fclose(capture);
+            if (!ok) {
+                fprintf(stderr, "Capture write failed.\n");
+                return 1;
+            }
+        }
+    }
+
+    printf("%d turns, %u format switches, final up %s@%u down %s@%u\n", turns, adapter.switches(),
+           adapter.uplink().codec, adapter.uplink().rate, adapter.downlink().codec, adapter.downlink().rate);
+    if (played > 0) {
+        printf("%s playout: first audio %.0f ms mean, %u glitches (%.1f per minute of audio), %.0f ms stalled, "
+               "%u concealed, %u recovered\n",
+               rtpPort ? "rtp" : "tcp", total.firstAudioMs / played, total.glitches,
+               total.glitches * 60000.0 / total.audioMs, total.stallMs, total.concealed, total.recovered);
+    }
+    for (size_t i = 0; i < AUDIO_PROFILE_COUNT; i++) {
+        const AudioProfileStats& stats = profiles.stats(i);
+        if (stats.turns > 0) {
+            printf("profile %s: %u turns, %.0f s of audio, %.0f ms mean latency, %.1f glitches per minute\n",
+                   AUDIO_PROFILES[i].name, stats.turns, stats.audioSeconds, stats.meanLatencyMs(), stats.glitchesPerMinute());
+        }
+    }
+    if (udp >= 0) {
+        close(udp);
+    }
+    closeServer();
+    free(pcm);
+    free(body);
+    free(frames);
+    free(ex.response);
+    free(ex.arrivalEnds);
+    free(ex.arrivalMs);
+    return failures == 0 ? 0 : 1;
+}
@@ -9,10 +9,16 @@
 #include <Arduino.h>
 #include <WiFi.h>
 #include <HTTPClient.h>
-#include <WebServer.h>
-#include <DNSServer.h>
 #include <nvs_flash.h>
 #include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <esp_freertos_hooks.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <new>
+#include <limits.h>
+#include <lwip/sockets.h>
 #include <driver/i2s.h>
 #include <Adafruit_GFX.h>
 #include <Adafruit_SSD1306.h>
@@ -21,19 +27,60 @@
 // --- Fix for NVS Global Handle Compiler Conflict ---
 #include "nvs_globals.h"
 
+// --- Shared with the native build (lib/) ---
+#include <trinity_protocol.h>
+#include <frame_parser.h>
+#include <trinity_caps.h>
+#include <ima_adpcm.h>
+#include <link_adapt.h>
+#include <rtp_packet.h>
+#include <jitter_buffer.h>
+#include <binlog.h>
+#include <http_response.h>
+#include <heap_track.h>
+#include <audio_format.h>
+#include <audio_kernels.h>
+#include <dsp_kernels.h>
+#include <cpu_profile.h>
+#include <audio_loopback.h>
+#include <playback_ring.h>
+#include <output_chain.h>
+#include <audio_profile.h>
+#include <wifi_portal.h>
+#include <portal_assets.h>
+#include <config_store.h>
+#include <ota_image.h>
+
 // =================================================================================================
 // 1. CONFIGURATION & CONSTANTS
 // =================================================================================================
 
 // --- Server & Network ---
-// !!! CRITICAL: REPLACE THIS WITH THE LOCAL IP ADDRESS OF YOUR PYTHON SERVER !!!
-const char* SERVER_URL = "http://192.168.2.10:5002/voice_input";
+// Defaults of the device configuration (section 4), which the setup portal can change: the
+// server address, the recording limit, the volume, the audio profile and the portal's timeout
+// !!! CRITICAL: REPLACE THIS WITH THE LOCAL IP ADDRESS OF YOUR PYTHON SERVER (or set it in the portal) !!!
+#define SERVER_HOST "192.168.2.10"
+#define SERVER_PORT 5002
+const uint16_t SERVER_TIMEOUT_MS = 30000;       // HTTP read timeout for the whole voice turn
+const uint16_t HELLO_TIMEOUT_MS = 5000;
+const uint16_t RTP_LOCAL_PORT = 5004;           // Reply audio arrives here on RTP turns
+const uint16_t DIAG_TIMEOUT_MS = 10000;
 const char* NVS_NAMESPACE = "trinity_nvs";
-const char* WIFI_SSID_KEY = "ssid";
-const char* WIFI_PASS_KEY = "pass";
+const char* CONFIG_KEY = "config";              // The configuration blob (lib/config_store)
+const char* LEGACY_AUDIO_PROFILE_KEY = "audio_profile"; // Kept separately before the blob, like the credentials
 const char* AP_SSID = "Trinity_Setup";
 const int AP_CHANNEL = 1;
-const int AP_TIMEOUT_MS = 180000; // 3 minutes for AP mode
+const int AP_TIMEOUT_MS = 180000; // 3 minutes without a request to the portal
+
+// --- Firmware Updates (A/B OTA from the server: partitions_ab.csv, lib/ota_image) ---
+const uint16_t OTA_TIMEOUT_MS = 30000;              // Per read; the first request may wait for the server to pack
+const uint32_t OTA_STALL_MS = 10000;                // No data for this long counts as a dropped connection
+const uint8_t OTA_MAX_RESUMES = 8;                  // Dropped connections resumed per update
+const uint32_t OTA_RESUME_DELAY_MS = 2000;          // Lets Wi-Fi reconnect first
+const uint32_t OTA_RETRY_MS = 15 * 60 * 1000;       // After a failed or cancelled update
+const uint32_t OTA_CONFIRM_TIMEOUT_MS = 120000;     // An update that hasn't reached the server by then is rolled back
+const uint32_t OTA_CONFIRM_RETRY_MS = 10000;        // Handshake retries until then
+const size_t OTA_BUILD_ID_SIZE = 17;                // 8 bytes of the ELF SHA-256 in hex
 
 // --- GPIO Pin Definitions (CORRECTED based on your pinout table) ---
 #define PIN_OLED_SDA 21     // I2C Data (J3-18)
@@ -50,21 +97,94 @@ const int AP_TIMEOUT_MS = 180000; // 3 minutes for AP mode
 #define PIN_RGB_LED 48
 
 // --- I2S Configuration ---
-// Audio format constants
+// Audio formats (audio_format.h); sizes below are derived from them
 const i2s_port_t I2S_PORT = I2S_NUM_0;
-const int SAMPLE_RATE = 16000; // Standard rate for speech recognition
-const int CHANNELS = 1;
-const int BITS_PER_SAMPLE = 16; 
+typedef Pcm16k CaptureFormat; // Standard rate for speech recognition
+typedef Pcm8k LowRateFormat;  // Also offered in the capability handshake
 
 // --- Audio Buffer Configuration ---
-const int MAX_RECORD_SECONDS = 6; // Max 6 seconds of recording to RAM
-const size_t AUDIO_BUFFER_CAPACITY = SAMPLE_RATE * MAX_RECORD_SECONDS * BITS_PER_SAMPLE / 8 * CHANNELS; 
-const size_t I2S_READ_CHUNK_SIZE = 1024 * 2; // Read 2KB at a time
+const int MAX_RECORD_SECONDS = 6; // Max 6 seconds of recording to RAM (the configured limit may be lower)
+const size_t AUDIO_BUFFER_CAPACITY = CaptureFormat::bytesForMs(MAX_RECORD_SECONDS * 1000);
+const size_t I2S_READ_CHUNK_SIZE = CaptureFormat::bytesForMs(64); // Read 2KB at a time, at most
+static_assert(CaptureFormat::bytesForMs(audioProfileMaxCaptureMs()) <= I2S_READ_CHUNK_SIZE, "An audio profile reads more than I2S_READ_CHUNK_SIZE");
+// Amplifier DMA ring (sized by the audio profile, see applyAudioProfile()); audio written to I2S
+// plays ampDmaBytes() later. The memory plan counts the deepest profile's.
+const size_t AMP_DMA_MAX_BYTES = CaptureFormat::bytesFor(audioProfileMaxDmaSamples());
+// Downlink audio is received into this ring and fed to the DMA buffers from it (in PSRAM)
+const size_t PLAYBACK_RING_BYTES = CaptureFormat::bytesForMs(1000);
+static_assert(PLAYBACK_RING_BYTES % PLAYBACK_RING_ALIGN == 0, "The playback ring holds whole ADPCM outputs");
+// The output chain scales the ring in place, a block at a time, so blocks must not straddle the wrap
+const size_t OUTPUT_BLOCK_BYTES = OUTPUT_CHAIN_BLOCK * sizeof(Mono16::Sample);
+static_assert(PLAYBACK_RING_BYTES % OUTPUT_BLOCK_BYTES == 0, "The playback ring holds whole output chain blocks");
+// Reads while chunk framing comes next: about one "\r\n<size>\r\n", so few payload bytes come along
+const size_t CHUNK_FRAMING_READ_BYTES = 8;
+// Transfers smaller than this mostly fit in the TCP buffers and say nothing about goodput
+const size_t MIN_GOODPUT_SAMPLE_BYTES = 16 * 1024;
+
+// --- Playback Volume (output chain gain, stepped by B1/B2 during a reply and by server control opcodes) ---
+const int VOLUME_MAX = 10;
+const int VOLUME_UNITY = 8;   // Step at which the normalized reply passes through unchanged
+const int VOLUME_DEFAULT = VOLUME_UNITY;
+const unsigned long VOLUME_BUTTON_DEBOUNCE_MS = 50;
+
+// Network self-test (hold B1)
+const unsigned long DIAG_LONG_PRESS_MS = 2000;
+const int DIAG_PINGS = 20;
+const int DIAG_BURSTS = 3;                      // Per direction; the median is reported
+const size_t DIAG_UPLOAD_BYTES = 64 * 1024;     // Sent from audioBuffer
+const size_t DIAG_DOWNLOAD_BYTES = 256 * 1024;
+
+// Audio loopback self-test (hold B2): a chirp through the amplifier, found again in the
+// microphone capture. Both run on the shared I2S clock at the capture rate.
+const uint32_t LOOPBACK_LEAD_MS = 300;              // Capture before the chirp (the INMP441 starts up in ~85 ms)
+const size_t LOOPBACK_CHIRP_FRAMES = CaptureFormat::framesForMs(128);
+const size_t LOOPBACK_CAPTURE_FRAMES = CaptureFormat::framesForMs(1500);
+const float LOOPBACK_F0_HZ = 300;                   // Above what the small speaker can't reproduce
+const float LOOPBACK_F1_HZ = 6000;
+const int16_t LOOPBACK_AMPLITUDE = 8192;            // -12 dBFS
+const uint32_t LOOPBACK_BLOCKED_US = 1000;          // A read that waited this long returned as its DMA buffer filled
 
 // --- Display Configuration ---
 #define SCREEN_WIDTH 128
 #define SCREEN_HEIGHT 64
 #define OLED_ADDR 0x3C
+const int TEXT_COLUMNS = 21;            // Characters per line at text size 1
+const int REPLY_VISIBLE_LINES = 7;      // Below the "SPEAKING" title line
+const int REPLY_MAX_LINES = 32;
+const unsigned long SCROLL_REFRESH_MS = 200; // A redraw stalls the loop for a few ms; keep them rare
+
+// --- Binary Log (BINLOG() records, decoded on the host by tools/binlog_decode.py) ---
+const size_t BINLOG_RING_BYTES = 64 * 1024;         // In PSRAM
+const size_t BINLOG_FALLBACK_BYTES = 4 * 1024;      // Internal RAM, if PSRAM is missing
+const uint32_t BINLOG_DRAIN_MS = 20;
+const uint32_t BINLOG_DRAIN_STACK_BYTES = 3072;
+const UBaseType_t BINLOG_DRAIN_PRIORITY = 1;        // Below the Arduino loop task
+const BaseType_t BINLOG_DRAIN_CORE = 0;             // Away from the loop task on core 1
+
+// --- CPU Profiler (lib/cpu_profile; "[CPU]" lines on the log, turn peaks in TRINITY_LINK_HEADER) ---
+const uint32_t CPU_PROFILE_WINDOW_MS = 1000;
+const uint32_t CPU_PROFILE_LOG_WINDOWS = 10;        // A summary line every 10 windows
+const size_t CPU_PROFILE_TICK_SLOTS = 16;           // Tasks per core the tick sampler tells apart
+// Run-time stats need CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS in the SDK configuration; without
+// them the tick sampler attributes each tick to the task it interrupted
+#if configGENERATE_RUN_TIME_STATS
+#define CPU_PROFILE_RUN_TIME_STATS 1
+#else
+#define CPU_PROFILE_RUN_TIME_STATS 0
+#endif
+
+// --- Memory Budget (checked against the plan in section 8 at compile time) ---
+// Large buffers go to PSRAM; internal RAM is left to Wi-Fi, lwIP and the DMA rings, which need
+// it. tools/memory_report.py checks the linked image against the map file after each build.
+const size_t DRAM_STATIC_BUDGET = 8 * 1024;         // Application buffers in internal .bss/.data
+const size_t DRAM_BUFFER_MAX_BYTES = 2 * 1024;      // Anything larger belongs in PSRAM
+const size_t INTERNAL_HEAP_BUDGET = 8 * 1024;       // Internal heap taken at boot (DMA rings, task stacks)
+const size_t PSRAM_BUDGET = 512 * 1024;             // Of 8 MB; the rest stays free for the heap
+const size_t FLASH_LITERAL_BUDGET = 8 * 1024;       // Served from flash, never copied to RAM
+const uint32_t LOOP_TASK_STACK_BYTES = 8192;        // Arduino's default for the loop task
+// Stack for the library calls at the bottom of a voice turn (i2s_write, lwIP, snprintf) and
+// the call chain's own scalars
+const size_t STACK_CALL_RESERVE_BYTES = 3 * 1024;
 
 // =================================================================================================
 // 2. GLOBAL OBJECTS & STATE
@@ -73,21 +193,112 @@ const size_t I2S_READ_CHUNK_SIZE = 1024 * 2; // Read 2KB at a time
 // Hardware Objects
 Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, -1);
 Adafruit_NeoPixel rgbLed(1, PIN_RGB_LED, NEO_GRB + NEO_KHZ800);
-DNSServer dnsServer;
-WebServer server(80);
-HTTPClient httpClient;
+WifiPortal* wifiPortal = NULL;   // Setup mode only (see setupAP())
+HTTPClient httpClient;           // Handshake and self-test requests (one connection each)
 
 // State Variables
-enum Status { STATUS_INITIALIZING, STATUS_WIFI_SETUP, STATUS_CONNECTED, STATUS_LISTENING, STATUS_THINKING, STATUS_SPEAKING, STATUS_ERROR };
+enum Status { STATUS_INITIALIZING, STATUS_WIFI_SETUP, STATUS_CONNECTED, STATUS_LISTENING, STATUS_THINKING, STATUS_SPEAKING, STATUS_ERROR, STATUS_DIAGNOSTICS, STATUS_UPDATING };
 Status currentStatus = STATUS_INITIALIZING;
 bool isListening = false;
-bool wifiCredentialsSaved = false;
-char saved_ssid[64] = "";
-char saved_pass[64] = "";
+bool wakeHeld = false;            // B1 still down since it started this recording
+unsigned long wakePressedMs = 0;
+const char* diagnosticsTitle = "NETWORK TEST"; // Of the self-test on screen in STATUS_DIAGNOSTICS
+bool sendWasPressed = false;      // B2 on the previous loop() pass
+unsigned long sendPressedMs = 0;  // When B2 went down in the ready state; 0 if it didn't
+char device_id[18] = ""; // Wi-Fi MAC address, "AA:BB:CC:DD:EE:FF"
+int playbackVolume = VOLUME_DEFAULT; // 0..VOLUME_MAX
+
+// Firmware updates (see runFirmwareUpdate())
+char firmwareBuild[OTA_BUILD_ID_SIZE] = "";   // This image's build
+char invalidBuild[OTA_BUILD_ID_SIZE] = "";    // The build the bootloader last rolled back from
+char offeredBuild[OTA_BUILD_ID_SIZE] = "";    // Offered in the last handshake; empty if none
+bool firmwareOnProbation = false;             // First boot of an update, not confirmed yet
+unsigned long probationStartMs = 0;           // When the probation clock started; 0 while stopped
+unsigned long lastHandshakeMs = 0;
+unsigned long otaFailedMs = 0;                // 0 if no update failed yet
+OtaDecoder* otaDecoder = NULL;                // In PSRAM
+
+// Audio formats agreed with the server in negotiateCapabilities(); the defaults are what
+// servers without the handshake expect.
+struct AudioLink {
+    char uplinkCodec[16];
+    uint32_t uplinkRate;
+    char downlinkCodec[16];
+    uint32_t downlinkRate;
+    size_t maxUploadBytes;
+    uint16_t rtpPort;       // Server's RTP port; 0 = audio over TCP
+};
+AudioLink audioLink = {TRINITY_CODEC_PCM16, CaptureFormat::RATE, TRINITY_CODEC_PCM16, CaptureFormat::RATE, AUDIO_BUFFER_CAPACITY, 0};
+
+// Per-turn format choice from measured goodput (see updateLinkAdaptation())
+LinkAdapter linkAdapter;
+char linkReport[256] = ""; // Previous turn's measurements, sent in TRINITY_LINK_HEADER
+
+// Latency-vs-robustness profile (lib/audio_profile): fixed per device in the configuration, or picked by
+// audioProfiles from each turn's playback. audioProfile is the one in effect; a new choice is
+// applied between turns (applyAudioProfile()).
+AudioProfileSelector audioProfiles;
+const AudioProfile* audioProfile = &AUDIO_PROFILES[AUDIO_PROFILE_BALANCED];
+
+// Device configuration (lib/config_store): read from NVS once in setup(), then from RAM. The loop
+// task owns it; other tasks take copies with configStore.read().
+ConfigStore configStore;
+
+// Voice turns reuse one kept-alive connection, with the request head and response parsing in
+// fixed buffers (see voiceExchange())
+WiFiClient voiceClient;
+HttpResponse voiceResponse;
+char voiceRequestHeaders[640];              // Built by processVoiceCommand()
+char voiceRequestHead[1024];
+char voiceContentType[64];
+char voiceControl[64];                      // TRINITY_CONTROL_HEADER
+char voiceTraceId[20];                      // TRINITY_TRACE_ID_HEADER, to tie the device's log to the server's trace
+uint8_t voiceHeadChunk[256];                // Response head; body bytes read along with it wait here
+// Response body reads, shared by the voice turn, the self-test and the boot-time DSP kernel
+// check (never active together)
+uint8_t voiceBodyChunk[I2S_READ_CHUNK_SIZE] DSP_ALIGNED;
+size_t voicePendingOffset = 0;
+size_t voicePendingFill = 0;
+unsigned long voiceLastDataMs = 0;
+uint32_t voiceReceivedBytes = 0;            // Raw bytes read from the socket, framing included
+uint32_t voiceTurns = 0;                    // Since boot; the first one allocates lazily created state
+uint32_t steadyHeapAllocations = 0;         // Made by steady-state turns since boot (runVoiceTurn()); should stay 0
+
+// RTP audio transport (when audioLink.rtpPort is set): the recording is streamed while it is
+// still being recorded, and the reply plays from the jitter buffer. A plain lwIP socket:
+// WiFiUDP allocates a buffer for every datagram it receives.
+int rtpSocket = -1;
+sockaddr_in rtpServerAddress;
+RtpPacketizer rtpUplink;
+size_t rtpUplinkOffset = 0; // Bytes of audioBuffer already sent
+JitterBuffer* jitterBuffer = NULL; // In PSRAM (allocated in setup()); touched once per 20 ms packet
+uint8_t rtpPacket[RTP_MAX_PACKET];
+
+// CPU profiler (see startCpuProfiler()). The wait sites are where the audio tasks block on the
+// I2S driver's DMA queues; the tasks waiting there record each wait.
+CpuProfiler* cpuProfiler = NULL;            // In PSRAM
+CpuWaitSite cpuWaitSites[] = {{"i2s_tx", 0, 0, 0}, {"i2s_rx", 0, 0, 0}};
+CpuWaitSite& i2sTxWait = cpuWaitSites[0];
+CpuWaitSite& i2sRxWait = cpuWaitSites[1];
+TaskStatus_t* cpuTaskSnapshot = NULL;       // uxTaskGetSystemState() output, in PSRAM
+
+// Per-core samples of the running task, taken in the tick interrupt (cpuProfileTick())
+struct TickSamples {
+    TaskHandle_t tasks[CPU_PROFILE_TICK_SLOTS];
+    uint32_t counts[CPU_PROFILE_TICK_SLOTS];
+    uint32_t ticks;
+    uint32_t switches;      // Ticks that found a different task running than the last one
+    TaskHandle_t last;
+};
+TickSamples tickSamples[portNUM_PROCESSORS];
 
 // Audio Data Buffer
 size_t audioDataSize = 0; // Current size of data stored in the buffer
-uint8_t audioBuffer[AUDIO_BUFFER_CAPACITY]; // 192KB buffer for recording
+uint8_t* audioBuffer = NULL; // 192KB buffer for recording, in PSRAM (allocated in setup())
+// Reply audio on its way to the speaker (storage in PSRAM, allocated in setup())
+PlaybackRing playbackRing;
+// Volume, loudness normalizer and limiter, run over the ring ahead of the I2S feeder
+OutputChain outputChain;
 
 // =================================================================================================
 // 3. LED AND DISPLAY FUNCTIONS
@@ -119,6 +330,8 @@ void updateStatus(Status newStatus, const char* message = "") {
         case STATUS_THINKING: setLedColor(C_ORANGE); break;
         case STATUS_SPEAKING: setLedColor(C_CYAN); break;
         case STATUS_ERROR: setLedColor(C_RED); break;
+        case STATUS_DIAGNOSTICS: setLedColor(C_PURPLE); break;
+        case STATUS_UPDATING: setLedColor(C_ORANGE); break;
     }
 
     // 2. Update Display
@@ -150,6 +363,10 @@ void updateStatus(Status newStatus, const char* message = "") {
             display.println("Press B1 to Listen");
             display.setCursor(0, 20);
             display.printf("IP: %s", WiFi.localIP().toString().c_str());
+            display.setCursor(0, 30);
+            display.println("Hold B1: network test");
+            display.setCursor(0, 40);
+            display.println("Hold B2: audio test");
             break;
         case STATUS_LISTENING:
             display.setTextSize(2);
@@ -158,7 +375,8 @@ void updateStatus(Status newStatus, const char* message = "") {
             // Show recorded time in seconds
             display.setTextSize(1);
             display.setCursor(0, 20);
-            display.printf("Time: %d/%d s", (int)(audioDataSize / (SAMPLE_RATE * 2)), MAX_RECORD_SECONDS);
+            display.printf("Time: %d/%d s", (int)(Mono16::framesIn(audioDataSize) / audioLink.uplinkRate),
+                           (int)(Mono16::framesIn(audioLink.maxUploadBytes) / audioLink.uplinkRate));
             display.setCursor(0, 30);
             display.println("Press B2 to Stop/Send");
             break;
@@ -183,6 +401,20 @@ void updateStatus(Status newStatus, const char* message = "") {
             display.setCursor(0, 20);
             display.println("Press B1 to Reset");
             break;
+        case STATUS_DIAGNOSTICS:
+            display.setCursor(0, 0);
+            display.println(diagnosticsTitle);
+            display.setCursor(0, 12);
+            display.println(message);
+            break;
+        case STATUS_UPDATING:
+            display.setTextSize(2);
+            display.setCursor(0, 0);
+            display.println("UPDATING");
+            display.setTextSize(1);
+            display.setCursor(0, 20);
+            display.println(message);
+            break;
     }
 
     display.display();
@@ -192,254 +424,190 @@ void updateStatus(Status newStatus, const char* message = "") {
 // 4. NVS (Non-Volatile Storage) FUNCTIONS
 // =================================================================================================
 
-bool loadCredentials() {
-    // NOTE: Using g_trinity_nvs_handle
-    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &g_trinity_nvs_handle);
+// Writes the configuration blob once a change is due (see ConfigStore), or any pending change if
+// 'now'. Only between turns: a flash write stalls the caches the audio path runs from. Returns
+// true if flash holds the current settings.
+bool flushConfig(bool now) {
+    uint8_t blob[CONFIG_BLOB_BYTES];
+    const size_t length = configStore.flushDue(millis(), now, blob);
+    if (length == 0) {
+        return !configStore.pending();
+    }
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &g_trinity_nvs_handle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(g_trinity_nvs_handle, CONFIG_KEY, blob, length);
+        if (err == ESP_OK) {
+            err = nvs_commit(g_trinity_nvs_handle);
+        }
+        nvs_close(g_trinity_nvs_handle);
+    }
+    configStore.flushed(err == ESP_OK, millis());
     if (err != ESP_OK) {
-        ESP_LOGE("NVS", "Error opening NVS: %s", esp_err_to_name(err));
+        ESP_LOGE("NVS", "Error saving the configuration: %s", esp_err_to_name(err));
         return false;
     }
+    ESP_LOGI("NVS", "Configuration saved (write %u).", (unsigned)configStore.writes());
+    return true;
+}
 
-    size_t ssid_len = sizeof(saved_ssid);
-    size_t pass_len = sizeof(saved_pass);
-
-    // Read SSID and Password
-    if (nvs_get_str(g_trinity_nvs_handle, WIFI_SSID_KEY, saved_ssid, &ssid_len) == ESP_OK &&
-        nvs_get_str(g_trinity_nvs_handle, WIFI_PASS_KEY, saved_pass, &pass_len) == ESP_OK) {
+// First boot without the blob: takes over the credentials and audio profile earlier firmware kept
+// as separate keys, and removes those once the blob is written
+void importLegacyConfig() {
+    DeviceConfig& config = configStore.edit();
+    bool found = wifiPortalLoadCredentials(NVS_NAMESPACE, config.ssid, sizeof(config.ssid), config.pass, sizeof(config.pass));
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &g_trinity_nvs_handle) == ESP_OK) {
+        size_t length = sizeof(config.audioProfile);
+        found = nvs_get_str(g_trinity_nvs_handle, LEGACY_AUDIO_PROFILE_KEY, config.audioProfile, &length) == ESP_OK || found;
         nvs_close(g_trinity_nvs_handle);
-        wifiCredentialsSaved = true;
-        ESP_LOGI("NVS", "Credentials loaded successfully.");
-        return true;
     }
-
-    nvs_close(g_trinity_nvs_handle);
-    ESP_LOGW("NVS", "No credentials found in NVS.");
-    return false;
-}
-
-void saveCredentials(const String& ssid, const String& pass) {
-    // NOTE: Using g_trinity_nvs_handle
-    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &g_trinity_nvs_handle);
-    if (err != ESP_OK) {
-        ESP_LOGE("NVS", "Error opening NVS for write: %s", esp_err_to_name(err));
+    if (!found) {
         return;
     }
+    configStore.publish(millis());
+    if (flushConfig(true) && nvs_open(NVS_NAMESPACE, NVS_READWRITE, &g_trinity_nvs_handle) == ESP_OK) {
+        nvs_erase_key(g_trinity_nvs_handle, WIFI_PORTAL_SSID_KEY);
+        nvs_erase_key(g_trinity_nvs_handle, WIFI_PORTAL_PASS_KEY);
+        nvs_erase_key(g_trinity_nvs_handle, LEGACY_AUDIO_PROFILE_KEY);
+        nvs_commit(g_trinity_nvs_handle);
+        nvs_close(g_trinity_nvs_handle);
+        ESP_LOGI("NVS", "Separate keys imported into the configuration.");
+    }
+}
 
-    nvs_set_str(g_trinity_nvs_handle, WIFI_SSID_KEY, ssid.c_str());
-    nvs_set_str(g_trinity_nvs_handle, WIFI_PASS_KEY, pass.c_str());
-
-    err = nvs_commit(g_trinity_nvs_handle);
-    nvs_close(g_trinity_nvs_handle);
+// Reads the device configuration: one NVS read. A blob from another schema version is rewritten
+// in this one; settings this firmware can't honour fall back to their defaults.
+void loadConfig() {
+    DeviceConfig defaults;
+    memset(&defaults, 0, sizeof(defaults));
+    strlcpy(defaults.serverHost, SERVER_HOST, sizeof(defaults.serverHost));
+    defaults.serverPort = SERVER_PORT;
+    strlcpy(defaults.audioProfile, AUDIO_PROFILE_AUTO, sizeof(defaults.audioProfile));
+    defaults.volume = VOLUME_DEFAULT;
+    defaults.maxRecordSeconds = MAX_RECORD_SECONDS;
+    defaults.apTimeoutMs = AP_TIMEOUT_MS;
+
+    uint8_t blob[CONFIG_BLOB_MAX_BYTES];
+    size_t length = sizeof(blob);
+    bool found = false;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &g_trinity_nvs_handle) == ESP_OK) {
+        found = nvs_get_blob(g_trinity_nvs_handle, CONFIG_KEY, blob, &length) == ESP_OK;
+        nvs_close(g_trinity_nvs_handle);
+    }
+    const ConfigLoadResult result = configStore.begin(defaults, found ? blob : NULL, found ? length : 0);
+    if (result == CONFIG_DEFAULTS) {
+        importLegacyConfig();
+    }
 
-    if (err == ESP_OK) {
-        ESP_LOGI("NVS", "Credentials saved and committed.");
-    } else {
-        ESP_LOGE("NVS", "Error committing NVS: %s", esp_err_to_name(err));
+    const DeviceConfig& config = configStore.current();
+    DeviceConfig checked;
+    memcpy(&checked, &config, sizeof(checked));
+    if (checked.volume > VOLUME_MAX) {
+        checked.volume = defaults.volume;
+    }
+    if (checked.maxRecordSeconds == 0 || checked.maxRecordSeconds > MAX_RECORD_SECONDS) {
+        checked.maxRecordSeconds = defaults.maxRecordSeconds;
+    }
+    if (checked.serverHost[0] == '\0' || checked.serverPort == 0) {
+        strlcpy(checked.serverHost, defaults.serverHost, sizeof(checked.serverHost));
+        checked.serverPort = defaults.serverPort;
     }
+    if (strcmp(checked.audioProfile, AUDIO_PROFILE_AUTO) != 0 && audioProfileFind(checked.audioProfile) == AUDIO_PROFILE_COUNT) {
+        strlcpy(checked.audioProfile, defaults.audioProfile, sizeof(checked.audioProfile));
+    }
+    if (checked.apTimeoutMs == 0) {
+        checked.apTimeoutMs = defaults.apTimeoutMs;
+    }
+    if (memcmp(&checked, &config, sizeof(checked)) != 0) {
+        memcpy(&configStore.edit(), &checked, sizeof(checked));
+        configStore.publish(millis());
+    }
+    flushConfig(result == CONFIG_MIGRATED);
+
+    Serial.printf("Configuration: %s, server %s:%u\n",
+                  result == CONFIG_LOADED ? "loaded" : (result == CONFIG_MIGRATED ? "migrated" : "defaults"),
+                  configStore.current().serverHost, (unsigned)configStore.current().serverPort);
 }
 
 // =================================================================================================
 // 5. WIFI AP CONFIGURATION PORTAL 
 // =================================================================================================
 
-const char CONFIG_HTML[] = R"rawliteral(
-<!DOCTYPE html>
-<html>
-<head>
-    <meta name="viewport" content="width=device-width, initial-scale=1.0">
-    <title>Trinity Setup</title>
-    <style>
-        :root {
-            --neon-green: #39ff14;
-            --neon-cyan: #00ffff;
-            --bg-color: #0d0d0d;
-            --box-color: #1a1a1a;
-            --text-color: #ffffff;
-        }
-        body {
-            font-family: 'Space Mono', monospace;
-            background-color: var(--bg-color);
-            color: var(--text-color);
-            display: flex;
-            justify-content: center;
-            align-items: center;
-            min-height: 100vh;
-            margin: 0;
-            background-image: linear-gradient(0deg, var(--bg-color) 90%, rgba(57, 255, 20, 0.1) 100%),
-                                     linear-gradient(90deg, transparent 99%, rgba(0, 255, 255, 0.1) 100%);
-            background-size: 50px 50px;
-        }
-        .container {
-            width: 90%;
-            max-width: 400px;
-            padding: 30px;
-            border-radius: 12px;
-            background-color: var(--box-color);
-            box-shadow: 0 0 15px rgba(0, 255, 255, 0.5), 0 0 25px rgba(57, 255, 20, 0.3);
-            border: 2px solid var(--neon-cyan);
-            transition: all 0.3s ease;
-        }
-        h1 {
-            color: var(--neon-cyan);
-            text-shadow: 0 0 5px var(--neon-cyan);
-            border-bottom: 2px solid var(--neon-green);
-            padding-bottom: 10px;
-            margin-bottom: 20px;
-            text-align: center;
-            font-size: 1.8em;
-        }
-        p {
-            font-size: 0.9em;
-            color: #ccc;
-            text-align: center;
-            margin-bottom: 25px;
-        }
-        input[type="text"], input[type="password"] {
-            width: 100%;
-            padding: 12px;
-            margin: 10px 0;
-            border: 1px solid var(--neon-green);
-            border-radius: 8px;
-            background-color: #000;
-            color: var(--neon-green);
-            box-shadow: 0 0 5px rgba(57, 255, 20, 0.5);
-            outline: none;
-            font-size: 1em;
-            box-sizing: border-box;
-            transition: border-color 0.3s, box-shadow 0.3s;
-        }
-        input[type="text"]:focus, input[type="password"]:focus {
-            border-color: var(--neon-cyan);
-            box-shadow: 0 0 10px rgba(0, 255, 255, 0.7);
-        }
-        button {
-            width: 100%;
-            padding: 12px;
-            margin-top: 20px;
-            border: none;
-            border-radius: 8px;
-            background: var(--neon-green);
-            color: var(--bg-color);
-            font-weight: bold;
-            text-transform: uppercase;
-            cursor: pointer;
-            box-shadow: 0 0 10px rgba(57, 255, 20, 0.7);
-            transition: background 0.3s, box-shadow 0.3s, transform 0.1s;
-        }
-        button:hover {
-            background: var(--neon-cyan);
-            box-shadow: 0 0 15px rgba(0, 255, 255, 1);
-            color: #000;
-        }
-        button:active {
-            transform: translateY(1px);
-        }
-        .status-message {
-            margin-top: 20px;
-            font-size: 0.9em;
-            text-align: center;
-            color: var(--neon-cyan);
-        }
-    </style>
-</head>
-<body>
-    <div class="container">
-        <h1>ACCESS POINT ENGAGED</h1>
-        <p>INITIATE CONNECTION PROTOCOL</p>
-        <form action="/save" method="post">
-            <label for="ssid">NETWORK IDENTIFIER (SSID):</label>
-            <input type="text" id="ssid" name="ssid" placeholder="Home Wi-Fi Network Name" required>
-            <label for="password">ACCESS KEY (Password):</label>
-            <input type="password" id="password" name="password" placeholder="Wi-Fi Password" required>
-            <button type="submit">ACTIVATE & REBOOT</button>
-        </form>
-        <div class="status-message">Connecting to: Trinity_Setup AP</div>
-    </div>
-</body>
-</html>
-)rawliteral";
-
-void handleRoot() {
-    server.send(200, "text/html", CONFIG_HTML);
-}
-
-void handleSave() {
-    String ssid = server.arg("ssid");
-    String pass = server.arg("password");
-
-    if (ssid.length() > 0 && pass.length() > 0) {
-        saveCredentials(ssid, pass);
-        
-        String html = "<meta http-equiv='refresh' content='5;url=/'><div style='text-align:center;color:white;background:black;padding:20px;border:3px solid #00ffff;'>";
-        html += "<h1>CREDENTIALS ACCEPTED</h1>";
-        html += "<p>System rebooting to connect to " + ssid + ". Please switch your device back to your home network.</p>";
-        html += "</div>";
-
-        server.send(200, "text/html", html);
-        
-        // Wait a moment for the response to send before rebooting
-        delay(100);
-        ESP.restart();
-    } else {
-        server.send(400, "text/plain", "Error: SSID and Password are required.");
+// Saves the portal's form in one configuration write: the credentials, the voice server ("host"
+// or "host:port"; empty keeps it) and the audio profile
+bool savePortalForm(WebServer& form) {
+    DeviceConfig& config = configStore.edit();
+    strlcpy(config.ssid, form.arg("ssid").c_str(), sizeof(config.ssid));
+    strlcpy(config.pass, form.arg("password").c_str(), sizeof(config.pass));
+    char server[sizeof(config.serverHost) + 6];
+    strlcpy(server, form.arg("server").c_str(), sizeof(server));
+    char* port = strrchr(server, ':');
+    if (port != NULL) {
+        *port++ = '\0';
+        const long number = strtol(port, NULL, 10);
+        if (number > 0 && number <= 65535) {
+            config.serverPort = (uint16_t)number;
+        }
+    }
+    if (server[0] != '\0') {
+        strlcpy(config.serverHost, server, sizeof(config.serverHost));
     }
+    const String profile = form.arg("profile");
+    if (profile == AUDIO_PROFILE_AUTO || audioProfileFind(profile.c_str()) < AUDIO_PROFILE_COUNT) {
+        strlcpy(config.audioProfile, profile.c_str(), sizeof(config.audioProfile));
+    }
+    configStore.publish(millis());
+    return flushConfig(true);
 }
 
+// Opens the setup access point (lib/wifi_portal) and returns: loop() serves it while the status
+// is STATUS_WIFI_SETUP, and restarts once the credentials are saved or the portal times out.
+// Allocated here, so a device that never needs setup doesn't carry the web server.
 void setupAP() {
     updateStatus(STATUS_WIFI_SETUP);
-    
-    // Start DNS and Web Server
-    WiFi.mode(WIFI_AP);
-    WiFi.softAP(AP_SSID, NULL, AP_CHANNEL); // No password for setup AP
-    
-    // Set up captive portal redirection
-    dnsServer.start(53, "*", WiFi.softAPIP());
-
-    server.on("/", handleRoot);
-    server.on("/save", HTTP_POST, handleSave);
-    // Redirect all unknown requests to the root page (captive portal)
-    server.onNotFound([](){
-        server.sendHeader("Location", "http://192.168.4.1/", true);
-        server.send(302, "text/plain", "");
-    });
-    server.begin();
-
-    Serial.println("\n--- AP Mode Started ---");
-    Serial.printf("Connect to AP: %s\n", AP_SSID);
-    Serial.println("Browse to: http://192.168.4.1/");
-
-    unsigned long startTime = millis();
-    while (millis() - startTime < AP_TIMEOUT_MS) {
-        dnsServer.processNextRequest();
-        server.handleClient();
-        delay(10);
-        // Use yield() to prevent WDT reset during the long wait
-        yield(); 
+    if (wifiPortal == NULL) {
+        wifiPortal = new WifiPortal();
+        const WifiPortalConfig config = {AP_SSID, AP_CHANNEL, configStore.current().apTimeoutMs, NVS_NAMESPACE, savePortalForm};
+        wifiPortal->begin(config);
     }
+}
 
-    // Timeout
-    updateStatus(STATUS_ERROR, "AP Timeout. Rebooting...");
-    delay(2000);
-    ESP.restart();
+void servePortal() {
+    switch (wifiPortal->poll()) {
+        case WIFI_PORTAL_SERVING:
+            delay(2);
+            break;
+        case WIFI_PORTAL_SAVED:
+            ESP.restart();
+            break;
+        case WIFI_PORTAL_TIMED_OUT:
+            updateStatus(STATUS_ERROR, "AP Timeout. Rebooting...");
+            delay(2000);
+            ESP.restart();
+            break;
+    }
 }
 
 // =================================================================================================
 // 6. I2S FUNCTIONS (Now using the correct PIN definitions)
 // =================================================================================================
 
-// Helper function to install the I2S driver for Microphone (RX)
-void i2s_mic_init() {
-    // I2S Configuration (RX Mode)
+// Installs the I2S driver, full duplex, with the audio profile's DMA ring: the microphone and the
+// amplifier share the bit and word clocks, so switching between recording and playback only
+// retunes the sample rate. (A driver reinstall per phase allocated DMA buffers and queues on
+// every turn; now only a change of profile reinstalls it, see applyAudioProfile().)
+void i2s_duplex_init() {
+    // I2S Configuration (TX and RX)
     const i2s_config_t i2s_config = {
-        .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_RX), // Master mode for timing, RX for input
-        .sample_rate = SAMPLE_RATE,
-        .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
-        .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT, // INMP441 uses the left channel slot
+        .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_TX | I2S_MODE_RX), // Master mode for timing
+        .sample_rate = audioLink.uplinkRate,
+        .bits_per_sample = (i2s_bits_per_sample_t)CaptureFormat::BITS,
+        .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT, // INMP441 and MAX98357A both use the left slot
         .communication_format = I2S_COMM_FORMAT_STAND_I2S, 
         .intr_alloc_flags = 0, 
-        .dma_buf_count = 8,
-        .dma_buf_len = 64,
+        .dma_buf_count = audioProfile->dmaBufferCount,
+        .dma_buf_len = audioProfile->dmaBufferSamples,
         .use_apll = false, // Use internal clock
+        .tx_desc_auto_clear = true, // The amplifier plays silence, not stale DMA buffers, while recording
         .fixed_mclk = 0
     };
 
@@ -447,7 +615,7 @@ void i2s_mic_init() {
     const i2s_pin_config_t pin_config = {
         .bck_io_num = PIN_I2S_BCLK, // 37
         .ws_io_num = PIN_I2S_LRCK,  // 36
-        .data_out_num = I2S_PIN_NO_CHANGE, // Not used in RX mode
+        .data_out_num = PIN_I2S_DOUT, // 40
         .data_in_num = PIN_I2S_DIN // 39
     };
 
@@ -456,119 +624,1653 @@ void i2s_mic_init() {
     i2s_zero_dma_buffer(I2S_PORT);
 }
 
-// Helper function to install the I2S driver for Amplifier (TX)
-void i2s_amp_init() {
-    // I2S Configuration (TX Mode)
-    const i2s_config_t i2s_config = {
-        .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_TX), // Master mode for timing, TX for output
-        .sample_rate = SAMPLE_RATE,
-        .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
-        .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT, // MAX98357A is mono, configured for left channel
-        .communication_format = I2S_COMM_FORMAT_STAND_I2S, 
-        .intr_alloc_flags = 0,
-        .dma_buf_count = 8,
-        .dma_buf_len = 64,
-        .use_apll = false,
-        .fixed_mclk = 0
-    };
-
-    // Pin configuration
-    const i2s_pin_config_t pin_config = {
-        .bck_io_num = PIN_I2S_BCLK, // 37
-        .ws_io_num = PIN_I2S_LRCK,  // 36
-        .data_out_num = PIN_I2S_DOUT, // 40
-        .data_in_num = I2S_PIN_NO_CHANGE // Not used in TX mode
-    };
-
-    // Install driver on I2S_NUM_0 again, as it supports both TX and RX
-    i2s_driver_install(I2S_PORT, &i2s_config, 0, NULL);
-    i2s_set_pin(I2S_PORT, &pin_config);
+// Bytes the amplifier's DMA ring holds (each direction) under the active audio profile
+size_t ampDmaBytes() {
+    return CaptureFormat::bytesFor((size_t)audioProfile->dmaBufferCount * audioProfile->dmaBufferSamples);
 }
 
+void i2s_start_at(uint32_t sampleRate) {
+    i2s_set_sample_rates(I2S_PORT, sampleRate); // Same DMA buffer size, so nothing is reallocated
+    i2s_zero_dma_buffer(I2S_PORT);
+    i2s_start(I2S_PORT);
+}
 
 void i2s_start_microphone() {
-    // Dynamic mode switching using uninstall/reinstall for mode change
-    i2s_driver_uninstall(I2S_PORT); 
-    i2s_mic_init(); // Re-initialize driver in RX mode
-    i2s_start(I2S_PORT);
+    i2s_start_at(audioLink.uplinkRate);
 }
 
 void i2s_stop_microphone() {
     i2s_stop(I2S_PORT);
-    // Keep the driver installed for quick restart, although some prefer uninstall here.
 }
 
 void i2s_playback_start() {
-    // Dynamic mode switching using uninstall/reinstall for mode change
-    i2s_driver_uninstall(I2S_PORT); 
-    i2s_amp_init(); // Re-initialize driver in TX mode
-    i2s_start(I2S_PORT);
+    i2s_start_at(audioLink.downlinkRate);
 }
 
 // =================================================================================================
 // 7. NETWORK REQUEST AND RESPONSE HANDLING
 // =================================================================================================
 
+// http://<server>:<port><path>, with the configured server
+void serverUrl(char* url, size_t size, const char* path) {
+    const DeviceConfig& config = configStore.current();
+    snprintf(url, size, "http://%s:%u%s", config.serverHost, (unsigned)config.serverPort, path);
+}
+
+// Recording limit: the configured seconds (at most what audioBuffer holds)
+size_t recordLimitBytes() {
+    return CaptureFormat::bytesForMs(configStore.current().maxRecordSeconds * 1000UL);
+}
+
+// --- Voice Connection ---
+// Voice turns bypass HTTPClient, which builds Strings for the URL, each header and each response
+// line: the request head is formatted into voiceRequestHead, the response is parsed by
+// HttpResponse (lib/http_lite), and the connection stays open for the next turn. Once warmed
+// up, a turn makes no heap allocations (checked by runVoiceTurn()).
+
+// Result of voiceExchange() when a reused connection turned out to be closed by the server
+const int VOICE_CONNECTION_CLOSED = -2;
+
+// Connects unless the previous turn's connection is still open. 'connectMs' gets the time the
+// connect took (the turn's RTT sample), 0 if the connection was reused.
+bool openVoiceConnection(float& connectMs) {
+    connectMs = 0;
+    if (voiceClient.connected()) {
+        return true;
+    }
+    voiceClient.stop();
+    const uint32_t startMicros = micros();
+    const DeviceConfig& config = configStore.current();
+    if (!voiceClient.connect(config.serverHost, config.serverPort, SERVER_TIMEOUT_MS)) {
+        return false;
+    }
+    connectMs = (micros() - startMicros) / 1000.0f;
+    return true;
+}
+
+// Reads from the voice connection's socket into 'parts' (a scatter read) without blocking. The
+// socket is read directly: WiFiClient::read() would copy everything through its own receive
+// buffer first. Returns the bytes read, 0 if none are waiting, or -1 once the connection has
+// closed or failed, or nothing arrived for SERVER_TIMEOUT_MS.
+int recvVoice(iovec* parts, int count) {
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = parts;
+    message.msg_iovlen = count;
+    const int received = recvmsg(voiceClient.fd(), &message, MSG_DONTWAIT);
+    if (received > 0) {
+        voiceLastDataMs = millis();
+        voiceReceivedBytes += received;
+        return received;
+    }
+    if (received < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) {
+        return millis() - voiceLastDataMs > SERVER_TIMEOUT_MS ? -1 : 0;
+    }
+    return -1;
+}
+
+// Writes the request and reads the response head. Returns the HTTP status, -1 on errors, or
+// VOICE_CONNECTION_CLOSED if the server closed the connection without answering.
+int sendVoiceRequest(const char* method, const char* path, const char* headers, const uint8_t* body, size_t length,
+                     LinkSample& sample) {
+    const int headLength = snprintf(voiceRequestHead, sizeof(voiceRequestHead),
+        "%s %s HTTP/1.1\r\nHost: %s:%u\r\n%sContent-Length: %u\r\n\r\n",
+        method, path, configStore.current().serverHost, (unsigned)configStore.current().serverPort, headers, (unsigned)length);
+    if (headLength <= 0 || (size_t)headLength >= sizeof(voiceRequestHead)) {
+        BINLOG("Request headers too long.\n");
+        return -1;
+    }
+    if (voiceClient.write((const uint8_t*)voiceRequestHead, headLength) != (size_t)headLength) {
+        return VOICE_CONNECTION_CLOSED;
+    }
+    const uint32_t uploadStartMicros = micros();
+    for (size_t sent = 0; sent < length; ) {
+        const size_t written = voiceClient.write(body + sent, length - sent);
+        if (written == 0) {
+            return -1;
+        }
+        sent += written;
+    }
+    const uint32_t uploadMicros = micros() - uploadStartMicros;
+    if (length >= MIN_GOODPUT_SAMPLE_BYTES && uploadMicros > 0) {
+        sample.uplinkBytesPerSec = length * 1e6f / uploadMicros;
+    }
+
+    voiceResponse.reset();
+    voicePendingOffset = voicePendingFill = 0;
+    bool answered = false;
+    voiceLastDataMs = millis();
+    for (;;) {
+        iovec part = {voiceHeadChunk, sizeof(voiceHeadChunk)};
+        const int bytesRead = recvVoice(&part, 1);
+        if (bytesRead < 0) {
+            break;
+        }
+        if (bytesRead == 0) {
+            delay(1);
+            continue;
+        }
+        answered = true;
+        size_t consumed;
+        const HttpHeadState state = voiceResponse.feedHead(voiceHeadChunk, bytesRead, &consumed);
+        if (state == HTTP_HEAD_FAILED) {
+            break;
+        }
+        if (state == HTTP_HEAD_DONE) {
+            voicePendingOffset = consumed;
+            voicePendingFill = bytesRead;
+            return voiceResponse.status();
+        }
+    }
+    voiceClient.stop();
+    return answered ? -1 : VOICE_CONNECTION_CLOSED;
+}
+
+// Sends one request over the voice connection ('headers' holds extra "Name: value\r\n" lines)
+// and reads the response head; the body follows through readVoiceBody(). Returns the HTTP
+// status, or -1 if the exchange failed. 'sample' gets the connect time as RTT (fresh
+// connections only) and the upload goodput.
+int voiceExchange(const char* method, const char* path, const char* headers, const uint8_t* body, size_t length,
+                  LinkSample& sample) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        float connectMs;
+        if (!openVoiceConnection(connectMs)) {
+            return -1;
+        }
+        sample.rttMs = connectMs;
+        sample.uplinkBytesPerSec = 0;
+        const int status = sendVoiceRequest(method, path, headers, body, length, sample);
+        if (status != VOICE_CONNECTION_CLOSED || connectMs > 0) {
+            return status < 0 ? -1 : status;
+        }
+        // The kept-alive connection had been closed on the server's side; retry on a new one
+        voiceClient.stop();
+    }
+    return -1;
+}
+
+// Reads the next piece of the response body into 'out'. Returns its length (0 if nothing has
+// arrived yet, or only chunk framing did), or -1 once the body is complete, the connection has
+// closed, or nothing arrived for SERVER_TIMEOUT_MS.
+int readVoiceBody(uint8_t* out, size_t capacity) {
+    size_t length;
+    if (voicePendingOffset < voicePendingFill) {
+        length = min(capacity, voicePendingFill - voicePendingOffset);
+        memcpy(out, voiceHeadChunk + voicePendingOffset, length);
+        voicePendingOffset += length;
+    } else {
+        if (voiceResponse.bodyComplete() || voiceResponse.failed()) {
+            return -1;
+        }
+        iovec part = {out, capacity};
+        const int bytesRead = recvVoice(&part, 1);
+        if (bytesRead <= 0) {
+            return bytesRead;
+        }
+        length = bytesRead;
+    }
+    return voiceResponse.decodeBody(out, length);
+}
+
+// Receives body payload straight into 'spans' (filled in order), at most 'limit' bytes: only
+// what voiceResponse.payloadRemaining() allows, so nothing has to be moved to undo chunk
+// framing. Returns the bytes received, 0 if none were waiting, or -1 as readVoiceBody() does.
+int receiveVoicePayload(const RingSpan* spans, size_t count, size_t limit) {
+    if (voiceResponse.bodyComplete() || voiceResponse.failed()) {
+        return -1;
+    }
+    limit = min(limit, voiceResponse.payloadRemaining());
+    iovec parts[2];
+    int used = 0;
+    for (size_t i = 0; i < count && i < 2 && limit > 0; i++) {
+        parts[used].iov_base = spans[i].data;
+        parts[used].iov_len = min(spans[i].length, limit);
+        limit -= parts[used++].iov_len;
+    }
+    const int received = used > 0 ? recvVoice(parts, used) : 0;
+    if (received > 0) {
+        size_t left = received;
+        for (int i = 0; i < used && left > 0; i++) {
+            const size_t length = min(left, parts[i].iov_len);
+            voiceResponse.decodeBody((uint8_t*)parts[i].iov_base, length); // Payload only: counted, not moved
+            left -= length;
+        }
+    }
+    return received;
+}
+
+// Ends the exchange. The connection is kept for the next turn only if the body was read to
+// its end and the server keeps the connection alive.
+void finishVoiceExchange() {
+    if (!voiceResponse.reusable() || voicePendingOffset < voicePendingFill) {
+        voiceClient.stop();
+    }
+}
+
+// Sets the volume within 0..VOLUME_MAX; the output chain glides to the new gain.
+void setPlaybackVolume(int volume) {
+    playbackVolume = constrain(volume, 0, VOLUME_MAX);
+    outputChain.setVolume((int16_t)(playbackVolume * OUTPUT_GAIN_UNITY / VOLUME_UNITY));
+}
+
+// Moves the volume by 'steps' and keeps it in the configuration (written once the presses stop)
+void stepPlaybackVolume(int steps) {
+    setPlaybackVolume(playbackVolume + steps);
+    configStore.edit().volume = (uint8_t)playbackVolume;
+    configStore.publish(millis());
+    BINLOG("Volume: %d/%d\n", playbackVolume, VOLUME_MAX);
+}
+
+// Executes the device-control opcodes from the server's intent fast path.
+// Returns false if playback of the response should be skipped.
+bool executeControlOpcodes(const char* opcodes) {
+    bool playResponse = true;
+    if (strstr(opcodes, TRINITY_OPCODE_VOLUME_UP)) {
+        stepPlaybackVolume(1);
+    }
+    if (strstr(opcodes, TRINITY_OPCODE_VOLUME_DOWN)) {
+        stepPlaybackVolume(-1);
+    }
+    if (strstr(opcodes, TRINITY_OPCODE_STOP)) {
+        playResponse = false;
+    }
+    return playResponse;
+}
+
+// Greedy word wrap of 'text' into at most maxLines lines of TEXT_COLUMNS characters.
+// Fills the start offset and length of each line; returns the line count.
+int wrapText(const char* text, uint16_t* starts, uint8_t* lengths, int maxLines) {
+    int lines = 0;
+    size_t pos = 0;
+    const size_t total = strlen(text);
+    while (pos < total && lines < maxLines) {
+        size_t len = total - pos;
+        size_t next;
+        if (len <= (size_t)TEXT_COLUMNS) {
+            next = total;
+        } else {
+            len = TEXT_COLUMNS;
+            while (len > 0 && text[pos + len] != ' ') {
+                len--;
+            }
+            if (len == 0) {
+                len = TEXT_COLUMNS; // One long word: hard break
+                next = pos + len;
+            } else {
+                next = pos + len + 1; // Skip the space at the break
+            }
+        }
+        starts[lines] = pos;
+        lengths[lines] = len;
+        lines++;
+        pos = next;
+    }
+    return lines;
+}
+
+// Receives the frames of a framed response: shows the reply text, scrolls it along with the
+// audio, applies control opcodes and plays the PCM. Reply audio goes through playbackRing: PCM
+// received in place is only committed, anything else is written in, the output chain scales it
+// in place a block at a time, and feed() (the I2S feeder) moves the scaled samples from the ring
+// into the DMA buffers. Raw PCM responses and RTP turns use the same path. A TCP reply starts
+// playing once the audio profile's prebuffer is in the ring (an RTP reply once the jitter buffer
+// has its delay queued). B1 and B2 step the volume while the reply plays.
+class PlaybackSink : public FrameSink {
+public:
+    PlaybackSink(bool adpcm, uint32_t sampleRate)
+        : _lineCount(0), _firstLine(-1), _play(true), _started(false), _rtpStream(false), _adpcm(adpcm), _sampleRate(sampleRate),
+          _processedAhead(0), _prebufferBytes(min(Mono16::bytesFor((size_t)audioProfile->prebufferMs * sampleRate / 1000), PLAYBACK_RING_BYTES)),
+          _prebuffered(false), _bytesWritten(0), _bytesReceived(0), _expectedPcmBytes(0), _lastScrollMs(0),
+          _startMicros(micros()), _i2sMicros(0), _waitMicros(0), _displayMicros(0), _playEndMicros(0), _underruns(0),
+          _latencyMicros(0), _latencySamples(0), _lastButtonMs(0) {
+        _reply[0] = '\0';
+        memset(&_timing, 0, sizeof(_timing));
+        memset(&_rtp, 0, sizeof(_rtp));
+        _adpcmState = {0, 0};
+        // Buttons already down (B2 ended the recording) count only once released
+        _wakeWasPressed = digitalRead(PIN_BUTTON_WAKE) == LOW;
+        _sendWasPressed = digitalRead(PIN_BUTTON_SEND) == LOW;
+        playbackRing.reset();
+        outputChain.restart();
+    }
+
+    void onText(TrinityTextKind kind, const char* text, size_t) override {
+        if (kind == TRINITY_TEXT_TRANSCRIPT) {
+            BINLOG("Heard: %s\n", text);
+        } else if (kind == TRINITY_TEXT_REPLY) {
+            strlcpy(_reply, text, sizeof(_reply));
+            _lineCount = wrapText(_reply, _lineStarts, _lineLengths, REPLY_MAX_LINES);
+            drawReply(0);
+        }
+    }
+
+    void onControl(const char* opcodes) override {
+        _play = executeControlOpcodes(opcodes);
+    }
+
+    void onTiming(const TrinityTimingFrame& timing) override {
+        _timing = timing;
+        _expectedPcmBytes = _adpcm ? timing.audio_bytes * 4 : timing.audio_bytes;
+        BINLOG("Server: stt %u ms, llm %u ms, tts %u ms, %u bytes of audio\n",
+               timing.stt_ms, timing.llm_ms, timing.tts_ms, timing.audio_bytes);
+    }
+
+    void onAudio(uint8_t* data, size_t length) override {
+        _bytesReceived += length;
+        if (!_play) {
+            return;
+        }
+        start();
+        if (_adpcm) {
+            // Each ADPCM byte decodes to two samples, straight into the ring (whose free spans
+            // are whole multiples of them); the decoder state runs across frames
+            while (length > 0) {
+                RingSpan spans[2];
+                const size_t take = playbackRing.writable(spans, length * 4) > 0 ? spans[0].length / 4 : 0;
+                if (take == 0) {
+                    waitForDma();
+                    feed();
+                    continue;
+                }
+                playbackRing.commit(adpcmDecode(data, take, (int16_t*)spans[0].data, _adpcmState) * sizeof(int16_t));
+                data += take;
+                length -= take;
+            }
+            return;
+        }
+        if (playbackRing.contains(data)) {
+            // Received in place (receivePlaybackBody()); an odd trailing byte completes later
+            playbackRing.commit(length);
+            return;
+        }
+        // Bytes that came another way: along with the response head, or between chunk framing
+        writeRing(data, length);
+    }
+
+    void onRtp(const TrinityRtpFrame& rtp) override {
+        _rtp = rtp;
+        _rtpStream = true;
+    }
+
+    void onEnd() override {}
+
+    // Plays PCM that arrives outside the AUDIO frames (RTP turns) through the ring; blocks until
+    // the DMA buffers have taken all of it but the last block or two, which wait for the output
+    // chain's look-ahead
+    void playPcm(FrameSpan<Mono16> pcm) {
+        if (!_play) {
+            return;
+        }
+        start();
+        writeRing((const uint8_t*)pcm.data(), pcm.bytes());
+        while (playbackRing.fill() >= 2 * OUTPUT_BLOCK_BYTES) {
+            if (feed() == 0) {
+                waitForDma();
+            }
+        }
+    }
+
+    // The I2S feeder: runs the output chain over the ring, then moves the scaled samples into
+    // whatever DMA buffers are free, without blocking. 'flush' at the end of the stream scales
+    // what is left without a look-ahead. Returns the bytes written.
+    size_t feed(bool flush = false) {
+        process(flush);
+        if (!_prebuffered) {
+            if (!flush && !_rtpStream && playbackRing.fill() < _prebufferBytes) {
+                return 0;
+            }
+            _prebuffered = true;
+        }
+        size_t total = 0;
+        for (;;) {
+            const RingSpan span = playbackRing.readable();
+            const size_t ready = span.length < _processedAhead ? span.length : _processedAhead;
+            if (ready == 0) {
+                break;
+            }
+            const uint32_t now = micros();
+            size_t written = 0;
+            i2s_write(I2S_PORT, span.data, ready, &written, 0);
+            if (written == 0) {
+                break;
+            }
+            playbackRing.consume(written);
+            _processedAhead -= written;
+            queued(now, written);
+            total += written;
+            if (written < ready) {
+                break; // The DMA buffers are full
+            }
+        }
+        return total;
+    }
+
+    // Waits for a DMA buffer to drain (playback pacing: excluded from goodput)
+    void waitForDma() {
+        const uint32_t start = micros();
+        delay(1);
+        const uint32_t blocked = micros() - start;
+        _i2sMicros += blocked;
+        _waitMicros += blocked;
+        cpuWaitRecord(i2sTxWait, blocked);
+    }
+
+    // Waits for the network
+    void waitForNetwork() {
+        const uint32_t start = micros();
+        delay(1);
+        _waitMicros += micros() - start;
+    }
+
+    // Plays out whatever is left in the ring, then empties it (an odd trailing byte included), so
+    // a stream that follows starts on a block boundary
+    void drain() {
+        while (playbackRing.fill() >= sizeof(Mono16::Sample)) {
+            if (feed(true) == 0) {
+                waitForDma();
+            }
+        }
+        playbackRing.reset();
+        _processedAhead = 0;
+    }
+
+    // B1 steps the volume up and B2 down, once per press
+    void pollButtons() {
+        const unsigned long now = millis();
+        if (now - _lastButtonMs < VOLUME_BUTTON_DEBOUNCE_MS) {
+            return;
+        }
+        const bool wake = digitalRead(PIN_BUTTON_WAKE) == LOW;
+        const bool send = digitalRead(PIN_BUTTON_SEND) == LOW;
+        if (wake != _wakeWasPressed || send != _sendWasPressed) {
+            _lastButtonMs = now;
+        }
+        if (wake && !_wakeWasPressed) {
+            stepPlaybackVolume(1);
+        }
+        if (send && !_sendWasPressed) {
+            stepPlaybackVolume(-1);
+        }
+        _wakeWasPressed = wake;
+        _sendWasPressed = send;
+    }
+
+    // Scrolls the reply so the line being spoken stays near the top. Progress is measured in
+    // samples that have actually left the DMA ring, not bytes received.
+    void updateScroll() {
+        if (_lineCount <= REPLY_VISIBLE_LINES || _expectedPcmBytes == 0) {
+            return;
+        }
+        const unsigned long now = millis();
+        if (now - _lastScrollMs < SCROLL_REFRESH_MS) {
+            return;
+        }
+        _lastScrollMs = now;
+        const size_t played = _bytesWritten > ampDmaBytes() ? _bytesWritten - ampDmaBytes() : 0;
+        const int spokenLine = (int)((uint64_t)played * _lineCount / _expectedPcmBytes);
+        drawReply(constrain(spokenLine - 1, 0, _lineCount - REPLY_VISIBLE_LINES));
+    }
+
+    bool started() const { return _started; }
+    bool playing() const { return _play; }
+    bool rtpStream() const { return _rtpStream; }
+    const TrinityRtpFrame& rtp() const { return _rtp; }
+    size_t bytesReceived() const { return _bytesReceived; }
+    uint32_t i2sMicros() const { return _i2sMicros; }
+    uint32_t underruns() const { return _underruns; }
+    // Mean audio queued ahead of the speaker (DMA buffers and ring), sampled at each DMA write
+    float meanLatencyMs() const { return _latencySamples > 0 ? _latencyMicros / 1000.0f / _latencySamples : 0; }
+    // Seconds of audio handed to the DMA buffers
+    float audioSeconds() const { return (float)Mono16::framesIn(_bytesWritten) / _sampleRate; }
+    // Time the loop spent receiving, parsing, decoding, processing and feeding: everything since
+    // construction but the waits and the reply's redraws
+    uint32_t workMicros() const { return (micros() - _startMicros) - _waitMicros - _displayMicros; }
+
+private:
+    void start() {
+        if (!_started) {
+            i2s_playback_start();
+            _started = true;
+        }
+    }
+
+    // Copies audio into the ring, feeding the DMA buffers while it is full
+    void writeRing(const uint8_t* data, size_t length) {
+        while (length > 0) {
+            const size_t written = playbackRing.write(data, length);
+            if (written == 0) {
+                waitForDma();
+                feed();
+            }
+            data += written;
+            length -= written;
+        }
+    }
+
+    // Runs the output chain over whole blocks past the ones already scaled, each once the block
+    // after it (the limiter's look-ahead) is in the ring too; with 'flush', over whatever is left.
+    // Blocks never straddle the wrap: the chain starts at the ring's start and the capacity is a
+    // whole number of blocks.
+    void process(bool flush) {
+        for (;;) {
+            const RingSpan block = playbackRing.readable(_processedAhead);
+            const size_t bytes = (block.length < OUTPUT_BLOCK_BYTES ? block.length : OUTPUT_BLOCK_BYTES) & ~(size_t)1;
+            RingSpan next = {NULL, 0};
+            if (bytes == OUTPUT_BLOCK_BYTES) {
+                next = playbackRing.readable(_processedAhead + bytes);
+                next.length = (next.length < OUTPUT_BLOCK_BYTES ? next.length : OUTPUT_BLOCK_BYTES) & ~(size_t)1;
+            }
+            if (bytes == 0 || (!flush && next.length < OUTPUT_BLOCK_BYTES)) {
+                break;
+            }
+            outputChain.process((int16_t*)block.data, bytes / sizeof(Mono16::Sample),
+                                next.length > 0 ? (const int16_t*)next.data : NULL, next.length / sizeof(Mono16::Sample));
+            _processedAhead += bytes;
+        }
+    }
+
+    // Accounts for 'bytes' queued at 'now'. If everything queued before has already played out,
+    // the DMA ring ran dry. Also samples the latency: what is now queued in DMA and the ring.
+    void queued(uint32_t now, size_t bytes) {
+        if (_playEndMicros != 0 && (int32_t)(now - _playEndMicros) > 0) {
+            _underruns++;
+        }
+        _playEndMicros = ((_playEndMicros != 0 && (int32_t)(_playEndMicros - now) > 0) ? _playEndMicros : now)
+                         + (uint32_t)((uint64_t)Mono16::framesIn(bytes) * 1000000 / _sampleRate);
+        _bytesWritten += bytes;
+        _latencyMicros += (_playEndMicros - now) + (uint64_t)Mono16::framesIn(playbackRing.fill()) * 1000000 / _sampleRate;
+        _latencySamples++;
+    }
+
+    void drawReply(int firstLine) {
+        if (firstLine == _firstLine) {
+            return;
+        }
+        _firstLine = firstLine;
+        const uint32_t drawStart = micros();
+        display.clearDisplay();
+        display.setTextSize(1);
+        display.setTextColor(SSD1306_WHITE);
+        display.setCursor(0, 0);
+        display.println("SPEAKING...");
+        for (int i = 0; i < REPLY_VISIBLE_LINES && firstLine + i < _lineCount; i++) {
+            display.setCursor(0, 8 * (i + 1));
+            display.write((const uint8_t*)_reply + _lineStarts[firstLine + i], _lineLengths[firstLine + i]);
+        }
+        display.display();
+        _displayMicros += micros() - drawStart;
+    }
+
+    char _reply[FRAME_PARSER_TEXT_MAX + 1];
+    uint16_t _lineStarts[REPLY_MAX_LINES];
+    uint8_t _lineLengths[REPLY_MAX_LINES];
+    int _lineCount;
+    int _firstLine;
+    TrinityTimingFrame _timing;
+    bool _play;
+    bool _started;
+    bool _rtpStream;             // Audio follows over RTP (see _rtp)
+    TrinityRtpFrame _rtp;
+    bool _adpcm;
+    uint32_t _sampleRate;
+    AdpcmState _adpcmState;
+    size_t _processedAhead;      // Bytes at the ring's read position the output chain has scaled
+    size_t _prebufferBytes;      // Queued in the ring before a TCP reply starts to play
+    bool _prebuffered;
+    size_t _bytesWritten;
+    size_t _bytesReceived;       // Encoded audio bytes from the network
+    size_t _expectedPcmBytes;    // Decoded size of the whole reply
+    unsigned long _lastScrollMs;
+    uint32_t _startMicros;
+    uint32_t _i2sMicros;         // Waiting for the DMA buffers
+    uint32_t _waitMicros;        // Waiting for anything
+    uint32_t _displayMicros;
+    uint32_t _playEndMicros;     // When the audio queued so far finishes playing
+    uint32_t _underruns;
+    uint64_t _latencyMicros;     // Sum of the latency samples
+    uint32_t _latencySamples;
+    bool _wakeWasPressed;        // Buttons at the last poll
+    bool _sendWasPressed;
+    unsigned long _lastButtonMs; // Last change, for debouncing
+};
+
+// Receives the next piece of a response body for 'sink'. Known PCM goes from the socket
+// straight into free space in playbackRing: an AUDIO payload of 'parser', or everything of a raw
+// PCM body ('parser' NULL). All else (frame headers and small frames, ADPCM, chunk framing, body
+// bytes that came with the head) is read into voiceBodyChunk, no more than the current part, so
+// it never takes PCM along. Returns the raw bytes consumed (0 if none were waiting, or the ring
+// is full), or -1 at the end of the body or on malformed frames.
+int receivePlaybackBody(FrameParser* parser, PlaybackSink& sink, bool adpcm) {
+    const uint32_t receivedBefore = voiceReceivedBytes;
+    const size_t pendingBefore = voicePendingOffset;
+    const bool pending = voicePendingOffset < voicePendingFill;
+    const size_t audioAhead = parser == NULL ? SIZE_MAX : (parser->audioPart() ? parser->partRemaining() : 0);
+    if (!adpcm && !pending && audioAhead > 0 && voiceResponse.payloadRemaining() > 0) {
+        RingSpan spans[2];
+        const size_t count = playbackRing.writable(spans, audioAhead);
+        const int received = count > 0 ? receiveVoicePayload(spans, count, audioAhead) : 0;
+        size_t left = received > 0 ? received : 0;
+        for (size_t i = 0; i < count && left > 0; i++) {
+            const size_t length = min(left, spans[i].length);
+            if (parser != NULL) {
+                parser->feed(spans[i].data, length, sink);
+            } else {
+                sink.onAudio(spans[i].data, length);
+            }
+            left -= length;
+        }
+        return received;
+    }
+
+    size_t capacity = sizeof(voiceBodyChunk);
+    if (!pending && voiceResponse.payloadRemaining() == 0) {
+        capacity = CHUNK_FRAMING_READ_BYTES;
+    } else if (parser != NULL && !parser->audioPart()) {
+        capacity = min(capacity, parser->partRemaining());
+    } else if (adpcm) {
+        // Leaves the ring room for what it decodes to
+        capacity = min(capacity, max(playbackRing.space() / 4, (size_t)1));
+    }
+    const int length = readVoiceBody(voiceBodyChunk, capacity);
+    if (length < 0) {
+        return -1;
+    }
+    if (length > 0) {
+        if (parser == NULL) {
+            sink.onAudio(voiceBodyChunk, length);
+        } else if (!parser->feed(voiceBodyChunk, length, sink)) {
+            BINLOG("Malformed response frames.\n");
+            return -1;
+        }
+    }
+    return (int)(voiceReceivedBytes - receivedBefore) + (int)(voicePendingOffset - pendingBefore);
+}
+
+// Plays a response body through playbackRing, parsing frames with 'parser' (NULL for raw PCM)
+// as they arrive, then logs the playback's CPU time per second of audio.
+void streamPlaybackBody(FrameParser* parser, PlaybackSink& sink, bool adpcm) {
+    int received;
+    while ((parser == NULL || !parser->finished()) && (received = receivePlaybackBody(parser, sink, adpcm)) >= 0) {
+        const size_t fed = sink.feed();
+        if (received == 0 && fed == 0) {
+            // Nothing moved: either the ring is full and the DMA buffers too, or the network is behind
+            if (playbackRing.space() == 0) {
+                sink.waitForDma();
+            } else {
+                sink.waitForNetwork();
+            }
+        }
+        sink.updateScroll();
+        sink.pollButtons();
+        yield(); // Prevent WDT reset
+    }
+    sink.drain();
+    const float seconds = sink.audioSeconds();
+    if (seconds > 0) {
+        BINLOG("[PLAY] %.1f s of audio, %u bytes received, %.1f ms of CPU per second of audio, %u underruns; "
+               "normalizer %+.1f dB, limiter down to %.1f dB\n",
+               seconds, (unsigned)sink.bytesReceived(), sink.workMicros() / 1000.0f / seconds, sink.underruns(),
+               20 * log10f((float)outputChain.normalizerGain() / OUTPUT_GAIN_UNITY),
+               20 * log10f((float)outputChain.deepestReduction() / OUTPUT_GAIN_UNITY));
+    }
+}
+
+// Plays the reply audio of an RTP turn through the jitter buffer. The sink's playPcm() paces
+// the loop: once the DMA ring is full, each packet played waits for one to drain.
+void playRtpStream(PlaybackSink& sink) {
+    const TrinityRtpFrame& rtp = sink.rtp();
+    jitterBuffer->start(rtp.ssrc, strcmp(audioLink.downlinkCodec, TRINITY_CODEC_ADPCM) == 0, audioLink.downlinkRate,
+                       (uint16_t)rtp.first_sequence, rtp.packets, millis());
+    Mono16::Sample pcm[Mono16::framesIn(RTP_MAX_PAYLOAD)];
+    size_t samples;
+
+    while (!jitterBuffer->finished()) {
+        // lwIP queues only a few datagrams, so drain them all before blocking in playPcm()
+        int length;
+        while ((length = recv(rtpSocket, rtpPacket, sizeof(rtpPacket), MSG_DONTWAIT)) > 0) {
+            jitterBuffer->push(rtpPacket, length, millis());
+        }
+        if (jitterBuffer->pop(millis(), pcm, &samples) == JITTER_WAITING) {
+            sink.waitForNetwork();
+            continue;
+        }
+        if (samples > 0) {
+            sink.playPcm(FrameSpan<Mono16>(pcm, samples));
+        }
+        sink.updateScroll();
+        sink.pollButtons();
+        yield(); // Prevent WDT reset
+    }
+    sink.drain();
+
+    const JitterStats& stats = jitterBuffer->stats();
+    BINLOG("[RTP] %u/%u packets played, %u rebuilt from FEC, %u concealed, %u stretched, %u late; "
+           "jitter %.1f ms, delay %u packets\n",
+           stats.played, rtp.packets, stats.recovered, stats.concealed, stats.stretched, stats.late,
+           jitterBuffer->jitterMs(), jitterBuffer->delayPackets());
+}
+
+// Plays a framed (TRINITY_FRAMES_MIME) response, parsing frames as they arrive.
+// Fills in the downlink goodput and playback underruns for link adaptation, and the playback's
+// latency and glitches for the audio profile.
+void playFramedResponse(LinkSample& sample, uint32_t& underruns, AudioProfileTurn& playback) {
+    updateStatus(STATUS_SPEAKING, "Response received.");
+    FrameParser parser;
+    const bool adpcm = strcmp(audioLink.downlinkCodec, TRINITY_CODEC_ADPCM) == 0;
+    PlaybackSink sink(adpcm, audioLink.downlinkRate);
+    const uint32_t startMicros = micros();
+
+    streamPlaybackBody(&parser, sink, adpcm);
+
+    const uint32_t networkMicros = (micros() - startMicros) - sink.i2sMicros();
+    if (sink.bytesReceived() >= MIN_GOODPUT_SAMPLE_BYTES && networkMicros > 0) {
+        sample.downlinkBytesPerSec = sink.bytesReceived() * 1e6f / networkMicros;
+    }
+    underruns = sink.underruns();
+
+    playback.latencyMs = sink.meanLatencyMs();
+    if (parser.finished() && sink.rtpStream() && sink.playing()) {
+        playRtpStream(sink);
+        underruns = sink.underruns() + jitterBuffer->stats().stretched;
+        playback.latencyMs = sink.meanLatencyMs() + jitterBuffer->delayPackets() * TRINITY_RTP_PACKET_MS;
+        playback.glitches = jitterBuffer->stats().concealed;
+        playback.jitterMs = jitterBuffer->jitterMs();
+    }
+    playback.audioSeconds = sink.audioSeconds();
+    playback.glitches += underruns;
+
+    if (sink.started()) {
+        i2s_stop(I2S_PORT);
+    }
+    updateStatus(STATUS_CONNECTED);
+}
+
+// Plays a raw PCM response (servers without framing) at the negotiated downlink rate.
+void playRawResponse() {
+    updateStatus(STATUS_SPEAKING, "Response received.");
+    PlaybackSink sink(false, audioLink.downlinkRate);
+    streamPlaybackBody(NULL, sink, false);
+    if (sink.started()) {
+        i2s_stop(I2S_PORT);
+    }
+    updateStatus(STATUS_CONNECTED); // Return to READY state
+}
+
+// Request body for HTTPClient::sendRequest(). HTTPClient connects before its first read and
+// writes each chunk right after reading it, so the first and last reads bracket the upload.
+class UploadStream : public Stream {
+public:
+    UploadStream(const uint8_t* data, size_t length)
+        : _data(data), _length(length), _offset(0), _firstReadMicros(0), _lastReadMicros(0) {}
+
+    int available() override { return _length - _offset; }
+    int peek() override { return _offset < _length ? _data[_offset] : -1; }
+    int read() override {
+        uint8_t byte;
+        return readBytes((char*)&byte, 1) == 1 ? byte : -1;
+    }
+    size_t readBytes(char* buffer, size_t length) override {
+        const uint32_t now = micros();
+        if (_offset == 0) {
+            _firstReadMicros = now;
+        }
+        _lastReadMicros = now;
+        length = min(length, _length - _offset);
+        memcpy(buffer, _data + _offset, length);
+        _offset += length;
+        return length;
+    }
+    size_t write(uint8_t) override { return 0; }
+
+    uint32_t firstReadMicros() const { return _firstReadMicros; }
+    uint32_t uploadMicros() const { return _lastReadMicros - _firstReadMicros; }
+
+private:
+    const uint8_t* _data;
+    size_t _length;
+    size_t _offset;
+    uint32_t _firstReadMicros;
+    uint32_t _lastReadMicros;
+};
+
+// Starts the RTP uplink stream for a new recording
+void startRtpUplink() {
+    rtpUplinkOffset = 0;
+    rtpUplink.begin(esp_random(), strcmp(audioLink.uplinkCodec, TRINITY_CODEC_ADPCM) == 0, audioLink.uplinkRate,
+                    (uint16_t)esp_random());
+}
+
+void closeRtpSocket() {
+    if (rtpSocket >= 0) {
+        close(rtpSocket);
+        rtpSocket = -1;
+    }
+}
+
+// Limits what lwIP queues on the RTP socket to the audio profile's buffer: packets arriving
+// past it would be too late to play anyway
+void setRtpReceiveBuffer() {
+    const int bytes = audioProfile->socketBufferBytes > 0 ? audioProfile->socketBufferBytes : INT_MAX; // lwIP's default
+    if (rtpSocket >= 0) {
+        setsockopt(rtpSocket, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes));
+    }
+}
+
+// Binds the local RTP port (non-blocking) and addresses the server's. Returns false on failure.
+bool openRtpSocket() {
+    closeRtpSocket();
+    rtpSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (rtpSocket < 0) {
+        return false;
+    }
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_port = htons(RTP_LOCAL_PORT);
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    memset(&rtpServerAddress, 0, sizeof(rtpServerAddress));
+    rtpServerAddress.sin_family = AF_INET;
+    rtpServerAddress.sin_port = htons(audioLink.rtpPort);
+    if (bind(rtpSocket, (sockaddr*)&local, sizeof(local)) != 0 ||
+        inet_aton(configStore.current().serverHost, &rtpServerAddress.sin_addr) == 0 ||
+        fcntl(rtpSocket, F_SETFL, O_NONBLOCK) != 0) {
+        closeRtpSocket();
+        return false;
+    }
+    setRtpReceiveBuffer();
+    return true;
+}
+
+void sendRtpPacket(size_t length) {
+    sendto(rtpSocket, rtpPacket, length, 0, (sockaddr*)&rtpServerAddress, sizeof(rtpServerAddress));
+}
+
+// Sends the recording made since the last call as RTP packets. At least one packet's worth is
+// held back until 'last', so the final packet (with the marker bit) always carries audio.
+void sendRtpUplink(bool last) {
+    const size_t packetBytes = Mono16::bytesFor(rtpPacketSamples(audioLink.uplinkRate));
+    while (audioDataSize - rtpUplinkOffset > packetBytes || (last && audioDataSize > rtpUplinkOffset)) {
+        const size_t bytes = min(packetBytes, audioDataSize - rtpUplinkOffset);
+        const bool final = last && rtpUplinkOffset + bytes == audioDataSize;
+        const ConstFrameSpan<Mono16> pcm = ConstFrameSpan<Mono16>::fromBytes(audioBuffer + rtpUplinkOffset, bytes);
+        sendRtpPacket(rtpUplink.packAudio(pcm.data(), pcm.frames(), final, rtpPacket));
+        const size_t fecLength = rtpUplink.packFec(rtpPacket);
+        if (fecLength > 0) {
+            sendRtpPacket(fecLength);
+        }
+        rtpUplinkOffset += bytes;
+    }
+}
+
+// Feeds one turn's measurements to the link adapter and adopts its formats for the next turn,
+// and the turn's playback to the audio profile selector (its choice is applied after the turn).
+void updateLinkAdaptation(LinkSample sample, uint32_t underruns, AudioProfileTurn playback) {
+    sample.rssiDbm = WiFi.RSSI();
+    const bool switched = linkAdapter.update(sample);
+    playback.rssiDbm = sample.rssiDbm;
+    const size_t profile = audioProfiles.index();
+    audioProfiles.update(playback);
+
+    const LinkMode& uplink = linkAdapter.uplink();
+    const LinkMode& downlink = linkAdapter.downlink();
+    strlcpy(audioLink.uplinkCodec, uplink.codec, sizeof(audioLink.uplinkCodec));
+    audioLink.uplinkRate = uplink.rate;
+    strlcpy(audioLink.downlinkCodec, downlink.codec, sizeof(audioLink.downlinkCodec));
+    audioLink.downlinkRate = downlink.rate;
+
+    int length = snprintf(linkReport, sizeof(linkReport), "up_kbps=%.0f,down_kbps=%.0f,rtt_ms=%.0f,rssi=%d,underruns=%u,switches=%u",
+                          linkAdapter.uplinkEstimate() * 8 / 1000, linkAdapter.downlinkEstimate() * 8 / 1000,
+                          linkAdapter.rttEstimate(), sample.rssiDbm, underruns, linkAdapter.switches());
+    if (audioLink.rtpPort != 0 && length > 0 && (size_t)length < sizeof(linkReport)) {
+        length += snprintf(linkReport + length, sizeof(linkReport) - length, ",concealed=%u,jitter_ms=%.0f",
+                           jitterBuffer->stats().concealed, jitterBuffer->jitterMs());
+    }
+    // The profile this turn played under, with its measurements since boot
+    const AudioProfileStats& profileStats = audioProfiles.stats(profile);
+    if (length > 0 && (size_t)length < sizeof(linkReport)) {
+        length += snprintf(linkReport + length, sizeof(linkReport) - length, ",profile=%s,latency_ms=%.0f,glitches_pm=%.1f",
+                           AUDIO_PROFILES[profile].name, profileStats.meanLatencyMs(), profileStats.glitchesPerMinute());
+    }
+    // Busiest window of each core since the turn started (see runVoiceTurn())
+    for (uint8_t core = 0; cpuProfiler != NULL && core < cpuProfiler->cores(); core++) {
+        if (length > 0 && (size_t)length < sizeof(linkReport)) {
+            length += snprintf(linkReport + length, sizeof(linkReport) - length, ",cpu%u_peak=%.0f",
+                               (unsigned)core, cpuProfiler->corePeak(core));
+        }
+    }
+    // Allocations in turns that should make none, for the server to alert on
+    if (heapTrackAvailable() && length > 0 && (size_t)length < sizeof(linkReport)) {
+        length += snprintf(linkReport + length, sizeof(linkReport) - length, ",heap_steady_allocs=%u",
+                           (unsigned)steadyHeapAllocations);
+    }
+    BINLOG("[LINK] %s -> up %s@%u, down %s@%u%s\n", linkReport, uplink.codec, uplink.rate,
+           downlink.codec, downlink.rate, switched ? " (switched)" : "");
+}
+
+// Switches to 'profile' between turns, with I2S stopped: reinstalls the I2S driver if the DMA
+// ring changes and hands the jitter buffer and the RTP socket their new limits. The capture read
+// and the prebuffer follow audioProfile as they are used.
+void applyAudioProfile(const AudioProfile& profile) {
+    const bool dmaChanged = profile.dmaBufferCount != audioProfile->dmaBufferCount ||
+                            profile.dmaBufferSamples != audioProfile->dmaBufferSamples;
+    audioProfile = &profile;
+    if (dmaChanged) {
+        i2s_driver_uninstall(I2S_PORT);
+        i2s_duplex_init();
+        i2s_stop(I2S_PORT);
+    }
+    jitterBuffer->setDelayRange(profile.jitterMinPackets, profile.jitterMaxPackets);
+    setRtpReceiveBuffer();
+}
+
+// Capability handshake: tells the server which codecs, rates and buffer sizes this firmware
+// supports and adopts the formats it picks. Keeps the protocol 1 defaults if the server
+// doesn't know the handshake. Also names this build, and takes the server's update offer.
+// Returns true if the server answered it.
+bool negotiateCapabilities() {
+    char caps[256];
+    int capsLength = snprintf(caps, sizeof(caps),
+        TRINITY_CAP_PROTOCOL "=%d\n"
+        TRINITY_CAP_CODECS "=" TRINITY_CODEC_PCM16 "," TRINITY_CODEC_ADPCM "\n"
+        TRINITY_CAP_RATES "=%u,%u\n"
+        TRINITY_CAP_FRAME_BYTES "=%u\n"
+        TRINITY_CAP_MAX_TEXT "=%u\n"
+        TRINITY_CAP_TRANSPORTS "=tcp," TRINITY_TRANSPORT_RTP "\n"
+        TRINITY_CAP_BUILD "=%s\n",
+        TRINITY_PROTOCOL_VERSION, (unsigned)CaptureFormat::RATE, (unsigned)LowRateFormat::RATE,
+        (unsigned)I2S_READ_CHUNK_SIZE, (unsigned)FRAME_PARSER_TEXT_MAX, firmwareBuild);
+    if (invalidBuild[0] != '\0') {
+        capsLength += snprintf(caps + capsLength, sizeof(caps) - capsLength, TRINITY_CAP_OTA_INVALID "=%s\n", invalidBuild);
+    }
+
+    char url[96];
+    serverUrl(url, sizeof(url), TRINITY_HELLO_PATH);
+    httpClient.begin(url);
+    httpClient.addHeader("Content-Type", TRINITY_CAPS_MIME);
+    httpClient.addHeader(TRINITY_DEVICE_ID_HEADER, device_id);
+    httpClient.setTimeout(HELLO_TIMEOUT_MS);
+    const int httpResponseCode = httpClient.POST((uint8_t*)caps, capsLength);
+    if (httpResponseCode != HTTP_CODE_OK) {
+        BINLOG("No capability handshake (HTTP %d), using %s@%u.\n", httpResponseCode, audioLink.uplinkCodec, audioLink.uplinkRate);
+        httpClient.end();
+        return false;
+    }
+    char reply[256];
+    strlcpy(reply, httpClient.getString().c_str(), sizeof(reply));
+    httpClient.end();
+
+    char* cursor = reply;
+    char* key;
+    char* value;
+    const char* codecs = TRINITY_CODEC_PCM16;
+    const char* rates = "16000";
+    offeredBuild[0] = '\0';
+    while (trinityNextCap(&cursor, &key, &value)) {
+        if (strcmp(key, TRINITY_CAP_CODECS) == 0) {
+            codecs = value;
+        } else if (strcmp(key, TRINITY_CAP_RATES) == 0) {
+            rates = value;
+        } else if (strcmp(key, TRINITY_CAP_UPLINK) == 0) {
+            trinityParseFormat(value, audioLink.uplinkCodec, sizeof(audioLink.uplinkCodec), &audioLink.uplinkRate);
+        } else if (strcmp(key, TRINITY_CAP_DOWNLINK) == 0) {
+            trinityParseFormat(value, audioLink.downlinkCodec, sizeof(audioLink.downlinkCodec), &audioLink.downlinkRate);
+        } else if (strcmp(key, TRINITY_CAP_MAX_UPLOAD) == 0) {
+            const size_t maxUpload = strtoul(value, NULL, 10) & ~(size_t)1; // Whole samples
+            if (maxUpload > 0) {
+                audioLink.maxUploadBytes = min(maxUpload, recordLimitBytes());
+            }
+        } else if (strcmp(key, TRINITY_CAP_RTP_PORT) == 0) {
+            audioLink.rtpPort = (uint16_t)strtoul(value, NULL, 10);
+        } else if (strcmp(key, TRINITY_CAP_OTA) == 0 && strcmp(value, firmwareBuild) != 0 && strcmp(value, invalidBuild) != 0) {
+            strlcpy(offeredBuild, value, sizeof(offeredBuild));
+        }
+    }
+    if (audioLink.rtpPort != 0 && !openRtpSocket()) {
+        BINLOG("RTP socket unavailable, audio stays on TCP.\n");
+        audioLink.rtpPort = 0;
+    }
+    // Link adaptation starts from the negotiated formats and stays within the common set
+    linkAdapter.allow(codecs, rates);
+    linkAdapter.start(audioLink.uplinkCodec, audioLink.uplinkRate, audioLink.downlinkCodec, audioLink.downlinkRate);
+    BINLOG("Negotiated uplink %s@%u, downlink %s@%u, max upload %u bytes, audio over %s.\n",
+           audioLink.uplinkCodec, audioLink.uplinkRate, audioLink.downlinkCodec, audioLink.downlinkRate,
+           (unsigned)audioLink.maxUploadBytes, audioLink.rtpPort ? "RTP" : "TCP");
+    if (offeredBuild[0] != '\0') {
+        BINLOG("Firmware update offered: %s -> %s.\n", firmwareBuild, offeredBuild);
+    }
+    return true;
+}
+
+// --- Network Self-Test ---
+// Diagnostic mode for "Trinity is slow" reports: connect-time RTT pings, then timed upload and
+// download bursts. Everything goes through the voice turn's own code: voiceExchange() and
+// HttpResponse, with reply bytes received into playbackRing. Each ping closes the voice
+// connection first, so it times a full TCP connect the way the first turn on a new connection
+// sees it; the bursts then reuse the kept-alive connection like warmed-up turns do.
+
+int compareFloats(const void* a, const void* b) {
+    const float x = *(const float*)a;
+    const float y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+// Sorts 'values' and returns the value at fraction p (0..1); 0 if there are none
+float percentile(float* values, int count, float p) {
+    if (count == 0) {
+        return 0;
+    }
+    qsort(values, count, sizeof(float), compareFloats);
+    return values[(int)(p * (count - 1) + 0.5f)];
+}
+
+// POSTs 'length' bytes of audioBuffer to the sink the way processVoiceCommand() uploads a
+// recording. Returns the goodput in bytes/s (0 if not measured); 'rttMs' gets the connect time
+// (0 if the connection was reused).
+float diagUpload(size_t length, float& rttMs) {
+    snprintf(voiceRequestHeaders, sizeof(voiceRequestHeaders),
+        "Content-Type: application/octet-stream\r\n" TRINITY_DEVICE_ID_HEADER ": %s\r\n", device_id);
+    LinkSample sample = {0, 0, 0, 0};
+    const int httpResponseCode = voiceExchange("POST", TRINITY_DIAG_SINK_PATH, voiceRequestHeaders, audioBuffer, length, sample);
+    rttMs = 0;
+    float bytesPerSec = 0;
+    if (httpResponseCode == HTTP_CODE_OK) {
+        // The sink's short answer, read to its end so the connection can be reused
+        while (readVoiceBody(voiceBodyChunk, sizeof(voiceBodyChunk)) >= 0) {
+            yield();
+        }
+        rttMs = sample.rttMs;
+        bytesPerSec = sample.uplinkBytesPerSec;
+    }
+    finishVoiceExchange();
+    return bytesPerSec;
+}
+
+// GETs 'length' bytes from the source and receives them the way a raw PCM reply is received:
+// straight from the socket into playbackRing's free space (never committed, so discarded).
+// Returns the goodput in bytes/s (0 if the burst failed).
+float diagDownload(size_t length) {
+    char path[48];
+    snprintf(path, sizeof(path), TRINITY_DIAG_SOURCE_PATH "?bytes=%u", (unsigned)length);
+    snprintf(voiceRequestHeaders, sizeof(voiceRequestHeaders), TRINITY_DEVICE_ID_HEADER ": %s\r\n", device_id);
+    LinkSample sample = {0, 0, 0, 0};
+    float bytesPerSec = 0;
+    if (voiceExchange("GET", path, voiceRequestHeaders, NULL, 0, sample) == HTTP_CODE_OK) {
+        playbackRing.reset();
+        size_t received = 0;
+        const uint32_t startMicros = micros();
+        for (;;) {
+            int bytesRead;
+            if (voicePendingOffset < voicePendingFill || voiceResponse.payloadRemaining() == 0) {
+                // Bytes that came with the head, or chunk framing
+                bytesRead = readVoiceBody(voiceBodyChunk, sizeof(voiceBodyChunk));
+            } else {
+                RingSpan spans[2];
+                const size_t count = playbackRing.writable(spans, SIZE_MAX);
+                bytesRead = receiveVoicePayload(spans, count, SIZE_MAX);
+            }
+            if (bytesRead < 0) {
+                break;
+            }
+            received += bytesRead;
+            yield(); // Prevent WDT reset
+        }
+        const uint32_t networkMicros = micros() - startMicros;
+        if (received == length && voiceResponse.bodyComplete() && networkMicros > 0) {
+            bytesPerSec = received * 1e6f / networkMicros;
+        }
+    }
+    finishVoiceExchange();
+    return bytesPerSec;
+}
+
+// Sends a self-test or update report (TRINITY_CAPS_MIME key=value lines) to the server's metrics
+void postReport(const char* path, const char* report, int length) {
+    char url[96];
+    serverUrl(url, sizeof(url), path);
+    httpClient.begin(url);
+    httpClient.addHeader("Content-Type", TRINITY_CAPS_MIME);
+    httpClient.addHeader(TRINITY_DEVICE_ID_HEADER, device_id);
+    httpClient.setTimeout(DIAG_TIMEOUT_MS);
+    httpClient.POST((uint8_t*)report, length);
+    httpClient.end();
+}
+
+// Runs the self-test, shows the results and reports them to the server's metrics
+void runNetworkSelfTest() {
+    BINLOG("Running network self-test...\n");
+    diagnosticsTitle = "NETWORK TEST";
+    float rtts[DIAG_PINGS];
+    float uploads[DIAG_BURSTS];
+    float downloads[DIAG_BURSTS];
+    int pings = 0, ups = 0, downs = 0;
+    float rttMs;
+
+    updateStatus(STATUS_DIAGNOSTICS, "Measuring RTT...");
+    for (int i = 0; i < DIAG_PINGS; i++) {
+        voiceClient.stop();     // A fresh connect each time
+        diagUpload(1, rttMs);
+        if (rttMs > 0) {
+            rtts[pings++] = rttMs;
+        }
+    }
+    if (pings == 0) {
+        char message[64];
+        snprintf(message, sizeof(message), "Server unreachable.\nRSSI %d dBm\n\nPress B2 to exit", WiFi.RSSI());
+        updateStatus(STATUS_DIAGNOSTICS, message);
+        return;
+    }
+
+    updateStatus(STATUS_DIAGNOSTICS, "Measuring upload...");
+    for (int i = 0; i < DIAG_BURSTS; i++) {
+        const float bytesPerSec = diagUpload(min(DIAG_UPLOAD_BYTES, AUDIO_BUFFER_CAPACITY), rttMs);
+        if (bytesPerSec > 0) {
+            uploads[ups++] = bytesPerSec;
+        }
+    }
+    updateStatus(STATUS_DIAGNOSTICS, "Measuring download...");
+    for (int i = 0; i < DIAG_BURSTS; i++) {
+        const float bytesPerSec = diagDownload(DIAG_DOWNLOAD_BYTES);
+        if (bytesPerSec > 0) {
+            downloads[downs++] = bytesPerSec;
+        }
+    }
+
+    const float upKbps = percentile(uploads, ups, 0.5f) * 8 / 1000;
+    const float downKbps = percentile(downloads, downs, 0.5f) * 8 / 1000;
+    const float rttP50 = percentile(rtts, pings, 0.5f);
+    const float rttP90 = percentile(rtts, pings, 0.9f);
+    const float rttMax = rtts[pings - 1];
+    const int rssi = WiFi.RSSI();
+
+    char results[128];
+    snprintf(results, sizeof(results), "Up   %.0f kbit/s\nDown %.0f kbit/s\nRTT  %.0f/%.0f/%.0f ms\n     (p50/p90/max)\nRSSI %d dBm\nPress B2 to exit",
+             upKbps, downKbps, rttP50, rttP90, rttMax, rssi);
+    updateStatus(STATUS_DIAGNOSTICS, results);
+    BINLOG("[DIAG] up %.0f kbit/s (%d bursts), down %.0f kbit/s (%d bursts), RTT p50 %.0f p90 %.0f max %.0f ms (%d pings), RSSI %d dBm\n",
+           upKbps, ups, downKbps, downs, rttP50, rttP90, rttMax, pings, rssi);
+
+    char report[160];
+    const int reportLength = snprintf(report, sizeof(report),
+        "up_kbps=%.0f\ndown_kbps=%.0f\nrtt_p50_ms=%.1f\nrtt_p90_ms=%.1f\nrtt_max_ms=%.1f\nrssi=%d\n",
+        upKbps, downKbps, rttP50, rttP90, rttMax, rssi);
+    postReport(TRINITY_DIAG_REPORT_PATH, report, reportLength);
+}
+
+// --- Audio Loopback Self-Test ---
+// Plays a chirp through the MAX98357A while the INMP441 records, then finds the chirp in the
+// recording (lib/audio_loopback). The latency is from handing the chirp to the I2S driver to
+// reading its echo back, both DMA rings included. The capture's frame count against the
+// microsecond clock gives the real sample rate: without the APLL the I2S clock is divided down
+// from a fixed PLL, so the rate can be off from nominal. The gain is the echo's level relative to
+// the chirp, so a dead speaker, a blocked microphone port or a low-gain build stands out.
+
+// Workspace carved from audioBuffer: the chirp, its shifted copies and the capture, each aligned
+const size_t LOOPBACK_WORKSPACE_BYTES = DSP_ALIGN + CaptureFormat::bytesFor(LOOPBACK_CHIRP_FRAMES)
+                                        + DSP_ALIGN + loopbackPhaseSamples(LOOPBACK_CHIRP_FRAMES) * sizeof(int16_t)
+                                        + DSP_ALIGN + CaptureFormat::bytesFor(LOOPBACK_CAPTURE_FRAMES);
+static_assert(LOOPBACK_WORKSPACE_BYTES <= AUDIO_BUFFER_CAPACITY, "The loopback test runs in audioBuffer");
+
+int16_t* alignedSamples(uint8_t*& cursor, size_t samples) {
+    int16_t* start = (int16_t*)(((uintptr_t)cursor + DSP_ALIGN - 1) & ~(uintptr_t)(DSP_ALIGN - 1));
+    cursor = (uint8_t*)(start + samples);
+    return start;
+}
+
+void runAudioSelfTest() {
+    BINLOG("Running audio loopback self-test...\n");
+    diagnosticsTitle = "AUDIO TEST";
+    updateStatus(STATUS_DIAGNOSTICS, "Chirp and echo...\nKeep quiet");
+    uint8_t* cursor = audioBuffer;
+    int16_t* chirp = alignedSamples(cursor, LOOPBACK_CHIRP_FRAMES);
+    int16_t* phases = alignedSamples(cursor, loopbackPhaseSamples(LOOPBACK_CHIRP_FRAMES));
+    int16_t* capture = alignedSamples(cursor, LOOPBACK_CAPTURE_FRAMES);
+    loopbackChirp(chirp, LOOPBACK_CHIRP_FRAMES, CaptureFormat::RATE, LOOPBACK_F0_HZ, LOOPBACK_F1_HZ, LOOPBACK_AMPLITUDE);
+    LoopbackCorrelator correlator;
+    correlator.begin(chirp, LOOPBACK_CHIRP_FRAMES, phases);
+
+    // Record throughout; once the lead-in is captured, keep the TX ring topped up with the chirp
+    const size_t leadFrames = CaptureFormat::framesForMs(LOOPBACK_LEAD_MS);
+    LoopbackRateFit rateFit;
+    size_t captured = 0;
+    size_t played = 0;
+    uint32_t queuedMicros = 0;
+    i2s_start_at(CaptureFormat::RATE);
+    while (captured < LOOPBACK_CAPTURE_FRAMES) {
+        if (captured >= leadFrames && played < LOOPBACK_CHIRP_FRAMES) {
+            size_t written = 0;
+            i2s_write(I2S_PORT, chirp + played, CaptureFormat::bytesFor(LOOPBACK_CHIRP_FRAMES - played), &written, 0);
+            if (played == 0 && written > 0) {
+                queuedMicros = micros();
+            }
+            played += CaptureFormat::framesIn(written);
+        }
+        size_t bytesRead = 0;
+        const size_t frames = min((size_t)audioProfile->dmaBufferSamples, LOOPBACK_CAPTURE_FRAMES - captured);
+        const uint32_t readStart = micros();
+        i2s_read(I2S_PORT, capture + captured, CaptureFormat::bytesFor(frames), &bytesRead, pdMS_TO_TICKS(100));
+        const uint32_t readEnd = micros();
+        if (bytesRead == 0) {
+            break; // The clock stopped
+        }
+        captured += CaptureFormat::framesIn(bytesRead);
+        // Only reads that waited mark the moment a DMA buffer completed
+        if (readEnd - readStart >= LOOPBACK_BLOCKED_US) {
+            rateFit.add(readEnd, captured);
+        }
+    }
+    i2s_stop(I2S_PORT);
+
+    const uint32_t correlateStart = micros();
+    const LoopbackMatch match = correlator.match(capture, captured);
+    const uint32_t correlateMs = (micros() - correlateStart) / 1000;
+    // Frame 'lag' was in hand once the read that brought frame lag + 1 returned
+    const float latencyMs = match.found ? (float)(rateFit.microsAt(match.lag + 1) - queuedMicros) / 1000 : 0;
+    const float rateHz = (float)rateFit.rate();
+    const float ratePpm = rateFit.errorPpm(CaptureFormat::RATE);
+
+    char results[160];
+    if (match.found) {
+        snprintf(results, sizeof(results), "Latency %.1f ms\nRate %.1f Hz\n     (%+.0f ppm)\nGain %.1f dB%s\nPress B2 to exit",
+                 latencyMs, rateHz, ratePpm, match.gainDb, match.inverted ? " (inv)" : "");
+    } else {
+        snprintf(results, sizeof(results), "No echo found.\nCheck speaker & mic.\nRate %.1f Hz\n     (%+.0f ppm)\nPress B2 to exit",
+                 rateHz, ratePpm);
+    }
+    updateStatus(STATUS_DIAGNOSTICS, results);
+    BINLOG("[DIAG] audio loopback: %s, latency %.2f ms, rate %.2f Hz (%+.0f ppm, %u points), gain %.1f dB%s, "
+           "peak %.1f dB over the correlation, correlated in %u ms\n",
+           match.found ? "echo found" : "no echo", latencyMs, rateHz, ratePpm, (unsigned)rateFit.points(), match.gainDb,
+           match.inverted ? " (inverted)" : "", match.peakDb, (unsigned)correlateMs);
+
+    char report[160];
+    int reportLength = snprintf(report, sizeof(report), "audio_found=%d\naudio_rate_hz=%.2f\naudio_rate_ppm=%.0f\n",
+                                match.found ? 1 : 0, rateHz, ratePpm);
+    if (match.found) {
+        reportLength += snprintf(report + reportLength, sizeof(report) - reportLength,
+                                 "audio_latency_ms=%.2f\naudio_gain_db=%.1f\naudio_peak_db=%.1f\n",
+                                 latencyMs, match.gainDb, match.peakDb);
+    }
+    postReport(TRINITY_DIAG_REPORT_PATH, report, reportLength);
+}
+
+// --- Firmware Update ---
+// The server offers a new build in the handshake; it is downloaded between turns into the other
+// app partition (partitions_ab.csv) as a package from lib/ota_image: a delta against this build
+// if the server still has it, compressed otherwise. The package is decoded as it arrives, straight
+// into flash, and a dropped connection resumes where it stopped with a Range request. The new
+// build boots on probation: the bootloader returns to this one if it crashes or resets first, and
+// it rolls itself back if it doesn't complete a handshake within OTA_CONFIRM_TIMEOUT_MS of
+// running outside the setup portal (where no handshake is possible).
+
+// Arduino's core marks an update valid as soon as it boots unless this says otherwise
+extern "C" bool verifyRollbackLater() {
+    return true;
+}
+
+// The start of an app's ELF SHA-256 in hex: the server names builds the same way
+void formatBuildId(const esp_app_desc_t& app, char* out) {
+    for (size_t i = 0; i < OTA_BUILD_ID_SIZE / 2; i++) {
+        snprintf(out + 2 * i, 3, "%02x", app.app_elf_sha256[i]);
+    }
+}
+
+// This build, whether it is an update's first boot, and the build last rolled back from
+void loadFirmwareState() {
+    const esp_partition_t* running = esp_ota_get_running_partition();
+    esp_app_desc_t app;
+    if (esp_ota_get_partition_description(running, &app) == ESP_OK) {
+        formatBuildId(app, firmwareBuild);
+    }
+    esp_ota_img_states_t state;
+    firmwareOnProbation = esp_ota_get_state_partition(running, &state) == ESP_OK && state == ESP_OTA_IMG_PENDING_VERIFY;
+    const esp_partition_t* invalid = esp_ota_get_last_invalid_partition();
+    if (invalid != NULL && esp_ota_get_partition_description(invalid, &app) == ESP_OK) {
+        formatBuildId(app, invalidBuild);
+    }
+    Serial.printf("Firmware %s in %s%s\n", firmwareBuild, running->label,
+                  firmwareOnProbation ? " (first boot of an update, on probation)" : "");
+    if (invalidBuild[0] != '\0') {
+        Serial.printf("Rolled back from %s\n", invalidBuild);
+    }
+}
+
+// The server answered this build's handshake: keep it
+void confirmFirmware() {
+    if (firmwareOnProbation && esp_ota_mark_app_valid_cancel_rollback() == ESP_OK) {
+        firmwareOnProbation = false;
+        BINLOG("Firmware %s confirmed.\n", firmwareBuild);
+    }
+}
+
+// On probation: retries the handshake, and rolls back once OTA_CONFIRM_TIMEOUT_MS passed without one.
+// The clock is stopped in the setup portal, so entering credentials never runs into it.
+void checkFirmwareProbation() {
+    if (!firmwareOnProbation || currentStatus == STATUS_LISTENING) {
+        return;
+    }
+    if (currentStatus == STATUS_WIFI_SETUP) {
+        probationStartMs = 0;
+        return;
+    }
+    if (probationStartMs == 0) {
+        probationStartMs = millis();
+    }
+    if (millis() - probationStartMs >= OTA_CONFIRM_TIMEOUT_MS) {
+        Serial.println("Update never reached the server. Rolling back...");
+        updateStatus(STATUS_UPDATING, "Rolling back...");
+        esp_ota_mark_app_invalid_rollback_and_reboot();
+    }
+    if (currentStatus == STATUS_CONNECTED && millis() - lastHandshakeMs >= OTA_CONFIRM_RETRY_MS) {
+        lastHandshakeMs = millis();
+        if (negotiateCapabilities()) {
+            confirmFirmware();
+        }
+    }
+}
+
+// The update partition, with the running image as the delta base
+class OtaPartitionTarget : public OtaTarget {
+public:
+    OtaPartitionTarget()
+        : _running(esp_ota_get_running_partition()), _update(esp_ota_get_next_update_partition(NULL)), _handle(0),
+          _started(false) {}
+
+    const esp_partition_t* update() const { return _update; }
+    esp_ota_handle_t handle() const { return _handle; }
+    bool started() const { return _started; }
+
+    bool baseCrc(uint32_t length, uint32_t* crc) override {
+        if (length > _running->size) {
+            return false;
+        }
+        uint8_t chunk[512];     // The decoder is working on voiceBodyChunk
+        uint32_t value = 0;
+        for (uint32_t at = 0; at < length; at += sizeof(chunk)) {
+            const size_t n = min((size_t)(length - at), sizeof(chunk));
+            if (esp_partition_read(_running, at, chunk, n) != ESP_OK) {
+                return false;
+            }
+            value = otaCrc32(value, chunk, n);
+        }
+        *crc = value;
+        return true;
+    }
+
+    bool start(const OtaHeader& header) override {
+        // Erased a sector at a time as the image is written, not all up front
+        _started = _update != NULL && header.imageBytes <= _update->size &&
+                   esp_ota_begin(_update, OTA_WITH_SEQUENTIAL_WRITES, &_handle) == ESP_OK;
+        return _started;
+    }
+
+    bool readBase(uint32_t offset, uint8_t* data, size_t length) override {
+        return esp_partition_read(_running, offset, data, length) == ESP_OK;
+    }
+
+    bool readImage(uint32_t offset, uint8_t* data, size_t length) override {
+        return esp_partition_read(_update, offset, data, length) == ESP_OK;
+    }
+
+    bool write(const uint8_t* data, size_t length) override {
+        return esp_ota_write(_handle, data, length) == ESP_OK;
+    }
+
+private:
+    const esp_partition_t* _running;
+    const esp_partition_t* _update;
+    esp_ota_handle_t _handle;
+    bool _started;
+};
+
+struct OtaDownload {
+    char url[128];
+    char etag[48];              // Of the package; resumed requests ask for the same one (If-Range)
+    uint32_t receivedBytes;     // Over the air, resumed requests included
+    uint8_t resumes;
+    int shownPercent;
+};
+
+enum OtaFetch {
+    OTA_FETCH_DROPPED,          // Connection failed, dropped or stalled: resume
+    OTA_FETCH_STOPPED,          // The decoder finished or failed
+    OTA_FETCH_REFUSED,          // No package, or (resuming) another one than before
+    OTA_FETCH_CANCELLED         // B2
+};
+
+void showOtaProgress(OtaDownload& download) {
+    const OtaHeader& header = otaDecoder->header();
+    const int percent = (int)((uint64_t)otaDecoder->decoded() * 100 / header.imageBytes);
+    if (percent == download.shownPercent) {
+        return;     // A redraw stalls the download for a few ms
+    }
+    download.shownPercent = percent;
+    char message[96];
+    snprintf(message, sizeof(message), "%s %u KB\nof a %u KB image\n%d%%\n\nB2: cancel",
+             (header.flags & OTA_FLAG_DELTA) ? "Delta" : "Package", (unsigned)(otaDecoder->packageBytes() / 1024),
+             (unsigned)(header.imageBytes / 1024), percent);
+    updateStatus(STATUS_UPDATING, message);
+}
+
+// One GET of the package, from where the decoder stopped, fed to the decoder as it arrives
+OtaFetch fetchOtaPackage(OtaDownload& download) {
+    httpClient.begin(download.url);
+    httpClient.addHeader(TRINITY_DEVICE_ID_HEADER, device_id);
+    httpClient.setTimeout(OTA_TIMEOUT_MS);
+    const bool resuming = otaDecoder->consumed() > 0;
+    if (resuming) {
+        char range[32];
+        snprintf(range, sizeof(range), "bytes=%u-", (unsigned)otaDecoder->consumed());
+        httpClient.addHeader("Range", range);
+        httpClient.addHeader("If-Range", download.etag);
+    }
+    static const char* headers[] = {"ETag"};
+    httpClient.collectHeaders(headers, 1);
+    const int httpResponseCode = httpClient.GET();
+    if (httpResponseCode <= 0) {
+        httpClient.end();
+        return OTA_FETCH_DROPPED;
+    }
+    if (httpResponseCode != (resuming ? HTTP_CODE_PARTIAL_CONTENT : HTTP_CODE_OK)) {
+        BINLOG("Update download refused (HTTP %d).\n", httpResponseCode);
+        httpClient.end();
+        return OTA_FETCH_REFUSED;
+    }
+    if (!resuming) {
+        strlcpy(download.etag, httpClient.header("ETag").c_str(), sizeof(download.etag));
+    }
+
+    WiFiClient* stream = httpClient.getStreamPtr();
+    unsigned long lastDataMs = millis();
+    OtaFetch result = OTA_FETCH_DROPPED;
+    while (otaDecoder->status() == OTA_MORE) {
+        if (digitalRead(PIN_BUTTON_SEND) == LOW) {
+            result = OTA_FETCH_CANCELLED;
+            break;
+        }
+        const size_t availableBytes = min((size_t)stream->available(), sizeof(voiceBodyChunk));
+        if (availableBytes == 0) {
+            if (!httpClient.connected() || millis() - lastDataMs >= OTA_STALL_MS) {
+                break;
+            }
+            delay(1);
+            continue;
+        }
+        const int bytesRead = stream->read(voiceBodyChunk, availableBytes);
+        if (bytesRead > 0) {
+            download.receivedBytes += bytesRead;
+            lastDataMs = millis();
+            otaDecoder->feed(voiceBodyChunk, bytesRead);
+            if (otaDecoder->headerRead()) {
+                showOtaProgress(download);
+            }
+        }
+    }
+    httpClient.end();
+    return otaDecoder->status() != OTA_MORE ? OTA_FETCH_STOPPED : result;
+}
+
+const char* otaResultName(OtaFetch fetch, OtaStatus status) {
+    switch (fetch) {
+        case OTA_FETCH_DROPPED: return "dropped";
+        case OTA_FETCH_REFUSED: return "refused";
+        case OTA_FETCH_CANCELLED: return "cancelled";
+        default: break;
+    }
+    switch (status) {
+        case OTA_DONE: return "ok";
+        case OTA_BAD_HEADER: return "bad_header";
+        case OTA_BASE_MISMATCH: return "base_mismatch";
+        case OTA_CORRUPT: return "corrupt";
+        case OTA_TARGET_FAILED: return "flash_failed";
+        case OTA_BAD_CRC: return "bad_crc";
+        default: return "incomplete";
+    }
+}
+
+// Downloads the offered build into the other app partition, reports the transfer and reboots into
+// it. Blocks for the download (B2 cancels it); a failed update is tried again after OTA_RETRY_MS.
+void runFirmwareUpdate() {
+    OtaPartitionTarget target;
+    if (target.update() == NULL || otaDecoder == NULL) {
+        BINLOG("No OTA partition to update into; flash partitions_ab.csv over USB once.\n");
+        offeredBuild[0] = '\0';
+        return;
+    }
+    BINLOG("Updating firmware %s -> %s into %s...\n", firmwareBuild, offeredBuild, target.update()->label);
+    updateStatus(STATUS_UPDATING, "Downloading...\n\nB2: cancel");
+
+    OtaDownload download = {};
+    char path[64];
+    snprintf(path, sizeof(path), TRINITY_OTA_IMAGE_PATH "?base=%s", firmwareBuild);
+    serverUrl(download.url, sizeof(download.url), path);
+    download.shownPercent = -1;
+    otaDecoder->begin(&target);
+    const unsigned long startMs = millis();
+    OtaFetch fetch;
+    while ((fetch = fetchOtaPackage(download)) == OTA_FETCH_DROPPED && download.resumes < OTA_MAX_RESUMES) {
+        download.resumes++;
+        BINLOG("Update download dropped at %u bytes; resuming (%u).\n", (unsigned)otaDecoder->consumed(), download.resumes);
+        delay(OTA_RESUME_DELAY_MS);
+    }
+
+    const char* result = otaResultName(fetch, otaDecoder->status());
+    if (otaDecoder->status() == OTA_DONE) {
+        // Checks the image (its own SHA-256) before it can be booted
+        if (esp_ota_end(target.handle()) != ESP_OK) {
+            result = "invalid_image";
+        } else if (esp_ota_set_boot_partition(target.update()) != ESP_OK) {
+            result = "flash_failed";
+        }
+    } else if (target.started()) {
+        esp_ota_abort(target.handle());
+    }
+    const uint32_t elapsedMs = millis() - startMs;
+    BINLOG("Update %s: %u bytes received for a %u byte image, %u resumes, %u ms.\n", result,
+           (unsigned)download.receivedBytes, (unsigned)otaDecoder->header().imageBytes, download.resumes, (unsigned)elapsedMs);
+
+    char report[160];
+    const int reportLength = snprintf(report, sizeof(report),
+        "build=%s\nresult=%s\nreceived_bytes=%u\nresumes=%u\nms=%u\n",
+        offeredBuild, result, (unsigned)download.receivedBytes, download.resumes, (unsigned)elapsedMs);
+    postReport(TRINITY_OTA_REPORT_PATH, report, reportLength);
+
+    if (strcmp(result, "ok") == 0) {
+        updateStatus(STATUS_UPDATING, "Restarting...");
+        delay(500);
+        ESP.restart();
+    }
+    otaFailedMs = millis();
+    updateStatus(STATUS_CONNECTED);
+}
+
 // This function sends the recorded audio data and handles the streaming audio response.
 void processVoiceCommand() {
     // 1. Check if we actually recorded anything before sending
     if (audioDataSize == 0) {
         updateStatus(STATUS_CONNECTED, "No audio recorded.");
-        Serial.println("Error: No audio data to send.");
+        BINLOG("Error: No audio data to send.\n");
         return;
     }
 
     updateStatus(STATUS_THINKING);
 
-    // 2. Prepare HTTP Client
-    httpClient.begin(SERVER_URL);
-    // CRITICAL: Ensure Content-Type is correct for raw PCM audio data
-    httpClient.addHeader("Content-Type", "application/octet-stream");
+    // RTP turns already streamed the recording; the request only names the stream
+    const bool rtpTurn = audioLink.rtpPort != 0;
+    char rtpStream[64];
+    if (rtpTurn) {
+        sendRtpUplink(true);
+        snprintf(rtpStream, sizeof(rtpStream), "ssrc=%u,seq=%u,packets=%u",
+                 rtpUplink.ssrc(), rtpUplink.firstSequence(), rtpUplink.packets());
+    }
+
+    // Encode the recording in place for the current uplink format
+    size_t bodySize = rtpTurn ? 0 : audioDataSize;
+    if (!rtpTurn && strcmp(audioLink.uplinkCodec, TRINITY_CODEC_ADPCM) == 0) {
+        AdpcmState state = {0, 0};
+        bodySize = adpcmEncode<Mono16>(ConstFrameSpan<Mono16>::fromBytes(audioBuffer, audioDataSize), audioBuffer, state);
+    }
+
+    // 2. Request headers (the request line, Host and Content-Length are added by voiceExchange())
+    // CRITICAL: Content-Type must be octet-stream for the raw audio data
+    snprintf(voiceRequestHeaders, sizeof(voiceRequestHeaders),
+        "Content-Type: application/octet-stream\r\n"
+        TRINITY_FORMAT_HEADER ": %s@%u\r\n"
+        TRINITY_DOWNLINK_HEADER ": %s@%u\r\n"
+        // Identifies this device so the server can keep its conversation history
+        TRINITY_DEVICE_ID_HEADER ": %s\r\n"
+        // Tell the server how long we will wait, so it can hedge/fail fast instead of timing us out
+        TRINITY_DEADLINE_HEADER ": %u\r\n"
+        // Ask for text, timing and control frames around the audio. Servers without framing
+        // send raw PCM and the control opcodes in a response header.
+        "Accept: " TRINITY_FRAMES_MIME ", application/octet-stream\r\n"
+        "%s%s%s%s%s%s",
+        audioLink.uplinkCodec, audioLink.uplinkRate, audioLink.downlinkCodec, audioLink.downlinkRate,
+        device_id, SERVER_TIMEOUT_MS,
+        linkReport[0] ? TRINITY_LINK_HEADER ": " : "", linkReport, linkReport[0] ? "\r\n" : "",
+        rtpTurn ? TRINITY_RTP_HEADER ": " : "", rtpTurn ? rtpStream : "", rtpTurn ? "\r\n" : "");
     
     // 3. Send the actual recorded audio data
-    Serial.printf("Uploading %u bytes of audio data...\n", audioDataSize);
-    int httpResponseCode = httpClient.sendRequest("POST", (uint8_t*)audioBuffer, audioDataSize);
-    
+    if (rtpTurn) {
+        BINLOG("Sent %u RTP packets of %s audio data (%s).\n", rtpUplink.packets(), audioLink.uplinkCodec, rtpStream);
+    } else {
+        BINLOG("Uploading %u bytes of %s audio data...\n", bodySize, audioLink.uplinkCodec);
+    }
+    // Link measurements for this turn (0 = not measured)
+    LinkSample linkSample = {0, 0, 0, 0};
+    uint32_t underruns = 0;
+    AudioProfileTurn playback = {0, 0, 0, 0, 0};
+    int httpResponseCode = voiceExchange("POST", TRINITY_VOICE_PATH, voiceRequestHeaders, audioBuffer, bodySize, linkSample);
+
+    if (rtpTurn && httpResponseCode == HTTP_CODE_UNPROCESSABLE_ENTITY) {
+        // None of the datagrams got through (UDP filtered?): resend this turn over TCP, and
+        // keep using TCP until the next handshake
+        BINLOG("RTP uplink never arrived, falling back to TCP.\n");
+        finishVoiceExchange();
+        audioLink.rtpPort = 0;
+        closeRtpSocket();
+        processVoiceCommand();
+        return;
+    }
+
     // Clear the buffer size immediately after sending to be ready for next command
     audioDataSize = 0; 
 
     if (httpResponseCode > 0) {
         // 4. Handle Audio Response Stream
-        if (httpResponseCode == HTTP_CODE_OK) {
-            updateStatus(STATUS_SPEAKING, "Response received.");
-            i2s_playback_start();
-            
-            WiFiClient* stream = httpClient.getStreamPtr();
-            size_t bytes_written = 0;
-            size_t availableBytes = 0;
-            uint8_t dummy_audio_data[I2S_READ_CHUNK_SIZE] = {0}; // Reuse chunk buffer for incoming data
-            
-            // Read until the stream closes or times out
-            while (httpClient.connected() || stream->available()) {
-                if (stream->available()) {
-                    availableBytes = stream->available();
-                    if (availableBytes > 0) {
-                        // Read chunks of data
-                        int bytesRead = stream->readBytes((char*)dummy_audio_data, min(availableBytes, I2S_READ_CHUNK_SIZE));
-                        if (bytesRead > 0) {
-                            // Write PCM audio data to the I2S DAC (MAX98357A)
-                            i2s_write(I2S_PORT, dummy_audio_data, bytesRead, &bytes_written, portMAX_DELAY);
-                        }
-                    }
-                }
-                yield(); // Prevent WDT reset
-            }
-            
-            // Playback complete
-            i2s_stop(I2S_PORT);
-            updateStatus(STATUS_CONNECTED); // Return to READY state
-
+        if (httpResponseCode == HTTP_CODE_OK && strncmp(voiceContentType, TRINITY_FRAMES_MIME, strlen(TRINITY_FRAMES_MIME)) == 0) {
+            playFramedResponse(linkSample, underruns, playback);
+        } else if (httpResponseCode == HTTP_CODE_OK && !executeControlOpcodes(voiceControl)) {
+            // "stop": nothing to play
+            updateStatus(STATUS_CONNECTED);
+        } else if (httpResponseCode == HTTP_CODE_OK) {
+            playRawResponse();
         } else if (httpResponseCode == HTTP_CODE_NOT_ACCEPTABLE) {
             updateStatus(STATUS_ERROR, "Server Error: No Speech Detected.");
             delay(3000); 
         } else {
             // Error response from server (e.g., 500)
-            updateStatus(STATUS_ERROR, (String("HTTP Error: ") + String(httpResponseCode)).c_str());
+            char message[32];
+            snprintf(message, sizeof(message), "HTTP Error: %d", httpResponseCode);
+            updateStatus(STATUS_ERROR, message);
             delay(3000); 
         }
     } else {
@@ -577,18 +2279,331 @@ void processVoiceCommand() {
         delay(3000);
     }
     
-    httpClient.end();
+    finishVoiceExchange();
+    updateLinkAdaptation(linkSample, underruns, playback);
 }
 
+// Runs one voice turn with its heap use counted. Once a turn reuses the previous turn's
+// connection it should allocate nothing; an allocation there is a regression (a String, a new,
+// a driver reinstall) that fragments the heap over a long uptime, so it is logged and counted
+// in steadyHeapAllocations, which the link report carries to the server's metrics. The turn's
+// peak core load is logged under the server's trace ID. A change of audio profile reinstalls
+// the I2S driver, so it is applied after the counted part.
+void runVoiceTurn() {
+    const bool steadyState = voiceTurns > 0 && voiceClient.connected();
+    if (cpuProfiler != NULL) {
+        cpuProfiler->markPeak();
+    }
+    heapTrackBegin();
+    processVoiceCommand();
+    const HeapTrackStats heap = heapTrackEnd();
+    voiceTurns++;
+    if (&audioProfiles.profile() != audioProfile) {
+        const AudioProfileStats& stats = audioProfiles.stats(audioProfile - AUDIO_PROFILES);
+        BINLOG("[PROFILE] %s (%.0f ms latency, %.1f glitches/min over %u turns) -> %s\n", audioProfile->name,
+               stats.meanLatencyMs(), stats.glitchesPerMinute(), stats.turns, audioProfiles.profile().name);
+        applyAudioProfile(audioProfiles.profile());
+    }
+    if (cpuProfiler != NULL) {
+        BINLOG("[CPU] Turn %u (trace %s): peak core0 %.0f%%, core1 %.0f%%\n", voiceTurns,
+               voiceTraceId[0] ? voiceTraceId : "-", cpuProfiler->corePeak(0), cpuProfiler->corePeak(1));
+    }
+    if (!heapTrackAvailable()) {
+        return;
+    }
+    if (steadyState && heap.allocations > 0) {
+        steadyHeapAllocations += heap.allocations;
+        BINLOG("[HEAP] Warning: turn %u made %u allocations (%u bytes) on a reused connection\n",
+               voiceTurns, heap.allocations, heap.bytes);
+    } else {
+        BINLOG("[HEAP] Turn %u: %u allocations (%u bytes), %u frees\n", voiceTurns, heap.allocations, heap.bytes, heap.frees);
+    }
+}
 
 // =================================================================================================
-// 8. CORE SETUP AND LOOP
+// 8. MEMORY PLAN
+// Every major buffer, the region it lives in and its size. The totals are checked against the
+// budgets in section 1 when compiling, so a buffer that outgrows its region (or a large one
+// declared in internal RAM) fails the build instead of crashing in the field.
 // =================================================================================================
 
+enum MemoryRegion {
+    MEMORY_DRAM,            // Internal RAM, static (.bss/.data)
+    MEMORY_INTERNAL_HEAP,   // Internal RAM taken from the heap at boot
+    MEMORY_PSRAM,           // External RAM, allocated at boot
+    MEMORY_FLASH            // Constant data read straight from flash
+};
+
+struct BufferPlan {
+    const char* name;
+    MemoryRegion region;
+    size_t bytes;
+};
+
+constexpr BufferPlan MEMORY_PLAN[] = {
+    {"audioBuffer", MEMORY_PSRAM, AUDIO_BUFFER_CAPACITY},
+    {"jitterBuffer", MEMORY_PSRAM, sizeof(JitterBuffer)},
+    {"binlog ring", MEMORY_PSRAM, BINLOG_RING_BYTES},
+    {"playback ring", MEMORY_PSRAM, PLAYBACK_RING_BYTES},
+    {"voiceRequestHeaders", MEMORY_DRAM, sizeof(voiceRequestHeaders)},
+    {"voiceRequestHead", MEMORY_DRAM, sizeof(voiceRequestHead)},
+    {"voiceHeadChunk", MEMORY_DRAM, sizeof(voiceHeadChunk)},
+    {"voiceBodyChunk", MEMORY_DRAM, sizeof(voiceBodyChunk)},
+    {"voiceResponse", MEMORY_DRAM, sizeof(voiceResponse)},
+    {"outputChain", MEMORY_DRAM, sizeof(outputChain)},
+    {"voice header values", MEMORY_DRAM, sizeof(voiceContentType) + sizeof(voiceControl) + sizeof(voiceTraceId)},
+    {"linkReport", MEMORY_DRAM, sizeof(linkReport)},
+    {"audioProfiles", MEMORY_DRAM, sizeof(audioProfiles)},
+    {"configStore", MEMORY_DRAM, sizeof(configStore)},
+    {"rtpUplink", MEMORY_DRAM, sizeof(rtpUplink)},
+    {"rtpPacket", MEMORY_DRAM, sizeof(rtpPacket)},
+    {"binlog drain record", MEMORY_DRAM, sizeof(BINLOG_SYNC) + BINLOG_MAX_RECORD},
+    {"CPU tick samples", MEMORY_DRAM, sizeof(tickSamples)},
+    {"cpuProfiler", MEMORY_PSRAM, sizeof(CpuProfiler)},
+    {"otaDecoder", MEMORY_PSRAM, sizeof(OtaDecoder)},
+    {"CPU task snapshot", MEMORY_PSRAM, CPU_PROFILE_MAX_TASKS * sizeof(TaskStatus_t)},
+    {"I2S DMA rings (TX + RX)", MEMORY_INTERNAL_HEAP, 2 * AMP_DMA_MAX_BYTES},
+    {"OLED frame buffer", MEMORY_INTERNAL_HEAP, SCREEN_WIDTH * SCREEN_HEIGHT / 8},
+    {"binlog drain stack", MEMORY_INTERNAL_HEAP, BINLOG_DRAIN_STACK_BYTES},
+    {"portal page (gzip)", MEMORY_FLASH, WIFI_PORTAL_INDEX_GZ_BYTES},
+};
+const size_t MEMORY_PLAN_ENTRIES = sizeof(MEMORY_PLAN) / sizeof(MEMORY_PLAN[0]);
+
+// Total and largest entry of a region (recursive: C++11 constexpr functions are one expression)
+constexpr size_t plannedBytes(MemoryRegion region, size_t i = 0) {
+    return i == MEMORY_PLAN_ENTRIES ? 0
+         : (MEMORY_PLAN[i].region == region ? MEMORY_PLAN[i].bytes : 0) + plannedBytes(region, i + 1);
+}
+constexpr size_t largestPlanned(MemoryRegion region, size_t i = 0) {
+    return i == MEMORY_PLAN_ENTRIES ? 0
+         : (MEMORY_PLAN[i].region == region && MEMORY_PLAN[i].bytes > largestPlanned(region, i + 1))
+           ? MEMORY_PLAN[i].bytes : largestPlanned(region, i + 1);
+}
+
+// The deepest point of a voice turn on the loop task's stack: processVoiceCommand() ->
+// playFramedResponse() (parser and sink) -> playRtpStream() (one packet of PCM) -> i2s_write()
+// or lwIP. Everything else on the way is scalars and small arrays, covered by the reserve.
+constexpr size_t VOICE_TURN_STACK_BYTES = sizeof(FrameParser) + sizeof(PlaybackSink) + RTP_MAX_PAYLOAD
+                                          + STACK_CALL_RESERVE_BYTES;
+
+static_assert(plannedBytes(MEMORY_DRAM) <= DRAM_STATIC_BUDGET, "Internal RAM buffers exceed DRAM_STATIC_BUDGET");
+static_assert(largestPlanned(MEMORY_DRAM) <= DRAM_BUFFER_MAX_BYTES, "Buffer too large for internal RAM; plan it in PSRAM");
+static_assert(plannedBytes(MEMORY_INTERNAL_HEAP) <= INTERNAL_HEAP_BUDGET, "Boot-time internal heap use exceeds INTERNAL_HEAP_BUDGET");
+static_assert(plannedBytes(MEMORY_PSRAM) <= PSRAM_BUDGET, "PSRAM buffers exceed PSRAM_BUDGET");
+static_assert(plannedBytes(MEMORY_FLASH) <= FLASH_LITERAL_BUDGET, "Flash literals exceed FLASH_LITERAL_BUDGET");
+static_assert(VOICE_TURN_STACK_BYTES <= LOOP_TASK_STACK_BYTES, "A voice turn can overflow the loop task's stack");
+static_assert(BINLOG_DRAIN_STACK_BYTES >= STACK_CALL_RESERVE_BYTES, "The binlog drain task's stack is below the call reserve");
+
+// The loop task's stack is the one the voice turn was checked against
+SET_LOOP_TASK_STACK_SIZE(LOOP_TASK_STACK_BYTES);
+
+// Boot-time allocation of a MEMORY_PSRAM buffer, 16-byte aligned so the DSP kernels take their
+// vector path over it (the output chain runs on the playback ring). Falls back to internal RAM
+// on boards without PSRAM, which only works for the small ones.
+void* allocatePsram(const char* name, size_t bytes) {
+    void* buffer = heap_caps_aligned_alloc(DSP_ALIGN, bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (buffer == NULL) {
+        buffer = heap_caps_aligned_alloc(DSP_ALIGN, bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (buffer != NULL) {
+            Serial.printf("No PSRAM for %s; using %u bytes of internal RAM.\n", name, (unsigned)bytes);
+        }
+    }
+    return buffer;
+}
+
+// Prints the plan's totals next to what the heaps have left after setup()
+void reportMemoryPlan() {
+    Serial.printf("Memory plan: DRAM %u/%u, internal heap %u/%u, PSRAM %u/%u, flash literals %u/%u bytes; "
+                  "voice turn stack %u/%u\n",
+                  (unsigned)plannedBytes(MEMORY_DRAM), (unsigned)DRAM_STATIC_BUDGET,
+                  (unsigned)plannedBytes(MEMORY_INTERNAL_HEAP), (unsigned)INTERNAL_HEAP_BUDGET,
+                  (unsigned)plannedBytes(MEMORY_PSRAM), (unsigned)PSRAM_BUDGET,
+                  (unsigned)plannedBytes(MEMORY_FLASH), (unsigned)FLASH_LITERAL_BUDGET,
+                  (unsigned)VOICE_TURN_STACK_BYTES, (unsigned)LOOP_TASK_STACK_BYTES);
+    Serial.printf("Free heap: internal %u (largest block %u), PSRAM %u\n",
+                  (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+                  (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL),
+                  (unsigned)heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+}
+
+// =================================================================================================
+// 9. CORE SETUP AND LOOP
+// =================================================================================================
+
+// Writes BINLOG() records to the serial port, each behind the sync bytes. Runs at low priority,
+// so a burst of records costs the audio path nothing but ring space.
+void binlogDrainTask(void*) {
+    static uint8_t record[sizeof(BINLOG_SYNC) + BINLOG_MAX_RECORD];
+    memcpy(record, BINLOG_SYNC, sizeof(BINLOG_SYNC));
+    for (;;) {
+        size_t length;
+        while ((length = binlog.read(record + sizeof(BINLOG_SYNC))) > 0) {
+            Serial.write(record, sizeof(BINLOG_SYNC) + length);
+        }
+        vTaskDelay(pdMS_TO_TICKS(BINLOG_DRAIN_MS));
+    }
+}
+
+void startBinLog() {
+    size_t capacity = BINLOG_RING_BYTES;
+    uint8_t* ring = (uint8_t*)heap_caps_malloc(capacity, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (ring == NULL) {
+        capacity = BINLOG_FALLBACK_BYTES;
+        ring = (uint8_t*)heap_caps_malloc(capacity, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    if (ring == NULL) {
+        Serial.println("No memory for the log ring; BINLOG() output is discarded.");
+        return;
+    }
+    binlog.begin(ring, capacity);
+    xTaskCreatePinnedToCore(binlogDrainTask, "binlog", BINLOG_DRAIN_STACK_BYTES, NULL, BINLOG_DRAIN_PRIORITY, NULL, BINLOG_DRAIN_CORE);
+}
+
+// Counts the tick against the task it interrupted. The samples stand in for run-time stats
+// where the SDK is built without them; the task changes between ticks are a lower bound of the
+// context switches either way. A slot, once taken, stays with its task handle.
+void IRAM_ATTR cpuProfileTick() {
+    TickSamples& samples = tickSamples[xPortGetCoreID()];
+    const TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    samples.ticks++;
+    if (task != samples.last) {
+        samples.switches++;
+        samples.last = task;
+    }
+    for (size_t slot = 0; slot < CPU_PROFILE_TICK_SLOTS; slot++) {
+        if (samples.tasks[slot] == task) {
+            samples.counts[slot]++;
+            return;
+        }
+        if (samples.tasks[slot] == NULL) {
+            samples.counts[slot] = 1;
+            samples.tasks[slot] = task;
+            return;
+        }
+    }
+}
+
+const TaskStatus_t* findTaskStatus(TaskHandle_t task, UBaseType_t count) {
+    for (UBaseType_t i = 0; i < count; i++) {
+        if (cpuTaskSnapshot[i].xHandle == task) {
+            return &cpuTaskSnapshot[i];
+        }
+    }
+    return NULL;
+}
+
+// The core whose idle task this is, else the one the task is pinned to
+uint8_t taskStatusCore(const TaskStatus_t& status) {
+    for (UBaseType_t core = 0; core < portNUM_PROCESSORS; core++) {
+        if (status.xHandle == xTaskGetIdleTaskHandleForCPU(core)) {
+            return core;
+        }
+    }
+#if configTASKLIST_INCLUDE_COREID
+    if (status.xCoreID >= 0 && status.xCoreID < portNUM_PROCESSORS) {
+        return (uint8_t)status.xCoreID;
+    }
+#endif
+    return CPU_PROFILE_ANY_CORE;
+}
+
+// Once per window, in the esp_timer task
+void sampleCpuProfile(void*) {
+    static uint32_t lastClock[portNUM_PROCESSORS];
+    uint32_t totalRunTime = 0;
+    const UBaseType_t count = uxTaskGetSystemState(cpuTaskSnapshot, CPU_PROFILE_MAX_TASKS, &totalRunTime);
+    uint32_t elapsed[portNUM_PROCESSORS];
+    uint32_t switches[portNUM_PROCESSORS];
+
+    cpuProfiler->beginSample();
+#if CPU_PROFILE_RUN_TIME_STATS
+    // Microseconds run per task; each core's clock is the total
+    for (UBaseType_t i = 0; i < count; i++) {
+        const TaskStatus_t& status = cpuTaskSnapshot[i];
+        const uint8_t core = taskStatusCore(status);
+        cpuProfiler->addTask((uintptr_t)status.xHandle, status.pcTaskName, core,
+                             core != CPU_PROFILE_ANY_CORE && status.xHandle == xTaskGetIdleTaskHandleForCPU(core),
+                             status.ulRunTimeCounter);
+    }
+#endif
+    for (UBaseType_t core = 0; core < portNUM_PROCESSORS; core++) {
+        const TickSamples& samples = tickSamples[core];
+#if CPU_PROFILE_RUN_TIME_STATS
+        const uint32_t clock = totalRunTime;
+#else
+        // Ticks per task and core; tasks deleted since are left out
+        const TaskHandle_t idle = xTaskGetIdleTaskHandleForCPU(core);
+        for (size_t slot = 0; slot < CPU_PROFILE_TICK_SLOTS && samples.tasks[slot] != NULL; slot++) {
+            const TaskStatus_t* status = findTaskStatus(samples.tasks[slot], count);
+            if (status != NULL) {
+                cpuProfiler->addTask((uintptr_t)status->xHandle, status->pcTaskName, core, status->xHandle == idle,
+                                     samples.counts[slot]);
+            }
+        }
+        const uint32_t clock = samples.ticks;
+#endif
+        elapsed[core] = clock - lastClock[core];
+        lastClock[core] = clock;
+        switches[core] = samples.switches;
+    }
+    cpuProfiler->endSample(elapsed, switches);
+
+    if (cpuProfiler->samples() % CPU_PROFILE_LOG_WINDOWS == 0) {
+        char summary[BINLOG_MAX_STRING];
+        cpuProfiler->format(summary, sizeof(summary));
+        BINLOG("[CPU] %s\n", summary);
+    }
+}
+
+// Samples task and core load once per CPU_PROFILE_WINDOW_MS from an esp_timer (no task of its own)
+void startCpuProfiler() {
+    void* memory = allocatePsram("cpuProfiler", sizeof(CpuProfiler));
+    cpuTaskSnapshot = (TaskStatus_t*)allocatePsram("CPU task snapshot", CPU_PROFILE_MAX_TASKS * sizeof(TaskStatus_t));
+    if (memory == NULL || cpuTaskSnapshot == NULL) {
+        Serial.println("No memory for the CPU profiler.");
+        return;
+    }
+    CpuProfiler* profiler = new (memory) CpuProfiler();
+    profiler->begin(portNUM_PROCESSORS, CPU_PROFILE_WINDOW_MS, cpuWaitSites, sizeof(cpuWaitSites) / sizeof(cpuWaitSites[0]));
+    for (UBaseType_t core = 0; core < portNUM_PROCESSORS; core++) {
+        esp_register_freertos_tick_hook_for_cpu(cpuProfileTick, core);
+    }
+    esp_timer_create_args_t timer = {};
+    timer.callback = sampleCpuProfile;
+    timer.name = "cpu_profile";
+    esp_timer_handle_t handle;
+    if (esp_timer_create(&timer, &handle) != ESP_OK) {
+        Serial.println("No timer for the CPU profiler.");
+        return;
+    }
+    cpuProfiler = profiler;
+    esp_timer_start_periodic(handle, (uint64_t)CPU_PROFILE_WINDOW_MS * 1000);
+    Serial.printf("CPU profiler: %s, %u ms windows\n",
+                  CPU_PROFILE_RUN_TIME_STATS ? "FreeRTOS run-time stats" : "tick sampling", (unsigned)CPU_PROFILE_WINDOW_MS);
+}
+
+uint32_t cpuCycles() {
+    return ESP.getCycleCount();
+}
+
+// Checks the DSP kernels' PIE paths against their scalar references (a kernel that disagrees
+// falls back to the reference) and logs cycles per sample for each
+void checkDspKernels() {
+    static_assert(sizeof(voiceBodyChunk) >= DSP_SELF_TEST_BYTES, "voiceBodyChunk is the DSP self-test workspace");
+    DspKernelResult results[DSP_KERNEL_COUNT + 1];
+    const size_t count = dspSelfTest(cpuCycles, voiceBodyChunk, sizeof(voiceBodyChunk), results, DSP_KERNEL_COUNT + 1);
+    for (size_t i = 0; i < count; i++) {
+        Serial.printf("DSP %s: %.2f cycles/sample (scalar %.2f)%s%s\n", results[i].name, results[i].fastPerSample,
+                      results[i].refPerSample, results[i].vectorized && DSP_KERNELS_PIE ? ", PIE" : "",
+                      results[i].exact ? "" : ", MISMATCH: using the scalar reference");
+    }
+}
+
 void setup() {
     // 1. Initialize System
     Serial.begin(115200);
     delay(100);
+    startBinLog();
     
     // 2. LED/Display Init
     rgbLed.begin();
@@ -600,6 +2615,19 @@ void setup() {
         for (;;); // Loop indefinitely if display fails
     }
     updateStatus(STATUS_INITIALIZING);
+
+    // 2b. Large buffers (see the memory plan)
+    audioBuffer = (uint8_t*)allocatePsram("audioBuffer", AUDIO_BUFFER_CAPACITY);
+    void* jitterMemory = allocatePsram("jitterBuffer", sizeof(JitterBuffer));
+    uint8_t* playbackStorage = (uint8_t*)allocatePsram("playback ring", PLAYBACK_RING_BYTES);
+    if (audioBuffer == NULL || jitterMemory == NULL || !playbackRing.begin(playbackStorage, PLAYBACK_RING_BYTES)) {
+        Serial.println("Audio buffers do not fit. Check the PSRAM settings.");
+        updateStatus(STATUS_ERROR, "No PSRAM");
+        for (;;); // Nothing works without them
+    }
+    jitterBuffer = new (jitterMemory) JitterBuffer();
+    void* otaMemory = allocatePsram("otaDecoder", sizeof(OtaDecoder));
+    otaDecoder = otaMemory != NULL ? new (otaMemory) OtaDecoder() : NULL; // No updates without it
     
     // 3. GPIO Setup (Buttons)
     pinMode(PIN_BUTTON_WAKE, INPUT_PULLUP);
@@ -613,16 +2641,32 @@ void setup() {
     }
     ESP_ERROR_CHECK(ret);
 
-    // 5. Load Wi-Fi Credentials
-    if (!loadCredentials()) {
+    // 4b. Device configuration (one NVS read), and what it sets up: the volume, the recording
+    // limit and the audio profile (the device's, or automatic starting from "balanced")
+    loadConfig();
+    const DeviceConfig& config = configStore.current();
+    setPlaybackVolume(config.volume);
+    audioLink.maxUploadBytes = recordLimitBytes();
+    const bool automaticProfile = strcmp(config.audioProfile, AUDIO_PROFILE_AUTO) == 0;
+    audioProfiles.start(automaticProfile ? (size_t)AUDIO_PROFILE_BALANCED : audioProfileFind(config.audioProfile), automaticProfile);
+    audioProfile = &audioProfiles.profile();
+    jitterBuffer->setDelayRange(audioProfile->jitterMinPackets, audioProfile->jitterMaxPackets);
+    Serial.printf("Audio profile: %s%s\n", audioProfile->name, automaticProfile ? " (automatic)" : "");
+
+    // 4c. Firmware build, and whether this is an update's first boot
+    loadFirmwareState();
+
+    // 5. Wi-Fi credentials (from the configuration)
+    const bool wifiCredentialsSaved = config.ssid[0] != '\0';
+    if (!wifiCredentialsSaved) {
         Serial.println("Starting AP for Wi-Fi configuration...");
         setupAP();
     }
 
     // 6. Connect to Wi-Fi (if credentials exist)
     if (wifiCredentialsSaved) {
-        Serial.printf("Connecting to %s...\n", saved_ssid);
-        WiFi.begin(saved_ssid, saved_pass);
+        Serial.printf("Connecting to %s...\n", config.ssid);
+        WiFi.begin(config.ssid, config.pass);
 
         // Wait for connection (15 seconds)
         unsigned long startAttemptTime = millis();
@@ -635,6 +2679,11 @@ void setup() {
 
         if (WiFi.status() == WL_CONNECTED) {
             Serial.printf("\nConnected! IP: %s\n", WiFi.localIP().toString().c_str());
+            strlcpy(device_id, WiFi.macAddress().c_str(), sizeof(device_id));
+            if (negotiateCapabilities()) {
+                confirmFirmware();
+            }
+            lastHandshakeMs = millis();
             updateStatus(STATUS_CONNECTED);
         } else {
             Serial.println("\nFailed to connect. Starting AP mode.");
@@ -644,59 +2693,110 @@ void setup() {
         }
     }
     
-    // 7. Initialize I2S
-    // We only call one init function here to ensure the I2S driver is initially loaded. 
-    i2s_mic_init(); 
+    // 7. Initialize I2S (with the audio profile's DMA ring)
+    i2s_duplex_init();
     i2s_stop(I2S_PORT); // Start stopped, will be enabled only when needed
+
+    // 8. Voice connection: the response headers the turns look at, and the allocation check
+    voiceResponse.watch("Content-Type", voiceContentType, sizeof(voiceContentType));
+    voiceResponse.watch(TRINITY_CONTROL_HEADER, voiceControl, sizeof(voiceControl));
+    voiceResponse.watch(TRINITY_TRACE_ID_HEADER, voiceTraceId, sizeof(voiceTraceId));
+    httpClient.setReuse(false); // Reports and updates: one request each, nothing kept open
+    if (!heapTrackAvailable()) {
+        Serial.println("Heap tracking unavailable (built without the --wrap linker flags).");
+    }
+
+    // 9. DSP kernels, CPU profiler
+    checkDspKernels();
+    startCpuProfiler();
+    reportMemoryPlan();
 }
 
 void loop() {
-    // Handle AP mode and server clients if in SETUP state
+    // An update's first boot stays only once it reaches the server
+    checkFirmwareProbation();
+
+    // Serve the setup portal if in SETUP state
     if (currentStatus == STATUS_WIFI_SETUP) {
-        dnsServer.processNextRequest();
-        server.handleClient();
+        servePortal();
         return;
     }
 
     // Status management and button polling
     bool button1Pressed = (digitalRead(PIN_BUTTON_WAKE) == LOW);
     bool button2Pressed = (digitalRead(PIN_BUTTON_SEND) == LOW);
+    const bool button2Down = button2Pressed && !sendWasPressed; // A press that started now, not in another state
+    sendWasPressed = button2Pressed;
 
     switch (currentStatus) {
         case STATUS_CONNECTED:
+            flushConfig(false); // Between turns only
+            if (offeredBuild[0] != '\0' && !button1Pressed && !button2Pressed &&
+                (otaFailedMs == 0 || millis() - otaFailedMs >= OTA_RETRY_MS)) {
+                runFirmwareUpdate(); // Blocks until it reboots into the update, fails or B2 cancels it
+                break;
+            }
+            if (button2Down) {
+                sendPressedMs = millis();
+            } else if (!button2Pressed) {
+                sendPressedMs = 0;
+            } else if (sendPressedMs != 0 && millis() - sendPressedMs >= DIAG_LONG_PRESS_MS) {
+                // Long press of B2: audio loopback self-test
+                sendPressedMs = 0;
+                runAudioSelfTest();
+                break;
+            }
             if (button1Pressed) {
                 // Start recording (Wake button)
                 audioDataSize = 0; // Reset buffer for new recording
+                if (audioLink.rtpPort != 0) {
+                    startRtpUplink();
+                }
                 isListening = true;
+                wakeHeld = true;
+                wakePressedMs = millis();
                 i2s_start_microphone(); // Start the I2S capture hardware
                 updateStatus(STATUS_LISTENING);
-                Serial.println("Started listening...");
+                BINLOG("Started listening...\n");
             }
             break;
 
         case STATUS_LISTENING:
-            if (button2Pressed || audioDataSize >= AUDIO_BUFFER_CAPACITY) {
+            wakeHeld = wakeHeld && button1Pressed;
+            if (wakeHeld && millis() - wakePressedMs >= DIAG_LONG_PRESS_MS) {
+                // Long press of B1: drop the recording it started and run the network self-test
+                isListening = false;
+                wakeHeld = false;
+                i2s_stop_microphone();
+                audioDataSize = 0;
+                runNetworkSelfTest();
+            } else if (button2Pressed || audioDataSize >= audioLink.maxUploadBytes) {
                 // Stop recording and process (Send button or auto-stop)
                 isListening = false;
                 i2s_stop_microphone(); // Stop the I2S capture hardware
-                Serial.println("Stopped listening. Processing command...");
+                BINLOG("Stopped listening. Processing command...\n");
                 
-                // processVoiceCommand() is a blocking call and handles its own status change
-                processVoiceCommand(); 
+                // runVoiceTurn() is a blocking call and handles its own status change
+                runVoiceTurn();
             } else if (isListening) {
                 // Read audio data from I2S into the RAM buffer
                 size_t bytesRead = 0;
-                size_t remainingCapacity = AUDIO_BUFFER_CAPACITY - audioDataSize;
+                size_t remainingCapacity = audioLink.maxUploadBytes - audioDataSize;
                 
                 if (remainingCapacity > 0) {
-                    size_t bytesToRead = min(remainingCapacity, I2S_READ_CHUNK_SIZE);
+                    size_t bytesToRead = min(remainingCapacity, CaptureFormat::bytesForMs(audioProfile->captureChunkMs));
                     
                     // Read data into the buffer starting from the current size offset
                     // The timeout '10' ms is critical for non-blocking read in the loop
+                    const uint32_t readStart = micros();
                     esp_err_t err = i2s_read(I2S_PORT, (char*)(audioBuffer + audioDataSize), bytesToRead, &bytesRead, 10 / portTICK_PERIOD_MS);
+                    cpuWaitRecord(i2sRxWait, micros() - readStart);
                     
                     if (err == ESP_OK && bytesRead > 0) {
                         audioDataSize += bytesRead;
+                        if (audioLink.rtpPort != 0) {
+                            sendRtpUplink(false); // Stream it while still recording
+                        }
                         // Update display to show time remaining/recorded
                         updateStatus(STATUS_LISTENING); 
                     }
@@ -708,6 +2808,14 @@ void loop() {
             }
             break;
 
+        case STATUS_DIAGNOSTICS:
+            // Results stay on screen until B2 is pressed again (B1 would start a recording right
+            // away); the long press that started the audio self-test may still be held
+            if (button2Down) {
+                updateStatus(STATUS_CONNECTED);
+            }
+            break;
+
         case STATUS_ERROR:
             // Pressing B1 while in ERROR state resets the status
             if (button1Pressed) {
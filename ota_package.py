@@ -0,0 +1,265 @@
+"""
+Firmware update packages (the device side is client/lib/ota_image).
+
+An app image goes to the device as a package: LZ77-compressed, and when the
+device's current image is known, as a delta against it. Copies reach back
+into the image decoded so far or into the base image, both of which the
+device reads back from flash, so it decodes while it writes with no window in
+RAM. Wire format (little-endian, see ota_image.h):
+
+    header := u32:magic "TOTA" u8:version u8:flags u16:header bytes u32:image bytes
+              u32:image crc u32:base bytes u32:base crc u32:payload bytes u32:header crc
+    op     := u8:tag [varint:length] [varint:argument] [bytes]
+
+The tag is the op in its top two bits and the length minus the op's minimum
+in the low six (63: the rest follows as a varint). Image copies give how far
+back they start; base copies where they start relative to the end of the
+previous base copy, zigzag-coded.
+
+The packer is greedy: at each position it takes the best of the latest
+earlier occurrence of the next HASH_BYTES bytes in the image, the latest one
+in the base, and the base right where the previous base copy left off (code
+that didn't change after an edit), whichever saves the most bytes. "raw"
+packages are all literals: the image stored, for measuring the others
+against through the same download path.
+"""
+import struct
+import zlib
+
+MAGIC = 0x41544F54          # "TOTA"
+VERSION = 1
+FLAG_DELTA = 0x01
+HEADER = struct.Struct("<IBBHIIIII")
+HEADER_BYTES = HEADER.size + 4
+OP_LITERAL, OP_IMAGE_COPY, OP_BASE_COPY = 0, 1, 2
+LENGTH_BITS = 6
+LENGTH_MORE = 63
+MIN_LITERAL = 1
+MIN_COPY = 4
+# Copies are found from this many equal bytes on (the continuation of a base copy from MIN_COPY)
+HASH_BYTES = 6
+# Positions inside a long copy indexed for later matches (every one in short copies)
+COPY_INDEX_STEP = 4
+LITERAL_MAX = 1 << 16       # Long literal runs are split, so a resumed decoder never waits long for an op
+# ESP-IDF app image: esp_image_header_t (24) + the first segment's header (8), then esp_app_desc_t,
+# whose app_elf_sha256 starts 144 bytes in
+APP_ELF_SHA256_OFFSET = 0xB0
+BUILD_ID_BYTES = 8
+
+MODES = ("raw", "full", "delta")
+
+
+def build_id(image):
+    """The build's identity as the firmware reports it: the start of the ELF's SHA-256, in hex."""
+    if len(image) < APP_ELF_SHA256_OFFSET + BUILD_ID_BYTES or image[0] != 0xE9:
+        raise ValueError("not an ESP-IDF app image")
+    return image[APP_ELF_SHA256_OFFSET:APP_ELF_SHA256_OFFSET + BUILD_ID_BYTES].hex()
+
+
+def _varint(value):
+    out = bytearray()
+    while value >= 0x80:
+        out.append(value & 0x7F | 0x80)
+        value >>= 7
+    out.append(value)
+    return out
+
+
+def _zigzag(value):
+    return (value << 1) ^ (value >> 31)
+
+
+def _op(out, op, length, argument=None):
+    code = length - (MIN_LITERAL if op == OP_LITERAL else MIN_COPY)
+    if code < LENGTH_MORE:
+        out.append(op << LENGTH_BITS | code)
+    else:
+        out.append(op << LENGTH_BITS | LENGTH_MORE)
+        out += _varint(code - LENGTH_MORE)
+    if argument is not None:
+        out += _varint(argument)
+
+
+def _op_bytes(op, length, argument):
+    code = length - MIN_COPY
+    return 1 + (len(_varint(code - LENGTH_MORE)) if code >= LENGTH_MORE else 0) + len(_varint(argument))
+
+
+def _literals(out, data):
+    for start in range(0, len(data), LITERAL_MAX):
+        chunk = data[start:start + LITERAL_MAX]
+        _op(out, OP_LITERAL, len(chunk))
+        out += chunk
+
+
+def _match_length(a, i, b, j, limit):
+    """Length of the common prefix of a[i:] and b[j:], up to 'limit' (compared in growing slices)."""
+    length, step = 0, 32
+    while length < limit:
+        n = min(step, limit - length)
+        if a[i + length:i + length + n] == b[j + length:j + length + n]:
+            length += n
+            step = min(step * 2, 4096)
+        elif n == 1:
+            break
+        else:
+            step = max(1, n // 2)
+    return length
+
+
+def _index(data):
+    index = {}
+    for j in range(len(data) - HASH_BYTES + 1):
+        index.setdefault(data[j:j + HASH_BYTES], j)
+    return index
+
+
+def _payload(image, base):
+    out = bytearray()
+    recent = {}
+    base_index = _index(base) if base else {}
+    base_cursor = 0         # Where the last base copy ended, in the base and in the image
+    base_resume = 0
+    literal_start = 0
+    i, n = 0, len(image)
+    while i < n:
+        limit = n - i
+        best = None         # (saved bytes, op, length, argument)
+        key = image[i:i + HASH_BYTES]
+        if limit >= MIN_COPY:
+            candidates = []
+            if base:
+                # Unchanged code after an edit continues where the last base copy stopped
+                candidates.append((OP_BASE_COPY, base_cursor + i - base_resume))
+                if key in base_index:
+                    candidates.append((OP_BASE_COPY, base_index[key]))
+            if key in recent:
+                candidates.append((OP_IMAGE_COPY, recent[key]))
+            for op, at in candidates:
+                source = base if op == OP_BASE_COPY else image
+                if at < 0 or at >= len(source):
+                    continue
+                length = _match_length(image, i, source, at, min(limit, len(source) - at) if op == OP_BASE_COPY else limit)
+                if length < MIN_COPY:
+                    continue
+                argument = _zigzag(at - base_cursor) if op == OP_BASE_COPY else i - at
+                saved = length - _op_bytes(op, length, argument)
+                if saved > 0 and (best is None or saved > best[0]):
+                    best = (saved, op, length, argument)
+        if best is None:
+            if len(key) == HASH_BYTES:
+                recent[key] = i
+            i += 1
+            continue
+        _, op, length, argument = best
+        if literal_start < i:
+            _literals(out, image[literal_start:i])
+        _op(out, op, length, argument)
+        if op == OP_BASE_COPY:
+            base_cursor += _zigzag_decode(argument) + length
+            base_resume = i + length
+        step = 1 if length <= 64 else COPY_INDEX_STEP
+        for j in range(i, min(i + length, n - HASH_BYTES + 1), step):
+            recent[image[j:j + HASH_BYTES]] = j
+        i += length
+        literal_start = i
+    if literal_start < n:
+        _literals(out, image[literal_start:])
+    return bytes(out)
+
+
+def _zigzag_decode(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def pack(image, base=None, mode="delta"):
+    """
+    Packs an app image: "delta" against 'base' (the image the device runs; "full" without one),
+    "full" compressed on its own, or "raw" stored.
+    """
+    image = bytes(image)
+    if mode not in MODES:
+        raise ValueError(f"unknown mode {mode!r}")
+    delta = mode == "delta" and base is not None
+    base = bytes(base) if delta else b""
+    if mode == "raw":
+        out = bytearray()
+        _literals(out, image)
+        payload = bytes(out)
+    else:
+        payload = _payload(image, base)
+    head = HEADER.pack(MAGIC, VERSION, FLAG_DELTA if delta else 0, HEADER_BYTES, len(image),
+                       zlib.crc32(image), len(base), zlib.crc32(base), len(payload))
+    return head + struct.pack("<I", zlib.crc32(head)) + payload
+
+
+def read_header(package):
+    """The header's fields as a dict; ValueError if it isn't a package this module writes."""
+    if len(package) < HEADER_BYTES:
+        raise ValueError("truncated header")
+    magic, version, flags, header_bytes, image_bytes, image_crc, base_bytes, base_crc, payload_bytes = \
+        HEADER.unpack_from(package)
+    (crc,) = struct.unpack_from("<I", package, HEADER.size)
+    if magic != MAGIC or version != VERSION or header_bytes != HEADER_BYTES or crc != zlib.crc32(package[:HEADER.size]):
+        raise ValueError("not an update package")
+    return {"flags": flags, "image_bytes": image_bytes, "image_crc": image_crc, "base_bytes": base_bytes,
+            "base_crc": base_crc, "payload_bytes": payload_bytes}
+
+
+def unpack(package, base=None):
+    """Decodes a package (the reference for the device's decoder). Raises ValueError if it is corrupt."""
+    header = read_header(package)
+    if header["flags"] & FLAG_DELTA:
+        if base is None or zlib.crc32(base[:header["base_bytes"]]) != header["base_crc"]:
+            raise ValueError("delta against another base image")
+    payload = memoryview(package)[HEADER_BYTES:HEADER_BYTES + header["payload_bytes"]]
+    out = bytearray()
+    base_cursor = 0
+    p = 0
+
+    def varint():
+        nonlocal p
+        value, shift = 0, 0
+        while True:
+            byte = payload[p]
+            p += 1
+            value |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                return value
+
+    try:
+        while p < len(payload):
+            tag = payload[p]
+            p += 1
+            op, length = tag >> LENGTH_BITS, tag & LENGTH_MORE
+            if length == LENGTH_MORE:
+                length += varint()
+            if op == OP_LITERAL:
+                length += MIN_LITERAL
+                out += payload[p:p + length]
+                p += length
+            elif op == OP_IMAGE_COPY:
+                length += MIN_COPY
+                distance = varint()
+                if not 0 < distance <= len(out):
+                    raise ValueError("copy before the start of the image")
+                if distance >= length:
+                    out += out[len(out) - distance:len(out) - distance + length]
+                else:
+                    for _ in range(length):     # Overlaps what it writes
+                        out.append(out[-distance])
+            elif op == OP_BASE_COPY:
+                length += MIN_COPY
+                start = base_cursor + _zigzag_decode(varint())
+                if start < 0 or start + length > header["base_bytes"]:
+                    raise ValueError("copy outside the base image")
+                out += base[start:start + length]
+                base_cursor = start + length
+            else:
+                raise ValueError(f"unknown op {op}")
+    except IndexError:
+        raise ValueError("truncated payload") from None
+    if len(out) != header["image_bytes"] or zlib.crc32(out) != header["image_crc"]:
+        raise ValueError("decoded image doesn't match its CRC")
+    return bytes(out)
@@ -0,0 +1,245 @@
+"""
+RTP audio transport, server side (the device side is client/lib/rtp_audio).
+
+Optional low-latency path for voice-turn audio. The device streams its
+recording as RTP over UDP while it is still recording, and the reply audio goes
+back the same way, paced in real time. The HTTP request/response stays the
+control channel. A lost datagram then costs one concealed 20 ms packet instead
+of a TCP retransmission stall. Wire format (see
+client/lib/trinity_protocol/trinity_protocol.h):
+
+    audio packet := RTP header (12 bytes, PT 96) + 20 ms of audio
+                    adpcm payloads start with s16:predicted u8:index u8:0 (LE)
+    fec packet   := RTP header (PT 97, own sequence numbers)
+                    + u16:base seq u8:count u8:0 u16:length xor (BE) + xor of payloads
+
+Uplink packets that are lost are rebuilt from FEC where possible. Otherwise
+they are concealed the same way the device's jitter buffer does it: the
+previous packet is repeated with a fade.
+"""
+import audioop  # Provided by audioop-lts on Python 3.13+
+import socket
+import struct
+import threading
+import time
+from collections import OrderedDict
+
+PT_AUDIO = 96
+PT_FEC = 97
+PACKET_MS = 20
+FEC_GROUP = 4
+RTP_HEADER = struct.Struct("!BBHII")
+FEC_HEADER = struct.Struct("!HBxH")
+ADPCM_BLOCK_HEADER = struct.Struct("<hBx")
+# Reply packets sent ahead of real time so the device's jitter buffer fills at
+# once. Kept small: lwIP only queues a handful of datagrams per socket.
+SEND_LEAD_PACKETS = 3
+# An uplink stream with no new packet for this long has nothing left in flight
+UPLINK_IDLE_S = 0.08
+# Uplink streams kept until their turn's request arrives
+MAX_PENDING_STREAMS = 64
+STREAM_EXPIRY_S = 60
+# Each consecutive concealed packet repeats the last one at this much of its gain
+CONCEAL_FADE = 0.5
+
+
+def packet_samples(rate):
+    return rate * PACKET_MS // 1000
+
+
+def encode_payloads(pcm, codec, rate):
+    """pcm16 at 'rate' -> one payload per packet. adpcm packets carry their starting decoder state."""
+    step = packet_samples(rate) * 2
+    payloads, state = [], None
+    for offset in range(0, len(pcm), step):
+        chunk = pcm[offset:offset + step]
+        if codec == "adpcm":
+            predicted, index = state or (0, 0)
+            data, state = audioop.lin2adpcm(chunk, 2, state)
+            payloads.append(ADPCM_BLOCK_HEADER.pack(predicted, index) + data)
+        else:
+            payloads.append(chunk)
+    return payloads
+
+
+def decode_payload(payload, codec):
+    if codec != "adpcm":
+        return payload[:len(payload) & ~1]
+    if len(payload) < ADPCM_BLOCK_HEADER.size:
+        return b""
+    predicted, index = ADPCM_BLOCK_HEADER.unpack_from(payload)
+    return audioop.adpcm2lin(payload[ADPCM_BLOCK_HEADER.size:], 2, (predicted, min(index, 88)))[0]
+
+
+def xor_payloads(payloads):
+    """Parity of a FEC group: (xor of the zero-padded payloads, xor of their lengths)."""
+    size = max(len(p) for p in payloads)
+    parity, length_xor = 0, 0
+    for payload in payloads:
+        parity ^= int.from_bytes(payload.ljust(size, b"\0"), "big")
+        length_xor ^= len(payload)
+    return parity.to_bytes(size, "big"), length_xor
+
+
+def packetize(ssrc, first_seq, payloads, rate):
+    """Yields (is_audio, datagram) for a stream, with a parity packet after each FEC group."""
+    samples = packet_samples(rate)
+    for group_index, base in enumerate(range(0, len(payloads), FEC_GROUP)):
+        group = payloads[base:base + FEC_GROUP]
+        for i, payload in enumerate(group, base):
+            marker = 0x80 if i == len(payloads) - 1 else 0
+            yield True, RTP_HEADER.pack(0x80, marker | PT_AUDIO, (first_seq + i) & 0xFFFF,
+                                        (i * samples) & 0xFFFFFFFF, ssrc) + payload
+        parity, length_xor = xor_payloads(group)
+        yield False, (RTP_HEADER.pack(0x80, PT_FEC, group_index & 0xFFFF, 0, ssrc)
+                      + FEC_HEADER.pack((first_seq + base) & 0xFFFF, len(group), length_xor) + parity)
+
+
+def parse_packet(data):
+    """Returns (payload type, sequence, ssrc, payload), or None if it isn't an RTP v2 datagram."""
+    if len(data) < RTP_HEADER.size:
+        return None
+    first, second, seq, _, ssrc = RTP_HEADER.unpack_from(data)
+    offset = RTP_HEADER.size + (first & 0x0F) * 4
+    if first >> 6 != 2 or first & 0x10 or offset > len(data):
+        return None
+    return second & 0x7F, seq, ssrc, data[offset:]
+
+
+class UplinkStream:
+    """Packets received so far for one uplink SSRC."""
+
+    def __init__(self, address):
+        self.address = address
+        self.payloads = {}   # sequence -> payload
+        self.fec = {}        # base sequence -> (count, length xor, parity)
+        self.updated = time.monotonic()
+
+    def add(self, payload_type, seq, payload):
+        self.updated = time.monotonic()
+        if payload_type == PT_AUDIO:
+            self.payloads[seq] = payload
+        elif payload_type == PT_FEC and len(payload) >= FEC_HEADER.size:
+            base, count, length_xor = FEC_HEADER.unpack_from(payload)
+            self.fec[base] = (count, length_xor, payload[FEC_HEADER.size:])
+
+    def _recover(self, first_seq, index):
+        """Rebuilds packet 'index' if it is the only one missing from its FEC group."""
+        base = index - index % FEC_GROUP
+        fec = self.fec.get((first_seq + base) & 0xFFFF)
+        if fec is None:
+            return None
+        count, length_xor, parity = fec
+        others = [self.payloads.get((first_seq + i) & 0xFFFF) for i in range(base, base + count) if i != index]
+        if any(p is None for p in others):
+            return None
+        rebuilt, others_xor = xor_payloads([parity] + others) if others else (parity, 0)
+        length = length_xor ^ others_xor ^ (len(parity) if others else 0)
+        return rebuilt[:length] if length <= len(parity) else None
+
+    def complete(self, first_seq, packets):
+        """True if every packet has arrived or can be rebuilt, so waiting longer gains nothing."""
+        return all((first_seq + i) & 0xFFFF in self.payloads or self._recover(first_seq, i) is not None
+                   for i in range(packets))
+
+    def assemble(self, first_seq, packets, codec, rate):
+        """Returns (pcm16, stats) for the whole stream, rebuilding or concealing lost packets."""
+        out, last, gain = [], b"\0" * packet_samples(rate) * 2, 1.0
+        stats = {"received": 0, "recovered": 0, "concealed": 0}
+        for i in range(packets):
+            payload = self.payloads.get((first_seq + i) & 0xFFFF)
+            if payload is not None:
+                stats["received"] += 1
+            else:
+                payload = self._recover(first_seq, i)
+                if payload is not None:
+                    stats["recovered"] += 1
+            if payload is not None:
+                last, gain = decode_payload(payload, codec), 1.0
+                out.append(last)
+            else:
+                stats["concealed"] += 1
+                gain *= CONCEAL_FADE
+                out.append(audioop.mul(last, 2, gain))
+        return b"".join(out), stats
+
+
+class RtpEndpoint:
+    """The server's UDP socket: collects uplink streams and sends reply streams."""
+
+    def __init__(self, port):
+        self.port = port
+        self._sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self._sock.bind(("0.0.0.0", port))
+        self._cond = threading.Condition()
+        self._streams = OrderedDict()   # ssrc -> UplinkStream
+        threading.Thread(target=self._receive_loop, name="rtp-receive", daemon=True).start()
+
+    def _receive_loop(self):
+        while True:
+            try:
+                data, address = self._sock.recvfrom(2048)
+            except OSError as e:
+                print(f"[RTP] Receive failed: {e}")
+                continue
+            packet = parse_packet(data)
+            if packet is None:
+                continue
+            payload_type, seq, ssrc, payload = packet
+            with self._cond:
+                stream = self._streams.get(ssrc)
+                if stream is None:
+                    stream = self._streams[ssrc] = UplinkStream(address)
+                    self._expire()
+                stream.add(payload_type, seq, payload)
+                self._cond.notify_all()
+
+    def _expire(self):
+        """Drops streams whose request never came. Caller holds the lock."""
+        now = time.monotonic()
+        while self._streams:
+            oldest = next(iter(self._streams.values()))
+            if len(self._streams) <= MAX_PENDING_STREAMS and now - oldest.updated < STREAM_EXPIRY_S:
+                break
+            self._streams.popitem(last=False)
+
+    def collect(self, ssrc, first_seq, packets, codec, rate, wait_s):
+        """
+        Waits up to wait_s for the rest of an uplink stream, then assembles it. Stops early
+        once the stream is complete or has gone idle (its missing packets are lost, not late).
+        Returns (pcm16, device address, stats), or None if no packet of it arrived.
+        """
+        deadline = time.monotonic() + wait_s
+        with self._cond:
+            while True:
+                stream = self._streams.get(ssrc)
+                now = time.monotonic()
+                remaining = deadline - now
+                if remaining <= 0 or (stream and (now - stream.updated >= UPLINK_IDLE_S
+                                                  or stream.complete(first_seq, packets))):
+                    break
+                self._cond.wait(min(remaining, UPLINK_IDLE_S) if stream else remaining)
+            stream = self._streams.pop(ssrc, None)
+        if stream is None:
+            return None
+        pcm, stats = stream.assemble(first_seq, packets, codec, rate)
+        return pcm, stream.address, stats
+
+    def send(self, address, ssrc, first_seq, payloads, rate):
+        """Sends a reply stream in the background, paced at real time after a short lead."""
+        threading.Thread(target=self._send_stream, args=(address, ssrc, first_seq, payloads, rate),
+                         name="rtp-send", daemon=True).start()
+
+    def _send_stream(self, address, ssrc, first_seq, payloads, rate):
+        start = time.monotonic()
+        sent = 0
+        try:
+            for is_audio, datagram in packetize(ssrc, first_seq, payloads, rate):
+                if is_audio:
+                    delay = start + max(0, sent - SEND_LEAD_PACKETS) * PACKET_MS / 1000 - time.monotonic()
+                    if delay > 0:
+                        time.sleep(delay)
+                    sent += 1
+                self._sock.sendto(datagram, address)
+        except OSError as e:
+            print(f"[RTP] Sending to {address} failed after {sent} packets: {e}")
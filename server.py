@@ -5,11 +5,22 @@ import base64
 import json
 import re 
 import random 
+import threading
+import uuid
+import audioop  # Provided by audioop-lts on Python 3.13+
+import struct
+from collections import OrderedDict, deque
+from concurrent.futures import ThreadPoolExecutor, wait, FIRST_COMPLETED
 from flask import Flask, request, Response, jsonify
+from werkzeug.serving import WSGIRequestHandler
 from dotenv import load_dotenv
 import requests 
 from gtts import gTTS
 from pydub import AudioSegment
+import trace_archive
+import metrics
+import rtp_transport
+import ota_package
 # -------------------------
 
 # --- Configuration ---
@@ -24,13 +35,151 @@ if not GEMINI_API_KEY:
 # Using gemini-2.5-flash-lite for both STT and Text Generation
 GEMINI_MODEL = "gemini-2.5-flash-lite"
 # Base URL for the generateContent endpoint
-GEMINI_API_BASE_URL = "https://generativelanguage.googleapis.com/v1beta/models"
+# Overridable so the server can be pointed at a local mock backend (see tools/mock_gemini.py)
+GEMINI_API_ROOT_URL = os.getenv("GEMINI_API_ROOT_URL", "https://generativelanguage.googleapis.com/v1beta")
+GEMINI_API_BASE_URL = f"{GEMINI_API_ROOT_URL}/models"
+
+# --- Conversation Session Configuration ---
+# Each device identifies itself with this header (the firmware sends its Wi-Fi MAC address).
+DEVICE_ID_HEADER = "X-Device-ID"
+# Rough prompt-size budget for the rolling history (system prompt is cached separately).
+HISTORY_TOKEN_BUDGET = 1500
+# Hard cap on stored turns, independent of the token budget.
+MAX_HISTORY_TURNS = 20
+# Sessions idle for longer than this are discarded, and at most MAX_SESSIONS are kept.
+SESSION_IDLE_TIMEOUT_S = 15 * 60
+MAX_SESSIONS = 64
+# Lifetime of the server-side cached content holding the Trinity system instruction.
+CONTEXT_CACHE_TTL_S = 3600
+# Heuristic used to estimate tokens before the API reports real counts.
+CHARS_PER_TOKEN = 4
+
+# --- Tail Latency Configuration (Hedging, Circuit Breaker, Deadlines) ---
+# A duplicate request is fired once a stage has not answered by its rolling p90.
+HEDGING_ENABLED = os.getenv("TRINITY_HEDGING", "1") != "0"
+HEDGE_WINDOW = 200              # Latency samples kept per stage
+HEDGE_MIN_SAMPLES = 20          # Below this, HEDGE_DEFAULT_DELAY_S is used instead of the p90
+HEDGE_DEFAULT_DELAY_S = 2.0
+HEDGE_MIN_DELAY_S = 0.2
+# Per-stage upper bounds (the previous fixed timeouts)
+STT_TIMEOUT_S = 30
+LLM_TIMEOUT_S = 15
+# Consecutive failures that open an endpoint's breaker, and how long it stays open
+BREAKER_FAILURE_THRESHOLD = 5
+BREAKER_RESET_TIMEOUT_S = 30
+# The device sends its own HTTP timeout; the server plans its stages inside it.
+DEADLINE_HEADER = "X-Deadline-Ms"
+DEFAULT_DEADLINE_MS = 45000
+# Time kept in reserve for TTS conversion and the response transfer
+TTS_RESERVE_S = 3.0
+
+# --- Intent Fast Path Configuration ---
+# Device-control opcodes are returned in this header; the firmware executes them.
+CONTROL_HEADER = "X-Trinity-Control"
+# Utterances longer than this never take the fast path (they are real questions)
+INTENT_MAX_WORDS = 6
+# Maximum normalized edit distance for a fuzzy intent match (0.0 = exact only); multi-word phrases only
+INTENT_FUZZY_MAX_DISTANCE = 0.2
+# Entries kept in the template TTS cache
+TEMPLATE_TTS_CACHE_SIZE = 64
+
+# --- Framed Response Configuration ---
+# Firmware that sends this Accept type gets text, timing and control frames around the audio
+# (see client/lib/trinity_protocol/trinity_protocol.h); everything else gets raw PCM.
+FRAMES_MIME = "application/x-trinity-frames"
+FRAME_END, FRAME_TEXT, FRAME_AUDIO, FRAME_TIMING, FRAME_CONTROL, FRAME_RTP = range(6)
+TEXT_KIND_TRANSCRIPT, TEXT_KIND_REPLY = range(2)
+# PCM bytes per AUDIO frame, unless the device asked for another size in its handshake
+FRAME_AUDIO_CHUNK_BYTES = 4096
+# TTS output and all cached reply audio use this rate; other downlink rates are resampled from it
+OUTPUT_SAMPLE_RATE = 16000
+
+# --- Capability Negotiation Configuration ---
+# Devices POST their capabilities to /hello at connect time (see client/lib/trinity_protocol).
+# Protocol 1 is firmware without the handshake: pcm16 at 16 kHz both ways.
+PROTOCOL_VERSION = 2
+CAPS_MIME = "text/x-trinity-caps"
+FORMAT_HEADER = "X-Trinity-Format"
+# Per-request downlink format chosen by the device's link adaptation
+DOWNLINK_HEADER = "X-Trinity-Downlink"
+# Link measurements from the device's previous turn, exported at /metrics
+LINK_HEADER = "X-Trinity-Link"
+# Codecs this server can decode/encode, most efficient first
+CODEC_PREFERENCE = ["adpcm", "pcm16"]
+# Sample rates in order of preference for each direction
+UPLINK_RATE_PREFERENCE = [16000, 8000]
+DOWNLINK_RATE_PREFERENCE = [16000, 8000]
+DEFAULT_FORMAT = ("pcm16", 16000)
+# Largest accepted request body (about 60 s of 16 kHz PCM)
+MAX_UPLOAD_BYTES = 2 * 1024 * 1024
+# Devices whose negotiated capabilities are remembered
+MAX_CAPABILITY_ENTRIES = 256
+
+# --- RTP Audio Transport Configuration ---
+# UDP port for voice audio as RTP (see rtp_transport.py), offered to devices that support it
+# in the handshake. 0 keeps every device on TCP.
+RTP_PORT = int(os.getenv("TRINITY_RTP_PORT", "0"))
+# Sent instead of an audio body: "ssrc=..,seq=..,packets=.." of the turn's uplink stream
+RTP_HEADER = "X-Trinity-Rtp"
+# After the request arrives, how long to wait for uplink packets still in flight
+RTP_UPLINK_GRACE_S = 0.3
+
+# --- Network Self-Test Configuration ---
+# Largest download burst /diag/source serves; uploads to /diag/sink are bounded by MAX_UPLOAD_BYTES
+DIAG_SOURCE_MAX_BYTES = 4 * 1024 * 1024
+DIAG_CHUNK_BYTES = 16 * 1024
+
+# --- Firmware Update (OTA) Configuration ---
+# App images (.bin) for over-the-air updates (see ota_package.py). The newest is offered in the
+# handshake to devices running another build; the older ones stay as delta bases for the devices
+# still running them. Builds publish themselves here (tools/ota_pack.py, custom_ota_dir).
+OTA_DIR = os.getenv("TRINITY_OTA_DIR", "firmware")
+# "delta" (against the device's build if it is in OTA_DIR, else full), "full" (compressed) or
+# "raw" (stored: the baseline the other two are measured against)
+OTA_MODE = os.getenv("TRINITY_OTA_MODE", "delta")
+OTA_MIME = "application/x-trinity-ota"
+# Packages kept packed (one per build, base and mode)
+OTA_PACKAGE_CACHE_SIZE = 8
 
 # --- DEBUGGING OUTPUT CONFIGURATION ---
-# All generated debug files (like response_audio.mp3) will be saved here.
+# Sampled turn archives (input PCM, transcript, reply and timings) will be saved here.
 DEBUG_OUTPUT_DIR = "debug_audio_files" 
+# Fraction of turns archived; writes happen on a background thread and are dropped under load.
+DEBUG_ARCHIVE_SAMPLE_RATE = float(os.getenv("TRINITY_ARCHIVE_SAMPLE_RATE", "0.1"))
+DEBUG_ARCHIVE_QUEUE_SIZE = 32
+DEBUG_ARCHIVE_MAX_FILE_BYTES = 64 * 1024 * 1024
+DEBUG_ARCHIVE_MAX_FILES = 8
+# Full capture for record-and-replay (tools/replay.py): also archive the request headers,
+# response body and raw model responses. Use with TRINITY_ARCHIVE_SAMPLE_RATE=1.
+CAPTURE_FULL = os.getenv("TRINITY_CAPTURE_FULL", "0") == "1"
+# Returned on every response so device logs can be matched with archive records
+TRACE_ID_HEADER = "X-Trace-Id"
 
 app = Flask(__name__)
+app.config["MAX_CONTENT_LENGTH"] = MAX_UPLOAD_BYTES
+server_metrics = metrics.Metrics()
+# Started in __main__ when RTP_PORT is set
+rtp_endpoint = None
+
+debug_archiver = trace_archive.DebugArchiver(
+    DEBUG_OUTPUT_DIR,
+    DEBUG_ARCHIVE_SAMPLE_RATE,
+    queue_size=DEBUG_ARCHIVE_QUEUE_SIZE,
+    max_file_bytes=DEBUG_ARCHIVE_MAX_FILE_BYTES,
+    max_files=DEBUG_ARCHIVE_MAX_FILES
+)
+
+# Define the Trinity Persona via the System Instruction
+system_prompt_trinity = (
+    """Trinity: Hacker, warrior, resistance. Loyal to Neo/Morpheus. Tone: Cool, 
+    direct, focused, cryptic, confident. Theme: Matrix is a lie, trust is everything, 
+    the fight is constant. Rule: Responses must be brief, serving only to **reveal a subtle truth**, **give 
+    a direct instruction**, or **offer cryptic reassurance**. Always assume user is a potential 'Redpill' 
+    or a 'Crew Member'. Use minimum words."""
+)
+
+# Google Search Grounding is included for real-time information
+LLM_TOOLS = [{"google_search": {}}]
 
 # --- Helper Function for Cleaning Text ---
 
@@ -49,6 +198,1123 @@ def clean_text_for_tts(text):
     return text
 
 
+# --- Intent Fast Path ---
+# Short device-control phrases are recognized locally on the transcript and answered
+# from templates and cached TTS (or with a bare control opcode), skipping the LLM.
+
+OPCODE_STOP = "stop"
+OPCODE_VOLUME_UP = "volume_up"
+OPCODE_VOLUME_DOWN = "volume_down"
+
+# intent name -> trigger phrases (matched after normalization)
+INTENT_PHRASES = {
+    "stop": ["stop", "stop talking", "be quiet", "quiet", "cancel", "never mind", "shut up", "enough"],
+    "repeat": ["repeat", "repeat that", "say that again", "say again", "again", "what did you say", "come again"],
+    "louder": ["louder", "volume up", "turn it up", "turn up the volume", "speak up", "increase volume"],
+    "quieter": ["quieter", "softer", "volume down", "turn it down", "turn down the volume", "decrease volume"],
+    "time": ["what time is it", "what is the time", "whats the time", "tell me the time", "time"],
+}
+
+# Words that carry no meaning for intent matching
+INTENT_FILLER_WORDS = {"please", "trinity", "hey", "ok", "okay", "um", "uh", "can", "you", "could", "now", "just"}
+
+
+def normalize_utterance(text):
+    """Lowercases, strips punctuation and filler words: "Trinity, stop!" -> "stop"."""
+    text = re.sub(r"[^a-z0-9\s]", "", text.lower().replace("'", ""))
+    return " ".join(word for word in text.split() if word not in INTENT_FILLER_WORDS)
+
+
+def edit_distance(a, b, limit):
+    """Levenshtein distance between two short strings, giving up early once it exceeds 'limit'."""
+    if abs(len(a) - len(b)) > limit:
+        return limit + 1
+    previous = list(range(len(b) + 1))
+    for i, char_a in enumerate(a, 1):
+        current = [i]
+        for j, char_b in enumerate(b, 1):
+            current.append(min(previous[j] + 1, current[j - 1] + 1, previous[j - 1] + (char_a != char_b)))
+        if min(current) > limit:
+            return limit + 1
+        previous = current
+    return previous[-1]
+
+
+class IntentMatcher:
+    """
+    Word-level trie over the normalized trigger phrases for exact matches, plus a small
+    bounded-edit-distance matcher for near misses from STT ("say that agin"). Single-word
+    triggers match exactly only: one edit turns "stop" into "shop" or "top" and "time" into
+    "dime", whole utterances that must reach the LLM.
+    """
+
+    def __init__(self, intent_phrases):
+        self._root = {}
+        self._phrases = []
+        for intent, phrases in intent_phrases.items():
+            for phrase in phrases:
+                normalized = normalize_utterance(phrase)
+                node = self._root
+                for word in normalized.split():
+                    node = node.setdefault(word, {})
+                node[None] = intent
+                self._phrases.append((normalized, intent))
+
+    def match(self, text):
+        """Returns the intent name for a whole-utterance match, or None."""
+        normalized = normalize_utterance(text)
+        words = normalized.split()
+        if not words or len(words) > INTENT_MAX_WORDS:
+            return None
+
+        # 1. Exact match through the trie
+        node = self._root
+        for word in words:
+            node = node.get(word)
+            if node is None:
+                break
+        else:
+            if None in node:
+                return node[None]
+
+        # 2. Fuzzy match against every phrase (the phrase list is tiny)
+        best_intent, best_distance = None, None
+        for phrase, intent in self._phrases:
+            if " " not in phrase:
+                continue
+            limit = round(len(phrase) * INTENT_FUZZY_MAX_DISTANCE)
+            distance = edit_distance(normalized, phrase, limit)
+            if distance <= limit and (best_distance is None or distance < best_distance):
+                best_intent, best_distance = intent, distance
+        return best_intent
+
+
+class TemplateTtsCache:
+    """Small LRU of rendered template replies, text -> PCM."""
+
+    def __init__(self, max_entries=TEMPLATE_TTS_CACHE_SIZE):
+        self._lock = threading.Lock()
+        self._entries = OrderedDict()
+        self._max_entries = max_entries
+
+    def get_pcm(self, text):
+        with self._lock:
+            if text in self._entries:
+                self._entries.move_to_end(text)
+                return self._entries[text]
+        pcm = text_to_pcm(text)
+        with self._lock:
+            self._entries[text] = pcm
+            while len(self._entries) > self._max_entries:
+                self._entries.popitem(last=False)
+        return pcm
+
+
+class IntentLatencyStats:
+    """Tracks how much time the fast path saves compared with the LLM + TTS path."""
+
+    def __init__(self):
+        self._lock = threading.Lock()
+        self._llm_path_ms = deque(maxlen=100)
+        self.fast_path_turns = 0
+        self.total_saved_ms = 0.0
+
+    def record_llm_path(self, ms):
+        with self._lock:
+            self._llm_path_ms.append(ms)
+
+    def record_fast_path(self, intent, ms):
+        with self._lock:
+            typical = sum(self._llm_path_ms) / len(self._llm_path_ms) if self._llm_path_ms else None
+            self.fast_path_turns += 1
+            if typical is not None:
+                self.total_saved_ms += max(0.0, typical - ms)
+        saved = f"saved ~{typical - ms:.0f} ms vs LLM path" if typical is not None else "no LLM baseline yet"
+        print(f"[INTENT] '{intent}' answered in {ms:.0f} ms ({saved}; "
+              f"{self.fast_path_turns} fast-path turns, {self.total_saved_ms / 1000:.1f} s saved in total)")
+
+
+intent_matcher = IntentMatcher(INTENT_PHRASES)
+template_tts_cache = TemplateTtsCache()
+intent_stats = IntentLatencyStats()
+
+
+def handle_intent(intent, turn):
+    """Answers a recognized intent without the LLM. Returns a Flask Response."""
+    start = time.perf_counter()
+    session = turn.session
+    control = None
+    pcm = b""
+
+    if intent == "stop":
+        control = OPCODE_STOP
+    elif intent == "louder":
+        control = OPCODE_VOLUME_UP
+        turn.reply_text = "Louder."
+    elif intent == "quieter":
+        control = OPCODE_VOLUME_DOWN
+        turn.reply_text = "Quieter."
+    elif intent == "repeat":
+        if session and session.last_reply_pcm:
+            pcm = session.last_reply_pcm
+            turn.reply_text = session.turns[-1][1] if session.turns else ""
+        else:
+            turn.reply_text = "Nothing to repeat."
+    elif intent == "time":
+        turn.reply_text = time.strftime("It's %H:%M.")
+
+    try:
+        if turn.reply_text and not pcm:
+            pcm = template_tts_cache.get_pcm(turn.reply_text)
+    except Exception as e:
+        # A control opcode alone is still a valid answer
+        print(f"[INTENT] Template TTS failed: {e}")
+
+    turn.timings["intent_ms"] = (time.perf_counter() - start) * 1000
+    intent_stats.record_fast_path(intent, turn.timings["intent_ms"])
+    return audio_response(turn, pcm, control)
+
+
+# --- Per-Turn Context ---
+
+class TurnContext:
+    """
+    State of one voice turn: who sent it, its conversation session, the deadline for the
+    model stages (time.monotonic() based), and what gets recorded for the debug archive.
+    """
+
+    def __init__(self, device_id=None, session=None, deadline=None):
+        self.trace_id = uuid.uuid4().hex[:16]
+        self.device_id = device_id
+        self.session = session
+        self.deadline = deadline
+        self.started_at = time.time()
+        self.input_pcm = b""
+        self.transcript = ""
+        self.reply_text = ""
+        self.timings = {}   # stage name -> milliseconds
+        self.framed = False   # Device accepts FRAMES_MIME
+        self.caps = LEGACY_CAPABILITIES
+        self.uplink = DEFAULT_FORMAT     # (codec, rate) of the request body
+        self.downlink = DEFAULT_FORMAT   # (codec, rate) of the response audio
+        self.rtp = None       # (device address, ssrc) when the audio goes over RTP
+        # Only filled in when CAPTURE_FULL is set
+        self.request_headers = {}
+        self.response_body = b""
+        self.model_exchanges = []
+
+    def record_model_exchange(self, stage, ms, data):
+        if CAPTURE_FULL:
+            self.model_exchanges.append({"stage": stage, "ms": round(ms, 1), "response": data})
+
+    def set_response_body(self, body):
+        if CAPTURE_FULL:
+            self.response_body = body
+
+    def archive(self):
+        """Hands the turn to the background archiver if it was sampled."""
+        self.timings["total_ms"] = round((time.time() - self.started_at) * 1000, 1)
+        print(f"[TRACE {self.trace_id}] " + " ".join(f"{k}={v:.0f}" for k, v in self.timings.items()))
+        if not debug_archiver.should_sample():
+            return
+        fields = [
+            trace_archive.text_field(trace_archive.TAG_TRACE_ID, self.trace_id),
+            trace_archive.text_field(trace_archive.TAG_DEVICE_ID, self.device_id),
+            trace_archive.timestamp_field(self.started_at),
+            (trace_archive.TAG_INPUT_PCM, self.input_pcm),
+            trace_archive.text_field(trace_archive.TAG_TRANSCRIPT, self.transcript),
+            trace_archive.text_field(trace_archive.TAG_REPLY_TEXT, self.reply_text),
+            trace_archive.timings_field(self.timings),
+        ]
+        if CAPTURE_FULL:
+            fields += [
+                trace_archive.text_field(trace_archive.TAG_SOURCE, "server"),
+                trace_archive.json_field(trace_archive.TAG_REQUEST_HEADERS, self.request_headers),
+                (trace_archive.TAG_RESPONSE_BODY, self.response_body),
+                trace_archive.json_field(trace_archive.TAG_MODEL_EXCHANGES, self.model_exchanges),
+            ]
+        debug_archiver.submit(fields)
+
+
+def trace_headers(turn):
+    return {TRACE_ID_HEADER: turn.trace_id} if turn else {}
+
+
+# --- Framed Responses ---
+
+def encode_frame(frame_type, payload=b""):
+    """One TLV frame: u8 type, u32 little-endian length, payload."""
+    return struct.pack("<BI", frame_type, len(payload)) + payload
+
+
+def encode_frames(turn, pcm, control=None, rtp_stream=None):
+    """
+    Builds the framed body: transcript and reply text first (so the display can show them
+    before the first sample plays), then control opcodes, timings, audio chunks and END.
+    With rtp_stream = (ssrc, first sequence, packets) an RTP frame replaces the audio chunks.
+    """
+    caps = turn.caps
+    out = [
+        encode_frame(FRAME_TEXT, bytes([TEXT_KIND_TRANSCRIPT]) + truncate_utf8(turn.transcript, caps.max_text - 1)),
+        encode_frame(FRAME_TEXT, bytes([TEXT_KIND_REPLY]) + truncate_utf8(turn.reply_text, caps.max_text - 1)),
+    ]
+    if control:
+        out.append(encode_frame(FRAME_CONTROL, control.encode("ascii")))
+    out.append(encode_frame(FRAME_TIMING, struct.pack(
+        "<5I",
+        len(pcm),
+        turn.downlink[1],
+        int(turn.timings.get("stt_ms", 0)),
+        int(turn.timings.get("llm_ms", 0)),
+        int(turn.timings.get("tts_ms", 0)),
+    )))
+    if rtp_stream:
+        out.append(encode_frame(FRAME_RTP, struct.pack("<3I", *rtp_stream)))
+    else:
+        for offset in range(0, len(pcm), caps.frame_bytes):
+            out.append(encode_frame(FRAME_AUDIO, pcm[offset:offset + caps.frame_bytes]))
+    out.append(encode_frame(FRAME_END))
+    return b"".join(out)
+
+
+def audio_response(turn, pcm, control=None):
+    """
+    The reply for a turn, in its downlink format: framed if the device
+    asked for it, raw audio plus headers otherwise. 'pcm' is OUTPUT_SAMPLE_RATE pcm16.
+    """
+    headers = trace_headers(turn)
+    if turn:
+        # The capture keeps the plain PCM (even when framed) so replay can substitute it for TTS output
+        turn.set_response_body(pcm)
+        if turn.rtp and turn.framed:
+            return rtp_audio_response(turn, pcm, control, headers)
+        pcm = encode_downlink(pcm, turn.downlink)
+        if turn.framed:
+            return Response(encode_frames(turn, pcm, control), mimetype=FRAMES_MIME, headers=headers)
+
+    if control:
+        headers[CONTROL_HEADER] = control
+    return Response(pcm, mimetype='application/octet-stream', headers=headers)
+
+
+def rtp_audio_response(turn, pcm, control, headers):
+    """
+    Framed reply whose audio follows over RTP to the address the turn's uplink came from.
+    The packets start once the frames have been handed to the device, so it already knows
+    the stream when they arrive.
+    """
+    codec, rate = turn.downlink
+    address, ssrc = turn.rtp
+    pcm = resample_pcm16(pcm, OUTPUT_SAMPLE_RATE, rate)
+    payloads = rtp_transport.encode_payloads(pcm, codec, rate)
+    first_seq = random.randrange(0x10000)
+    body = encode_frames(turn, AUDIO_CODECS[codec][1](pcm), control, rtp_stream=(ssrc, first_seq, len(payloads)))
+    server_metrics.inc("trinity_rtp_packets_total", {"direction": "downlink", "outcome": "sent"}, len(payloads))
+
+    def generate():
+        yield body
+        rtp_endpoint.send(address, ssrc, first_seq, payloads, rate)
+    return Response(generate(), mimetype=FRAMES_MIME, headers=headers)
+
+
+# --- Capability Negotiation ---
+
+def resample_pcm16(pcm, from_rate, to_rate):
+    if from_rate == to_rate or not pcm:
+        return pcm
+    segment = AudioSegment(data=pcm, sample_width=2, frame_rate=from_rate, channels=1)
+    return segment.set_frame_rate(to_rate).raw_data
+
+
+def _passthrough(data):
+    return data
+
+
+def _adpcm_decode(data):
+    return audioop.adpcm2lin(data, 2, None)[0]
+
+
+def _adpcm_encode(pcm):
+    return audioop.lin2adpcm(pcm, 2, None)[0]
+
+
+# Codec name -> (decode to pcm16, encode from pcm16). Rates are handled separately.
+# "adpcm" is IMA ADPCM exactly as audioop codes it; the firmware's lib/audio_codec matches it.
+AUDIO_CODECS = {
+    "pcm16": (_passthrough, _passthrough),
+    "adpcm": (_adpcm_decode, _adpcm_encode),
+}
+
+
+def format_name(fmt):
+    return f"{fmt[0]}@{fmt[1]}"
+
+
+def parse_format(value):
+    """Parses "codec@rate". Returns (codec, rate), or None if this server can't handle it."""
+    codec, _, rate = (value or "").partition("@")
+    try:
+        rate = int(rate)
+    except ValueError:
+        return None
+    if codec not in AUDIO_CODECS or rate not in UPLINK_RATE_PREFERENCE + DOWNLINK_RATE_PREFERENCE:
+        return None
+    return codec, rate
+
+
+def decode_uplink(body, fmt):
+    """Request body in 'fmt' -> pcm16 at fmt's rate."""
+    return AUDIO_CODECS[fmt[0]][0](body)
+
+
+def encode_downlink(pcm, fmt):
+    """OUTPUT_SAMPLE_RATE pcm16 -> audio in 'fmt'."""
+    return AUDIO_CODECS[fmt[0]][1](resample_pcm16(pcm, OUTPUT_SAMPLE_RATE, fmt[1]))
+
+
+def truncate_utf8(text, max_bytes):
+    return text.encode("utf-8")[:max(0, max_bytes)].decode("utf-8", "ignore").encode("utf-8")
+
+
+class DeviceCapabilities:
+    """What a device announced in its handshake, and the formats negotiated for it."""
+
+    def __init__(self, protocol=1, codecs=("pcm16",), rates=(16000,), frame_bytes=FRAME_AUDIO_CHUNK_BYTES, max_text=512,
+                 transports=("tcp",)):
+        self.protocol = min(protocol, PROTOCOL_VERSION)
+        self.rtp = "rtp" in transports
+        self.frame_bytes = max(256, frame_bytes)
+        self.max_text = max_text
+        # The device's link adaptation may switch between any of the common codecs and rates
+        self.codecs = [c for c in CODEC_PREFERENCE if c in codecs] or [DEFAULT_FORMAT[0]]
+        self.rates = [r for r in UPLINK_RATE_PREFERENCE if r in rates] or [DEFAULT_FORMAT[1]]
+        # Starting formats: the most efficient codec both sides support; pcm16 is mandatory for every device
+        codec = self.codecs[0]
+        self.uplink = (codec, next((r for r in UPLINK_RATE_PREFERENCE if r in rates), DEFAULT_FORMAT[1]))
+        self.downlink = (codec, next((r for r in DOWNLINK_RATE_PREFERENCE if r in rates), DEFAULT_FORMAT[1]))
+
+    @classmethod
+    def from_caps(cls, caps):
+        """Builds the negotiated capabilities from the parsed "key=value" handshake body."""
+        def int_list(value):
+            return [int(v) for v in value.split(",") if v.strip().isdigit()]
+        return cls(
+            protocol=int(caps.get("protocol", 1)),
+            codecs=[c.strip() for c in caps.get("codecs", "pcm16").split(",")],
+            rates=int_list(caps.get("rates", "16000")),
+            frame_bytes=int(caps.get("frame_bytes", FRAME_AUDIO_CHUNK_BYTES)),
+            max_text=int(caps.get("max_text", 512)),
+            transports=[t.strip() for t in caps.get("transports", "tcp").split(",")],
+        )
+
+    def to_caps(self):
+        return (f"protocol={self.protocol}\n"
+                f"codecs={','.join(self.codecs)}\n"
+                f"rates={','.join(str(r) for r in self.rates)}\n"
+                f"uplink={format_name(self.uplink)}\n"
+                f"downlink={format_name(self.downlink)}\n"
+                f"frame_bytes={self.frame_bytes}\n"
+                f"max_upload={MAX_UPLOAD_BYTES}\n"
+                + (f"rtp_port={rtp_endpoint.port}\n" if self.rtp and rtp_endpoint else ""))
+
+
+# Devices that never sent a handshake (protocol 1 firmware)
+LEGACY_CAPABILITIES = DeviceCapabilities()
+
+
+def parse_caps(body):
+    """Parses "key=value" lines; lines without '=' are ignored."""
+    caps = {}
+    for line in body.splitlines():
+        key, sep, value = line.partition("=")
+        if sep:
+            caps[key.strip()] = value.strip()
+    return caps
+
+
+class CapabilityStore:
+    """Thread-safe LRU of negotiated DeviceCapabilities keyed by device ID."""
+
+    def __init__(self):
+        self._lock = threading.Lock()
+        self._entries = OrderedDict()
+
+    def get(self, device_id):
+        with self._lock:
+            caps = self._entries.get(device_id)
+            if caps is None:
+                return LEGACY_CAPABILITIES
+            self._entries.move_to_end(device_id)
+            return caps
+
+    def put(self, device_id, caps):
+        with self._lock:
+            self._entries[device_id] = caps
+            self._entries.move_to_end(device_id)
+            while len(self._entries) > MAX_CAPABILITY_ENTRIES:
+                self._entries.popitem(last=False)
+
+
+capability_store = CapabilityStore()
+
+
+# --- Link Metrics ---
+
+server_metrics.describe("trinity_link_turns_total", "counter", "Voice turns by direction and audio format")
+server_metrics.describe("trinity_link_goodput_kbps", "gauge", "Device-measured goodput of its previous turn")
+server_metrics.describe("trinity_link_rtt_ms", "gauge", "Device-measured round-trip time")
+server_metrics.describe("trinity_link_rssi_dbm", "gauge", "Device Wi-Fi signal strength")
+server_metrics.describe("trinity_link_underruns", "gauge", "Playback buffer underruns in the device's previous turn")
+server_metrics.describe("trinity_link_switches", "gauge", "Format switches made by the device's link adaptation since boot")
+server_metrics.describe("trinity_link_concealed", "gauge", "RTP packets the device concealed in its previous turn")
+server_metrics.describe("trinity_link_jitter_ms", "gauge", "RTP interarrival jitter measured by the device")
+server_metrics.describe("trinity_device_heap_steady_allocs", "gauge", "Heap allocations the device made in steady-state voice turns since boot (should stay 0)")
+server_metrics.describe("trinity_device_cpu_peak_percent", "gauge", "Busiest one-second load of each device core during its previous turn")
+server_metrics.describe("trinity_audio_profile_turns_total", "counter", "Voice turns played under each device audio profile")
+server_metrics.describe("trinity_audio_profile_latency_ms", "gauge", "Mean audio buffered ahead of the speaker under each device audio profile")
+server_metrics.describe("trinity_audio_profile_glitches_per_min", "gauge", "Playback glitches per minute of audio under each device audio profile")
+server_metrics.describe("trinity_rtp_packets_total", "counter", "RTP audio packets by direction and outcome")
+
+
+def record_link_metrics(turn, link_report):
+    """Counts the turn's formats and exports the device's own link measurements."""
+    server_metrics.inc("trinity_link_turns_total", {"direction": "uplink", "format": format_name(turn.uplink)})
+    server_metrics.inc("trinity_link_turns_total", {"direction": "downlink", "format": format_name(turn.downlink)})
+    if not link_report:
+        return
+    report = parse_caps(link_report.replace(",", "\n"))
+    device = {"device": turn.device_id}
+    try:
+        for direction in ("up", "down"):
+            if f"{direction}_kbps" in report:
+                server_metrics.set("trinity_link_goodput_kbps", float(report[f"{direction}_kbps"]),
+                                   {**device, "direction": direction + "link"})
+        for key, name in (("rtt_ms", "trinity_link_rtt_ms"), ("rssi", "trinity_link_rssi_dbm"),
+                          ("underruns", "trinity_link_underruns"), ("switches", "trinity_link_switches"),
+                          ("concealed", "trinity_link_concealed"), ("jitter_ms", "trinity_link_jitter_ms"),
+                          ("heap_steady_allocs", "trinity_device_heap_steady_allocs")):
+            if key in report:
+                server_metrics.set(name, float(report[key]), device)
+        for core in ("0", "1"):
+            if f"cpu{core}_peak" in report:
+                server_metrics.set("trinity_device_cpu_peak_percent", float(report[f"cpu{core}_peak"]), {**device, "core": core})
+        if "profile" in report:
+            profile = {**device, "profile": report["profile"]}
+            server_metrics.inc("trinity_audio_profile_turns_total", profile)
+            for key, name in (("latency_ms", "trinity_audio_profile_latency_ms"),
+                              ("glitches_pm", "trinity_audio_profile_glitches_per_min")):
+                if key in report:
+                    server_metrics.set(name, float(report[key]), profile)
+    except ValueError:
+        print(f"[LINK {turn.device_id}] Malformed link report: {link_report}")
+        return
+    print(f"[LINK {turn.device_id}] up {format_name(turn.uplink)} down {format_name(turn.downlink)} ({link_report})")
+
+
+# --- Network Self-Test ---
+# The device's diagnostic mode (long-press B1) times bursts against /diag/sink and /diag/source
+# and reports what it measured, so a slow device can be told apart from a slow server.
+
+server_metrics.describe("trinity_diag_goodput_kbps", "gauge", "Goodput measured by the device's last network self-test")
+server_metrics.describe("trinity_diag_rtt_ms", "gauge", "Connect-time RTT percentiles from the device's last network self-test")
+server_metrics.describe("trinity_diag_rssi_dbm", "gauge", "Wi-Fi signal strength during the device's last network self-test")
+server_metrics.describe("trinity_diag_runs_total", "counter", "Network self-tests reported by devices")
+server_metrics.describe("trinity_diag_audio_latency_ms", "gauge", "Speaker-to-microphone round trip from the device's last audio self-test")
+server_metrics.describe("trinity_diag_audio_rate_error_ppm", "gauge", "I2S sample rate error measured by the device's last audio self-test")
+server_metrics.describe("trinity_diag_audio_gain_db", "gauge", "Echo level relative to the test chirp in the device's last audio self-test")
+server_metrics.describe("trinity_diag_audio_runs_total", "counter", "Audio self-tests reported by devices, by whether the echo was found")
+
+
+def record_diag_report(device_id, report):
+    """
+    Exports a self-test report: "up_kbps=..,down_kbps=..,rtt_p50_ms=..,..,rssi=.." lines from
+    the network test, or "audio_found=..,audio_rate_ppm=..,audio_latency_ms=..,.." from the
+    audio loopback test.
+    """
+    device = {"device": device_id}
+    if "audio_found" in report:
+        # Read every field before exporting any, so a partial report changes nothing
+        found = report["audio_found"] == "1"
+        rate_ppm = float(report["audio_rate_ppm"])
+        if found:
+            latency_ms, gain_db = float(report["audio_latency_ms"]), float(report["audio_gain_db"])
+        server_metrics.set("trinity_diag_audio_rate_error_ppm", rate_ppm, device)
+        if found:
+            server_metrics.set("trinity_diag_audio_latency_ms", latency_ms, device)
+            server_metrics.set("trinity_diag_audio_gain_db", gain_db, device)
+        server_metrics.inc("trinity_diag_audio_runs_total", {**device, "echo": "found" if found else "missing"})
+        return
+    for direction in ("up", "down"):
+        if f"{direction}_kbps" in report:
+            server_metrics.set("trinity_diag_goodput_kbps", float(report[f"{direction}_kbps"]),
+                               {**device, "direction": direction + "link"})
+    for quantile in ("p50", "p90", "max"):
+        if f"rtt_{quantile}_ms" in report:
+            server_metrics.set("trinity_diag_rtt_ms", float(report[f"rtt_{quantile}_ms"]), {**device, "quantile": quantile})
+    if "rssi" in report:
+        server_metrics.set("trinity_diag_rssi_dbm", float(report["rssi"]), device)
+    server_metrics.inc("trinity_diag_runs_total", device)
+
+
+# --- Firmware Updates ---
+# The handshake offers the newest image in OTA_DIR to devices running another build. The device
+# downloads it between turns from /ota/image as a package against the build it runs (resuming
+# with Range requests after a drop), writes it to its other app partition, reports the transfer
+# to /ota/report and reboots into it. The new build confirms itself with its first handshake;
+# one that doesn't is rolled back by the device and named in its next handshake (ota_invalid),
+# so it isn't offered again.
+
+server_metrics.describe("trinity_ota_updates_total", "counter", "Firmware updates reported by devices, by package mode and result")
+server_metrics.describe("trinity_ota_transfer_bytes", "gauge", "Bytes a device received for its last update, resumed transfers included")
+server_metrics.describe("trinity_ota_raw_bytes", "gauge", "Size of the image of a device's last update: what sending it raw costs")
+server_metrics.describe("trinity_ota_transfer_ratio", "gauge", "Bytes received for a device's last update relative to the raw image")
+server_metrics.describe("trinity_ota_download_seconds", "gauge", "Download and flash time of a device's last update")
+server_metrics.describe("trinity_ota_resumes", "gauge", "Dropped connections resumed during a device's last update")
+server_metrics.describe("trinity_ota_bytes_total", "counter", "Update bytes received by devices, by package mode")
+server_metrics.describe("trinity_ota_raw_bytes_total", "counter", "Image bytes of the updates devices received, as raw transfers would cost")
+server_metrics.describe("trinity_ota_rollout_seconds", "gauge", "From the handshake offering a build to the device's first handshake running it")
+server_metrics.describe("trinity_ota_rollbacks_total", "counter", "Offered builds that devices rolled back from")
+
+
+class FirmwareStore:
+    """The images in OTA_DIR by build id, the packages made from them, and the offers made."""
+
+    def __init__(self, directory):
+        self._directory = directory
+        self._lock = threading.Lock()
+        self._pack_lock = threading.Lock()  # One package is made at a time; it takes seconds
+        self._builds = {}                   # path -> (mtime, build id)
+        self._packages = OrderedDict()      # (build, base build, mode) -> package
+        self._offers = {}                   # device -> (build, monotonic time of the first offer)
+        self._served = {}                   # device -> (build, mode, package bytes, image bytes)
+
+    def _scan(self):
+        """Returns the newest build id (None if there is no image) and {build id: path}."""
+        try:
+            names = os.listdir(self._directory)
+        except FileNotFoundError:
+            return None, {}
+        builds, newest = {}, None
+        for name in names:
+            path = os.path.join(self._directory, name)
+            if not name.endswith(".bin") or not os.path.isfile(path):
+                continue
+            mtime = os.path.getmtime(path)
+            known = self._builds.get(path)
+            if known is None or known[0] != mtime:
+                try:
+                    with open(path, "rb") as f:
+                        known = (mtime, ota_package.build_id(f.read(ota_package.APP_ELF_SHA256_OFFSET + ota_package.BUILD_ID_BYTES)))
+                except (OSError, ValueError):
+                    continue
+                self._builds[path] = known
+            builds[known[1]] = path
+            if newest is None or mtime > newest[0]:
+                newest = (mtime, known[1])
+        return (newest[1] if newest else None), builds
+
+    def offer(self, device_id, caps):
+        """The build to offer a device in its handshake; None if it is up to date or can't update."""
+        running = caps.get("build")
+        if not running:
+            return None     # Firmware without OTA
+        device = {"device": device_id}
+        with self._lock:
+            current, _ = self._scan()
+            offered = self._offers.get(device_id)
+            if offered and running == offered[0]:
+                server_metrics.set("trinity_ota_rollout_seconds", time.monotonic() - offered[1], device)
+                del self._offers[device_id]
+            elif offered and caps.get("ota_invalid") == offered[0]:
+                server_metrics.inc("trinity_ota_rollbacks_total")
+                del self._offers[device_id]
+            if current is None or running == current or caps.get("ota_invalid") == current:
+                return None
+            if device_id not in self._offers:
+                self._offers[device_id] = (current, time.monotonic())
+        # Packed ahead, so the download doesn't wait for it
+        threading.Thread(target=self.package, args=(running,), daemon=True).start()
+        return current
+
+    def package(self, base_build, device_id=None):
+        """Returns (build, mode, package) of the newest image for a device running 'base_build'."""
+        with self._lock:
+            current, builds = self._scan()
+        if current is None:
+            return None
+        mode = OTA_MODE if OTA_MODE != "delta" or base_build in builds else "full"
+        key = (current, base_build if mode == "delta" else None, mode)
+        with self._pack_lock:
+            with self._lock:
+                package = self._packages.get(key)
+            if package is None:
+                with open(builds[current], "rb") as f:
+                    image = f.read()
+                base = None
+                if mode == "delta":
+                    with open(builds[base_build], "rb") as f:
+                        base = f.read()
+                started = time.perf_counter()
+                package = ota_package.pack(image, base, mode)
+                print(f"[OTA] Packed {current} ({mode}{' from ' + base_build if base else ''}): "
+                      f"{len(package)} of {len(image)} bytes in {time.perf_counter() - started:.1f} s")
+        with self._lock:
+            self._packages[key] = package
+            self._packages.move_to_end(key)
+            while len(self._packages) > OTA_PACKAGE_CACHE_SIZE:
+                self._packages.popitem(last=False)
+            if device_id is not None:
+                self._served[device_id] = (current, mode, len(package), ota_package.read_header(package)["image_bytes"])
+        return current, mode, package
+
+    def served(self, device_id):
+        with self._lock:
+            return self._served.get(device_id)
+
+
+firmware_store = FirmwareStore(OTA_DIR)
+
+
+def record_ota_report(device_id, report):
+    """
+    Exports a device's update report ("build=..,result=..,received_bytes=..,resumes=..,ms=.."
+    lines) next to what was served to it: bytes over the air against the raw image.
+    """
+    served = firmware_store.served(device_id)
+    mode = served[1] if served and served[0] == report.get("build") else "unknown"
+    received = int(report["received_bytes"])
+    server_metrics.inc("trinity_ota_updates_total", {"mode": mode, "result": report["result"]})
+    if report["result"] != "ok":
+        return
+    device = {"device": device_id}
+    server_metrics.set("trinity_ota_transfer_bytes", received, {**device, "mode": mode})
+    server_metrics.set("trinity_ota_download_seconds", int(report["ms"]) / 1000, {**device, "mode": mode})
+    server_metrics.set("trinity_ota_resumes", int(report.get("resumes", 0)), device)
+    server_metrics.inc("trinity_ota_bytes_total", {"mode": mode}, received)
+    if served and mode != "unknown":
+        image_bytes = served[3]
+        server_metrics.set("trinity_ota_raw_bytes", image_bytes, device)
+        server_metrics.set("trinity_ota_transfer_ratio", received / image_bytes, {**device, "mode": mode})
+        server_metrics.inc("trinity_ota_raw_bytes_total", None, image_bytes)
+
+
+def receive_rtp_uplink(turn, rtp_header):
+    """
+    Collects the turn's uplink stream named in RTP_HEADER. Returns its pcm16, or None if no
+    packet of it arrived (UDP blocked?). Afterwards turn.uplink describes the returned PCM
+    and turn.rtp points the reply at the device. Raises ValueError for a malformed header.
+    """
+    fields = parse_caps(rtp_header.replace(",", "\n"))
+    ssrc, first_seq, packets = (int(fields[key]) for key in ("ssrc", "seq", "packets"))
+    start = time.perf_counter()
+    result = rtp_endpoint.collect(ssrc, first_seq, packets, turn.uplink[0], turn.uplink[1], RTP_UPLINK_GRACE_S)
+    turn.timings["rtp_wait_ms"] = (time.perf_counter() - start) * 1000
+    if result is None:
+        return None
+    pcm, address, stats = result
+    for outcome, count in stats.items():
+        server_metrics.inc("trinity_rtp_packets_total", {"direction": "uplink", "outcome": outcome}, count)
+    if stats["recovered"] or stats["concealed"]:
+        print(f"[RTP {turn.device_id}] uplink: {stats['recovered']} packets rebuilt from FEC, {stats['concealed']} concealed")
+    # Symmetric RTP: the reply goes back to wherever the uplink came from (NAT friendly)
+    turn.rtp = (address, ssrc)
+    turn.uplink = ("pcm16", turn.uplink[1])
+    if FORMAT_HEADER in turn.request_headers:
+        # Captures store this PCM as the request body; replay must not decode it again
+        turn.request_headers[FORMAT_HEADER] = format_name(turn.uplink)
+    return pcm
+
+
+# --- Tail Latency: Hedged Requests, Circuit Breakers, Deadlines ---
+
+class StageLatencyTracker:
+    """Rolling window of successful call latencies for one stage (e.g. 'stt', 'llm')."""
+
+    def __init__(self, window=HEDGE_WINDOW):
+        self._lock = threading.Lock()
+        self._samples = deque(maxlen=window)
+
+    def record(self, seconds):
+        with self._lock:
+            self._samples.append(seconds)
+
+    def percentile(self, pct):
+        with self._lock:
+            if not self._samples:
+                return None
+            ordered = sorted(self._samples)
+        return ordered[min(len(ordered) - 1, int(len(ordered) * pct / 100))]
+
+    def hedge_delay(self):
+        with self._lock:
+            enough = len(self._samples) >= HEDGE_MIN_SAMPLES
+        if not enough:
+            return HEDGE_DEFAULT_DELAY_S
+        return max(HEDGE_MIN_DELAY_S, self.percentile(90))
+
+
+class CircuitOpenError(Exception):
+    """Raised instead of calling an endpoint whose breaker is open."""
+
+
+class CircuitBreaker:
+    """
+    Classic closed -> open -> half-open breaker. While open, calls fail immediately so
+    the caller can use its fallback instead of waiting for a timeout.
+    """
+
+    def __init__(self, name):
+        self.name = name
+        self._lock = threading.Lock()
+        self._failures = 0
+        self._opened_at = None
+        self._probe_in_flight = False
+
+    def allow(self):
+        with self._lock:
+            if self._opened_at is None:
+                return True
+            if time.monotonic() - self._opened_at < BREAKER_RESET_TIMEOUT_S or self._probe_in_flight:
+                return False
+            # Half-open: let exactly one probe through
+            self._probe_in_flight = True
+            return True
+
+    def record_success(self):
+        with self._lock:
+            if self._opened_at is not None:
+                print(f"[BREAKER {self.name}] Closed.")
+            self._failures = 0
+            self._opened_at = None
+            self._probe_in_flight = False
+
+    def release_probe(self):
+        """The call ended without saying anything about the stage's health (a 4xx): neither closes nor counts."""
+        with self._lock:
+            self._probe_in_flight = False
+
+    def record_failure(self):
+        with self._lock:
+            self._failures += 1
+            self._probe_in_flight = False
+            if self._opened_at is not None or self._failures >= BREAKER_FAILURE_THRESHOLD:
+                if self._opened_at is None:
+                    print(f"[BREAKER {self.name}] Open after {self._failures} consecutive failures.")
+                self._opened_at = time.monotonic()
+
+
+# Canned replies used when the LLM stage fails; their audio is cached after the first synthesis.
+LLM_DEFAULT_RESPONSE = "Sorry, I encountered an unknown error during processing. Status update failed."
+LLM_CONNECTION_FAILURE_RESPONSE = "Connection failure. We're running out of time."
+LLM_PARSE_FAILURE_RESPONSE = "Invalid data stream. System integrity compromised."
+FALLBACK_RESPONSES = {LLM_DEFAULT_RESPONSE, LLM_CONNECTION_FAILURE_RESPONSE, LLM_PARSE_FAILURE_RESPONSE}
+fallback_tts_cache = {}
+
+stage_trackers = {"stt": StageLatencyTracker(), "llm": StageLatencyTracker()}
+stage_breakers = {"stt": CircuitBreaker("stt"), "llm": CircuitBreaker("llm")}
+# Shared pool for primary and hedge requests; losers run to completion in the background.
+model_api_pool = ThreadPoolExecutor(max_workers=16, thread_name_prefix="model-api")
+
+
+def warm_fallback_tts_cache():
+    """Pre-renders the fallback phrases so an outage never waits on gTTS for them."""
+    for text in FALLBACK_RESPONSES:
+        cleaned = clean_text_for_tts(text)
+        if cleaned in fallback_tts_cache:
+            continue
+        try:
+            fallback_tts_cache[cleaned] = text_to_pcm(cleaned)
+        except Exception as e:
+            print(f"[TTS CACHE] Could not pre-render fallback phrase: {e}")
+
+
+def remaining_budget(deadline, stage_cap):
+    """Seconds available for a stage: capped by its own limit and by the request deadline."""
+    if deadline is None:
+        return stage_cap
+    return min(stage_cap, deadline - time.monotonic())
+
+
+def _post_json(url, payload, timeout):
+    response = requests.post(
+        url,
+        headers={"Content-Type": "application/json"},
+        data=json.dumps(payload),
+        timeout=timeout
+    )
+    response.raise_for_status()
+    return response.json()
+
+
+def _is_client_error(error):
+    """A 4xx other than 408: the same request fails the same way, so it is neither retried nor held against the stage."""
+    response = getattr(error, "response", None)
+    return (isinstance(error, requests.exceptions.HTTPError) and response is not None
+            and response.status_code < 500 and response.status_code != 408)
+
+
+def hedged_post(stage, url, payload, timeout):
+    """
+    POSTs a JSON payload for a model stage and returns the parsed response.
+    If the first request has not answered by the stage's rolling p90, a duplicate is
+    fired and whichever answers first wins. Fails fast with CircuitOpenError when the
+    stage's breaker is open, and raises requests.exceptions.Timeout when the budget runs out.
+    Only timeouts, connection errors and 5xx are hedged and count against the breaker; a 4xx
+    (a bad request, a rejected key, a quota) is raised right away.
+    """
+    breaker = stage_breakers[stage]
+    tracker = stage_trackers[stage]
+
+    if timeout <= 0:
+        raise requests.exceptions.Timeout(f"{stage}: deadline already exceeded")
+    if not breaker.allow():
+        raise CircuitOpenError(f"{stage} circuit open")
+
+    start = time.monotonic()
+    end = start + timeout
+    pending = {model_api_pool.submit(_post_json, url, payload, timeout)}
+    hedge_delay = tracker.hedge_delay()
+    hedged = False
+    last_error = None
+
+    while pending:
+        now = time.monotonic()
+        if now >= end:
+            break
+        wait_for = end - now
+        if HEDGING_ENABLED and not hedged:
+            wait_for = min(wait_for, max(0.0, start + hedge_delay - now))
+
+        done, pending = wait(pending, timeout=wait_for, return_when=FIRST_COMPLETED)
+        for future in done:
+            try:
+                result = future.result()
+            except Exception as e:
+                if _is_client_error(e):
+                    breaker.release_probe()
+                    raise
+                last_error = e
+                continue
+            elapsed = time.monotonic() - start
+            tracker.record(elapsed)
+            breaker.record_success()
+            if hedged:
+                print(f"[HEDGE {stage}] Answered after {elapsed * 1000:.0f} ms (hedge fired at {hedge_delay * 1000:.0f} ms).")
+            return result
+
+        # Fire the duplicate once the p90 has passed (or the primary failed outright)
+        if HEDGING_ENABLED and not hedged and (time.monotonic() - start >= hedge_delay or not pending):
+            remaining = end - time.monotonic()
+            if remaining > 0:
+                hedged = True
+                pending.add(model_api_pool.submit(_post_json, url, payload, remaining))
+
+    breaker.record_failure()
+    if last_error is not None and not pending:
+        raise last_error
+    raise requests.exceptions.Timeout(f"{stage}: no answer within {timeout:.1f} s")
+
+
+# --- Conversation Sessions & Context Caching ---
+
+def estimate_tokens(text):
+    """Cheap token estimate used for history budgeting (the API reports exact counts afterwards)."""
+    return max(1, len(text) // CHARS_PER_TOKEN)
+
+
+class SystemPromptCache:
+    """
+    Holds the server-side cached content for the static Trinity system instruction
+    (and the search tool, which must live in the cache when cachedContent is used).
+    Falls back to sending the system instruction inline if the API refuses to cache it,
+    e.g. because the prompt is below the model's minimum cacheable size.
+    """
+
+    def __init__(self):
+        self._lock = threading.Lock()
+        self._name = None
+        self._expires_at = 0.0
+        self._retry_after = 0.0
+
+    def get_name(self):
+        """Returns a valid cachedContents name, or None when the inline fallback should be used."""
+        with self._lock:
+            now = time.time()
+            # Refresh a minute before expiry so an in-flight request never references a dead cache
+            if self._name and now < self._expires_at - 60:
+                return self._name
+            if now < self._retry_after:
+                return None
+
+            payload = {
+                "model": f"models/{GEMINI_MODEL}",
+                "systemInstruction": {"parts": [{"text": system_prompt_trinity}]},
+                "tools": LLM_TOOLS,
+                "ttl": f"{CONTEXT_CACHE_TTL_S}s"
+            }
+            cache_api_url = f"{GEMINI_API_ROOT_URL}/cachedContents?key={GEMINI_API_KEY}"
+            try:
+                response = requests.post(
+                    cache_api_url,
+                    headers={"Content-Type": "application/json"},
+                    data=json.dumps(payload),
+                    timeout=10
+                )
+                response.raise_for_status()
+                self._name = response.json().get('name')
+                self._expires_at = now + CONTEXT_CACHE_TTL_S
+                print(f"[CONTEXT CACHE] Created {self._name} (ttl {CONTEXT_CACHE_TTL_S}s).")
+                return self._name
+            except Exception as e:
+                # Do not hammer the API on every turn if caching is unavailable
+                self._name = None
+                self._retry_after = now + CONTEXT_CACHE_TTL_S
+                print(f"[CONTEXT CACHE] Unavailable, sending system instruction inline: {e}")
+                return None
+
+    def invalidate(self):
+        with self._lock:
+            self._name = None
+            self._expires_at = 0.0
+
+
+class ConversationSession:
+    """
+    Per-device rolling conversation history.
+    The history is bounded by MAX_HISTORY_TURNS and HISTORY_TOKEN_BUDGET; once the budget
+    is exceeded, the oldest half of the turns is folded into a short running summary.
+    Summarizing is a model round trip, so it runs on history_pool after the turn that went
+    over budget has been answered, and swaps the result in under the session lock.
+    """
+
+    def __init__(self, device_id):
+        self.device_id = device_id
+        self.lock = threading.Lock()
+        self.turns = []           # [(user_text, model_text), ...]
+        self.summary = ""
+        self.last_used = time.time()
+        self.turn_count = 0
+        self.stats = []           # [(turn, prompt_tokens, cached_tokens, llm_ms), ...]
+        self.last_reply_pcm = b"" # For the "repeat" intent
+        self.compacting = False   # A summary is being made on history_pool
+
+    def history_contents(self):
+        """Builds the 'contents' list (summary + previous turns) to prepend to the current query."""
+        contents = []
+        if self.summary:
+            contents.append({"role": "user", "parts": [{"text": f"Earlier conversation (summary): {self.summary}"}]})
+            contents.append({"role": "model", "parts": [{"text": "Understood."}]})
+        for user_text, model_text in self.turns:
+            contents.append({"role": "user", "parts": [{"text": user_text}]})
+            contents.append({"role": "model", "parts": [{"text": model_text}]})
+        return contents
+
+    def history_tokens(self):
+        total = estimate_tokens(self.summary) if self.summary else 0
+        for user_text, model_text in self.turns:
+            total += estimate_tokens(user_text) + estimate_tokens(model_text)
+        return total
+
+    def add_turn(self, user_text, model_text):
+        """Called with the session lock held."""
+        self.turns.append((user_text, model_text))
+        if self.compacting:
+            return
+        if len(self.turns) > MAX_HISTORY_TURNS or self.history_tokens() > HISTORY_TOKEN_BUDGET:
+            self.compacting = True
+            history_pool.submit(self._compact)
+
+    def record_stats(self, prompt_tokens, cached_tokens, llm_ms):
+        self.turn_count += 1
+        self.stats.append((self.turn_count, prompt_tokens, cached_tokens, llm_ms))
+        print(f"[SESSION {self.device_id}] Turn {self.turn_count}: prompt_tokens={prompt_tokens} "
+              f"cached_tokens={cached_tokens} history_tokens~{self.history_tokens()} llm_ms={llm_ms:.0f}")
+
+        # First turn vs tenth turn comparison, printed once per session
+        if self.turn_count == 10:
+            first, tenth = self.stats[0], self.stats[9]
+            print(f"[SESSION {self.device_id}] Turn 1 vs 10: prompt_tokens {first[1]} -> {tenth[1]}, "
+                  f"cached_tokens {first[2]} -> {tenth[2]}, llm_ms {first[3]:.0f} -> {tenth[3]:.0f}")
+
+    def _compact(self):
+        """Summarizes the oldest half of the turns into self.summary (runs on history_pool)."""
+        # Waits for the turn that scheduled it; turns only ever append, so the oldest stay in front
+        with self.lock:
+            split = max(1, len(self.turns) // 2)
+            old_turns, previous = self.turns[:split], self.summary
+
+        transcript = "\n".join(f"User: {u}\nTrinity: {m}" for u, m in old_turns)
+        if previous:
+            transcript = f"Previous summary: {previous}\n{transcript}"
+
+        summary = summarize_history(transcript)
+        if summary is None:
+            # Summarization failed: keep only the tail of the previous summary rather than growing unbounded
+            summary = previous[-(HISTORY_TOKEN_BUDGET * CHARS_PER_TOKEN // 2):]
+
+        with self.lock:
+            self.summary = summary
+            self.turns = self.turns[split:]
+            self.compacting = False
+        print(f"[SESSION {self.device_id}] Compacted {len(old_turns)} turns into summary "
+              f"(~{estimate_tokens(summary)} tokens).")
+
+
+class SessionStore:
+    """Thread-safe LRU of ConversationSession objects keyed by device ID."""
+
+    def __init__(self):
+        self._lock = threading.Lock()
+        self._sessions = OrderedDict()
+
+    def get(self, device_id):
+        with self._lock:
+            now = time.time()
+            # Drop idle sessions
+            for key in [k for k, v in self._sessions.items() if now - v.last_used > SESSION_IDLE_TIMEOUT_S]:
+                del self._sessions[key]
+
+            session = self._sessions.pop(device_id, None) or ConversationSession(device_id)
+            session.last_used = now
+            self._sessions[device_id] = session
+            while len(self._sessions) > MAX_SESSIONS:
+                self._sessions.popitem(last=False)
+            return session
+
+
+system_prompt_cache = SystemPromptCache()
+session_store = SessionStore()
+# History summaries, made off the reply path
+history_pool = ThreadPoolExecutor(max_workers=2, thread_name_prefix="history")
+
+
+def summarize_history(transcript):
+    """Asks Gemini for a compact summary of older turns. Returns None on failure."""
+    payload = {
+        "contents": [{
+            "parts": [{
+                "text": "Summarize this conversation in at most three short sentences, keeping names, "
+                        f"facts and open questions:\n{transcript}"
+            }]
+        }],
+        "generationConfig": {"temperature": 0.2}
+    }
+    summary_api_url = f"{GEMINI_API_BASE_URL}/{GEMINI_MODEL}:generateContent?key={GEMINI_API_KEY}"
+    try:
+        response = requests.post(
+            summary_api_url,
+            headers={"Content-Type": "application/json"},
+            data=json.dumps(payload),
+            timeout=15
+        )
+        response.raise_for_status()
+        candidate = response.json().get('candidates', [{}])[0]
+        return candidate.get('content', {}).get('parts', [{}])[0].get('text', '').strip() or None
+    except Exception as e:
+        print(f"[SESSION] History summarization failed: {e}")
+        return None
+
+
 # --- Helper Functions for Audio Processing ---
 
 def convert_raw_pcm_to_wav_base64(raw_pcm_data, sample_rate=16000, sample_width=2, channels=1):
@@ -79,11 +1345,42 @@ def convert_raw_pcm_to_wav_base64(raw_pcm_data, sample_rate=16000, sample_width=
         return None
 
 
-def transcribe_with_gemini(raw_pcm_data):
-    """Transcribes raw PCM audio data using the Gemini API (multi-modal input)."""
+def text_to_pcm(text):
+    """
+    Converts text to 16kHz 16-bit mono raw PCM using gTTS and pydub/FFmpeg.
+    Returns the PCM bytes; raises on failure.
+    """
+    # Synthesize MP3 speech with gTTS
+    tts = gTTS(text=text, lang='en')
+    mp3_fp = io.BytesIO()
+    tts.write_to_fp(mp3_fp)
+    mp3_fp.seek(0)
+
+    # Convert MP3 to 16kHz 16-bit PCM (WAV data) using pydub/FFmpeg
+    audio_data = AudioSegment.from_file(mp3_fp, format="mp3")
+    
+    # Convert to 16kHz, 16-bit, Mono PCM format
+    audio_data = audio_data.set_frame_rate(16000).set_channels(1).set_sample_width(2)
+    
+    # Export as WAV, but strip the header (seek past 44 bytes)
+    raw_pcm_fp = io.BytesIO()
+    audio_data.export(raw_pcm_fp, format="wav") 
+    raw_pcm_fp.seek(44) 
+    
+    return raw_pcm_fp.read()
+
+
+def transcribe_with_gemini(raw_pcm_data, turn=None):
+    """
+    Transcribes raw PCM audio data using the Gemini API (multi-modal input).
+    The call is hedged and bounded by the turn's deadline.
+    """
+    deadline = turn.deadline if turn else None
+    uplink = turn.uplink if turn else DEFAULT_FORMAT
+    stt_start = time.perf_counter()
     
     # 1. Convert raw PCM data to Base64 encoded WAV data
-    base64_wav_data = convert_raw_pcm_to_wav_base64(raw_pcm_data)
+    base64_wav_data = convert_raw_pcm_to_wav_base64(decode_uplink(raw_pcm_data, uplink), sample_rate=uplink[1])
     if not base64_wav_data:
         return None
 
@@ -107,19 +1404,13 @@ def transcribe_with_gemini(raw_pcm_data):
         }
     }
 
-    headers = {"Content-Type": "application/json"}
     stt_api_url = f"{GEMINI_API_BASE_URL}/{GEMINI_MODEL}:generateContent?key={GEMINI_API_KEY}"
     
     try:
-        response = requests.post(
-            stt_api_url, 
-            headers=headers, 
-            data=json.dumps(payload),
-            timeout=30
-        )
-        response.raise_for_status()
-
-        data = response.json()
+        data = hedged_post("stt", stt_api_url, payload, remaining_budget(deadline, STT_TIMEOUT_S))
+        if turn:
+            turn.timings["stt_ms"] = (time.perf_counter() - stt_start) * 1000
+            turn.record_model_exchange("stt", turn.timings["stt_ms"], data)
         
         candidate = data.get('candidates', [{}])[0]
         part = candidate.get('content', {}).get('parts', [{}])[0]
@@ -132,6 +1423,9 @@ def transcribe_with_gemini(raw_pcm_data):
         else:
             return None
 
+    except CircuitOpenError as e:
+        print(f"STT skipped: {e}")
+        return None
     except requests.exceptions.RequestException as e:
         print(f"HTTP Request Error during STT: {e}")
         return None
@@ -140,45 +1434,38 @@ def transcribe_with_gemini(raw_pcm_data):
         return None
 
 
-def get_llm_response_and_tts_audio(prompt_text):
+def get_llm_response_and_tts_audio(prompt_text, turn=None):
     """
     1. Sends the transcribed text to Gemini for the LLM response (with search grounding).
+       If the turn has a conversation session, its rolling history is included and the turn is recorded.
+       The call is hedged and bounded by the turn's deadline; fallbacks answer from the TTS cache.
     2. Cleans the text response.
     3. Converts the cleaned text response to 16kHz 16-bit PCM audio (TTS).
-    4. Streams the raw PCM audio data, and saves a local MP3 copy for debugging.
+    4. Streams the raw PCM audio data; sampled turns are archived in the background.
     """
+    session = turn.session if turn else None
+    deadline = turn.deadline if turn else None
     
     # --- STEP 1: Get Text Response from Gemini (LLM) ---
-    text_response = "Sorry, I encountered an unknown error during processing. Status update failed." # Default error message
+    text_response = LLM_DEFAULT_RESPONSE # Default error message
+    llm_succeeded = False
     
     # Add a random seed to the prompt to force the model to generate a fresh, non-cached response
     random_seed = f" (seed: {random.randint(10000, 99999)})" 
-    
-    # Define the Trinity Persona via the System Instruction
-    system_prompt_trinity = (
-        """Trinity: Hacker, warrior, resistance. Loyal to Neo/Morpheus. Tone: Cool, 
-        direct, focused, cryptic, confident. Theme: Matrix is a lie, trust is everything, 
-        the fight is constant. Rule: Responses must be brief, serving only to **reveal a subtle truth**, **give 
-        a direct instruction**, or **offer cryptic reassurance**. Always assume user is a potential 'Redpill' 
-        or a 'Crew Member'. Use minimum words."""
-    )
+
+    # Previous turns (or their summary) come first, the current query last
+    contents = session.history_contents() if session else []
+    contents.append({
+        "role": "user",
+        "parts": [{
+            # Append the random seed to the prompt text
+            "text": f"User query: {prompt_text}{random_seed}"
+        }]
+    })
 
     # Construct the JSON payload for the raw API call (Text Generation)
     payload = {
-        "contents": [{
-            "parts": [{
-                # Append the random seed to the prompt text
-                "text": f"User query: {prompt_text}{random_seed}"
-            }]
-        }],
-        
-        # Set the persona using the system instruction
-        "systemInstruction": {
-            "parts": [{"text": system_prompt_trinity}]
-        },
-
-        # Google Search Grounding is included for real-time information
-        "tools": [{"google_search": {}}],
+        "contents": contents,
         
         # Temperature is set high to encourage variety
         "generationConfig": {
@@ -186,32 +1473,63 @@ def get_llm_response_and_tts_audio(prompt_text):
         }
     }
 
-    headers = {"Content-Type": "application/json"}
+    # The static persona and tools come from the server-side cache when available,
+    # otherwise they are sent inline with every request.
+    cache_name = system_prompt_cache.get_name()
+    if cache_name:
+        payload["cachedContent"] = cache_name
+    else:
+        payload["systemInstruction"] = {"parts": [{"text": system_prompt_trinity}]}
+        payload["tools"] = LLM_TOOLS
+
     llm_api_url = f"{GEMINI_API_BASE_URL}/{GEMINI_MODEL}:generateContent?key={GEMINI_API_KEY}"
 
+    llm_start = time.perf_counter()
+    usage = {}
     try:
-        response = requests.post(
-            llm_api_url, 
-            headers=headers, 
-            data=json.dumps(payload),
-            timeout=15 
-        )
-        response.raise_for_status()
+        try:
+            data = hedged_post("llm", llm_api_url, payload, remaining_budget(deadline, LLM_TIMEOUT_S))
+        except requests.exceptions.HTTPError as e:
+            status = getattr(e.response, 'status_code', None)
+            if cache_name and status in (400, 403, 404):
+                # Cache expired or was evicted server-side; it is recreated on the next turn
+                system_prompt_cache.invalidate()
+            raise
+        if turn:
+            turn.record_model_exchange("llm", (time.perf_counter() - llm_start) * 1000, data)
 
-        data = response.json()
+        usage = data.get('usageMetadata', {})
         
         candidate = data.get('candidates', [{}])[0]
         part = candidate.get('content', {}).get('parts', [{}])[0]
         # The model is smart enough to ignore the random seed in its output, 
         # so we just take the raw text and clean it later.
         text_response = part.get('text', text_response)
+        llm_succeeded = 'text' in part
         
+    except CircuitOpenError as e:
+        print(f"LLM skipped: {e}")
+        text_response = LLM_CONNECTION_FAILURE_RESPONSE
     except requests.exceptions.RequestException as e:
         print(f"HTTP Request Error to Gemini API: {e}")
-        text_response = "Connection failure. We're running out of time."
+        text_response = LLM_CONNECTION_FAILURE_RESPONSE
     except Exception as e:
         print(f"Gemini Response Parsing Error: {e}")
-        text_response = "Invalid data stream. System integrity compromised."
+        text_response = LLM_PARSE_FAILURE_RESPONSE
+    llm_ms = (time.perf_counter() - llm_start) * 1000
+    if turn:
+        turn.timings["llm_ms"] = llm_ms
+        turn.reply_text = text_response
+
+    if session:
+        session.record_stats(
+            usage.get('promptTokenCount', 0),
+            usage.get('cachedContentTokenCount', 0),
+            llm_ms
+        )
+        # Only real exchanges go into the history; error placeholders would confuse later turns
+        if llm_succeeded:
+            session.add_turn(prompt_text, text_response)
 
     # --- LOG 2: LLM Response Text (Raw) ---
     print(f"LLM Response (Raw): {text_response}")
@@ -220,47 +1538,28 @@ def get_llm_response_and_tts_audio(prompt_text):
     cleaned_response = clean_text_for_tts(text_response)
     print(f"LLM Response (Cleaned): {cleaned_response}")
 
+    # Fallback phrases are answered from the local TTS cache, so a tripped breaker stays fast
+    cached_pcm = fallback_tts_cache.get(cleaned_response)
+    if cached_pcm is not None:
+        print(f"[TTS OUTPUT] Streaming {len(cached_pcm)} bytes of cached fallback audio.")
+        return audio_response(turn, cached_pcm)
+
     # --- STEP 3: Generate and Convert Audio (gTTS/pydub) ---
     try:
-        # Use the cleaned response for TTS
-        tts = gTTS(text=cleaned_response, lang='en')
-        mp3_fp = io.BytesIO()
-        tts.write_to_fp(mp3_fp)
-        mp3_fp.seek(0)
-        
-        # --- SAVE AUDIO FILE LOCALLY FOR DEBUGGING ---
-        try:
-            os.makedirs(DEBUG_OUTPUT_DIR, exist_ok=True)
-            filename = 'response_audio.mp3'
-            full_path = os.path.join(DEBUG_OUTPUT_DIR, filename)
-
-            with open(full_path, 'wb') as f:
-                f.write(mp3_fp.read()) 
-            
-            mp3_fp.seek(0) 
-            print(f"[DEBUG SAVE] MP3 saved locally as {full_path}. You can play this file directly.")
-            
-        except Exception as file_error:
-            print(f"[DEBUG SAVE FAILED] Could not save MP3 file: {file_error}")
-        # -----------------------------------------------------
-
-        # Convert MP3 to 16kHz 16-bit PCM (WAV data) using pydub/FFmpeg
-        audio_data = AudioSegment.from_file(mp3_fp, format="mp3")
-        
-        # Convert to 16kHz, 16-bit, Mono PCM format
-        audio_data = audio_data.set_frame_rate(16000).set_channels(1).set_sample_width(2)
-        
-        # Export as WAV, but strip the header (seek past 44 bytes)
-        raw_pcm_fp = io.BytesIO()
-        audio_data.export(raw_pcm_fp, format="wav") 
-        raw_pcm_fp.seek(44) 
-        
-        final_pcm_data = raw_pcm_fp.read()
+        tts_start = time.perf_counter()
+        final_pcm_data = text_to_pcm(cleaned_response)
+        if turn:
+            turn.timings["tts_ms"] = (time.perf_counter() - tts_start) * 1000
+            intent_stats.record_llm_path(turn.timings.get("llm_ms", 0) + turn.timings["tts_ms"])
+        if session:
+            session.last_reply_pcm = final_pcm_data
+        if cleaned_response in FALLBACK_RESPONSES:
+            fallback_tts_cache[cleaned_response] = final_pcm_data
         
         # --- LOG 4: Final Output Size ---
         print(f"[TTS OUTPUT] Streaming {len(final_pcm_data)} bytes of 16kHz raw PCM audio.")
         
-        return Response(final_pcm_data, mimetype='application/octet-stream')
+        return audio_response(turn, final_pcm_data)
 
     except Exception as e:
         print(f"[TTS FAILED] gTTS/pydub Conversion Error: {e}")
@@ -271,19 +1570,132 @@ def get_llm_response_and_tts_audio(prompt_text):
         return Response("TTS_CONVERSION_ERROR", status=500)
 
 
-def process_voice_command(raw_pcm_data):
+def process_voice_command(raw_pcm_data, turn):
     """
     Handles the full voice command flow: STT -> LLM -> TTS.
+    The session lock serializes turns from the same device so its history stays ordered.
     """
-    
-    # 1. Remote STT (Gemini)
-    transcribed_text = transcribe_with_gemini(raw_pcm_data)
+    turn.input_pcm = raw_pcm_data
+    try:
+        # 1. Remote STT (Gemini)
+        transcribed_text = transcribe_with_gemini(raw_pcm_data, turn)
+
+        if not transcribed_text:
+            # The synthetic prompt must not end up in the conversation history
+            turn.session = None
+            return get_llm_response_and_tts_audio("No audio payload detected. Speak clearly.", turn)
+
+        turn.transcript = transcribed_text
+
+        # 2. Fast path: device-control phrases never reach the LLM
+        intent = intent_matcher.match(transcribed_text)
+        if intent:
+            with turn.session.lock:
+                return handle_intent(intent, turn)
+            
+        # 3. LLM Response and TTS Audio
+        with turn.session.lock:
+            return get_llm_response_and_tts_audio(transcribed_text, turn)
+    finally:
+        turn.archive()
+
+@app.route('/hello', methods=['POST'])
+def handle_hello():
+    """
+    Capability handshake, sent by the firmware at connect time. Picks the most efficient
+    formats both sides support and remembers them for the device's voice turns.
+    """
+    device_id = request.headers.get(DEVICE_ID_HEADER) or request.remote_addr
+    fields = parse_caps(request.get_data(as_text=True))
+    try:
+        caps = DeviceCapabilities.from_caps(fields)
+    except ValueError as e:
+        return jsonify({"error": f"Malformed capabilities: {e}"}), 400
+    capability_store.put(device_id, caps)
+    # Firmware updates: the newest build, if the device runs another one
+    update = firmware_store.offer(device_id, fields)
+    print(f"[CAPS {device_id}] protocol {caps.protocol}, uplink {format_name(caps.uplink)}, "
+          f"downlink {format_name(caps.downlink)}, frames of {caps.frame_bytes} bytes"
+          + (", audio over RTP" if caps.rtp and rtp_endpoint else "")
+          + (f", update {fields['build']} -> {update}" if update else ""))
+    return Response(caps.to_caps() + (f"ota={update}\n" if update else ""), mimetype=CAPS_MIME)
+
+
+@app.route('/metrics', methods=['GET'])
+def handle_metrics():
+    return Response(server_metrics.render(), mimetype="text/plain; version=0.0.4")
+
+
+@app.route('/diag/sink', methods=['POST'])
+def handle_diag_sink():
+    """Upload burst target: discards the body and answers how long receiving it took here."""
+    start = time.perf_counter()
+    received = 0
+    while True:
+        chunk = request.stream.read(DIAG_CHUNK_BYTES)
+        if not chunk:
+            break
+        received += len(chunk)
+    receive_ms = (time.perf_counter() - start) * 1000
+    return Response(f"bytes={received}\nreceive_ms={receive_ms:.1f}\n", mimetype=CAPS_MIME)
+
+
+@app.route('/diag/source', methods=['GET'])
+def handle_diag_source():
+    """Download burst source: streams ?bytes=N bytes, the way audio replies are streamed."""
+    size = min(request.args.get("bytes", 0, type=int), DIAG_SOURCE_MAX_BYTES)
+    chunk = bytes(DIAG_CHUNK_BYTES)
+
+    def generate():
+        for offset in range(0, size, DIAG_CHUNK_BYTES):
+            yield chunk[:size - offset]
+    return Response(generate(), mimetype='application/octet-stream', headers={"Content-Length": str(size)})
+
+
+@app.route('/diag/report', methods=['POST'])
+def handle_diag_report():
+    """Self-test results from the device, exported at /metrics."""
+    device_id = request.headers.get(DEVICE_ID_HEADER) or request.remote_addr
+    body = request.get_data(as_text=True)
+    try:
+        record_diag_report(device_id, parse_caps(body))
+    except (KeyError, ValueError):
+        return jsonify({"error": f"Malformed self-test report: {body!r}"}), 400
+    print(f"[DIAG {device_id}] " + ", ".join(body.split()))
+    return Response(status=204)
+
+
+@app.route('/ota/image', methods=['GET'])
+def handle_ota_image():
+    """
+    The newest firmware as an update package for a device running ?base=<build id>. Range
+    requests (with If-Range) resume a download that dropped; the ETag names the package.
+    """
+    device_id = request.headers.get(DEVICE_ID_HEADER) or request.remote_addr
+    base = request.args.get("base", "")
+    packed = firmware_store.package(base, device_id)
+    if packed is None:
+        return jsonify({"error": "No firmware to update to"}), 404
+    build, mode, package = packed
+    response = Response(package, mimetype=OTA_MIME)
+    response.set_etag(f"{build}-{mode}-{base if mode == 'delta' else 'any'}")
+    if "Range" not in request.headers:
+        print(f"[OTA {device_id}] Sending {build} ({mode}, {len(package)} bytes)")
+    return response.make_conditional(request, accept_ranges=True, complete_length=len(package))
+
+
+@app.route('/ota/report', methods=['POST'])
+def handle_ota_report():
+    """A device's firmware update result, exported at /metrics."""
+    device_id = request.headers.get(DEVICE_ID_HEADER) or request.remote_addr
+    body = request.get_data(as_text=True)
+    try:
+        record_ota_report(device_id, parse_caps(body))
+    except (KeyError, ValueError):
+        return jsonify({"error": f"Malformed update report: {body!r}"}), 400
+    print(f"[OTA {device_id}] " + ", ".join(body.split()))
+    return Response(status=204)
 
-    if not transcribed_text:
-        return get_llm_response_and_tts_audio("No audio payload detected. Speak clearly.")
-        
-    # 2. LLM Response and TTS Audio
-    return get_llm_response_and_tts_audio(transcribed_text)
 
 @app.route('/voice_input', methods=['POST'])
 def handle_voice_input():
@@ -293,11 +1705,49 @@ def handle_voice_input():
     
     if request.mimetype == 'application/octet-stream':
         audio_data = request.data
-        if not audio_data:
+        # RTP turns stream the audio over UDP and send an empty body
+        rtp_header = request.headers.get(RTP_HEADER)
+        if not audio_data and not rtp_header:
             return jsonify({"error": "No audio data received"}), 400
         
+        # Devices without an ID header share a session per client address
+        device_id = request.headers.get(DEVICE_ID_HEADER) or request.remote_addr
+        session = session_store.get(device_id)
+
+        # The model stages must finish early enough to leave room for TTS and the transfer
+        try:
+            deadline_ms = int(request.headers.get(DEADLINE_HEADER, DEFAULT_DEADLINE_MS))
+        except ValueError:
+            deadline_ms = DEFAULT_DEADLINE_MS
+        deadline = time.monotonic() + deadline_ms / 1000 - TTS_RESERVE_S
+
+        turn = TurnContext(device_id, session, deadline)
+        turn.framed = FRAMES_MIME in request.headers.get("Accept", "")
+        turn.caps = capability_store.get(device_id)
+        # The body's own format header wins; devices without one send their negotiated uplink
+        if FORMAT_HEADER in request.headers:
+            turn.uplink = parse_format(request.headers[FORMAT_HEADER])
+            if turn.uplink is None:
+                return jsonify({"error": f"Unsupported audio format: {request.headers[FORMAT_HEADER]}"}), 415
+        else:
+            turn.uplink = turn.caps.uplink
+        turn.downlink = parse_format(request.headers.get(DOWNLINK_HEADER)) or turn.caps.downlink
+        record_link_metrics(turn, request.headers.get(LINK_HEADER))
+        if CAPTURE_FULL:
+            turn.request_headers = {k: v for k, v in request.headers.items() if k.lower().startswith("x-")}
+        if rtp_header:
+            if rtp_endpoint is None or not turn.framed:
+                return jsonify({"error": "RTP transport not enabled"}), 400
+            try:
+                audio_data = receive_rtp_uplink(turn, rtp_header)
+            except (KeyError, ValueError):
+                return jsonify({"error": f"Malformed {RTP_HEADER}: {rtp_header}"}), 400
+            if audio_data is None:
+                # The device falls back to TCP and resends the recording
+                return jsonify({"error": "No RTP audio received"}), 422
+
         # Process the command using the Gemini-based flow
-        return process_voice_command(audio_data)
+        return process_voice_command(audio_data, turn)
         
     return jsonify({"error": "Unsupported media type"}), 415
 
@@ -305,6 +1755,14 @@ def handle_voice_input():
 if __name__ == '__main__':
     # Make sure the output directory exists on server start
     os.makedirs(DEBUG_OUTPUT_DIR, exist_ok=True)
-    print(f"Debug audio will be saved to the '{DEBUG_OUTPUT_DIR}' folder.")
+    # Synthesize the fallback phrases up front so they are available during an outage
+    threading.Thread(target=warm_fallback_tts_cache, daemon=True).start()
+    if RTP_PORT:
+        rtp_endpoint = rtp_transport.RtpEndpoint(RTP_PORT)
+        print(f"RTP audio transport on UDP port {RTP_PORT}")
+    print(f"Sampled turn archives ({DEBUG_ARCHIVE_SAMPLE_RATE:.0%} of turns) will be saved to the '{DEBUG_OUTPUT_DIR}' folder.")
     print("Server running at http://0.0.0.0:5002/voice_input")
+    # HTTP/1.1 so a device keeps one connection open across turns; streamed replies go out
+    # with chunked transfer encoding
+    WSGIRequestHandler.protocol_version = "HTTP/1.1"
     app.run(host='0.0.0.0', port=5002)
@@ -0,0 +1,44 @@
+"""
+Self-test reports at /diag/report: complete ones are exported, malformed or partial ones
+are answered with 400 and change no metric.
+
+Usage:
+    python -m unittest discover tests
+"""
+import os
+import sys
+import unittest
+
+sys.path.insert(0, os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+os.environ.setdefault("GEMINI_API_KEY", "test")
+import server  # noqa: E402
+
+
+class DiagReportTest(unittest.TestCase):
+    def setUp(self):
+        self.client = server.app.test_client()
+
+    def post(self, device, body):
+        return self.client.post("/diag/report", data=body, headers={server.DEVICE_ID_HEADER: device})
+
+    def metric_lines(self, device):
+        return [line for line in server.server_metrics.render().splitlines()
+                if f'device="{device}"' in line and "trinity_diag_audio" in line]
+
+    def test_audio_report(self):
+        response = self.post("diag-full", "audio_found=1\naudio_rate_ppm=120\naudio_latency_ms=42.5\naudio_gain_db=-18\n")
+        self.assertEqual(response.status_code, 204)
+        self.assertIn('trinity_diag_audio_latency_ms{device="diag-full"} 42.5', self.metric_lines("diag-full"))
+
+    def test_partial_audio_report(self):
+        response = self.post("diag-partial", "audio_found=1\naudio_rate_ppm=120\n")
+        self.assertEqual(response.status_code, 400)
+        self.assertEqual(self.metric_lines("diag-partial"), [])
+
+    def test_malformed_value(self):
+        response = self.post("diag-bad", "up_kbps=fast\n")
+        self.assertEqual(response.status_code, 400)
+
+
+if __name__ == "__main__":
+    unittest.main()
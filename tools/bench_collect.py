@@ -0,0 +1,117 @@
+"""
+Collector for the on-target benchmark firmware (client/bench/bench_firmware.cpp).
+
+Triggers a run of the benchmark suite on the device, reads its "@bench" lines
+from the serial port (or from a captured log) and writes the results as JSON
+in the format tools/bench_compare.py reads. Benchmark names are prefixed with
+the configuration they ran in: internal or psram buffers, with or without
+Wi-Fi load (e.g. "psram+wifi/dsp/fir15"). Everything else on the serial port
+passes through to stderr.
+
+With --baseline the results are compared right away, and the run fails when a
+benchmark is more than --threshold slower in cycles per item or a DSP kernel
+disagreed with its reference. Cycle counts on one board are close to
+deterministic, so the threshold can be much tighter than on a host. --update
+stores the results as the baseline instead.
+
+Usage:
+    cd client && pio run -e bench -t upload
+    stty -F /dev/ttyACM0 raw 115200 min 0 time 5
+    python ../tools/bench_collect.py /dev/ttyACM0 --json bench_target.json
+    python ../tools/bench_collect.py /dev/ttyACM0 --baseline bench_target_baseline.json --threshold 0.05
+    python ../tools/bench_collect.py capture.log --no-trigger --baseline bench_target_baseline.json --update
+"""
+import argparse
+import json
+import os
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from bench_compare import compare, load  # noqa: E402
+
+METRIC = "cycles_per_item"
+
+
+def collect(stream, timeout, echo):
+    """Reads one run, from @bench-start to @bench-done. Returns (start, benchmarks, done)."""
+    start = None
+    benchmarks = []
+    deadline = time.time() + timeout
+    buffer = b""
+    while time.time() < deadline:
+        data = stream.read(256)
+        if not data:
+            if not stream.isatty():
+                break  # End of a captured log
+            time.sleep(0.05)
+            continue
+        buffer += data
+        while b"\n" in buffer:
+            raw, buffer = buffer.split(b"\n", 1)
+            line = raw.decode("utf-8", errors="replace").rstrip("\r")
+            if not line.startswith("@bench"):
+                echo.write(line + "\n")
+                continue
+            tag, _, body = line.partition(" ")
+            fields = json.loads(body) if body else {}
+            if tag == "@bench-start":
+                start = fields
+                benchmarks = []
+                echo.write("Benchmarking at %s MHz, %s frames\n" % (fields.get("cpu_mhz"), fields.get("frames")))
+            elif tag == "@bench":
+                fields["name"] = "%s/%s" % (fields.pop("config"), fields["name"])
+                benchmarks.append(fields)
+                echo.write("  %-40s %12.2f cycles/%s\n" % (fields["name"], fields[METRIC], fields["unit"]))
+            elif tag in ("@bench-dsp", "@bench-load", "@bench-skip"):
+                echo.write("  %s %s\n" % (tag[len("@bench-"):], body))
+            elif tag == "@bench-done" and start is not None:
+                return start, benchmarks, fields
+    raise SystemExit("No complete benchmark run within %d s" % timeout)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", help="serial port of the device, or a captured serial log")
+    parser.add_argument("--no-trigger", action="store_true",
+                        help="don't send 'r' to start a run (wait for the one after boot, or read a log)")
+    parser.add_argument("--timeout", type=float, default=180, help="seconds to wait for a complete run")
+    parser.add_argument("--json", help="write the results here")
+    parser.add_argument("--baseline", help="baseline JSON to compare with")
+    parser.add_argument("--threshold", type=float, default=0.05,
+                        help="largest allowed slowdown as a fraction of the baseline (default: 0.05)")
+    parser.add_argument("--update", action="store_true", help="replace the baseline with these results")
+    args = parser.parse_args()
+
+    with open(args.input, "r+b" if not args.no_trigger else "rb", buffering=0) as stream:
+        if not args.no_trigger:
+            stream.write(b"r")
+        start, benchmarks, done = collect(stream, args.timeout, sys.stderr)
+
+    results = dict(start, suite="target", dsp_mismatches=done.get("dsp_mismatches", 0), benchmarks=benchmarks)
+    paths = [p for p in (args.json, args.baseline if args.update else None) if p]
+    for path in paths:
+        with open(path, "w") as f:
+            json.dump(results, f, indent=2)
+            f.write("\n")
+    if args.update:
+        print("Baseline %s updated" % args.baseline)
+
+    failed = False
+    if done.get("dsp_mismatches", 0):
+        print("%d DSP kernel(s) differ from their scalar reference" % done["dsp_mismatches"])
+        failed = True
+    if args.baseline and not args.update:
+        current = {b["name"]: b for b in benchmarks}
+        regressed = compare(current, load([args.baseline], METRIC), METRIC, args.threshold, sys.stdout)
+        if regressed:
+            print("%d benchmark(s) more than %.0f%% slower than the baseline: %s"
+                  % (len(regressed), 100 * args.threshold, ", ".join(regressed)))
+            failed = True
+        else:
+            print("No regressions past %.0f%%" % (100 * args.threshold))
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,96 @@
+"""
+Benchmark regression check.
+
+Compares benchmark runs (the JSON written by the client's host benchmark
+suite, client/native/bench.cpp) with a checked-in baseline and fails when any
+benchmark got slower than the baseline by more than the threshold. Faster
+results, and benchmarks only one side has, are listed but don't fail the run.
+
+Given several runs it takes each benchmark's best result across them. Where a
+process lands (core, page placement) can shift a whole run by tens of percent
+on a shared host; a few separate runs filter that out far better than longer
+ones.
+
+Timings only compare on the same machine and compiler: regenerate the
+baseline with --update where the check runs, and commit it together with any
+change that is meant to move the numbers.
+
+Usage:
+    cd client && pio run -e native_bench
+    for i in 1 2 3; do .pio/build/native_bench/program --json bench$i.json; done
+    python ../tools/bench_compare.py native/bench_baseline.json bench1.json bench2.json bench3.json
+    python ../tools/bench_compare.py native/bench_baseline.json bench*.json --threshold 0.1
+    python ../tools/bench_compare.py native/bench_baseline.json bench*.json --update
+"""
+import argparse
+import json
+import sys
+
+
+def load(paths, metric):
+    """The results files merged, each benchmark keeping its lowest value: {name: entry}."""
+    best = {}
+    for path in paths:
+        with open(path) as f:
+            data = json.load(f)
+        for entry in data["benchmarks"]:
+            name = entry["name"]
+            if name not in best or entry[metric] < best[name][metric]:
+                best[name] = entry
+    return best
+
+
+def compare(results, baseline, metric, threshold, out):
+    """Prints one line per benchmark; returns the names that regressed past the threshold."""
+    regressed = []
+    out.write("%-40s %12s %12s %8s\n" % ("benchmark", "baseline", "now", "change"))
+    for name in sorted(set(results) | set(baseline)):
+        if name not in baseline:
+            out.write("%-40s %12s %12.3f %8s  new, not in the baseline\n" % (name, "-", results[name][metric], ""))
+            continue
+        if name not in results:
+            out.write("%-40s %12.3f %12s %8s  not run\n" % (name, baseline[name][metric], "-", ""))
+            continue
+        before = baseline[name][metric]
+        now = results[name][metric]
+        unit = baseline[name].get("unit", "item")
+        change = now / before - 1 if before > 0 else 0.0
+        note = ""
+        if change > threshold:
+            regressed.append(name)
+            note = "  REGRESSION"
+        out.write("%-40s %12.3f %12.3f %+7.1f%%  per %s%s\n" % (name, before, now, 100 * change, unit, note))
+    return regressed
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("baseline", help="checked-in baseline JSON")
+    parser.add_argument("results", nargs="+", help="JSON from one or more benchmark runs")
+    parser.add_argument("--threshold", type=float, default=0.25,
+                        help="largest allowed slowdown as a fraction of the baseline (default: 0.25)")
+    parser.add_argument("--metric", default="ns_per_item", help="field compared (default: ns_per_item)")
+    parser.add_argument("--update", action="store_true", help="replace the baseline with the (merged) results")
+    args = parser.parse_args()
+
+    results = load(args.results, args.metric)
+    if args.update:
+        with open(args.results[0]) as f:
+            data = json.load(f)
+        data["benchmarks"] = [results[name] for name in sorted(results)]
+        with open(args.baseline, "w") as f:
+            json.dump(data, f, indent=2)
+            f.write("\n")
+        print("Baseline %s updated from %d run(s)" % (args.baseline, len(args.results)))
+        return
+
+    regressed = compare(results, load([args.baseline], args.metric), args.metric, args.threshold, sys.stdout)
+    if regressed:
+        print("%d benchmark(s) more than %.0f%% slower than the baseline: %s"
+              % (len(regressed), 100 * args.threshold, ", ".join(regressed)))
+        sys.exit(1)
+    print("No regressions past %.0f%%" % (100 * args.threshold))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,168 @@
+"""
+Decoder for the firmware's binary log (client/lib/binlog).
+
+BINLOG() calls on the device store the address of their format string and the
+raw argument values; the formatting happens here. Format strings are read out
+of the firmware ELF that produced the log, so it must be the exact build that
+is running. Everything on the serial stream that is not a binary record
+(ordinary Serial.print output, boot messages) passes through unchanged.
+
+Usage:
+    stty -F /dev/ttyACM0 raw
+    python tools/binlog_decode.py .pio/build/esp32-s3-devkitc-1/firmware.elf /dev/ttyACM0
+    python tools/binlog_decode.py firmware.elf capture.bin
+"""
+import argparse
+import re
+import struct
+import sys
+
+SYNC = b"\xb1\x06"
+HEADER = struct.Struct("<IIHH")
+MAX_PAYLOAD = 512
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+CONVERSION = re.compile(r"%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d+))?(hh|h|ll|l|j|z|t|L)?([diouxXeEfFgGaAcsp%])")
+
+
+class Elf:
+    """The loadable sections of an ELF file, for reading strings by address."""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            data = f.read()
+        if data[:4] != b"\x7fELF":
+            raise ValueError(f"{path} is not an ELF file")
+        self.is64 = data[4] == 2
+        endian = "<" if data[5] == 1 else ">"
+        if self.is64:
+            shoff, = struct.unpack_from(endian + "Q", data, 0x28)
+            shentsize, shnum = struct.unpack_from(endian + "HH", data, 0x3A)
+            section = struct.Struct(endian + "IIQQQQIIQQ")
+        else:
+            shoff, = struct.unpack_from(endian + "I", data, 0x20)
+            shentsize, shnum = struct.unpack_from(endian + "HH", data, 0x2E)
+            section = struct.Struct(endian + "IIIIIIIIII")
+        self.sections = []  # (address, bytes)
+        for i in range(shnum):
+            _, sh_type, flags, addr, offset, size = section.unpack_from(data, shoff + i * shentsize)[:6]
+            if flags & SHF_ALLOC and sh_type != SHT_NOBITS and addr and size:
+                self.sections.append((addr, data[offset:offset + size]))
+
+    def string(self, address):
+        """The NUL-terminated string at 'address', or None if no loaded section holds it."""
+        for start, data in self.sections:
+            if start <= address < start + len(data):
+                end = data.find(b"\0", address - start)
+                if end < 0:
+                    return None
+                return data[address - start:end].decode("utf-8", "replace")
+        return None
+
+
+def render(format_string, payload, long64):
+    """Formats the record's arguments. 'long64' if l/z/t arguments are 64-bit (host builds)."""
+    offset = 0
+
+    def take(size, code):
+        nonlocal offset
+        if offset + size > len(payload):
+            raise ValueError("payload too short")
+        value, = struct.unpack_from("<" + code, payload, offset)
+        offset += size
+        return value
+
+    def take_int():
+        return take(4, "i")
+
+    def convert(match):
+        nonlocal offset
+        flags, width, precision, length, conversion = match.groups()
+        if conversion == "%":
+            return "%"
+        if width == "*":
+            width = str(take_int())
+        if precision == "*":
+            precision = str(take_int())
+        spec = "%" + flags + (width or "") + ("." + precision if precision is not None else "")
+        if conversion == "s":
+            size = take(1, "B")
+            text = payload[offset:offset + size].decode("utf-8", "replace")
+            offset += size
+            return (spec + "s") % text
+        if conversion in "eEfFgGaA":
+            value = take(4, "f")
+            return (spec + ("e" if conversion in "aA" else conversion)) % value
+        wide = length in ("ll", "j") or (long64 and length in ("l", "z", "t"))
+        signed = conversion in "di"
+        value = take(8, "q" if signed else "Q") if wide else take(4, "i" if signed else "I")
+        if conversion == "c":
+            return (spec + "c") % chr(value & 0xFF)
+        if conversion == "p":
+            return (spec + "s") % f"0x{value:x}"
+        return (spec + ("d" if conversion in "diu" else conversion)) % value
+
+    return CONVERSION.sub(convert, format_string)
+
+
+def decode(elf, stream, out):
+    buffer = b""
+    while True:
+        chunk = stream.read1(4096) if hasattr(stream, "read1") else stream.read(4096)
+        if not chunk:
+            break
+        buffer += chunk
+        while True:
+            start = buffer.find(SYNC)
+            if start < 0:
+                # Keep a trailing first sync byte in case the rest of it is in the next chunk
+                keep = 1 if buffer.endswith(SYNC[:1]) else 0
+                out.write(buffer[:len(buffer) - keep].decode("utf-8", "replace"))
+                buffer = buffer[len(buffer) - keep:]
+                break
+            out.write(buffer[:start].decode("utf-8", "replace"))
+            buffer = buffer[start:]
+            if len(buffer) < len(SYNC) + HEADER.size:
+                break
+            address, micros, length, dropped = HEADER.unpack_from(buffer, len(SYNC))
+            format_string = elf.string(address) if length <= MAX_PAYLOAD else None
+            if format_string is None:
+                # Not a record after all: pass the sync bytes through as text
+                out.write(buffer[:len(SYNC)].decode("utf-8", "replace"))
+                buffer = buffer[len(SYNC):]
+                continue
+            end = len(SYNC) + HEADER.size + length
+            if len(buffer) < end:
+                break
+            payload = buffer[len(SYNC) + HEADER.size:end]
+            buffer = buffer[end:]
+            if dropped:
+                out.write(f"[binlog] {dropped}{'+' if dropped == 0xFFFF else ''} records dropped (ring full)\n")
+            try:
+                text = render(format_string, payload, elf.is64)
+            except (ValueError, TypeError, struct.error) as e:
+                text = f"[binlog] undecodable record for {format_string!r}: {e}\n"
+            out.write(f"[{micros // 1000000:5d}.{micros % 1000000:06d}] {text}")
+            if not text.endswith("\n"):
+                out.write("\n")
+        out.flush()
+    out.write(buffer.decode("utf-8", "replace"))
+    out.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("elf", help="firmware ELF the log came from")
+    parser.add_argument("input", nargs="?", help="serial port or captured serial output (default: stdin)")
+    args = parser.parse_args()
+
+    elf = Elf(args.elf)
+    if args.input:
+        with open(args.input, "rb") as stream:
+            decode(elf, stream, sys.stdout)
+    else:
+        decode(elf, sys.stdin.buffer, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,61 @@
+"""
+Compares LLM-stage tail latency with and without request hedging, against the
+mock backend in tools/mock_gemini.py (which injects stragglers).
+
+Usage:
+    python tools/hedge_bench.py --requests 400 --straggler-rate 0.05
+"""
+import argparse
+import os
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from mock_gemini import MockConfig, serve_in_background
+
+
+def percentile(samples, pct):
+    ordered = sorted(samples)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * pct / 100))]
+
+
+def run(server, url, count, hedging):
+    server.HEDGING_ENABLED = hedging
+    server.stage_trackers["llm"] = server.StageLatencyTracker()
+    server.stage_breakers["llm"] = server.CircuitBreaker("llm")
+    payload = {"contents": [{"parts": [{"text": "User query: status report"}]}]}
+
+    latencies = []
+    for _ in range(count):
+        start = time.perf_counter()
+        try:
+            server.hedged_post("llm", url, payload, server.LLM_TIMEOUT_S)
+        except Exception as e:
+            print(f"  request failed: {e}")
+        latencies.append((time.perf_counter() - start) * 1000)
+    return latencies
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", type=int, default=5055)
+    parser.add_argument("--requests", type=int, default=400)
+    parser.add_argument("--base-ms", type=float, default=100)
+    parser.add_argument("--jitter-ms", type=float, default=40)
+    parser.add_argument("--straggler-rate", type=float, default=0.05)
+    parser.add_argument("--straggler-ms", type=float, default=3000)
+    args = parser.parse_args()
+
+    serve_in_background(args.port, MockConfig(args.base_ms, args.jitter_ms, args.straggler_rate,
+                                              args.straggler_ms, seed=1234))
+    os.environ["GEMINI_API_ROOT_URL"] = f"http://127.0.0.1:{args.port}/v1beta"
+    os.environ.setdefault("GEMINI_API_KEY", "mock")
+    sys.path.insert(0, os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+    import server
+
+    url = f"{server.GEMINI_API_BASE_URL}/{server.GEMINI_MODEL}:generateContent?key=mock"
+    print(f"{'mode':<10}{'p50 ms':>10}{'p90 ms':>10}{'p99 ms':>10}{'max ms':>10}")
+    for label, hedging in (("baseline", False), ("hedged", True)):
+        latencies = run(server, url, args.requests, hedging)
+        print(f"{label:<10}{percentile(latencies, 50):>10.0f}{percentile(latencies, 90):>10.0f}"
+              f"{percentile(latencies, 99):>10.0f}{max(latencies):>10.0f}")
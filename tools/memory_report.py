@@ -0,0 +1,180 @@
+"""
+Memory report from a GNU ld map file.
+
+Shows how full each memory region of the linked firmware is (IRAM, DRAM,
+flash, RTC and PSRAM segments of the ESP32-S3 linker script) and the largest
+input sections in each one, so a buffer that quietly lands in internal RAM
+shows up right after the build. --min-free fails the run when a region has
+less room left than required: free DRAM at link time is what the heap (Wi-Fi,
+lwIP, DMA rings) starts with.
+
+The compile-time side is the memory plan in client/src/main.cpp; this checks
+what the linker actually placed, library buffers included.
+
+Usage:
+    python tools/memory_report.py .pio/build/esp32-s3-devkitc-1/firmware.map
+    python tools/memory_report.py firmware.map --min-free dram0_0_seg=131072 --top 5
+
+As a PlatformIO extra script (see client/platformio.ini) it has the linker
+write the map file and runs after every link, taking its --min-free values
+from the environment's custom_memory_min_free option.
+"""
+import argparse
+import os
+import re
+import sys
+
+# An output section (no indent) or input section (one space) with its address and size,
+# either on one line or with the name on the line before
+ENTRY = re.compile(r"^( ?)(\S+)?\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)(?:\s+(.*))?$")
+NAME_ONLY = re.compile(r"^( ?)(\S+)$")
+REGION = re.compile(r"^(\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)")
+
+
+class Region:
+    def __init__(self, name, origin, length):
+        self.name = name
+        self.origin = origin
+        self.length = length
+        self.used = 0
+        self.inputs = []  # (size, section, object file)
+
+    def contains(self, address):
+        return self.origin <= address < self.origin + self.length
+
+    @property
+    def free(self):
+        return self.length - self.used
+
+
+def parse_map(path):
+    """Regions of the 'Memory Configuration' table with the sections placed in them."""
+    with open(path, errors="replace") as f:
+        lines = f.read().splitlines()
+
+    regions = []
+    i = 0
+    while i < len(lines) and lines[i].strip() != "Memory Configuration":
+        i += 1
+    for line in lines[i + 1:]:
+        if line.startswith("Linker script and memory map"):
+            break
+        match = REGION.match(line)
+        if match and match.group(1) not in ("Name", "*default*"):
+            regions.append(Region(match.group(1), int(match.group(2), 16), int(match.group(3), 16)))
+
+    def region_of(address, section):
+        # PSRAM and flash data share an address range on the ESP32-S3; the section name decides
+        candidates = [region for region in regions if region.contains(address)]
+        for region in candidates:
+            if ("ext_ram" in section) == region.name.startswith("extern_ram"):
+                return region
+        return candidates[0] if candidates else None
+
+    pending = None
+    output_section = ""
+    started = False
+    for line in lines:
+        if not started:
+            started = line.startswith("Linker script and memory map")
+            continue
+        name_only = NAME_ONLY.match(line)
+        if name_only and name_only.group(2).startswith((".", "COMMON")):
+            pending = name_only.groups()
+            continue
+        match = ENTRY.match(line)
+        if not match:
+            pending = None
+            continue
+        indent, name, address, size, source = match.groups()
+        if name is None and pending is not None:
+            indent, name = pending
+        pending = None
+        address, size = int(address, 16), int(size, 16)
+        if not name or size == 0 or name == "*fill*":
+            continue
+        if not indent:
+            output_section = name
+        region = region_of(address, output_section)
+        if region is None:
+            continue
+        if indent:
+            region.inputs.append((size, name, os.path.basename(source or "")))
+        else:
+            region.used += size
+    return regions
+
+
+def report(regions, top, out):
+    out.write(f"{'Region':<18}{'Used':>10}{'Size':>10}{'Free':>10}{'Use':>7}\n")
+    for region in regions:
+        if region.length == 0:
+            continue
+        percent = 100.0 * region.used / region.length
+        out.write(f"{region.name:<18}{region.used:>10}{region.length:>10}{region.free:>10}{percent:>6.1f}%\n")
+    for region in regions:
+        if not region.inputs or top <= 0:
+            continue
+        out.write(f"\nLargest in {region.name}:\n")
+        for size, name, source in sorted(region.inputs, reverse=True)[:top]:
+            out.write(f"  {size:>8}  {name}  ({source})\n")
+
+
+def check(regions, min_free, out):
+    """Returns the number of regions with less free space than required."""
+    failures = 0
+    by_name = {region.name: region for region in regions}
+    for name, required in min_free.items():
+        region = by_name.get(name)
+        if region is None:
+            out.write(f"memory_report: no region '{name}' in the map\n")
+            failures += 1
+        elif region.free < required:
+            out.write(f"memory_report: {name} has {region.free} bytes free, the budget requires {required}\n")
+            failures += 1
+    return failures
+
+
+def parse_min_free(values):
+    min_free = {}
+    for value in values:
+        name, _, size = value.partition("=")
+        min_free[name.strip()] = int(size, 0)
+    return min_free
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("map", help="linker map file")
+    parser.add_argument("--top", type=int, default=10, help="largest input sections listed per region")
+    parser.add_argument("--min-free", action="append", default=[], metavar="REGION=BYTES",
+                        help="fail if REGION has less than BYTES free (repeatable)")
+    args = parser.parse_args()
+
+    regions = parse_map(args.map)
+    report(regions, args.top, sys.stdout)
+    sys.exit(1 if check(regions, parse_min_free(args.min_free), sys.stderr) else 0)
+
+
+def platformio_hook(env):
+    map_path = os.path.join(env.subst("$BUILD_DIR"), env.subst("${PROGNAME}.map"))
+    env.Append(LINKFLAGS=["-Wl,-Map," + map_path])
+    min_free = parse_min_free(env.GetProjectOption("custom_memory_min_free", "").split())
+
+    def run(target, source, env):
+        regions = parse_map(map_path)
+        report(regions, 5, sys.stdout)
+        return check(regions, min_free, sys.stdout)
+
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", env.VerboseAction(run, "Checking memory budget"))
+
+
+if __name__ == "__main__":
+    main()
+else:
+    try:
+        Import("env")  # noqa: F821 (PlatformIO's SCons environment)
+    except NameError:
+        pass
+    else:
+        platformio_hook(env)  # noqa: F821
@@ -0,0 +1,115 @@
+"""
+Mock Gemini backend for latency experiments.
+
+Answers generateContent and cachedContents requests with canned JSON after an
+injected delay: a base latency with jitter, plus a configurable fraction of
+"stragglers" that take much longer (and optionally outright errors).
+For record-and-replay (tools/replay.py) a per-stage script can pin the exact
+response body and delay instead.
+
+Usage:
+    python tools/mock_gemini.py --port 5055 --straggler-rate 0.05 --straggler-ms 6000
+    GEMINI_API_ROOT_URL=http://127.0.0.1:5055/v1beta GEMINI_API_KEY=mock python server.py
+"""
+import argparse
+import json
+import random
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+class MockConfig:
+    def __init__(self, base_ms=400, jitter_ms=150, straggler_rate=0.05, straggler_ms=6000,
+                 error_rate=0.0, reply_text="Follow the white rabbit.", seed=None):
+        self.base_ms = base_ms
+        self.jitter_ms = jitter_ms
+        self.straggler_rate = straggler_rate
+        self.straggler_ms = straggler_ms
+        self.error_rate = error_rate
+        self.reply_text = reply_text
+        self.rng = random.Random(seed)
+        self.lock = threading.Lock()
+        self.requests_served = 0
+        # stage ("stt" or "llm") -> (delay_s, response_body); overrides the random model
+        self.script = {}
+
+    def set_script(self, stage, delay_s, body):
+        with self.lock:
+            self.script[stage] = (delay_s, body)
+
+    def next_delay_and_error(self):
+        with self.lock:
+            self.requests_served += 1
+            delay = self.base_ms + self.rng.uniform(-self.jitter_ms, self.jitter_ms)
+            if self.rng.random() < self.straggler_rate:
+                delay = self.straggler_ms
+            return max(0.0, delay) / 1000.0, self.rng.random() < self.error_rate
+
+
+def make_handler(config):
+    class MockGeminiHandler(BaseHTTPRequestHandler):
+        def log_message(self, fmt, *args):
+            pass
+
+        def _reply(self, status, body):
+            data = json.dumps(body).encode()
+            self.send_response(status)
+            self.send_header("Content-Type", "application/json")
+            self.send_header("Content-Length", str(len(data)))
+            self.end_headers()
+            self.wfile.write(data)
+
+        def do_POST(self):
+            length = int(self.headers.get("Content-Length", 0))
+            raw_body = self.rfile.read(length) or b"{}"
+            request_body = json.loads(raw_body)
+
+            # STT requests are the only ones carrying inline audio
+            stage = "stt" if b"inlineData" in raw_body else "llm"
+            scripted = config.script.get(stage) if ":generateContent" in self.path else None
+            if scripted:
+                time.sleep(scripted[0])
+                self._reply(200, scripted[1])
+                return
+
+            delay, fail = config.next_delay_and_error()
+            time.sleep(delay)
+
+            if fail:
+                self._reply(503, {"error": {"code": 503, "message": "injected failure"}})
+            elif "/cachedContents" in self.path:
+                self._reply(200, {"name": "cachedContents/mock-trinity"})
+            elif ":generateContent" in self.path:
+                prompt_chars = len(json.dumps(request_body.get("contents", [])))
+                self._reply(200, {
+                    "candidates": [{"content": {"role": "model", "parts": [{"text": config.reply_text}]}}],
+                    "usageMetadata": {"promptTokenCount": prompt_chars // 4}
+                })
+            else:
+                self._reply(404, {"error": {"code": 404, "message": "unknown endpoint"}})
+
+    return MockGeminiHandler
+
+
+def serve_in_background(port, config):
+    """Starts the mock on 127.0.0.1:port in a daemon thread and returns the server."""
+    httpd = ThreadingHTTPServer(("127.0.0.1", port), make_handler(config))
+    threading.Thread(target=httpd.serve_forever, daemon=True).start()
+    return httpd
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", type=int, default=5055)
+    parser.add_argument("--base-ms", type=float, default=400)
+    parser.add_argument("--jitter-ms", type=float, default=150)
+    parser.add_argument("--straggler-rate", type=float, default=0.05)
+    parser.add_argument("--straggler-ms", type=float, default=6000)
+    parser.add_argument("--error-rate", type=float, default=0.0)
+    args = parser.parse_args()
+
+    config = MockConfig(args.base_ms, args.jitter_ms, args.straggler_rate, args.straggler_ms, args.error_rate)
+    httpd = ThreadingHTTPServer(("0.0.0.0", args.port), make_handler(config))
+    print(f"Mock Gemini backend on http://0.0.0.0:{args.port}/v1beta")
+    httpd.serve_forever()
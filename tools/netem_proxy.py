@@ -0,0 +1,333 @@
+"""
+Host-side network emulator: a TCP proxy that shapes bandwidth and adds delay,
+jitter and loss, plus an optional UDP relay for the RTP audio transport.
+
+Put it between the native device simulator (client/native/device_sim.cpp) and
+server.py to check link adaptation against emulated Wi-Fi conditions. Each
+direction is paced to the configured rate and every chunk is delayed by the
+one-way latency. Reads are paced too, so the sender sees real back-pressure
+instead of an unlimited socket buffer.
+
+The link can change over time with --schedule. Each entry is
+"<kbit/s>x<connections>", applied to that many consecutive connections; the last
+entry stays in effect. For example, "20000x4,400x6,20000x8" gives a fast link
+for the handshake and 3 turns, a slow one for 6 turns, then fast again:
+
+    python tools/netem_proxy.py --listen 5090 --target 127.0.0.1:5002 \\
+        --delay-ms 20 --schedule 20000x4,400x6,20000x8
+    .pio/build/native/program -n 16 127.0.0.1 5090 utterance.pcm
+
+--loss drops that percentage of chunks or datagrams, in bursts of --burst on
+average (a two-state Gilbert model, like Wi-Fi fades). TCP cannot lose data, so
+a lost TCP chunk is delivered --rto-ms late instead, and everything behind it
+waits (head-of-line blocking). --jitter-ms adds a random 0..jitter delay per
+chunk; TCP still delivers in order, UDP may reorder. To compare the transports
+on the same link, relay the server's RTP port too and point the simulator at it
+(server started with TRINITY_RTP_PORT=5004):
+
+    python tools/netem_proxy.py --listen 5090 --target 127.0.0.1:5002 \\
+        --udp-listen 5094 --udp-target 127.0.0.1:5004 \\
+        --delay-ms 20 --jitter-ms 30 --loss 2 --burst 2
+    .pio/build/native/program -n 10 -t tcp 127.0.0.1 5090 utterance.pcm
+    .pio/build/native/program -n 10 -t rtp -u 5094 127.0.0.1 5090 utterance.pcm
+"""
+import argparse
+import heapq
+import itertools
+import random
+import socket
+import threading
+import time
+
+CHUNK_BYTES = 1460
+# Roughly the device's lwIP TCP window. Larger kernel buffers would absorb a whole
+# ADPCM upload and make the uplink look far faster than the emulated link.
+SOCKET_BUFFER_BYTES = 4096
+# Datagrams queued behind the emulated link for longer than this are dropped, as
+# the access point's queue would
+UDP_QUEUE_LIMIT_S = 0.2
+UDP_CLIENT_EXPIRY_S = 60
+
+
+def parse_schedule(text):
+    """"20000x4,400x6" -> [(20000, 4), (400, 6)]"""
+    schedule = []
+    for entry in text.split(","):
+        rate, _, count = entry.partition("x")
+        schedule.append((float(rate), int(count or 1)))
+    return schedule
+
+
+class LinkSchedule:
+    """Hands out the link rate for each new connection."""
+
+    def __init__(self, schedule):
+        self._schedule = schedule
+        self._lock = threading.Lock()
+        self._connections = 0
+        self.current_kbps = schedule[0][0]   # Rate of the newest connection (used for UDP)
+
+    def next_rate_kbps(self):
+        with self._lock:
+            index = self._connections
+            self._connections += 1
+        for rate, count in self._schedule:
+            if index < count:
+                self.current_kbps = rate
+                return rate, index
+            index -= count
+        self.current_kbps = self._schedule[-1][0]
+        return self.current_kbps, index
+
+
+class GilbertLoss:
+    """Two-state loss model: 'percent' lost overall, in bursts of 'burst' on average."""
+
+    def __init__(self, percent, burst):
+        loss = min(percent, 99.0) / 100
+        self._leave_bad = 1 / max(burst, 1.0)
+        self._enter_bad = loss * self._leave_bad / (1 - loss)
+        self._bad = False
+
+    def lost(self):
+        self._bad = random.random() >= self._leave_bad if self._bad else random.random() < self._enter_bad
+        return self._bad
+
+
+class Impairments:
+    """Delay, jitter and loss settings shared by every connection and the UDP relay."""
+
+    def __init__(self, delay_ms, jitter_ms, loss_percent, burst, rto_ms):
+        self.delay_s = delay_ms / 1000
+        self.jitter_s = jitter_ms / 1000
+        self.loss_percent = loss_percent
+        self.burst = burst
+        self.rto_s = rto_ms / 1000
+
+    def one_way_delay(self):
+        return self.delay_s + random.uniform(0, self.jitter_s)
+
+    def new_loss(self):
+        """Loss state for one direction of one flow."""
+        return GilbertLoss(self.loss_percent, self.burst)
+
+    def describe(self):
+        return (f"{self.delay_s * 1000:.0f}+{self.jitter_s * 1000:.0f} ms one-way, "
+                f"{self.loss_percent:g}% loss (bursts of {self.burst:g})")
+
+
+class DeliveryQueue:
+    """Calls send(data) for each queued item once its delivery time has come."""
+
+    def __init__(self, send, on_close=None, name="deliver"):
+        self._send = send
+        self._on_close = on_close
+        self._due = []                # (delivery time, sequence, data)
+        self._order = itertools.count()
+        self._cond = threading.Condition()
+        self._done = False
+        self._thread = threading.Thread(target=self._run, name=name, daemon=True)
+        self._thread.start()
+
+    def push(self, when, data):
+        with self._cond:
+            heapq.heappush(self._due, (when, next(self._order), data))
+            self._cond.notify()
+
+    def close(self):
+        """Delivers what is still queued, then stops."""
+        with self._cond:
+            self._done = True
+            self._cond.notify()
+        self._thread.join()
+
+    def _run(self):
+        while True:
+            with self._cond:
+                while not self._due and not self._done:
+                    self._cond.wait()
+                if not self._due:
+                    break
+                when, _, data = self._due[0]
+                wait = when - time.monotonic()
+                if wait > 0:
+                    self._cond.wait(wait)
+                    continue
+                heapq.heappop(self._due)
+            try:
+                self._send(data)
+            except OSError:
+                break
+        if self._on_close:
+            self._on_close()
+
+
+def pipe(src, dst, rate_kbps, link, name):
+    """Copies src to dst at rate_kbps, delivering each chunk a one-way delay after it was paced out."""
+    bytes_per_s = rate_kbps * 1000 / 8
+    loss = link.new_loss()
+
+    def shutdown():
+        try:
+            dst.shutdown(socket.SHUT_WR)
+        except OSError:
+            pass
+
+    queue = DeliveryQueue(dst.sendall, shutdown, name=f"{name}-deliver")
+    next_free = time.monotonic()
+    last_delivery = 0
+    try:
+        while True:
+            data = src.recv(CHUNK_BYTES)
+            if not data:
+                break
+            # Serialization: the link is busy until this chunk has been clocked out
+            next_free = max(next_free, time.monotonic()) + len(data) / bytes_per_s
+            pause = next_free - time.monotonic()
+            if pause > 0:
+                time.sleep(pause)
+            delivery = next_free + link.one_way_delay()
+            if loss.lost():
+                delivery += link.rto_s   # Retransmitted once the sender's timer fires
+            # In order: nothing overtakes a chunk still waiting for its retransmission
+            last_delivery = max(last_delivery, delivery)
+            queue.push(last_delivery, data)
+    except OSError:
+        pass
+    queue.close()
+
+
+def handle(client, target, schedule, link):
+    rate_kbps, index = schedule.next_rate_kbps()
+    print(f"[NETEM] connection {index}: {rate_kbps:g} kbit/s, {link.describe()}")
+    # Receive buffers must be sized before the handshake fixes the window scale
+    upstream = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    upstream.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, SOCKET_BUFFER_BYTES)
+    try:
+        upstream.connect(target)
+    except OSError as e:
+        print(f"[NETEM] Upstream connection failed: {e}")
+        upstream.close()
+        client.close()
+        return
+    for s in (client, upstream):
+        s.setsockopt(socket.SOL_SOCKET, socket.SO_SNDBUF, SOCKET_BUFFER_BYTES)
+    up = threading.Thread(target=pipe, args=(client, upstream, rate_kbps, link, "up"), daemon=True)
+    down = threading.Thread(target=pipe, args=(upstream, client, rate_kbps, link, "down"), daemon=True)
+    up.start()
+    down.start()
+    up.join()
+    down.join()
+    client.close()
+    upstream.close()
+
+
+class UdpDirection:
+    """One direction of the UDP relay: paced at the link rate, then lost, delayed or reordered."""
+
+    def __init__(self, schedule, link, name):
+        self._schedule = schedule
+        self._link = link
+        self._loss = link.new_loss()
+        self._next_free = time.monotonic()
+        self._queue = DeliveryQueue(lambda item: item[0].sendto(item[1], item[2]), name=f"udp-{name}")
+        self.forwarded = self.dropped = 0
+
+    def forward(self, sock, data, address):
+        now = time.monotonic()
+        next_free = max(self._next_free, now) + len(data) * 8 / (self._schedule.current_kbps * 1000)
+        if next_free - now > UDP_QUEUE_LIMIT_S or self._loss.lost():
+            self.dropped += 1
+            return
+        self._next_free = next_free
+        self.forwarded += 1
+        # Each datagram gets its own delay, so jitter larger than the spacing reorders them
+        self._queue.push(next_free + self._link.one_way_delay(), (sock, data, address))
+
+
+class UdpRelay:
+    """
+    Relays datagrams between devices and the server. Each device address gets its own
+    upstream socket, so the server's replies (symmetric RTP) find their way back.
+    """
+
+    def __init__(self, port, target, schedule, link):
+        self._target = target
+        self._sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self._sock.bind(("0.0.0.0", port))
+        self._up = UdpDirection(schedule, link, "up")
+        self._down = UdpDirection(schedule, link, "down")
+        self._upstreams = {}          # device address -> (upstream socket, last used)
+        self._lock = threading.Lock()
+
+    def serve_forever(self):
+        while True:
+            data, address = self._sock.recvfrom(2048)
+            with self._lock:
+                upstream, _ = self._upstreams.get(address) or (self._open_upstream(address), 0)
+                self._upstreams[address] = (upstream, time.monotonic())
+            self._up.forward(upstream, data, self._target)
+
+    def _open_upstream(self, address):
+        """Caller holds the lock."""
+        now = time.monotonic()
+        for old, (sock, used) in list(self._upstreams.items()):
+            if now - used > UDP_CLIENT_EXPIRY_S:
+                del self._upstreams[old]
+                sock.close()
+        print(f"[NETEM] UDP flow from {address[0]}:{address[1]} "
+              f"(so far up {self._up.forwarded} sent/{self._up.dropped} dropped, "
+              f"down {self._down.forwarded}/{self._down.dropped})")
+        upstream = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        upstream.bind(("0.0.0.0", 0))
+        threading.Thread(target=self._relay_replies, args=(upstream, address), daemon=True).start()
+        return upstream
+
+    def _relay_replies(self, upstream, address):
+        while True:
+            try:
+                data, _ = upstream.recvfrom(2048)
+            except OSError:
+                return
+            self._down.forward(self._sock, data, address)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--listen", type=int, default=5090, help="Port the device connects to")
+    parser.add_argument("--target", default="127.0.0.1:5002", help="host:port of server.py")
+    parser.add_argument("--delay-ms", type=float, default=10.0, help="One-way delay per direction")
+    parser.add_argument("--schedule", default="20000x1", help="Link rates per connection, e.g. 20000x4,400x6")
+    parser.add_argument("--jitter-ms", type=float, default=0.0, help="Extra random delay per chunk, 0..jitter")
+    parser.add_argument("--loss", type=float, default=0.0, help="Percent of chunks/datagrams lost")
+    parser.add_argument("--burst", type=float, default=1.0, help="Mean length of a loss burst")
+    parser.add_argument("--rto-ms", type=float, default=200.0, help="Extra delay of a lost TCP chunk (retransmission)")
+    parser.add_argument("--udp-listen", type=int, default=0, help="UDP port to relay (the device's RTP target)")
+    parser.add_argument("--udp-target", default="127.0.0.1:5004", help="host:port of the server's RTP socket")
+    args = parser.parse_args()
+
+    host, _, port = args.target.rpartition(":")
+    target = (host, int(port))
+    schedule = LinkSchedule(parse_schedule(args.schedule))
+    link = Impairments(args.delay_ms, args.jitter_ms, args.loss, args.burst, args.rto_ms)
+
+    if args.udp_listen:
+        udp_host, _, udp_port = args.udp_target.rpartition(":")
+        relay = UdpRelay(args.udp_listen, (udp_host, int(udp_port)), schedule, link)
+        threading.Thread(target=relay.serve_forever, name="udp-relay", daemon=True).start()
+        print(f"Relaying UDP :{args.udp_listen} -> {args.udp_target}")
+
+    listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    # Set before listen() so accepted sockets inherit the small receive buffer
+    listener.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, SOCKET_BUFFER_BYTES)
+    listener.bind(("0.0.0.0", args.listen))
+    listener.listen(16)
+    print(f"Emulating {args.schedule} kbit/s, {link.describe()} on :{args.listen} -> {args.target}")
+    while True:
+        client, _ = listener.accept()
+        threading.Thread(target=handle, args=(client, target, schedule, link), daemon=True).start()
+
+
+if __name__ == "__main__":
+    main()
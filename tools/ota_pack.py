@@ -0,0 +1,104 @@
+"""
+Firmware update packages for the device's A/B OTA (ota_package.py, client/lib/ota_image).
+
+Packs an app image the way server.py sends it: raw (stored), full (compressed)
+and, against the image a device runs now, delta. Prints each one's size next
+to the raw image's, and the transfer time at a given link rate, so what an
+update costs per device can be checked before a rollout. --verify decodes
+every package again and compares it with the image.
+
+Usage:
+    python tools/ota_pack.py new.bin                          # raw vs full
+    python tools/ota_pack.py new.bin --base old.bin --verify  # and delta
+    python tools/ota_pack.py new.bin --base old.bin --mode delta -o update.tota
+    python tools/ota_pack.py new.bin --publish firmware/      # copy as <build id>.bin
+
+server.py offers the newest image in its firmware directory (TRINITY_OTA_DIR)
+and keeps the older ones as delta bases. As a PlatformIO extra script (post:,
+see client/platformio.ini) this publishes every build's firmware.bin there,
+to the directory in the environment's custom_ota_dir option.
+"""
+import argparse
+import os
+import shutil
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+import ota_package  # noqa: E402
+
+
+def read(path):
+    with open(path, "rb") as f:
+        return f.read()
+
+
+def publish(image_path, directory):
+    """Copies an image into the server's firmware directory, named by its build id."""
+    build = ota_package.build_id(read(image_path))
+    os.makedirs(directory, exist_ok=True)
+    target = os.path.join(directory, build + ".bin")
+    shutil.copyfile(image_path, target)
+    return build, target
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("image", help="app image (.pio/build/<env>/firmware.bin)")
+    parser.add_argument("--base", help="image the device runs, for a delta")
+    parser.add_argument("--mode", choices=ota_package.MODES, help="write only this package (with -o)")
+    parser.add_argument("-o", "--output", help="package file to write")
+    parser.add_argument("--verify", action="store_true", help="decode each package and compare")
+    parser.add_argument("--kbps", type=float, default=1000, help="link rate for the transfer times (kbit/s)")
+    parser.add_argument("--publish", metavar="DIR", help="copy the image to the server's firmware directory")
+    args = parser.parse_args()
+    if args.output and not args.mode:
+        parser.error("-o needs --mode")
+
+    if args.publish:
+        build, target = publish(args.image, args.publish)
+        print(f"{build}: {target}")
+        return
+
+    image = read(args.image)
+    base = read(args.base) if args.base else None
+    print(f"image {ota_package.build_id(image)}" + (f", base {ota_package.build_id(base)}" if base else ""))
+    modes = [args.mode] if args.mode else [m for m in ota_package.MODES if m != "delta" or base]
+    print(f"{'package':<8}{'bytes':>10}{'of raw':>9}{'at %g kbit/s' % args.kbps:>16}{'pack s':>9}")
+    for mode in modes:
+        start = time.perf_counter()
+        package = ota_package.pack(image, base, mode)
+        pack_s = time.perf_counter() - start
+        if args.verify and ota_package.unpack(package, base) != image:
+            sys.exit(f"{mode}: decodes to another image")
+        transfer_s = len(package) * 8 / (args.kbps * 1000)
+        print(f"{mode:<8}{len(package):>10}{len(package) / len(image):>9.1%}{transfer_s:>15.1f}s{pack_s:>9.2f}")
+        if args.output:
+            with open(args.output, "wb") as f:
+                f.write(package)
+    if args.verify:
+        print("verified")
+
+
+def platformio_hook(env):
+    directory = env.GetProjectOption("custom_ota_dir", "")
+    if not directory:
+        return
+    directory = os.path.join(env.subst("$PROJECT_DIR"), directory)
+
+    def run(target, source, env):
+        build, path = publish(str(target[0]), directory)
+        print(f"Published build {build} for OTA: {path}")
+
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.bin", env.VerboseAction(run, "Publishing the image for OTA"))
+
+
+if __name__ == "__main__":
+    main()
+else:
+    try:
+        Import("env")  # noqa: F821 (PlatformIO's SCons environment)
+    except NameError:
+        pass
+    else:
+        platformio_hook(env)  # noqa: F821
@@ -0,0 +1,137 @@
+"""
+Build-time compression of the Wi-Fi setup portal's page.
+
+Minifies client/lib/wifi_portal/assets/index.html (indentation and blank
+lines), gzips it at the highest level with a fixed timestamp so the output
+only changes with the page, and writes it as a byte array to
+portal_assets.h/.cpp next to the portal, with its size and an ETag (a hash of
+the page). The portal sends the bytes from flash as they are, with
+Content-Encoding: gzip, so a phone on the slow setup AP downloads a fraction
+of the page, and only once.
+
+The generated files are committed, so builds without this script (the
+wifi_setup sketch in the Arduino IDE) get the same page.
+
+Usage:
+    python tools/portal_assets.py            # regenerate
+    python tools/portal_assets.py --check    # fail if the generated files are stale
+
+As a PlatformIO extra script (pre:, see client/platformio.ini) it regenerates
+them before every build when the page has changed.
+"""
+import argparse
+import gzip
+import hashlib
+import os
+import sys
+
+HEADER = "portal_assets.h"
+SOURCE = "portal_assets.cpp"
+BYTES_PER_LINE = 16
+
+
+def minify(html):
+    lines = (line.strip() for line in html.splitlines())
+    return "\n".join(line for line in lines if line) + "\n"
+
+
+def compress(text):
+    return gzip.compress(text.encode("utf-8"), compresslevel=9, mtime=0)
+
+
+def render(page, packed):
+    etag = '"%s"' % hashlib.sha1(page.encode("utf-8")).hexdigest()[:16]
+    header = (
+        "#pragma once\n"
+        "\n"
+        "// Generated by tools/portal_assets.py from assets/index.html; do not edit.\n"
+        "\n"
+        "#include <stddef.h>\n"
+        "#include <stdint.h>\n"
+        "\n"
+        "#define WIFI_PORTAL_INDEX_ETAG \"%s\"\n"
+        "const size_t WIFI_PORTAL_INDEX_GZ_BYTES = %d;     // %d bytes uncompressed\n"
+        "extern const uint8_t WIFI_PORTAL_INDEX_GZ[WIFI_PORTAL_INDEX_GZ_BYTES];\n"
+    ) % (etag.replace('"', '\\"'), len(packed), len(page.encode("utf-8")))
+    rows = []
+    for i in range(0, len(packed), BYTES_PER_LINE):
+        rows.append("    " + ", ".join("0x%02x" % b for b in packed[i:i + BYTES_PER_LINE]) + ",")
+    source = (
+        "// Generated by tools/portal_assets.py from assets/index.html; do not edit.\n"
+        "\n"
+        "#include \"%s\"\n"
+        "\n"
+        "const uint8_t WIFI_PORTAL_INDEX_GZ[WIFI_PORTAL_INDEX_GZ_BYTES] = {\n"
+        "%s\n"
+        "};\n"
+    ) % (HEADER, "\n".join(rows))
+    return {HEADER: header, SOURCE: source}
+
+
+def generate(portal_dir):
+    """Returns the generated files' contents by name, and the page's sizes before and after."""
+    with open(os.path.join(portal_dir, "assets", "index.html"), encoding="utf-8") as f:
+        html = f.read()
+    page = minify(html)
+    packed = compress(page)
+    return render(page, packed), len(html.encode("utf-8")), len(packed)
+
+
+def stale(portal_dir, files):
+    names = []
+    for name, content in sorted(files.items()):
+        path = os.path.join(portal_dir, name)
+        try:
+            with open(path, encoding="utf-8") as f:
+                if f.read() == content:
+                    continue
+        except OSError:
+            pass
+        names.append(name)
+    return names
+
+
+def write(portal_dir, files, names):
+    for name in names:
+        with open(os.path.join(portal_dir, name), "w", encoding="utf-8", newline="\n") as f:
+            f.write(files[name])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--portal", default=os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                                         "..", "client", "lib", "wifi_portal"),
+                        help="the wifi_portal library directory")
+    parser.add_argument("--check", action="store_true", help="only check that the generated files are current")
+    args = parser.parse_args()
+
+    files, original, packed = generate(args.portal)
+    names = stale(args.portal, files)
+    print("index.html: %d bytes, %d gzipped (%.1fx)" % (original, packed, original / packed))
+    if args.check:
+        for name in names:
+            print("%s is stale; run tools/portal_assets.py" % name, file=sys.stderr)
+        sys.exit(1 if names else 0)
+    write(args.portal, files, names)
+    for name in names:
+        print("wrote " + name)
+
+
+def platformio_hook(env):
+    portal_dir = os.path.join(env.subst("$PROJECT_DIR"), "lib", "wifi_portal")
+    files, original, packed = generate(portal_dir)
+    names = stale(portal_dir, files)
+    if names:
+        write(portal_dir, files, names)
+        print("Portal page: %d bytes, %d gzipped; wrote %s" % (original, packed, ", ".join(names)))
+
+
+if __name__ == "__main__":
+    main()
+else:
+    try:
+        Import("env")  # noqa: F821 (PlatformIO's SCons environment)
+    except NameError:
+        pass
+    else:
+        platformio_hook(env)  # noqa: F821
@@ -0,0 +1,141 @@
+"""
+Record-and-replay latency regression driver.
+
+Re-runs captured turns (trace archives written by server.py with
+TRINITY_ARCHIVE_SAMPLE_RATE=1 TRINITY_CAPTURE_FULL=1) through the real server
+pipeline. The model backend is the mock in tools/mock_gemini.py, scripted with
+each turn's captured model responses. TTS is replaced by the captured response
+body. All recorded delays are divided by --speed, so a corpus replays faster
+than real time while keeping its latency shape.
+
+Per-stage p95 latencies are compared with a stored baseline, and the script
+exits with status 1 if any stage regresses by more than --threshold.
+
+Usage:
+    python tools/replay.py corpus/*.trca --write-baseline corpus/baseline.json
+    python tools/replay.py corpus/*.trca --baseline corpus/baseline.json --threshold 0.10
+"""
+import argparse
+import json
+import os
+import sys
+import time
+
+TOOLS_DIR = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, TOOLS_DIR)
+sys.path.insert(0, os.path.dirname(TOOLS_DIR))
+from mock_gemini import MockConfig, serve_in_background
+import trace_archive
+
+STAGES = ("stt_ms", "llm_ms", "tts_ms", "total_ms")
+# Differences below this many milliseconds are noise at high replay speeds
+ABSOLUTE_SLACK_MS = 5.0
+
+
+def percentile(samples, pct):
+    ordered = sorted(samples)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * pct / 100))]
+
+
+def load_turns(paths):
+    """Returns replayable server-side records; device-side (native) records are skipped."""
+    turns, skipped = [], 0
+    for path in paths:
+        for record in trace_archive.read_archive(path):
+            if trace_archive.TAG_MODEL_EXCHANGES not in record:
+                skipped += 1
+                continue
+            turns.append(record)
+    return turns, skipped
+
+
+def replay_turn(server, mock, record, speed):
+    """Replays one captured turn and returns its measured stage timings."""
+    mock.script.clear()
+    for exchange in trace_archive.json_value(record, trace_archive.TAG_MODEL_EXCHANGES, []):
+        mock.set_script(exchange["stage"], exchange["ms"] / 1000 / speed, exchange["response"])
+
+    captured_timings = trace_archive.json_value(record, trace_archive.TAG_TIMINGS, {})
+    response_body = record.get(trace_archive.TAG_RESPONSE_BODY, b"")
+
+    def replayed_tts(text):
+        time.sleep(captured_timings.get("tts_ms", 0) / 1000 / speed)
+        return response_body
+    server.text_to_pcm = replayed_tts
+
+    device_id = record.get(trace_archive.TAG_DEVICE_ID, b"replay").decode()
+    headers = trace_archive.json_value(record, trace_archive.TAG_REQUEST_HEADERS, {})
+    deadline_ms = int(headers.get(server.DEADLINE_HEADER, server.DEFAULT_DEADLINE_MS))
+    deadline = time.monotonic() + deadline_ms / 1000 - server.TTS_RESERVE_S
+
+    # A fresh session per turn keeps every replay independent of corpus order
+    turn = server.TurnContext(device_id, server.ConversationSession(device_id), deadline)
+    turn.uplink = server.parse_format(headers.get(server.FORMAT_HEADER)) or server.DEFAULT_FORMAT
+    server.process_voice_command(record.get(trace_archive.TAG_INPUT_PCM, b""), turn)
+    return turn.timings
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("captures", nargs="+", help="Trace archive (.trca) files")
+    parser.add_argument("--baseline", help="Baseline JSON to compare against")
+    parser.add_argument("--write-baseline", help="Write the measured p95s to this JSON file")
+    parser.add_argument("--threshold", type=float, default=0.10, help="Allowed p95 regression (0.10 = 10%%)")
+    parser.add_argument("--speed", type=float, default=10.0, help="Replay speed-up factor")
+    parser.add_argument("--port", type=int, default=5056)
+    args = parser.parse_args()
+
+    turns, skipped = load_turns(args.captures)
+    if not turns:
+        print("No replayable (server-side, full capture) records found.")
+        return 2
+
+    mock = MockConfig(base_ms=0, jitter_ms=0, straggler_rate=0)
+    serve_in_background(args.port, mock)
+    os.environ["GEMINI_API_ROOT_URL"] = f"http://127.0.0.1:{args.port}/v1beta"
+    os.environ.setdefault("GEMINI_API_KEY", "replay")
+    os.environ["TRINITY_ARCHIVE_SAMPLE_RATE"] = "0"
+    import server
+    # The system prompt cache is not part of the captured turn
+    server.system_prompt_cache.get_name = lambda: None
+
+    samples = {stage: [] for stage in STAGES}
+    for record in turns:
+        timings = replay_turn(server, mock, record, args.speed)
+        for stage in STAGES:
+            if stage in timings:
+                samples[stage].append(timings[stage])
+
+    measured = {stage: percentile(values, 95) for stage, values in samples.items() if values}
+    print(f"Replayed {len(turns)} turns at {args.speed:g}x ({skipped} device-side records skipped).")
+
+    if args.write_baseline:
+        with open(args.write_baseline, "w") as f:
+            json.dump({"speed": args.speed, "turns": len(turns), "p95_ms": measured}, f, indent=2)
+        print(f"Baseline written to {args.write_baseline}")
+
+    failed = False
+    baseline = None
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        if baseline.get("speed") != args.speed:
+            print(f"Baseline was recorded at {baseline.get('speed')}x; replay with --speed {baseline.get('speed')}.")
+            return 2
+
+    print(f"{'stage':<10}{'p95 ms':>10}{'baseline':>10}{'change':>10}")
+    for stage, value in measured.items():
+        reference = baseline["p95_ms"].get(stage) if baseline else None
+        if reference is None:
+            print(f"{stage:<10}{value:>10.1f}{'-':>10}{'-':>10}")
+            continue
+        change = (value - reference) / reference if reference else 0.0
+        regressed = value > reference * (1 + args.threshold) + ABSOLUTE_SLACK_MS
+        failed |= regressed
+        print(f"{stage:<10}{value:>10.1f}{reference:>10.1f}{change:>+10.1%}{'  REGRESSION' if regressed else ''}")
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
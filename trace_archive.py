@@ -0,0 +1,181 @@
+"""
+Append-only debug archive and capture format for voice turns.
+
+Each archive file starts with a short header and then holds one record per
+archived turn. A record is a list of tagged fields, so new fields can be added
+without breaking older readers (unknown tags are skipped):
+
+    file   := b"TRCA" u16:version record*
+    record := u32:record_length u8:field_count field*
+    field  := u8:tag u32:length bytes[length]
+
+All integers are little-endian. Text fields are UTF-8, timings are JSON.
+Files rotate once they exceed a size limit, keeping the newest few.
+
+The same format is the record-and-replay capture format: server.py writes it
+(with TRINITY_CAPTURE_FULL=1 it also stores request headers, the response body
+and every model exchange), the firmware's native build writes it from the
+device side (client/lib/trace_capture), and tools/replay.py replays it.
+"""
+import glob
+import json
+import os
+import queue
+import random
+import struct
+import threading
+import time
+
+ARCHIVE_MAGIC = b"TRCA"
+ARCHIVE_VERSION = 1       # New fields are new tags; same framing, same version
+ARCHIVE_SUFFIX = ".trca"
+
+# Field tags
+TAG_TRACE_ID = 1
+TAG_DEVICE_ID = 2
+TAG_TIMESTAMP = 3     # f64 seconds since the epoch
+TAG_INPUT_PCM = 4     # Raw request audio as received from the device
+TAG_TRANSCRIPT = 5
+TAG_REPLY_TEXT = 6
+TAG_TIMINGS = 7       # JSON object of stage name -> milliseconds
+# Version 2: full capture fields for record-and-replay
+TAG_REQUEST_HEADERS = 8   # JSON object of the request headers that influence processing
+TAG_RESPONSE_BODY = 9     # Bytes returned to the device
+TAG_MODEL_EXCHANGES = 10  # JSON array of {"stage", "ms", "response"} in call order
+TAG_DEVICE_TIMINGS = 11   # JSON object of device-side stage name -> milliseconds
+TAG_SOURCE = 12           # "server" or "native"
+TAG_DEVICE_PCM = 13       # PCM as recorded on the device, before any uplink encoding
+
+_FILE_HEADER = struct.Struct("<4sH")
+_RECORD_HEADER = struct.Struct("<IB")
+_FIELD_HEADER = struct.Struct("<BI")
+
+
+def encode_record(fields):
+    """Encodes [(tag, bytes), ...] as one archive record."""
+    body = b"".join(_FIELD_HEADER.pack(tag, len(value)) + value for tag, value in fields)
+    return _RECORD_HEADER.pack(_RECORD_HEADER.size + len(body), len(fields)) + body
+
+
+def read_archive(path):
+    """Yields each record in an archive file as a {tag: bytes} dict."""
+    with open(path, "rb") as f:
+        magic, version = _FILE_HEADER.unpack(f.read(_FILE_HEADER.size))
+        if magic != ARCHIVE_MAGIC or version > ARCHIVE_VERSION:
+            raise ValueError(f"{path}: not a trace archive (magic {magic!r}, version {version})")
+        while True:
+            header = f.read(_RECORD_HEADER.size)
+            if len(header) < _RECORD_HEADER.size:
+                return  # End of file, or a record truncated by a crash
+            length, field_count = _RECORD_HEADER.unpack(header)
+            body = f.read(length - _RECORD_HEADER.size)
+            if len(body) < length - _RECORD_HEADER.size:
+                return
+            record, offset = {}, 0
+            for _ in range(field_count):
+                tag, size = _FIELD_HEADER.unpack_from(body, offset)
+                offset += _FIELD_HEADER.size
+                record[tag] = body[offset:offset + size]
+                offset += size
+            yield record
+
+
+class DebugArchiver:
+    """
+    Background writer for sampled turn archives.
+    submit() never blocks the request thread: when the bounded queue is full
+    the record is dropped and counted instead.
+    """
+
+    def __init__(self, directory, sample_rate, queue_size=32, max_file_bytes=64 * 1024 * 1024, max_files=8):
+        self.directory = directory
+        self.sample_rate = sample_rate
+        self.max_file_bytes = max_file_bytes
+        self.max_files = max_files
+        self.dropped = 0
+        self.written = 0
+        self._queue = queue.Queue(maxsize=queue_size)
+        self._file = None
+        self._thread = threading.Thread(target=self._run, name="debug-archiver", daemon=True)
+        self._thread.start()
+
+    def should_sample(self):
+        return self.sample_rate > 0 and random.random() < self.sample_rate
+
+    def submit(self, fields):
+        """Queues [(tag, bytes), ...] for archiving. Returns False if the record was dropped."""
+        try:
+            self._queue.put_nowait(fields)
+            return True
+        except queue.Full:
+            self.dropped += 1
+            return False
+
+    def _open_new_file(self):
+        if self._file:
+            self._file.close()
+        os.makedirs(self.directory, exist_ok=True)
+        name = time.strftime("session-%Y%m%d-%H%M%S") + f"-{os.getpid()}{ARCHIVE_SUFFIX}"
+        self._file = open(os.path.join(self.directory, name), "ab")
+        if self._file.tell() == 0:
+            self._file.write(_FILE_HEADER.pack(ARCHIVE_MAGIC, ARCHIVE_VERSION))
+
+        # Rotation: keep only the newest max_files archives
+        archives = sorted(glob.glob(os.path.join(self.directory, "*" + ARCHIVE_SUFFIX)), key=os.path.getmtime)
+        for old in archives[:-self.max_files]:
+            try:
+                os.remove(old)
+            except OSError:
+                pass
+
+    def _run(self):
+        while True:
+            fields = self._queue.get()
+            try:
+                if self._file is None or self._file.tell() >= self.max_file_bytes:
+                    self._open_new_file()
+                self._file.write(encode_record(fields))
+                self._file.flush()
+                self.written += 1
+            except Exception as e:
+                print(f"[ARCHIVE] Write failed: {e}")
+
+
+def text_field(tag, text):
+    return tag, (text or "").encode("utf-8")
+
+
+def timings_field(timings):
+    return json_field(TAG_TIMINGS, timings)
+
+
+def timestamp_field(ts):
+    return TAG_TIMESTAMP, struct.pack("<d", ts)
+
+
+def json_field(tag, value):
+    return tag, json.dumps(value, separators=(",", ":")).encode("utf-8")
+
+
+def json_value(record, tag, default=None):
+    """Decodes a JSON field of a record read by read_archive()."""
+    raw = record.get(tag)
+    return json.loads(raw) if raw else default
+
+
+if __name__ == "__main__":
+    # Quick inspection: python trace_archive.py debug_audio_files/session-*.trca
+    import sys
+    for path in sys.argv[1:]:
+        for record in read_archive(path):
+            trace_id = record.get(TAG_TRACE_ID, b"").decode()
+            pcm_bytes = len(record.get(TAG_INPUT_PCM, b""))
+            timings = record.get(TAG_TIMINGS, b"{}").decode()
+            source = record.get(TAG_SOURCE, b"server").decode()
+            print(f"{trace_id}  [{source}]  pcm={pcm_bytes}B  timings={timings}")
+            if TAG_DEVICE_TIMINGS in record:
+                print(f"    device timings: {record[TAG_DEVICE_TIMINGS].decode()}")
+            for exchange in json_value(record, TAG_MODEL_EXCHANGES, []):
+                print(f"    model {exchange.get('stage')}: {exchange.get('ms', 0):.0f} ms")
+            print(f"    transcript: {record.get(TAG_TRANSCRIPT, b'').decode()}")
+            print(f"    reply:      {record.get(TAG_REPLY_TEXT, b'').decode()}")